@@ -35,6 +35,7 @@
 #include "input.h"
 
 #include "xstd.h"
+#include "logreport.h"
 #include "image-header.h"
 #include "image-proc.h"
 #include "quantize.h"
@@ -48,6 +49,14 @@
 
 #define AT_DEFAULT_DPI 72
 
+static gboolean collect_begin(unsigned short width, unsigned short height, unsigned int planes, gpointer data);
+static gboolean collect_begin_packed(unsigned short width, unsigned short height, unsigned int planes, gpointer data);
+static gboolean collect_row(unsigned short row, const unsigned char *pixels, gpointer data);
+static unsigned char *collect_buffer(unsigned short row, gpointer data);
+static void input_stream(at_bitmap_reader * reader, FILE * file, gchar * name, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data);
+static FILE *input_memory_file(const void *data, size_t size);
+static unsigned char *input_slurp(FILE * file, size_t * size);
+
 at_fitting_opts_type *at_fitting_opts_new(void)
 {
   at_fitting_opts_type *opts;
@@ -81,6 +90,7 @@ at_input_opts_type *at_input_opts_new(void)
   XMALLOC(opts, sizeof(at_input_opts_type));
   opts->background_color = NULL;
   opts->charcode = 0;
+  opts->packed = FALSE;
   return opts;
 }
 
@@ -125,6 +135,15 @@ at_bitmap *at_bitmap_read(at_bitmap_reader * reader, gchar * filename, at_input_
   gboolean new_opts = FALSE;
   at_bitmap *bitmap;
   XMALLOC(bitmap, sizeof(at_bitmap));
+  if (reader->stream) {
+    at_input_consumer collector = { collect_begin, collect_row, bitmap, collect_buffer, NULL };
+
+    if (opts && opts->packed)
+      collector.begin_packed = collect_begin_packed;
+    *bitmap = at_bitmap_init(NULL, 0, 0, 0);
+    at_bitmap_stream(reader, filename, opts, &collector, msg_func, msg_data);
+    return bitmap;
+  }
   if (opts == NULL) {
     opts = at_input_opts_new();
     new_opts = TRUE;
@@ -135,6 +154,194 @@ at_bitmap *at_bitmap_read(at_bitmap_reader * reader, gchar * filename, at_input_
   return bitmap;
 }
 
+at_bitmap *at_bitmap_read_file(at_bitmap_reader * reader, FILE * file, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data)
+{
+  at_bitmap *bitmap;
+  at_input_consumer collector;
+  XMALLOC(bitmap, sizeof(at_bitmap));
+  *bitmap = at_bitmap_init(NULL, 0, 0, 0);
+  collector.begin = collect_begin;
+  collector.row = collect_row;
+  collector.data = bitmap;
+  collector.buffer = collect_buffer;
+  collector.begin_packed = opts && opts->packed ? collect_begin_packed : NULL;
+  at_bitmap_stream_file(reader, file, opts, &collector, msg_func, msg_data);
+  return bitmap;
+}
+
+at_bitmap *at_bitmap_read_memory(at_bitmap_reader * reader, const void *data, size_t size, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data)
+{
+  at_bitmap *bitmap;
+  at_input_consumer collector;
+  XMALLOC(bitmap, sizeof(at_bitmap));
+  *bitmap = at_bitmap_init(NULL, 0, 0, 0);
+  collector.begin = collect_begin;
+  collector.row = collect_row;
+  collector.data = bitmap;
+  collector.buffer = collect_buffer;
+  collector.begin_packed = opts && opts->packed ? collect_begin_packed : NULL;
+  at_bitmap_stream_memory(reader, data, size, opts, &collector, msg_func, msg_data);
+  return bitmap;
+}
+
+void at_bitmap_stream(at_bitmap_reader * reader, gchar * filename, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data)
+{
+  gboolean new_opts = FALSE;
+  at_bitmap bitmap;
+  FILE *file;
+  if (reader->stream) {
+    file = fopen(filename, "rb");
+    if (file == NULL) {
+      at_exception_type exp = at_exception_new(msg_func, msg_data);
+      LOG("Can't open \"%s\"\n", filename);
+      at_exception_fatal(&exp, "Cannot open input file");
+      return;
+    }
+    input_stream(reader, file, filename, opts, consumer, msg_func, msg_data);
+    fclose(file);
+    return;
+  }
+  if (opts == NULL) {
+    opts = at_input_opts_new();
+    new_opts = TRUE;
+  }
+  /* Older readers only return the whole image.  */
+  bitmap = (*reader->func) (filename, opts, msg_func, msg_data, reader->data);
+  if (AT_BITMAP_BITS(&bitmap))
+    at_input_deliver_bitmap(&bitmap, consumer);
+  free(AT_BITMAP_BITS(&bitmap));
+  if (new_opts)
+    at_input_opts_free(opts);
+}
+
+void at_bitmap_stream_file(at_bitmap_reader * reader, FILE * file, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data)
+{
+  input_stream(reader, file, "(stream)", opts, consumer, msg_func, msg_data);
+}
+
+void at_bitmap_stream_memory(at_bitmap_reader * reader, const void *data, size_t size, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data)
+{
+  FILE *file = input_memory_file(data, size);
+  if (file == NULL) {
+    at_exception_type exp = at_exception_new(msg_func, msg_data);
+    at_exception_fatal(&exp, "Cannot read the image in memory");
+    return;
+  }
+  input_stream(reader, file, "(memory)", opts, consumer, msg_func, msg_data);
+  fclose(file);
+}
+
+/* Read the image at the current position of FILE with READER, or the
+   reader its first bytes call for if READER is NULL.  */
+static void input_stream(at_bitmap_reader * reader, FILE * file, gchar * name, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data)
+{
+  at_exception_type exp = at_exception_new(msg_func, msg_data);
+  gboolean new_opts = FALSE;
+  unsigned char magic[AT_INPUT_MAGIC_SIZE], *data;
+  size_t size;
+  long start;
+
+  start = ftell(file);
+  if (start < 0) {
+    /* A pipe can neither go back to the image after its magic number
+       nor seek to the footers of some formats.  */
+    data = input_slurp(file, &size);
+    at_bitmap_stream_memory(reader, data, size, opts, consumer, msg_func, msg_data);
+    free(data);
+    return;
+  }
+  if (reader == NULL) {
+    size = fread(magic, 1, sizeof(magic), file);
+    reader = at_input_get_handler_by_magic(magic, size);
+    if (reader == NULL || fseek(file, start, SEEK_SET) != 0) {
+      at_exception_fatal(&exp, "Unsupported input format");
+      return;
+    }
+  }
+  if (reader->stream == NULL) {
+    at_exception_fatal(&exp, "This input format can only read named files");
+    return;
+  }
+
+  if (opts == NULL) {
+    opts = at_input_opts_new();
+    new_opts = TRUE;
+  }
+  (*reader->stream) (name, file, opts, consumer, msg_func, msg_data, reader->data);
+  if (new_opts)
+    at_input_opts_free(opts);
+}
+
+/* Return a stream reading the SIZE bytes at DATA, which must be kept
+   until it is closed, or NULL.  */
+static FILE *input_memory_file(const void *data, size_t size)
+{
+  FILE *file;
+#ifdef HAVE_FMEMOPEN
+  if (size > 0)
+    return fmemopen((void *)data, size, "rb");
+#endif
+  file = tmpfile();
+  if (file && (fwrite(data, 1, size, file) != size || fseek(file, 0, SEEK_SET) != 0)) {
+    fclose(file);
+    file = NULL;
+  }
+  return file;
+}
+
+/* Return the rest of FILE in a new buffer of *SIZE bytes.  */
+static unsigned char *input_slurp(FILE * file, size_t * size)
+{
+  unsigned char *data = NULL;
+  size_t length = 0, count = 0, n;
+
+  do {
+    if (count == length) {
+      length = length ? 2 * length : 65536;
+      XREALLOC(data, length);
+    }
+    n = fread(data + count, 1, length - count, file);
+    count += n;
+  } while (n > 0);
+  *size = count;
+  return data;
+}
+
+/* Collect the rows of a streaming reader into the bitmap DATA.  */
+static gboolean collect_begin(unsigned short width, unsigned short height, unsigned int planes, gpointer data)
+{
+  at_bitmap *bitmap = data;
+
+  *bitmap = at_bitmap_init(NULL, width, height, planes);
+  return TRUE;
+}
+
+static gboolean collect_begin_packed(unsigned short width, unsigned short height, unsigned int planes, gpointer data)
+{
+  at_bitmap *bitmap = data;
+
+  *bitmap = at_bitmap_init_packed(NULL, width, height, planes);
+  return TRUE;
+}
+
+static gboolean collect_row(unsigned short row, const unsigned char *pixels, gpointer data)
+{
+  at_bitmap *bitmap = data;
+  unsigned char *dest = AT_BITMAP_ROW(bitmap, row);
+
+  /* Nothing to do for a row decoded in place */
+  if (pixels != dest)
+    memcpy(dest, pixels, AT_BITMAP_ROW_BYTES(bitmap));
+  return TRUE;
+}
+
+static unsigned char *collect_buffer(unsigned short row, gpointer data)
+{
+  at_bitmap *bitmap = data;
+
+  return AT_BITMAP_BITS(bitmap) ? AT_BITMAP_ROW(bitmap, row) : NULL;
+}
+
 at_bitmap *at_bitmap_new(unsigned short width, unsigned short height, unsigned int planes)
 {
   at_bitmap *bitmap;
@@ -152,8 +359,12 @@ at_bitmap *at_bitmap_copy(const at_bitmap * src)
   height = at_bitmap_get_height(src);
   planes = at_bitmap_get_planes(src);
 
-  dist = at_bitmap_new(width, height, planes);
-  memcpy(dist->bitmap, src->bitmap, width * height * planes * sizeof(unsigned char));
+  if (AT_BITMAP_PACKED(src)) {
+    XMALLOC(dist, sizeof(at_bitmap));
+    *dist = at_bitmap_init_packed(NULL, width, height, planes);
+  } else
+    dist = at_bitmap_new(width, height, planes);
+  memcpy(dist->bitmap, src->bitmap, AT_BITMAP_ROW_BYTES(src) * height);
   return dist;
 }
 
@@ -173,6 +384,7 @@ at_bitmap at_bitmap_init(unsigned char *area, unsigned short width, unsigned sho
   bitmap.width = width;
   bitmap.height = height;
   bitmap.np = planes;
+  bitmap.depth = 8;
   return bitmap;
 }
 
@@ -205,6 +417,12 @@ void at_bitmap_get_color(const at_bitmap * bitmap, unsigned int row, unsigned in
   g_return_if_fail(color);
   g_return_if_fail(bitmap);
 
+  if (AT_BITMAP_PACKED(bitmap)) {
+    unsigned char v = AT_BITMAP_BLACK_BIT(bitmap, row, col) ? 0x00 : 0xff;
+
+    at_color_set(color, v, v, v);
+    return;
+  }
   p = AT_BITMAP_PIXEL(bitmap, row, col);
   if (at_bitmap_get_planes(bitmap) >= 3)
     at_color_set(color, p[0], p[1], p[2]);
@@ -228,6 +446,51 @@ at_splines_type *at_splines_new(at_bitmap * bitmap, at_fitting_opts_type * opts,
   return at_splines_new_full(bitmap, opts, msg_func, msg_data, NULL, NULL, NULL, NULL);
 }
 
+struct _at_palette {
+  QuantizeObj *quant;
+};
+
+at_palette *at_palette_new(at_bitmap ** bitmaps, unsigned count, at_fitting_opts_type * opts, at_msg_func msg_func, gpointer msg_data)
+{
+  at_palette *palette;
+  at_exception_type exp = at_exception_new(msg_func, msg_data);
+  QuantizeObj *quant;
+  at_bitmap **unpacked;
+  unsigned i;
+
+  if (opts->color_count == 0) {
+    at_exception_fatal(&exp, "at_palette_new: color_count must not be 0");
+    return NULL;
+  }
+  /* The histogram is made of bytes, so packed images are counted from
+     unpacked copies.  */
+  XMALLOC(unpacked, MAX(count, 1) * sizeof(at_bitmap *));
+  for (i = 0; i < count; i++) {
+    unpacked[i] = bitmaps[i];
+    if (AT_BITMAP_PACKED(bitmaps[i])) {
+      unpacked[i] = at_bitmap_copy(bitmaps[i]);
+      at_bitmap_unpack(unpacked[i]);
+    }
+  }
+  quant = quantize_object_new(unpacked, count, opts->color_count, opts->background_color, opts->quantizer, opts->threads, &exp);
+  for (i = 0; i < count; i++)
+    if (unpacked[i] != bitmaps[i])
+      at_bitmap_free(unpacked[i]);
+  free(unpacked);
+  if (at_exception_got_fatal(&exp))
+    return NULL;
+
+  XMALLOC(palette, sizeof(at_palette));
+  palette->quant = quant;
+  return palette;
+}
+
+void at_palette_free(at_palette * palette)
+{
+  quantize_object_free(palette->quant);
+  free(palette);
+}
+
 /* at_splines_new_full modify its argument: BITMAP
    when despeckle, quantize and/or thin_image are invoked. */
 at_splines_type *at_splines_new_full(at_bitmap * bitmap, at_fitting_opts_type * opts, at_msg_func msg_func, gpointer msg_data, at_progress_func notify_progress, gpointer progress_data, at_testcancel_func test_cancel, gpointer testcancel_data)
@@ -250,16 +513,24 @@ at_splines_type *at_splines_new_full(at_bitmap * bitmap, at_fitting_opts_type *
 #define FATAL_THEN_CLEANUP_DIST() if (FATALP) goto cleanup_dist;
 #define FATAL_THEN_CLEANUP_PIXELS() if (FATALP) {FREE_SPLINE(); goto cleanup_pixels;}
 
+  /* A packed bitmap is thinned and outlined as it is; the other
+     stages need its bytes.  */
+  if (opts->despeckle_level > 0 || opts->palette || opts->color_count > 0 || (opts->centerline && opts->preserve_width))
+    at_bitmap_unpack(bitmap);
+
   if (opts->despeckle_level > 0) {
-    despeckle(bitmap, opts->despeckle_level, opts->despeckle_tightness, opts->noise_removal, &exp);
+    despeckle(bitmap, opts->despeckle_level, opts->despeckle_tightness, opts->noise_removal, opts->despeckle_graph, opts->threads, &exp);
     FATAL_THEN_RETURN();
   }
 
   image_header.width = at_bitmap_get_width(bitmap);
   image_header.height = at_bitmap_get_height(bitmap);
 
-  if (opts->color_count > 0) {
-    quantize(bitmap, opts->color_count, opts->background_color, &myQuant, &exp);
+  if (opts->palette) {
+    quantize(bitmap, opts->color_count, opts->background_color, &opts->palette->quant, opts->quantizer, opts->threads, &exp);
+    FATAL_THEN_RETURN();
+  } else if (opts->color_count > 0) {
+    quantize(bitmap, opts->color_count, opts->background_color, &myQuant, opts->quantizer, opts->threads, &exp);
     if (myQuant)
       quantize_object_free(myQuant);  /* curently not used */
     FATAL_THEN_RETURN();
@@ -268,14 +539,17 @@ at_splines_type *at_splines_new_full(at_bitmap * bitmap, at_fitting_opts_type *
   if (opts->centerline) {
     if (opts->preserve_width) {
       /* Preserve line width prior to thinning. */
-      dist_map = new_distance_map(bitmap, 255, /*padded= */ TRUE, &exp);
+      if (opts->weighted_distance)
+        dist_map = new_distance_map(bitmap, 255, /*padded= */ TRUE, opts->threads, &exp);
+      else
+        dist_map = new_euclidean_distance_map(bitmap, 255, /*padded= */ TRUE, opts->threads, &exp);
       dist = &dist_map;
       FATAL_THEN_RETURN();
     }
     /* Hereafter, dist is allocated. dist must be freed if
        the execution is canceled or exception is raised;
        use FATAL_THEN_CLEANUP_DIST. */
-    thin_image(bitmap, opts->background_color, &exp);
+    thin_image(bitmap, opts->background_color, opts->threads, &exp);
     FATAL_THEN_CLEANUP_DIST()
   }
 
@@ -48,6 +48,9 @@ extern "C" {
     AT_CIRCLETYPE = 6
         /* not the real number of points to define a
            circle but to distinguish between a cubic spline */
+        /* Splines of the last three types are pieces of a circle or
+           an ellipse, but their control points are still those of a
+           cubic spline approximating the piece.  */
   };
 
   enum _at_msg_type {
@@ -56,16 +59,24 @@ extern "C" {
     AT_MSG_WARNING,
   };
 
+/* How color_count chooses the colors.  */
+  enum _at_quantizer_type {
+    AT_QUANTIZER_MEDIAN_CUT = 0,
+    AT_QUANTIZER_KMEANS
+  };
+
   typedef struct _at_fitting_opts_type at_fitting_opts_type;
   typedef struct _at_input_opts_type at_input_opts_type;
   typedef struct _at_output_opts_type at_output_opts_type;
   typedef struct _at_bitmap at_bitmap;
+  typedef struct _at_palette at_palette;
   typedef enum _at_polynomial_degree at_polynomial_degree;
   typedef struct _at_spline_type at_spline_type;
   typedef struct _at_spline_list_type at_spline_list_type;
   typedef struct _at_spline_list_array_type at_spline_list_array_type;
 #define at_splines_type at_spline_list_array_type
   typedef enum _at_msg_type at_msg_type;
+  typedef enum _at_quantizer_type at_quantizer_type;
 
 /* A Bezier spline can be represented as four points in the real plane:
    a starting point, ending point, and two control points.  The
@@ -202,11 +213,69 @@ N_("preserve-width: whether to preserve linewith with centerline fitting; "	\
 #define  at_doc__width_weight_factor				\
 N_("width-weight-factor <real>: weight factor for fitting the linewidth.")
     gfloat width_weight_factor;
+
+#define at_doc__fast_reject						\
+N_("fast-reject: reject poor fits from cheap error bounds and stop "	\
+"measuring a fit once it exceeds error-threshold; subdivision points "	\
+"may differ slightly from the exact search; default is exact search.")
+    gboolean fast_reject;
+
+#define at_doc__weighted_distance						\
+N_("weighted-distance: with preserve-width, measure the line width with "	\
+"the gray-weighted chamfer distance instead of the exact Euclidean "		\
+"distance; default is the Euclidean distance.")
+    gboolean weighted_distance;
+
+#define at_doc__threads								\
+N_("threads <unsigned>: number of threads used by the parallel stages; "	\
+"default is 0, that means one per processor.")
+    unsigned threads;
+
+#define at_doc__outline_cache							\
+N_("outline-cache: fit each repeated outline shape only once and reuse "	\
+"its splines, translated, for the other copies; not used with "		\
+"preserve-width; default fits every outline.")
+    gboolean outline_cache;
+
+#define at_doc__merge_threshold							\
+N_("merge-threshold <real>: after fitting, merge adjacent splines if a "	\
+"single spline stays within this many pixels of both, and collapse "		\
+"collinear lines; default is 0, that means no merging.")
+    gfloat merge_threshold;
+
+#define at_doc__fit_arcs							\
+N_("fit-arcs: fit curves with pieces of circles, and outlines without "	\
+"corners with whole circles or ellipses, where these are within "		\
+"error-threshold, before trying cubic splines; not used with "			\
+"preserve-width; default fits cubic splines only.")
+    gboolean fit_arcs;
+
+#define at_doc__despeckle_graph							\
+N_("despeckle-graph: label the regions of the image once and merge them "	\
+"level by level on their adjacency graph, which makes high despeckle "	\
+"levels about as fast as low ones; a different algorithm from the "	\
+"walk, which can give much different results on shaded images, since "	\
+"regions with equally similar neighbors may take another color; "	\
+"default walks the image at every level.")
+    gboolean despeckle_graph;
+
+/* A palette made by at_palette_new, used in place of the one
+   color_count would compute for each bitmap; default is NULL.
+   It is not freed with the options.  */
+    at_palette *palette;
+
+#define at_doc__quantizer							\
+N_("quantizer <name>: how color-count chooses the colors, either "		\
+"median-cut or k-means, which is faster and usually closer to the "		\
+"image for a few colors; default is median-cut.")
+    at_quantizer_type quantizer;
   };
 
   struct _at_input_opts_type {
     at_color *background_color;
     unsigned charcode;          /* Character code used only in GF input. */
+    gboolean packed;            /* Keep black and white images at one bit
+                                   per pixel; default is FALSE. */
   };
 
   struct _at_output_opts_type {
@@ -218,6 +287,8 @@ N_("width-weight-factor <real>: weight factor for fitting the linewidth.")
     unsigned short width;
     unsigned char *bitmap;
     unsigned int np;
+    unsigned int depth;         /* Bits per pixel and plane: 8, or 1 for a
+                                   packed black and white image. */
   };
 
   typedef
@@ -239,6 +310,39 @@ N_("width-weight-factor <real>: weight factor for fitting the linewidth.")
   typedef struct _at_spline_writer at_spline_writer;
   struct _at_spline_writer;
 
+/* A consumer of an image delivered a row at a time, the top row
+   first.  BEGIN is called once with the size of the image before any
+   row, then ROW with the WIDTH * PLANES bytes of each row, which are
+   only valid during the call.  Either returns FALSE to stop the
+   reading.
+
+   BUFFER may be NULL.  Otherwise a reader may call it after BEGIN for
+   the place to decode a row into, and then hand that place to ROW;
+   it must stay valid until the reading is done.  It may return NULL
+   to have the reader decode the row where it likes.
+
+   BEGIN_PACKED may be NULL.  Otherwise a reader of a black and white
+   image may call it instead of BEGIN, with the PLANES the pixels would
+   have had.  The rows then handed to ROW, and the places BUFFER gives,
+   are packed: (WIDTH + 7) / 8 bytes, the leftmost pixel in the top bit
+   of the first, a set bit black and a clear one white, and the bits
+   past WIDTH clear.  */
+  typedef
+  gboolean(*at_input_begin_func) (unsigned short width, unsigned short height, unsigned int planes, gpointer data);
+  typedef
+  gboolean(*at_input_row_func) (unsigned short row, const unsigned char *pixels, gpointer data);
+  typedef
+  unsigned char *(*at_input_buffer_func) (unsigned short row, gpointer data);
+
+  typedef struct _at_input_consumer at_input_consumer;
+  struct _at_input_consumer {
+    at_input_begin_func begin;
+    at_input_row_func row;
+    gpointer data;
+    at_input_buffer_func buffer;
+    at_input_begin_func begin_packed;
+  };
+
 /*
  * Progress handler typedefs
  * 0.0 <= percentage <= 1.0
@@ -302,8 +406,40 @@ N_("width-weight-factor <real>: weight factor for fitting the linewidth.")
       Use at_bitmap_new.
 
    In both case, you have to call at_bitmap_free when at_bitmap *
-   data are no longer needed. */
+   data are no longer needed.
+
+   If the PACKED member of OPTS is TRUE, a black and white image may be
+   read at one bit per pixel (a DEPTH of 1).  Its pixels must then be
+   read through at_bitmap_get_color and at_bitmap_equal_color; the
+   tracing functions take it as it is. */
   at_bitmap *at_bitmap_read(at_bitmap_reader * reader, gchar * filename, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data);
+
+/* at_bitmap_stream
+
+   Read FILENAME with READER and hand its rows to CONSUMER as they are
+   decoded, without keeping the whole image unless the format needs
+   it.  Errors are notified through MSG_FUNC as in at_bitmap_read. */
+  void at_bitmap_stream(at_bitmap_reader * reader, gchar * filename, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data);
+
+/* at_bitmap_read_file, at_bitmap_stream_file
+
+   Same as at_bitmap_read and at_bitmap_stream for an image read from
+   the current position of FILE, for example stdin or a descriptor
+   opened with fdopen.  FILE is left open.
+
+   If READER is NULL, the format is told from the first bytes of the
+   image (see at_input_get_handler_by_magic).  A FILE that cannot
+   seek, like a pipe, is read into memory first.  Readers added with
+   at_input_add_handler only read named files. */
+  at_bitmap *at_bitmap_read_file(at_bitmap_reader * reader, FILE * file, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data);
+  void at_bitmap_stream_file(at_bitmap_reader * reader, FILE * file, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data);
+
+/* at_bitmap_read_memory, at_bitmap_stream_memory
+
+   The same for an image held in the SIZE bytes at DATA. */
+  at_bitmap *at_bitmap_read_memory(at_bitmap_reader * reader, const void *data, size_t size, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data);
+  void at_bitmap_stream_memory(at_bitmap_reader * reader, const void *data, size_t size, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data);
+
   at_bitmap *at_bitmap_new(unsigned short width, unsigned short height, unsigned int planes);
   at_bitmap *at_bitmap_copy(const at_bitmap * src);
 
@@ -317,6 +453,26 @@ N_("width-weight-factor <real>: weight factor for fitting the linewidth.")
   gboolean at_bitmap_equal_color(const at_bitmap * bitmap, unsigned int row, unsigned int col, at_color * color);
   void at_bitmap_free(at_bitmap * bitmap);
 
+/* --------------------------------------------------------------------- *
+ * Palette related
+ * --------------------------------------------------------------------- */
+
+/* at_palette_new
+
+   Reduce the colors of COUNT bitmaps, for example a representative
+   image or a sample of the frames of an animation, to
+   OPTS->color_count colors, ignoring OPTS->background_color.  Set
+   the result as OPTS->palette of the options used to trace any
+   number of bitmaps, and their colors are reduced to this palette
+   without computing one for each of them, which also keeps their
+   colors consistent.  The palette may be shared by several threads
+   tracing at once.
+
+   Returns NULL on error.  Call at_palette_free when the palette is no
+   longer used. */
+  at_palette *at_palette_new(at_bitmap ** bitmaps, unsigned count, at_fitting_opts_type * opts, at_msg_func msg_func, gpointer msg_data);
+  void at_palette_free(at_palette * palette);
+
 /* --------------------------------------------------------------------- *
  * Spline related
  *
@@ -370,6 +526,15 @@ N_("width-weight-factor <real>: weight factor for fitting the linewidth.")
   at_bitmap_reader *at_input_get_handler(gchar * filename);
   at_bitmap_reader *at_input_get_handler_by_suffix(gchar * suffix);
 
+/* at_input_get_handler_by_magic
+   Return the reader for an image starting with the SIZE bytes at
+   DATA, or NULL if they are not known.  AT_INPUT_MAGIC_SIZE bytes are
+   enough.  TGA images have no magic number to tell them by.
+   at_input_get_handler falls back on this for a file whose suffix
+   is not known. */
+#define AT_INPUT_MAGIC_SIZE 8
+  at_bitmap_reader *at_input_get_handler_by_magic(const unsigned char *data, size_t size);
+
   const char **at_input_list_new(void);
   void at_input_list_free(const char **list);
 
@@ -6,3 +6,58 @@
 
 #include "bitmap.h"
 #include "xstd.h"
+#include <string.h>
+
+at_bitmap at_bitmap_init_packed(unsigned char *area, unsigned short width, unsigned short height, unsigned int planes)
+{
+  at_bitmap bitmap;
+
+  bitmap = at_bitmap_init(area, 0, 0, planes);
+  bitmap.width = width;
+  bitmap.height = height;
+  bitmap.depth = 1;
+  if (area == NULL && width > 0 && height > 0)
+    XCALLOC(bitmap.bitmap, AT_BITMAP_ROW_BYTES(&bitmap) * height);
+  return bitmap;
+}
+
+void at_bitmap_unpack(at_bitmap * bitmap)
+{
+  at_bitmap unpacked;
+  unsigned short row;
+
+  if (!AT_BITMAP_PACKED(bitmap))
+    return;
+  unpacked = at_bitmap_init(NULL, AT_BITMAP_WIDTH(bitmap), AT_BITMAP_HEIGHT(bitmap), AT_BITMAP_PLANES(bitmap));
+  for (row = 0; row < AT_BITMAP_HEIGHT(bitmap); row++)
+    at_bitmap_unpack_row(AT_BITMAP_ROW(&unpacked, row), AT_BITMAP_ROW(bitmap, row), AT_BITMAP_WIDTH(bitmap), AT_BITMAP_PLANES(bitmap));
+  free(AT_BITMAP_BITS(bitmap));
+  *bitmap = unpacked;
+}
+
+void at_bitmap_unpack_row(unsigned char *dest, const unsigned char *bits, unsigned int width, unsigned int planes)
+{
+  unsigned int x;
+
+  for (x = 0; x < width; x++) {
+    unsigned char byte = bits[x / 8];
+
+    /* Bilevel scans are mostly bytes of one color */
+    if (x % 8 == 0 && (byte == 0x00 || byte == 0xff) && x + 8 <= width) {
+      memset(dest + (size_t) x * planes, byte ^ 0xff, 8 * planes);
+      x += 7;
+      continue;
+    }
+    memset(dest + (size_t) x * planes, (byte << x % 8) & 0x80 ? 0x00 : 0xff, planes);
+  }
+}
+
+void at_bitmap_pack_row(unsigned char *dest, const unsigned char *src, unsigned int width)
+{
+  unsigned int x;
+
+  memset(dest, 0, (width + 7) / 8);
+  for (x = 0; x < width; x++)
+    if (src[x] == 0)
+      dest[x / 8] |= 0x80 >> x % 8;
+}
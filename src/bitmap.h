@@ -10,4 +10,40 @@
 #include "input.h"
 #include <stdio.h>
 
+/* A black and white image may be packed instead, with a DEPTH of 1:
+   each row is (WIDTH + 7) / 8 bytes, the leftmost pixel in the top bit
+   of the first, a set bit black and a clear one white, and the bits
+   past WIDTH clear.  NP is still the number of planes of its pixels
+   once unpacked.  AT_BITMAP_PIXEL means nothing for it; the stages
+   that do not read it bit by bit unpack it first.  */
+#define AT_BITMAP_PACKED(b)  ((b)->depth == 1)
+
+/* The bytes of each row, and row ROW.  */
+#define AT_BITMAP_ROW_BYTES(b)						\
+  (AT_BITMAP_PACKED (b) ? ((size_t) AT_BITMAP_WIDTH (b) + 7) / 8	\
+   : (size_t) AT_BITMAP_WIDTH (b) * AT_BITMAP_PLANES (b))
+#define AT_BITMAP_ROW(b, row)  (AT_BITMAP_BITS (b) + (size_t) (row) * AT_BITMAP_ROW_BYTES (b))
+
+/* Whether the pixel at [ROW,COL] of a packed bitmap is black.  */
+#define AT_BITMAP_BLACK_BIT(b, row, col)				\
+  ((AT_BITMAP_ROW (b, row)[(col) / 8] >> (7 - (col) % 8)) & 1)
+
+/* Same as at_bitmap_init for a packed bitmap.  */
+extern at_bitmap at_bitmap_init_packed(unsigned char *area, unsigned short width, unsigned short height, unsigned int planes);
+
+/* Turn BITMAP into one of a byte per pixel and plane if it is packed.  */
+extern void at_bitmap_unpack(at_bitmap * bitmap);
+
+/* Put the WIDTH pixels of the packed row BITS at DEST, PLANES bytes of
+   0 or 255 each.  */
+extern void at_bitmap_unpack_row(unsigned char *dest, const unsigned char *bits, unsigned int width, unsigned int planes);
+
+/* Pack the WIDTH one-byte pixels at SRC into DEST, those that are 0
+   being black and all others white.  */
+extern void at_bitmap_pack_row(unsigned char *dest, const unsigned char *src, unsigned int width);
+
+/* Clear the bits past WIDTH in the last byte of the packed row BITS.  */
+#define AT_BITMAP_CLEAR_PAD(bits, width)				\
+  ((width) % 8 ? (void) ((bits)[((width) - 1) / 8] &= 0xff << (8 - (width) % 8)) : (void) 0)
+
 #endif /* not BITMAP_H */
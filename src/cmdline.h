@@ -24,16 +24,16 @@
       /* Just wanted to know the version number?  */			\
       if (printed_version && optind == argc) exit (0);			\
                                                                         \
-      /* Exactly one (non-empty) argument left?  */			\
-      if (optind + 1 == argc && *argv[optind] != 0)			\
+      /* At least one (non-empty) argument left?  */			\
+      if (optind < argc && *argv[optind] != 0)				\
         {								\
           return (argv[optind]);					\
         }								\
       else								\
         {								\
-          fprintf (stderr, "Usage: %s [options] <image_name>.\n", argv[0]);\
+          fprintf (stderr, "Usage: %s [options] <image_name>...\n", argv[0]);\
           fprintf (stderr, "(%s.)\n", optind == argc ? "Missing <image_name>"\
-                                      : "Too many <image_name>s");	\
+                                      : "Empty <image_name>");		\
           fputs ("For more information, use ``-help''.\n", stderr);	\
           exit (1);							\
         }								\
@@ -25,11 +25,13 @@
 #include <math.h>
 #include <stdio.h>
 #include <time.h>
+#include <string.h>
 #include "xstd.h"
 #include "logreport.h"
 #include "types.h"
 #include "bitmap.h"
 #include "despeckle.h"
+#include "parallel.h"
 
 /* Calculate Error - compute the error between two colors
  *
@@ -73,298 +75,296 @@ static int calc_error_8(unsigned char *color1, unsigned char *color2)
   return the_error;
 }
 
-/* Find Size - Find the number of adjacent pixels of the same color
- *
- * Input Parameters:
- *   An 24 bit image, the current location inside the image, and the palette
- *   index of the color we are looking for
- *
- * Modified Parameters:
- *   A mask array used to prevent backtracking over already counted pixels
+/* Calculate Maximum Error - the largest error between the colors of a
+ * feature and its neighbor for which they are coalesced
  *
- * Returns:
- *   Number of adjacent pixels found having the same color
+ *   Input parameters:
+ *     The number of planes and adaptive tightness
  */
 
-static int find_size( /* in */ unsigned char *index,
-                     /* in */ int x,
-                     /* in */ int y,
-                     /* in */ int width,
-                     /* in */ int height,
-                     /* in */ unsigned char *bitmap,
-                     /* in/out */ unsigned char *mask)
+static int calc_max_error(int planes, double adaptive_tightness)
 {
-  int count;
-  int x1, x2;
-
-  if (y < 0 || y >= height || mask[y * width + x] == 1 || bitmap[3 * (y * width + x)] != index[0] || bitmap[3 * (y * width + x) + 1] != index[1] || bitmap[3 * (y * width + x) + 2] != index[2])
-    return 0;
-
-  for (x1 = x; x1 >= 0 && bitmap[3 * (y * width + x1)] == index[0] && bitmap[3 * (y * width + x1) + 1] == index[1] && bitmap[3 * (y * width + x1) + 2] == index[2] && mask[y * width + x] != 1; x1--) ;
-  x1++;
-
-  for (x2 = x; x2 < width && bitmap[3 * (y * width + x2)] == index[0] && bitmap[3 * (y * width + x2) + 1] == index[1] && bitmap[3 * (y * width + x2) + 2] == index[2] && mask[y * width + x] != 1; x2++) ;
-  x2--;
-
-  count = x2 - x1 + 1;
-  for (x = x1; x <= x2; x++)
-    mask[y * width + x] = 1;
-
-  for (x = x1; x <= x2; x++) {
-    count += find_size(index, x, y - 1, width, height, bitmap, mask);
-    count += find_size(index, x, y + 1, width, height, bitmap, mask);
-  }
-
-  return count;
+  /* For 24 bit images, the error is squared.  */
+  if (planes == 3)
+    return (int)(3.0 * adaptive_tightness * adaptive_tightness);
+  else
+    return (int)adaptive_tightness;
 }
 
-/* Find Size - Find the number of adjacent pixels of the same color
- *
- * Input Parameters:
- *   An 8 bit image, the current location inside the image, and the palette
- *   index of the color we are looking for
- *
- * Modified Parameters:
- *   A mask array used to prevent backtracking over already counted pixels
- *
- * Returns:
- *   Number of adjacent pixels found having the same color
+/* The blob walker - visit a blob, the pixels connected through their
+ * 4-neighbors to a seed pixel that have some property: the color of
+ * the seed, or some value in the mask.  The blob is visited one run of
+ * pixels on a row at a time; from each pixel of a run we look at the
+ * pixel above, then at the one below, and go on with the run starting
+ * there, if any, before looking further.  This used to be recursive,
+ * which overflows the stack on the large blobs of big scans, so we keep
+ * the runs still to be finished on a stack of our own, which is reused
+ * from one blob to the next.  The pixels are visited in the same order
+ * as before, which matters for find_most_similar_neighbor.
  */
 
-static int find_size_8( /* in */ unsigned char *index,
-                       /* in */ int x,
-                       /* in */ int y,
-                       /* in */ int width,
-                       /* in */ int height,
-                       /* in */ unsigned char *bitmap,
-                       /* in/out */ unsigned char *mask)
-{
-  int count;
-  int x1, x2;
-
-  if (y < 0 || y >= height || mask[y * width + x] == 1 || bitmap[(y * width + x)] != index[0])
-    return 0;
-
-  for (x1 = x; x1 >= 0 && bitmap[(y * width + x1)] == index[0] && mask[y * width + x] != 1; x1--) ;
-  x1++;
+typedef enum {
+  WALK_SIZE,                    /* Count the pixels of the seed's color.  */
+  WALK_NEIGHBOR,                /* Look at the pixels around them.  */
+  WALK_FILL,                    /* Recolor the pixels found so.  */
+  WALK_IGNORE                   /* Mask off the pixels counted.  */
+} walk_mode;
+
+typedef struct {
+  int y, x1, x2;                /* The run.  */
+  int x;                        /* Where we look at its neighbors next.  */
+  gboolean below;               /* Whether we look below X next.  */
+} run_type;
+
+typedef struct {
+  /* The image and the mask used to prevent backtracking.  */
+  unsigned char *bitmap;
+  unsigned char *mask;
+  int width, height, planes;
 
-  for (x2 = x; x2 < width && bitmap[(y * width + x2)] == index[0] && mask[y * width + x] != 1; x2++) ;
-  x2--;
+  /* The reusable stack of runs.  */
+  run_type *runs;
+  unsigned length, size;
 
-  count = x2 - x1 + 1;
-  for (x = x1; x <= x2; x++)
-    mask[y * width + x] = 1;
+  /* The current walk.  */
+  walk_mode mode;
+  unsigned char *index;         /* The color of the blob.  */
+  unsigned char *to_index;      /* The color to fill it with.  */
+  unsigned char *closest_index; /* The most similar neighbor so far.  */
+  int error_amt;                /* Its error.  */
+  int count;                    /* The size of the blob.  */
+} walker_type;
 
-  for (x = x1; x <= x2; x++) {
-    count += find_size_8(index, x, y - 1, width, height, bitmap, mask);
-    count += find_size_8(index, x, y + 1, width, height, bitmap, mask);
-  }
+#define PIXEL(w, x, y) (&(w)->bitmap[(w)->planes * ((size_t) (y) * (w)->width + (x))])
+#define MASK(w, x, y) ((w)->mask[(size_t) (y) * (w)->width + (x)])
 
-  return count;
+static gboolean same_color(walker_type * w, unsigned char *color)
+{
+  return color[0] == w->index[0] && (w->planes == 1 || (color[1] == w->index[1] && color[2] == w->index[2]));
 }
 
-/* Find Most Similar Neighbor - Given a position in an 24 bit bitmap and a color
- * index, traverse over a blob of adjacent pixels having the same value.
- * Return the color index of the neighbor pixel that has the most similar
- * color.
- *
- * Input parameters:
- *   24 bit bitmap, the current location inside the image,
- *   and the color index of the blob
- *
- * Modified parameters:
- *   Mask used to prevent backtracking
- *
- * Output parameters:
- *   Closest index != index and the error between the two colors squared
- */
-
-static void find_most_similar_neighbor( /* in */ unsigned char *index,
-                                       /* in/out */ unsigned char **closest_index,
-                                       /* in/out */ int *error_amt,
-                                       /* in */ int x,
-                                       /* in */ int y,
-                                       /* in */ int width,
-                                       /* in */ int height,
-                                       /* in */ unsigned char *bitmap,
-                                       /* in/out */ unsigned char *mask)
+static int calc_walker_error(walker_type * w, unsigned char *color1, unsigned char *color2)
 {
-  int x1, x2;
-  int temp_error;
-  unsigned char *value, *temp;
-
-  if (y < 0 || y >= height || mask[y * width + x] == 2)
-    return;
-
-  temp = &bitmap[3 * (y * width + x)];
-
-  assert(closest_index != NULL);
+  return w->planes == 3 ? calc_error(color1, color2) : calc_error_8(color1, color2);
+}
 
-  if (temp[0] != index[0] || temp[1] != index[1] || temp[2] != index[2]) {
-    value = temp;
+static void consider_neighbor(walker_type * w, unsigned char *value)
+{
+  int temp_error = calc_walker_error(w, w->index, value);
 
-    temp_error = calc_error(index, value);
+  if (w->closest_index == NULL || temp_error < w->error_amt)
+    w->closest_index = value, w->error_amt = temp_error;
+}
 
-    if (*closest_index == NULL || temp_error < *error_amt)
-      *closest_index = value, *error_amt = temp_error;
+/* Whether the pixel at X belongs to the run on row Y.  */
 
-    return;
+static gboolean in_run(walker_type * w, int x, int y)
+{
+  switch (w->mode) {
+  case WALK_SIZE:
+    return same_color(w, PIXEL(w, x, y)) && MASK(w, x, y) != 1;
+  case WALK_NEIGHBOR:
+    return same_color(w, PIXEL(w, x, y));
+  case WALK_FILL:
+    return MASK(w, x, y) == 2;
+  default:
+    return MASK(w, x, y) == 1;
   }
+}
 
-  for (x1 = x; x1 >= 0 && bitmap[3 * (y * width + x1)] == index[0] && bitmap[3 * (y * width + x1) + 1] == index[1] && bitmap[3 * (y * width + x1) + 2] == index[2]; x1--) ;
-  x1++;
-
-  for (x2 = x; x2 < width && bitmap[3 * (y * width + x2)] == index[0] && bitmap[3 * (y * width + x2) + 1] == index[1] && bitmap[3 * (y * width + x2) + 2] == index[2]; x2++) ;
-  x2--;
-
-  if (x1 > 0) {
-    value = &bitmap[3 * (y * width + x1 - 1)];
-
-    temp_error = calc_error(index, value);
-
-    if (*closest_index == NULL || temp_error < *error_amt)
-      *closest_index = value, *error_amt = temp_error;
-  }
+/* The first of the bytes from X on in ROW, of WIDTH bytes, that is not
+   VALUE, or WIDTH; and the last one before X, or -1.  They go eight
+   bytes at a time, so the runs of a mask or of a one-plane (bilevel)
+   image are found eight pixels at once.  */
 
-  if (x2 < width - 1) {
-    value = &bitmap[3 * (y * width + x2 + 1)];
+#define RUN_PATTERN(value) ((guint64) (value) * G_GUINT64_CONSTANT(0x0101010101010101))
 
-    temp_error = calc_error(index, value);
+static int run_end(const unsigned char *row, int x, int width, unsigned char value)
+{
+  guint64 pattern = RUN_PATTERN(value), word;
 
-    if (*closest_index == NULL || temp_error < *error_amt)
-      *closest_index = value, *error_amt = temp_error;
+  for (; x + 8 <= width; x += 8) {
+    memcpy(&word, row + x, 8);
+    if (word != pattern)
+      break;
   }
+  while (x < width && row[x] == value)
+    x++;
+  return x;
+}
 
-  for (x = x1; x <= x2; x++)
-    mask[y * width + x] = 2;
+static int run_start(const unsigned char *row, int x, unsigned char value)
+{
+  guint64 pattern = RUN_PATTERN(value), word;
 
-  for (x = x1; x <= x2; x++) {
-    find_most_similar_neighbor(index, closest_index, error_amt, x, y - 1, width, height, bitmap, mask);
-    find_most_similar_neighbor(index, closest_index, error_amt, x, y + 1, width, height, bitmap, mask);
+  for (; x >= 7; x -= 8) {
+    memcpy(&word, row + x - 7, 8);
+    if (word != pattern)
+      break;
   }
+  while (x >= 0 && row[x] == value)
+    x--;
+  return x;
 }
 
-/* Find Most Similar Neighbor - Given a position in an 8 bit bitmap and a color
- * index, traverse over a blob of adjacent pixels having the same value.
- * Return the color index of the neighbor pixel that has the most similar
- * color.
- *
- * Input parameters:
- *   8 bit bitmap, the current location inside the image,
- *   and the color index of the blob
- *
- * Modified parameters:
- *   Mask used to prevent backtracking
- *
- * Output parameters:
- *   Closest index != index and the error between the two colors squared
- */
+/* Look at the pixel (X, Y); if it starts a new run, do what we are
+   walking for with the run and push it on the stack.  */
 
-static void find_most_similar_neighbor_8( /* in */ unsigned char *index,
-                                         /* in/out */ unsigned char **closest_index,
-                                         /* in/out */ int *error_amt,
-                                         /* in */ int x,
-                                         /* in */ int y,
-                                         /* in */ int width,
-                                         /* in */ int height,
-                                         /* in */ unsigned char *bitmap,
-                                         /* in/out */ unsigned char *mask)
+static void visit(walker_type * w, int x, int y)
 {
   int x1, x2;
-  int temp_error;
-  unsigned char *value, *temp;
+  unsigned char *pixel;
 
-  if (y < 0 || y >= height || mask[y * width + x] == 2)
+  if (y < 0 || y >= w->height)
     return;
 
-  temp = &bitmap[(y * width + x)];
-
-  assert(closest_index != NULL);
+  switch (w->mode) {
+  case WALK_SIZE:
+    if (MASK(w, x, y) == 1 || !same_color(w, PIXEL(w, x, y)))
+      return;
+    break;
+  case WALK_NEIGHBOR:
+    if (MASK(w, x, y) == 2)
+      return;
+    if (!same_color(w, PIXEL(w, x, y))) {
+      consider_neighbor(w, PIXEL(w, x, y));
+      return;
+    }
+    break;
+  case WALK_FILL:
+    if (MASK(w, x, y) != 2)
+      return;
+    break;
+  case WALK_IGNORE:
+    if (MASK(w, x, y) != 1)
+      return;
+    break;
+  }
 
-  if (temp[0] != index[0]) {
-    value = temp;
+  /* A walk for the size counts a run of the seed's color whole or not
+     at all, so the mask need not be looked at along the run.  */
+  if (w->mode == WALK_FILL || w->mode == WALK_IGNORE || w->planes == 1) {
+    const unsigned char *row = w->planes == 1 && (w->mode == WALK_SIZE || w->mode == WALK_NEIGHBOR) ? PIXEL(w, 0, y) : &MASK(w, 0, y);
+    unsigned char value = w->mode == WALK_FILL ? 2 : w->mode == WALK_IGNORE ? 1 : w->index[0];
 
-    temp_error = calc_error_8(index, value);
+    x1 = run_start(row, x, value) + 1;
+    x2 = run_end(row, x, w->width, value) - 1;
+  } else {
+    for (x1 = x; x1 >= 0 && in_run(w, x1, y); x1--) ;
+    x1++;
+    for (x2 = x; x2 < w->width && in_run(w, x2, y); x2++) ;
+    x2--;
+  }
 
-    if (*closest_index == NULL || temp_error < *error_amt)
-      *closest_index = value, *error_amt = temp_error;
+  switch (w->mode) {
+  case WALK_SIZE:
+    w->count += x2 - x1 + 1;
+    memset(&MASK(w, x1, y), 1, x2 - x1 + 1);
+    break;
+  case WALK_NEIGHBOR:
+    if (x1 > 0)
+      consider_neighbor(w, PIXEL(w, x1 - 1, y));
+    if (x2 < w->width - 1)
+      consider_neighbor(w, PIXEL(w, x2 + 1, y));
+    memset(&MASK(w, x1, y), 2, x2 - x1 + 1);
+    break;
+  case WALK_FILL:
+    for (pixel = PIXEL(w, x1, y); pixel <= PIXEL(w, x2, y); pixel += w->planes)
+      memcpy(pixel, w->to_index, w->planes);
+    memset(&MASK(w, x1, y), 3, x2 - x1 + 1);
+    break;
+  case WALK_IGNORE:
+    memset(&MASK(w, x1, y), 3, x2 - x1 + 1);
+    break;
+  }
 
-    return;
+  if (w->length == w->size) {
+    w->size = w->size ? 2 * w->size : 256;
+    XREALLOC(w->runs, w->size * sizeof(run_type));
   }
+  w->runs[w->length].y = y;
+  w->runs[w->length].x1 = x1;
+  w->runs[w->length].x2 = x2;
+  w->runs[w->length].x = x1;
+  w->runs[w->length].below = FALSE;
+  w->length++;
+}
 
-  for (x1 = x; x1 >= 0 && bitmap[(y * width + x1)] == index[0]; x1--) ;
-  x1++;
+/* Walk the blob of the seed (X, Y) in the given MODE.  */
 
-  for (x2 = x; x2 < width && bitmap[(y * width + x2)] == index[0]; x2++) ;
-  x2--;
+static void walk(walker_type * w, walk_mode mode, int x, int y)
+{
+  w->mode = mode;
+  w->length = 0;
+  visit(w, x, y);
 
-  if (x1 > 0) {
-    value = &bitmap[(y * width + x1 - 1)];
+  while (w->length > 0) {
+    run_type *run = &w->runs[w->length - 1];
+    int next_x = run->x, next_y = run->below ? run->y + 1 : run->y - 1;
 
-    temp_error = calc_error_8(index, value);
+    if (run->x > run->x2) {
+      w->length--;
+      continue;
+    }
+    if (run->below)
+      run->x++;
+    run->below = !run->below;
 
-    if (*closest_index == NULL || temp_error < *error_amt)
-      *closest_index = value, *error_amt = temp_error;
+    /* This may move the stack.  */
+    visit(w, next_x, next_y);
   }
+}
 
-  if (x2 < width - 1) {
-    value = &bitmap[(y * width + x2 + 1)];
-
-    temp_error = calc_error_8(index, value);
-
-    if (*closest_index == NULL || temp_error < *error_amt)
-      *closest_index = value, *error_amt = temp_error;
-  }
+/* Find Size - Find the number of adjacent pixels of the same color
+ *
+ * Input Parameters:
+ *   The current location inside the image
+ *
+ * Modified Parameters:
+ *   The mask is set to 1 over the pixels counted
+ *
+ * Returns:
+ *   Number of adjacent pixels found having the same color
+ */
 
-  for (x = x1; x <= x2; x++)
-    mask[y * width + x] = 2;
+static int find_size( /* in */ int x,
+                     /* in */ int y,
+                     /* in/out */ walker_type * w)
+{
+  w->index = PIXEL(w, x, y);
+  w->count = 0;
+  walk(w, WALK_SIZE, x, y);
 
-  for (x = x1; x <= x2; x++) {
-    find_most_similar_neighbor_8(index, closest_index, error_amt, x, y - 1, width, height, bitmap, mask);
-    find_most_similar_neighbor_8(index, closest_index, error_amt, x, y + 1, width, height, bitmap, mask);
-  }
+  return w->count;
 }
 
-/* Fill - change the color of a blob
+/* Find Most Similar Neighbor - Given a position in the bitmap, traverse
+ * over a blob of adjacent pixels having the same value.  Return the
+ * color of the neighbor pixel that has the most similar color.
  *
  * Input parameters:
- *   The new color
+ *   The current location inside the image
  *
  * Modified parameters:
- *   24 bit pixbuf and its mask (used to prevent backtracking)
+ *   The mask is set to 2 over the blob
+ *
+ * Output parameters:
+ *   Closest color != the blob's color and the error between the two colors
  */
 
-static void fill( /* in */ unsigned char *to_index,
-                 /* in */ int x,
-                 /* in */ int y,
-                 /* in */ int width,
-                 /* in */ int height,
-                 /* in/out */ unsigned char *bitmap,
-                 /* in/out */ unsigned char *mask)
+static void find_most_similar_neighbor( /* in */ int x,
+                                       /* in */ int y,
+                                       /* out */ unsigned char **closest_index,
+                                       /* out */ int *error_amt,
+                                       /* in/out */ walker_type * w)
 {
-  int x1, x2;
-
-  if (y < 0 || y >= height || mask[y * width + x] != 2)
-    return;
-
-  for (x1 = x; x1 >= 0 && mask[y * width + x1] == 2; x1--) ;
-  x1++;
-  for (x2 = x; x2 < width && mask[y * width + x2] == 2; x2++) ;
-  x2--;
+  w->index = PIXEL(w, x, y);
+  w->closest_index = NULL;
+  w->error_amt = 0;
+  walk(w, WALK_NEIGHBOR, x, y);
 
-  assert(x1 >= 0 && x2 < width);
-
-  for (x = x1; x <= x2; x++) {
-    bitmap[3 * (y * width + x)] = to_index[0];
-    bitmap[3 * (y * width + x) + 1] = to_index[1];
-    bitmap[3 * (y * width + x) + 2] = to_index[2];
-    mask[y * width + x] = 3;
-  }
-
-  for (x = x1; x <= x2; x++) {
-    fill(to_index, x, y - 1, width, height, bitmap, mask);
-    fill(to_index, x, y + 1, width, height, bitmap, mask);
-  }
+  *closest_index = w->closest_index;
+  *error_amt = w->error_amt;
 }
 
 /* Fill - change the color of a blob
@@ -373,85 +373,43 @@ static void fill( /* in */ unsigned char *to_index,
  *   The new color
  *
  * Modified parameters:
- *   8 bit pixbuf and its mask (used to prevent backtracking)
+ *   The pixbuf, and the mask (from 2 to 3)
  */
 
-static void fill_8( /* in */ unsigned char *to_index,
-                   /* in */ int x,
-                   /* in */ int y,
-                   /* in */ int width,
-                   /* in */ int height,
-                   /* in/out */ unsigned char *bitmap,
-                   /* in/out */ unsigned char *mask)
+static void fill( /* in */ unsigned char *to_index,
+                 /* in */ int x,
+                 /* in */ int y,
+                 /* in/out */ walker_type * w)
 {
-  int x1, x2;
-
-  if (y < 0 || y >= height || mask[y * width + x] != 2)
-    return;
-
-  for (x1 = x; x1 >= 0 && mask[y * width + x1] == 2; x1--) ;
-  x1++;
-  for (x2 = x; x2 < width && mask[y * width + x2] == 2; x2++) ;
-  x2--;
-
-  assert(x1 >= 0 && x2 < width);
-
-  for (x = x1; x <= x2; x++) {
-    bitmap[(y * width + x)] = to_index[0];
-    mask[y * width + x] = 3;
-  }
-
-  for (x = x1; x <= x2; x++) {
-    fill_8(to_index, x, y - 1, width, height, bitmap, mask);
-    fill_8(to_index, x, y + 1, width, height, bitmap, mask);
-  }
+  w->to_index = to_index;
+  walk(w, WALK_FILL, x, y);
 }
 
 /* Ignore - blob is big enough, mask it off
  *
  * Modified parameters:
- *   its mask (used to prevent backtracking)
+ *   The mask (from 1 to 3)
  */
 
 static void ignore( /* in */ int x,
                    /* in */ int y,
-                   /* in */ int width,
-                   /* in */ int height,
-                   /* in/out */ unsigned char *mask)
+                   /* in/out */ walker_type * w)
 {
-  int x1, x2;
-
-  if (y < 0 || y >= height || mask[y * width + x] != 1)
-    return;
-
-  for (x1 = x; x1 >= 0 && mask[y * width + x1] == 1; x1--) ;
-  x1++;
-  for (x2 = x; x2 < width && mask[y * width + x2] == 1; x2++) ;
-  x2--;
-
-  assert(x1 >= 0 && x2 < width);
-
-  for (x = x1; x <= x2; x++)
-    mask[y * width + x] = 3;
-
-  for (x = x1; x <= x2; x++) {
-    ignore(x, y - 1, width, height, mask);
-    ignore(x, y + 1, width, height, mask);
-  }
+  walk(w, WALK_IGNORE, x, y);
 }
 
 /* Recolor - conditionally change a feature's color to the closest color of all
  * neighboring pixels
  *
  * Input parameters:
- *   The color palette, current blob size, and adaptive tightness
+ *   The current blob location, and adaptive tightness
  *
  *   Adaptive Tightness: (integer 1 to 256)
  *     1   = really tight
  *     256 = turn off the feature
  *
  * Modified parameters:
- *   24 bit pixbuf and its mask (used to prevent backtracking)
+ *   The pixbuf and its mask (used to prevent backtracking)
  *
  * Returns:
  *   TRUE  - feature was recolored, thus coalesced
@@ -461,75 +419,16 @@ static void ignore( /* in */ int x,
 static gboolean recolor( /* in */ double adaptive_tightness,
                         /* in */ int x,
                         /* in */ int y,
-                        /* in */ int width,
-                        /* in */ int height,
-                        /* in/out */ unsigned char *bitmap,
-                        /* in/out */ unsigned char *mask)
+                        /* in/out */ walker_type * w)
 {
   unsigned char *index, *to_index;
   int error_amt, max_error;
 
-  index = &bitmap[3 * (y * width + x)];
-  to_index = NULL;
-  error_amt = 0;
-  max_error = (int)(3.0 * adaptive_tightness * adaptive_tightness);
-
-  find_most_similar_neighbor(index, &to_index, &error_amt, x, y, width, height, bitmap, mask);
-
-  /* This condition only fails if the bitmap is all the same color */
-  if (to_index != NULL) {
-    /*
-     * If the difference between the two colors is too great,
-     * don't coalesce the feature with its neighbor(s).  This prevents a
-     * color from turning into its complement.
-     */
-
-    if (calc_error(index, to_index) > max_error)
-      fill(index, x, y, width, height, bitmap, mask);
-    else {
-      fill(to_index, x, y, width, height, bitmap, mask);
+  index = PIXEL(w, x, y);
 
-      return TRUE;
-    }
-  }
+  max_error = calc_max_error(w->planes, adaptive_tightness);
 
-  return FALSE;
-}
-
-/* Recolor - conditionally change a feature's color to the closest color of all
- * neighboring pixels
- *
- * Input parameters:
- *   The color palette, current blob size, and adaptive tightness
- *
- *   Adaptive Tightness: (integer 1 to 256)
- *     1   = really tight
- *     256 = turn off the feature
- *
- * Modified parameters:
- *   8 bit pixbuf and its mask (used to prevent backtracking)
- *
- * Returns:
- *   TRUE  - feature was recolored, thus coalesced
- *   FALSE - feature wasn't recolored
- */
-
-static gboolean recolor_8( /* in */ double adaptive_tightness,
-                          /* in */ int x,
-                          /* in */ int y,
-                          /* in */ int width,
-                          /* in */ int height,
-                          /* in/out */ unsigned char *bitmap,
-                          /* in/out */ unsigned char *mask)
-{
-  unsigned char *index, *to_index;
-  int error_amt;
-
-  index = &bitmap[(y * width + x)];
-  to_index = NULL;
-  error_amt = 0;
-
-  find_most_similar_neighbor_8(index, &to_index, &error_amt, x, y, width, height, bitmap, mask);
+  find_most_similar_neighbor(x, y, &to_index, &error_amt, w);
 
   /* This condition only fails if the bitmap is all the same color */
   if (to_index != NULL) {
@@ -539,10 +438,10 @@ static gboolean recolor_8( /* in */ double adaptive_tightness,
      * color from turning into its complement.
      */
 
-    if (calc_error_8(index, to_index) > adaptive_tightness)
-      fill_8(index, x, y, width, height, bitmap, mask);
+    if (calc_walker_error(w, index, to_index) > max_error)
+      fill(index, x, y, w);
     else {
-      fill_8(to_index, x, y, width, height, bitmap, mask);
+      fill(to_index, x, y, w);
 
       return TRUE;
     }
@@ -559,17 +458,14 @@ static gboolean recolor_8( /* in */ double adaptive_tightness,
  *   tightness and noise removal
  *
  * Modified Parameters:
- *   The 24 bit pixbuf is despeckled
+ *   The 8 or 24 bit pixbuf is despeckled
  */
 
 static void despeckle_iteration( /* in */ int level,
                                 /* in */ double adaptive_tightness,
                                 /* in */ double noise_max,
-                                /* in */ int width,
-                                /* in */ int height,
-                                /* in/out */ unsigned char *bitmap)
+                                /* in/out */ walker_type * w)
 {
-  unsigned char *mask;
   int x, y;
   int current_size;
   int tightness;
@@ -578,75 +474,563 @@ static void despeckle_iteration( /* in */ int level,
   current_size = 1 << level;
   tightness = (int)(noise_max / (1.0 + adaptive_tightness * level));
 
-  mask = (unsigned char *)calloc(width * height, sizeof(unsigned char));
-  for (y = 0; y < height; y++) {
-    for (x = 0; x < width; x++) {
-      if (mask[y * width + x] == 0) {
+  memset(w->mask, 0, (size_t) w->width * w->height);
+  for (y = 0; y < w->height; y++) {
+    for (x = 0; x < w->width; x++) {
+      if (MASK(w, x, y) == 0) {
         int size;
 
-        size = find_size(&bitmap[3 * (y * width + x)], x, y, width, height, bitmap, mask);
+        size = find_size(x, y, w);
 
         assert(size > 0);
 
         if (size < current_size) {
-          if (recolor(tightness, x, y, width, height, bitmap, mask))
+          if (recolor(tightness, x, y, w))
             x--;
         } else
-          ignore(x, y, width, height, mask);
+          ignore(x, y, w);
       }
     }
   }
+}
+
+/* The region graph - despeckle all levels at once.  The image is
+ * labeled a single time into regions, the 4-connected blobs of one
+ * color, numbered in the order the scan meets them, with their sizes,
+ * colors and adjacent regions.  The levels then only merge regions, and
+ * the pixels are rewritten at the end, so a level costs about the
+ * number of regions rather than the number of pixels.
+ *
+ * Every level visits the regions in order, as despeckle_iteration does
+ * with the pixels: a blob smaller than the current size takes the color
+ * of its most similar neighbor, if close enough, and so merges with the
+ * neighbors of that color.  Of equally similar neighbors the one met
+ * first by the scan is taken, where despeckle_iteration takes the one
+ * its walk meets first.  Every later merge builds on that choice, so
+ * this is a different algorithm rather than a faster despeckle_iteration:
+ * images of a few distinct colors, where such ties are rare, usually come
+ * out the same, but on shaded images, where they are everywhere, a large
+ * part of the pixels can end up with other colors.
+ */
 
-  free(mask);
+typedef struct {
+  /* Valid for the root of a blob only.  */
+  unsigned char color[3];
+  int size;                     /* Number of pixels.  */
+  int first;                    /* Lowest label in the blob.  */
+  int *adj;                     /* Labels of the adjacent regions.  */
+  int adj_length;
+  int adj_size;                 /* 0 if adj points into the edge table.  */
+
+  /* Valid for every region.  */
+  int parent;                   /* The blob it was merged into.  */
+  int next;                     /* The next region of its blob, circular.  */
+  int visited;                  /* The last level it was visited at, +1.  */
+  int seen;                     /* Scratch for find_neighbors.  */
+} region_type;
+
+typedef struct {
+  region_type *regions;
+  int count;
+  int planes;
+  int *edges;                   /* The initial adjacent regions.  */
+  int *merge;                   /* Scratch for recolor_blob.  */
+  int token;
+} region_graph;
+
+static int find_blob(region_graph * g, int r)
+{
+  region_type *regions = g->regions;
+
+  while (regions[r].parent != r) {
+    regions[r].parent = regions[regions[r].parent].parent;
+    r = regions[r].parent;
+  }
+  return r;
 }
 
-/* Despeckle Iteration - Despeckle all regions smaller than cur_size pixels
+/* The labeling is done over tiles of DESPECKLE_TILE_ROWS rows, in
+ * parallel.  A pixel that starts a region in its tile is its
+ * representative; the representatives are united, inside the tiles and
+ * then across their borders, always under the lowest, so every region
+ * ends up with the first of its pixels in scan order as root.  The
+ * regions are then numbered by their roots, which gives the numbers of
+ * a serial scan whatever the tiles and threads.
+ */
+
+#define DESPECKLE_TILE_ROWS 64
+
+typedef struct {
+  unsigned char *bitmap;
+  int width, height, planes;
+  int *labels;                  /* A representative, then a region.  */
+  int *parent;                  /* Of representatives only: the one they
+                                   were united with, or -2 - the region
+                                   if a root.  */
+  int *roots;                   /* Number of roots before each tile.  */
+  region_type *regions;
+  int **edges;                  /* Pairs of adjacent regions of each tile.  */
+  int *edge_counts;
+} tile_job;
+
+#define TILE_FIRST(job, t) ((size_t) (t) * DESPECKLE_TILE_ROWS * (job)->width)
+#define TILE_LAST(job, t) ((size_t) MIN (((t) + 1) * DESPECKLE_TILE_ROWS, (job)->height) * (job)->width)
+
+static int find_representative(int *parent, int l)
+{
+  while (parent[l] != l) {
+    parent[l] = parent[parent[l]];
+    l = parent[l];
+  }
+  return l;
+}
+
+static void unite_representatives(int *parent, int a, int b)
+{
+  a = find_representative(parent, a);
+  b = find_representative(parent, b);
+  if (a < b)
+    parent[b] = a;
+  else
+    parent[a] = b;
+}
+
+/* Give every pixel of the tiles a representative in its tile.  */
+
+static void label_tiles(unsigned first, unsigned last, gpointer data)
+{
+  tile_job *job = (tile_job *) data;
+  int width = job->width, planes = job->planes;
+  int *labels = job->labels, *parent = job->parent;
+  unsigned t;
+
+  for (t = first; t < last; t++) {
+    size_t p, tile_first = TILE_FIRST(job, t);
+
+    for (p = tile_first; p < TILE_LAST(job, t); p++) {
+      unsigned char *pixel = &job->bitmap[planes * p];
+      gboolean left = p % width > 0 && memcmp(pixel, pixel - planes, planes) == 0;
+      gboolean up = p >= tile_first + width && memcmp(pixel, pixel - planes * width, planes) == 0;
+
+      if (left) {
+        labels[p] = labels[p - 1];
+        if (up)
+          unite_representatives(parent, labels[p - 1], labels[p - width]);
+      } else if (up)
+        labels[p] = labels[p - width];
+      else
+        parent[p] = labels[p] = (int)p;
+    }
+  }
+}
+
+/* Count the roots of the tiles.  */
+
+static void count_roots(unsigned first, unsigned last, gpointer data)
+{
+  tile_job *job = (tile_job *) data;
+  unsigned t;
+
+  for (t = first; t < last; t++) {
+    size_t p;
+    int count = 0;
+
+    for (p = TILE_FIRST(job, t); p < TILE_LAST(job, t); p++)
+      if (job->labels[p] == (int)p && job->parent[p] == (int)p)
+        count++;
+    job->roots[t] = count;
+  }
+}
+
+/* Number the roots of the tiles and give their regions their color.  */
+
+static void number_roots(unsigned first, unsigned last, gpointer data)
+{
+  tile_job *job = (tile_job *) data;
+  unsigned t;
+
+  for (t = first; t < last; t++) {
+    size_t p;
+    int r = job->roots[t];
+
+    for (p = TILE_FIRST(job, t); p < TILE_LAST(job, t); p++)
+      if (job->labels[p] == (int)p && job->parent[p] == (int)p) {
+        job->parent[p] = -2 - r;
+        memcpy(job->regions[r].color, &job->bitmap[job->planes * p], job->planes);
+        r++;
+      }
+  }
+}
+
+/* Replace the representatives of the pixels of the tiles by their
+   regions.  */
+
+static void relabel_tiles(unsigned first, unsigned last, gpointer data)
+{
+  tile_job *job = (tile_job *) data;
+  int *labels = job->labels;
+  unsigned t;
+
+  for (t = first; t < last; t++) {
+    size_t p;
+
+    for (p = TILE_FIRST(job, t); p < TILE_LAST(job, t); p++) {
+      int l = labels[p];
+
+      while (job->parent[l] >= 0)
+        l = job->parent[l];
+      labels[p] = -2 - job->parent[l];
+    }
+  }
+}
+
+static void add_edge(tile_job * job, unsigned t, int *size, int a, int b)
+{
+  if (job->edge_counts[t] + 2 > *size) {
+    *size = *size ? 2 * *size : 1024;
+    XREALLOC(job->edges[t], *size * sizeof(int));
+  }
+  job->edges[t][job->edge_counts[t]++] = a;
+  job->edges[t][job->edge_counts[t]++] = b;
+}
+
+/* List the pairs of adjacent regions of the tiles, skipping the pairs
+   the pixels above or to the left have just given.  */
+
+static void find_edges(unsigned first, unsigned last, gpointer data)
+{
+  tile_job *job = (tile_job *) data;
+  int width = job->width, *labels = job->labels;
+  size_t count = (size_t) width * job->height;
+  unsigned t;
+
+  for (t = first; t < last; t++) {
+    size_t p;
+    int size = 0;
+
+    job->edges[t] = NULL;
+    job->edge_counts[t] = 0;
+    for (p = TILE_FIRST(job, t); p < TILE_LAST(job, t); p++) {
+      int a = labels[p], b;
+      gboolean up = p >= (size_t) width, left = p % width > 0;
+
+      if (p % width + 1 < (size_t) width && (b = labels[p + 1]) != a && !(up && labels[p - width] == a && labels[p + 1 - width] == b))
+        add_edge(job, t, &size, a, b);
+      if (p + width < count && (b = labels[p + width]) != a && !(left && labels[p - 1] == a && labels[p - 1 + width] == b))
+        add_edge(job, t, &size, a, b);
+    }
+  }
+}
+
+/* New Region Graph - label the image and find the adjacent regions
  *
- * Input Parameters:
- *   Current blob size, maximum blob size
- *   for all iterations (used to selectively recolor blobs), adaptive
- *   tightness and noise removal
+ * Input parameters:
+ *   The image, and the number of threads
  *
- * Modified Parameters:
- *   The 8 bit pixbuf is despeckled
+ * Output parameters:
+ *   The labels of the pixels
+ *
+ * Returns:
+ *   The graph of the regions
  */
 
-static void despeckle_iteration_8( /* in */ int level,
-                                  /* in */ double adaptive_tightness,
-                                  /* in */ double noise_max,
-                                  /* in */ int width,
-                                  /* in */ int height,
-                                  /* in/out */ unsigned char *bitmap)
+static region_graph new_region_graph( /* in */ unsigned char *bitmap,
+                                     /* in */ int width,
+                                     /* in */ int height,
+                                     /* in */ int planes,
+                                     /* in */ unsigned threads,
+                                     /* out */ int **labels)
 {
-  unsigned char *mask;
-  int x, y;
-  int current_size;
-  int tightness;
+  region_graph g;
+  region_type *regions;
+  tile_job job;
+  unsigned tiles = (height + DESPECKLE_TILE_ROWS - 1) / DESPECKLE_TILE_ROWS, t;
+  size_t p, edge_count = 0;
+  int r, i, y;
+
+  job.bitmap = bitmap;
+  job.width = width;
+  job.height = height;
+  job.planes = planes;
+  XMALLOC(job.labels, (size_t) width * height * sizeof(int));
+  XMALLOC(job.parent, (size_t) width * height * sizeof(int));
+  XMALLOC(job.roots, tiles * sizeof(int));
+  XMALLOC(job.edges, tiles * sizeof(int *));
+  XMALLOC(job.edge_counts, tiles * sizeof(int));
+
+  parallel_for(tiles, 1, threads, label_tiles, &job);
+
+  /* Unite the regions across the borders of the tiles.  */
+  for (y = DESPECKLE_TILE_ROWS; y < height; y += DESPECKLE_TILE_ROWS)
+    for (p = (size_t) y * width; p < (size_t) (y + 1) * width; p++)
+      if (memcmp(&bitmap[planes * p], &bitmap[planes * (p - width)], planes) == 0)
+        unite_representatives(job.parent, job.labels[p], job.labels[p - width]);
+
+  parallel_for(tiles, 1, threads, count_roots, &job);
+  for (t = 0, g.count = 0; t < tiles; t++) {
+    int count = job.roots[t];
+
+    job.roots[t] = g.count;
+    g.count += count;
+  }
 
-  /* Size doubles each iteration level, so current_size = 2^level */
-  current_size = 1 << level;
-  tightness = (int)(noise_max / (1.0 + adaptive_tightness * level));
+  XCALLOC(regions, g.count * sizeof(region_type));
+  job.regions = regions;
+  parallel_for(tiles, 1, threads, number_roots, &job);
+  parallel_for(tiles, 1, threads, relabel_tiles, &job);
+  free(job.parent);
+  parallel_for(tiles, 1, threads, find_edges, &job);
+
+  g.regions = regions;
+  g.planes = planes;
+  g.merge = NULL;
+  for (r = 0; r < g.count; r++)
+    regions[r].parent = regions[r].next = regions[r].first = r;
+  for (p = 0; p < (size_t) width * height; p++)
+    regions[job.labels[p]].size++;
+
+  for (t = 0; t < tiles; t++)
+    for (i = 0; i < job.edge_counts[t]; i++)
+      regions[job.edges[t][i]].adj_length++;
+  for (r = 0; r < g.count; r++)
+    edge_count += regions[r].adj_length;
+  XMALLOC(g.edges, (edge_count ? edge_count : 1) * sizeof(int));
+  for (r = 0, p = 0; r < g.count; r++) {
+    regions[r].adj = &g.edges[p];
+    p += regions[r].adj_length;
+    regions[r].adj_length = 0;
+  }
+  for (t = 0; t < tiles; t++) {
+    for (i = 0; i < job.edge_counts[t]; i += 2) {
+      int a = job.edges[t][i], b = job.edges[t][i + 1];
 
-  mask = (unsigned char *)calloc(width * height, sizeof(unsigned char));
-  for (y = 0; y < height; y++) {
-    for (x = 0; x < width; x++) {
-      if (mask[y * width + x] == 0) {
-        int size;
+      regions[a].adj[regions[a].adj_length++] = b;
+      regions[b].adj[regions[b].adj_length++] = a;
+    }
+    free(job.edges[t]);
+  }
+  free(job.edges);
+  free(job.edge_counts);
+  free(job.roots);
 
-        size = find_size_8(&bitmap[(y * width + x)], x, y, width, height, bitmap, mask);
+  /* Drop the pairs given more than once.  */
+  for (r = 0; r < g.count; r++) {
+    int length = 0;
 
-        assert(size > 0);
+    for (i = 0; i < regions[r].adj_length; i++) {
+      int a = regions[r].adj[i];
 
-        if (size < current_size) {
-          if (recolor_8(tightness, x, y, width, height, bitmap, mask))
-            x--;
-        } else
-          ignore(x, y, width, height, mask);
+      if (regions[a].seen != r + 1) {
+        regions[a].seen = r + 1;
+        regions[r].adj[length++] = a;
+      }
+    }
+    regions[r].adj_length = length;
+  }
+  for (r = 0; r < g.count; r++)
+    regions[r].seen = 0;
+  g.token = g.count;
+
+  *labels = job.labels;
+  return g;
+}
+
+static void free_region_graph(region_graph * g)
+{
+  int r;
+
+  for (r = 0; r < g->count; r++)
+    if (g->regions[r].parent == r && g->regions[r].adj_size > 0)
+      free(g->regions[r].adj);
+  free(g->regions);
+  free(g->edges);
+  free(g->merge);
+}
+
+/* Find Neighbors - bring the list of blobs adjacent to the blob R up to
+   date, after merges, and return the one most similar to R, or -1 if
+   there are none.  */
+
+static int find_neighbors( /* in/out */ region_graph * g,
+                          /* in */ int r,
+                          /* out */ int *error_amt)
+{
+  region_type *regions = g->regions;
+  region_type *blob = &regions[r];
+  int i, length = 0, closest = -1;
+
+  *error_amt = 0;
+  g->token++;
+  for (i = 0; i < blob->adj_length; i++) {
+    int a = find_blob(g, blob->adj[i]);
+
+    if (a != r && regions[a].seen != g->token) {
+      int temp_error = g->planes == 3 ? calc_error(blob->color, regions[a].color)
+        : calc_error_8(blob->color, regions[a].color);
+
+      regions[a].seen = g->token;
+      blob->adj[length++] = a;
+      if (closest < 0 || temp_error < *error_amt || (temp_error == *error_amt && regions[a].first < regions[closest].first))
+        closest = a, *error_amt = temp_error;
+    }
+  }
+  blob->adj_length = length;
+
+  return closest;
+}
+
+/* Merge the blob B into the blob A, or A into B, returning the root.  */
+
+static int merge_blobs(region_graph * g, int a, int b)
+{
+  region_type *regions = g->regions;
+  int length, temp;
+
+  /* Append the shorter list of neighbors to the longer.  */
+  if (regions[a].adj_length < regions[b].adj_length)
+    temp = a, a = b, b = temp;
+
+  length = regions[a].adj_length + regions[b].adj_length;
+  if (length > regions[a].adj_size) {
+    int size = 2 * length;
+
+    if (regions[a].adj_size == 0) {
+      int *adj;
+
+      XMALLOC(adj, size * sizeof(int));
+      memcpy(adj, regions[a].adj, regions[a].adj_length * sizeof(int));
+      regions[a].adj = adj;
+    } else
+      XREALLOC(regions[a].adj, size * sizeof(int));
+    regions[a].adj_size = size;
+  }
+  memcpy(&regions[a].adj[regions[a].adj_length], regions[b].adj, regions[b].adj_length * sizeof(int));
+  regions[a].adj_length = length;
+  if (regions[b].adj_size > 0)
+    free(regions[b].adj);
+  regions[b].adj = NULL;
+  regions[b].adj_length = regions[b].adj_size = 0;
+
+  regions[b].parent = a;
+  regions[a].size += regions[b].size;
+  if (regions[b].first < regions[a].first)
+    regions[a].first = regions[b].first;
+  temp = regions[a].next, regions[a].next = regions[b].next, regions[b].next = temp;
+
+  return a;
+}
+
+/* Recolor Blob - give the blob R the color of its neighbor TO and merge
+   it with its neighbors of that color.  The neighbors must be up to
+   date.  */
+
+static void recolor_blob(region_graph * g, int r, int to)
+{
+  region_type *regions = g->regions;
+  unsigned char color[3];
+  int i, count = 0;
+
+  memcpy(color, regions[to].color, 3);
+  XREALLOC(g->merge, regions[r].adj_length * sizeof(int));
+  for (i = 0; i < regions[r].adj_length; i++) {
+    int a = regions[r].adj[i];
+
+    if (memcmp(regions[a].color, color, g->planes) == 0)
+      g->merge[count++] = a;
+  }
+
+  for (i = 0; i < count; i++)
+    r = merge_blobs(g, r, g->merge[i]);
+  memcpy(regions[r].color, color, 3);
+}
+
+/* Give the pixels of the tiles the color of their blobs, the regions
+   pointing straight at the roots of these.  */
+
+static void recolor_tiles(unsigned first, unsigned last, gpointer data)
+{
+  tile_job *job = (tile_job *) data;
+  unsigned t;
+
+  for (t = first; t < last; t++) {
+    size_t p;
+
+    for (p = TILE_FIRST(job, t); p < TILE_LAST(job, t); p++) {
+      region_type *region = &job->regions[job->labels[p]];
+
+      memcpy(&job->bitmap[job->planes * p], job->regions[region->parent].color, job->planes);
+    }
+  }
+}
+
+/* Despeckle Graph - despeckle the image on its region graph
+ *
+ * Input Parameters:
+ *   Despeckling level, adaptive tightness, noise removal and the
+ *   number of threads
+ *
+ * Modified Parameters:
+ *   The 8 or 24 bit pixbuf is despeckled
+ */
+
+static void despeckle_graph( /* in/out */ unsigned char *bitmap,
+                            /* in */ int width,
+                            /* in */ int height,
+                            /* in */ int planes,
+                            /* in */ int level,
+                            /* in */ double adaptive_tightness,
+                            /* in */ double noise_max,
+                            /* in */ unsigned threads)
+{
+  region_graph g;
+  region_type *regions;
+  tile_job job;
+  int *labels;
+  int i, r, l, m;
+
+  g = new_region_graph(bitmap, width, height, planes, threads, &labels);
+  regions = g.regions;
+
+  for (i = 0; i < level; i++) {
+    int current_size = 1 << i;
+    int max_error = calc_max_error(planes, (int)(noise_max / (1.0 + adaptive_tightness * i)));
+
+    for (l = 0; l < g.count; l++) {
+      int closest, error_amt;
+
+      if (regions[l].visited == i + 1)
+        continue;
+
+      /* Like the pixels walked by despeckle_iteration, the whole blob
+         is done with at this level.  */
+      r = find_blob(&g, l);
+      for (m = r;; m = regions[m].next) {
+        regions[m].visited = i + 1;
+        if (regions[m].next == r)
+          break;
       }
+
+      if (regions[r].size >= current_size)
+        continue;
+
+      closest = find_neighbors(&g, r, &error_amt);
+      if (closest >= 0 && error_amt <= max_error)
+        recolor_blob(&g, r, closest);
     }
   }
 
-  free(mask);
+  for (l = 0; l < g.count; l++)
+    regions[l].parent = find_blob(&g, l);
+  job.bitmap = bitmap;
+  job.width = width;
+  job.height = height;
+  job.planes = planes;
+  job.labels = labels;
+  job.regions = regions;
+  parallel_for((height + DESPECKLE_TILE_ROWS - 1) / DESPECKLE_TILE_ROWS, 1, threads, recolor_tiles, &job);
+
+  free(labels);
+  free_region_graph(&g);
 }
 
 /* Despeckle - Despeckle a 8 or 24 bit image
@@ -670,6 +1054,13 @@ static void despeckle_iteration_8( /* in */ int level,
  *     You should always use the highest value, only if certain parts of the image
  *     disappear you should lower it.
  *
+ *   Region graph (graph): Boolean
+ *     TRUE  = label the regions once and merge them on their adjacency graph
+ *     FALSE = walk the whole image again at every level
+ *
+ *   Threads (threads): Number of threads labeling the tiles of the image
+ *     in region graph despeckling; 0 = one per processor
+ *
  * Modified Parameters:
  *   The bitmap is despeckled.
  */
@@ -678,12 +1069,15 @@ void despeckle( /* in/out */ at_bitmap * bitmap,
                /* in */ int level,
                /* in */ gfloat tightness,
                /* in */ gfloat noise_removal,
+               /* in */ gboolean graph,
+               /* in */ unsigned threads,
                /* exception handling */ at_exception_type * excep)
 {
   int i, planes, max_level;
   short width, height;
   unsigned char *bits;
   double noise_max, adaptive_tightness;
+  walker_type walker;
 
   planes = AT_BITMAP_PLANES(bitmap);
   noise_max = noise_removal * 255.0;
@@ -695,16 +1089,28 @@ void despeckle( /* in/out */ at_bitmap * bitmap,
     level = max_level;
   adaptive_tightness = (noise_removal * (1.0 + tightness * level) - 1.0) / level;
 
-  if (planes == 3) {
-    for (i = 0; i < level; i++)
-      despeckle_iteration(i, adaptive_tightness, noise_max, width, height, bits);
-  } else if (planes == 1) {
-    for (i = 0; i < level; i++)
-      despeckle_iteration_8(i, adaptive_tightness, noise_max, width, height, bits);
-  } else {
+  if (planes != 3 && planes != 1) {
     LOG("despeckle: %u-plane images are not supported", planes);
     at_exception_fatal(excep, "despeckle: wrong plane images are passed");
     return;
   }
 
+  if (graph) {
+    despeckle_graph(bits, width, height, planes, level, adaptive_tightness, noise_max, threads);
+    return;
+  }
+
+  walker.bitmap = bits;
+  walker.width = width;
+  walker.height = height;
+  walker.planes = planes;
+  walker.runs = NULL;
+  walker.length = walker.size = 0;
+  XMALLOC(walker.mask, (size_t) width * height);
+
+  for (i = 0; i < level; i++)
+    despeckle_iteration(i, adaptive_tightness, noise_max, &walker);
+
+  free(walker.mask);
+  free(walker.runs);
 }
@@ -45,10 +45,17 @@
  *     You should always use the highest value, only if certain parts of the image
  *     disappear you should lower it.
  *
+ *   Region graph (graph): Boolean
+ *     TRUE  = label the regions once and merge them on their adjacency graph
+ *     FALSE = walk the whole image again at every level
+ *
+ *   Threads (threads): Number of threads labeling the tiles of the image
+ *     in region graph despeckling; 0 = one per processor
+ *
  * Modified Parameters:
  *   The bitmap is despeckled.
  */
 
-extern void despeckle(at_bitmap * bitmap, int level, gfloat tightness, gfloat noise_removal, at_exception_type * exp);
+extern void despeckle(at_bitmap * bitmap, int level, gfloat tightness, gfloat noise_removal, gboolean graph, unsigned threads, at_exception_type * exp);
 
 #endif /* not DESPECKLE_H */
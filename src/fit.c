@@ -33,6 +33,7 @@
 #include "pxl-outline.h"
 #include "epsilon-equal.h"
 #include "xstd.h"
+#define _USE_MATH_DEFINES
 #include <math.h>
 #ifndef FLT_MAX
 #include <limits.h>
@@ -48,6 +49,9 @@
 #define SQUARE(x) ((x) * (x))
 #define CUBE(x) ((x) * (x) * (x))
 
+/* We don't try to fit an arc to fewer points than this.  */
+#define ARC_MIN_POINTS 6
+
 /* We need to manipulate lists of array indices.  */
 
 typedef struct index_list {
@@ -65,10 +69,15 @@ static void free_index_list(index_list_type *);
 static index_list_type new_index_list(void);
 static void remove_adjacent_corners(index_list_type *, unsigned, gboolean, at_exception_type * exception);
 static void change_bad_lines(spline_list_type *, fitting_opts_type *);
+static void merge_splines(spline_list_type *, fitting_opts_type *, at_exception_type * exception);
+static gboolean merge_lines(spline_list_type, unsigned, unsigned, gfloat, spline_type *);
+static gboolean merge_cubics(spline_list_type, unsigned, unsigned, gfloat, spline_type *, at_exception_type * exception);
+static vector_type spline_tangent(spline_type, gboolean);
 static void filter(curve_type, fitting_opts_type *);
 static void find_vectors(unsigned, pixel_outline_type, vector_type *, vector_type *, unsigned);
 static index_list_type find_corners(pixel_outline_type, fitting_opts_type *, at_exception_type * exception);
 static gfloat find_error(curve_type, spline_type, unsigned *, at_exception_type * exception);
+static gfloat find_error_bounded(curve_type, spline_type, gfloat, unsigned *);
 static vector_type find_half_tangent(curve_type, gboolean start, unsigned *, unsigned);
 static void find_tangent(curve_type, gboolean, gboolean, unsigned);
 static spline_type fit_one_spline(curve_type, at_exception_type * exception);
@@ -76,10 +85,16 @@ static spline_list_type *fit_curve(curve_type, fitting_opts_type *, at_exception
 static spline_list_type fit_curve_list(curve_list_type, fitting_opts_type *, at_distance_map *, at_exception_type * exception);
 static spline_list_type *fit_with_least_squares(curve_type, fitting_opts_type *, at_exception_type * exception);
 static spline_list_type *fit_with_line(curve_type);
+static spline_list_type *fit_with_arc(curve_type, fitting_opts_type *);
+static gboolean fit_circle(curve_type, unsigned, double *, double *, double *);
+static gboolean fit_ellipse(curve_type, unsigned, gfloat, double *, double *, double[2], double[2]);
+static gboolean arc_sweep(curve_type, double, double, double, double *);
+static spline_list_type *arc_splines(double, double, const double[2], const double[2], double, double, polynomial_degree);
+static gboolean solve_linear_system(double *, double *, unsigned);
 static void remove_knee_points(curve_type, gboolean);
 static void set_initial_parameter_values(curve_type);
 static gboolean spline_linear_enough(spline_type *, curve_type, fitting_opts_type *);
-static curve_list_array_type split_at_corners(pixel_outline_list_type, fitting_opts_type *, at_exception_type * exception);
+static curve_list_type split_at_corners(pixel_outline_type, fitting_opts_type *, at_exception_type * exception);
 static at_coord real_to_int_coord(at_real_coord);
 static gfloat distance(at_real_coord, at_real_coord);
 
@@ -106,10 +121,86 @@ fitting_opts_type new_fitting_opts(void)
   fitting_opts.centerline = FALSE;
   fitting_opts.preserve_width = FALSE;
   fitting_opts.width_weight_factor = 6.0;
+  fitting_opts.fast_reject = FALSE;
+  fitting_opts.weighted_distance = FALSE;
+  fitting_opts.threads = 0;
+  fitting_opts.outline_cache = FALSE;
+  fitting_opts.merge_threshold = 0.0;
+  fitting_opts.fit_arcs = FALSE;
+  fitting_opts.despeckle_graph = FALSE;
+  fitting_opts.palette = NULL;
+  fitting_opts.quantizer = AT_QUANTIZER_MEDIAN_CUT;
 
   return (fitting_opts);
 }
 
+/* Many images repeat the same outline at different places: the
+   letters of a text, the dots of a halftone screen, hatching.  Such an
+   outline would be fitted to the same splines, only translated.  So,
+   if asked to, we remember the splines fitted to each outline, keyed by
+   its shape, that is by the moves from each pixel to the next plus the
+   clockwise and open flags, and reuse them for the later copies.  */
+
+typedef struct {
+  at_coord origin;              /* The first pixel of the fitted outline.  */
+  spline_list_type splines;
+} cached_outline_type;
+
+static guint outline_hash(gconstpointer key)
+{
+  const pixel_outline_type *o = (const pixel_outline_type *)key;
+  guint hash = 2166136261U;     /* FNV-1a */
+  unsigned p;
+
+  hash = (hash ^ (o->length * 4 + (o->clockwise ? 2 : 0) + (o->open ? 1 : 0))) * 16777619U;
+  for (p = 1; p < o->length; p++) {
+    hash = (hash ^ (guint) (o->data[p].x - o->data[p - 1].x)) * 16777619U;
+    hash = (hash ^ (guint) (o->data[p].y - o->data[p - 1].y)) * 16777619U;
+  }
+  return hash;
+}
+
+static gboolean outline_equal(gconstpointer a, gconstpointer b)
+{
+  const pixel_outline_type *o1 = (const pixel_outline_type *)a;
+  const pixel_outline_type *o2 = (const pixel_outline_type *)b;
+  unsigned p;
+
+  if (o1->length != o2->length || !o1->clockwise != !o2->clockwise || !o1->open != !o2->open)
+    return FALSE;
+  for (p = 1; p < o1->length; p++)
+    if (o1->data[p].x - o1->data[p - 1].x != o2->data[p].x - o2->data[p - 1].x || o1->data[p].y - o1->data[p - 1].y != o2->data[p].y - o2->data[p - 1].y)
+      return FALSE;
+  return TRUE;
+}
+
+static void free_cached_outline(gpointer data)
+{
+  cached_outline_type *cached = (cached_outline_type *) data;
+  free_spline_list(cached->splines);
+  free(cached);
+}
+
+/* Return a copy of SPLINES moved from FROM to TO.  */
+
+static spline_list_type translate_spline_list(spline_list_type splines, at_coord from, at_coord to)
+{
+  unsigned this_spline, i;
+  gfloat dx = (gfloat) to.x - (gfloat) from.x;
+  gfloat dy = (gfloat) to.y - (gfloat) from.y;
+  spline_list_type moved = splines;
+
+  SPLINE_LIST_DATA(moved) = NULL;
+  SPLINE_LIST_LENGTH(moved) = 0;
+  concat_spline_lists(&moved, splines);
+  for (this_spline = 0; this_spline < SPLINE_LIST_LENGTH(moved); this_spline++)
+    for (i = 0; i < 4; i++) {
+      SPLINE_LIST_ELT(moved, this_spline).v[i].x += dx;
+      SPLINE_LIST_ELT(moved, this_spline).v[i].y += dy;
+    }
+  return moved;
+}
+
 /* The top-level call that transforms the list of pixels in the outlines
    of the original character to a list of spline lists fitted to those
    pixels.  */
@@ -117,11 +208,9 @@ fitting_opts_type new_fitting_opts(void)
 spline_list_array_type fitted_splines(pixel_outline_list_type pixel_outline_list, fitting_opts_type * fitting_opts, at_distance_map * dist, unsigned short width, unsigned short height, at_exception_type * exception, at_progress_func notify_progress, gpointer progress_data, at_testcancel_func test_cancel, gpointer testcancel_data)
 {
   unsigned this_list;
+  GHashTable *outline_cache = NULL;
 
   spline_list_array_type char_splines = new_spline_list_array();
-  curve_list_array_type curve_array = split_at_corners(pixel_outline_list,
-                                                       fitting_opts,
-                                                       exception);
 
   char_splines.centerline = fitting_opts->centerline;
   char_splines.preserve_width = fitting_opts->preserve_width;
@@ -135,30 +224,57 @@ spline_list_array_type fitted_splines(pixel_outline_list_type pixel_outline_list
   char_splines.width = width;
   char_splines.height = height;
 
-  for (this_list = 0; this_list < CURVE_LIST_ARRAY_LENGTH(curve_array); this_list++) {
+  /* The line width taken from DIST depends on where the outline is,
+     so translated splines would be wrong.  */
+  if (fitting_opts->outline_cache && dist == NULL)
+    outline_cache = g_hash_table_new_full(outline_hash, outline_equal, NULL, free_cached_outline);
+
+  for (this_list = 0; this_list < O_LIST_LENGTH(pixel_outline_list); this_list++) {
     spline_list_type curve_list_splines;
-    curve_list_type curves = CURVE_LIST_ARRAY_ELT(curve_array, this_list);
+    pixel_outline_type *pixel_o = &O_LIST_OUTLINE(pixel_outline_list, this_list);
+    cached_outline_type *cached = NULL;
 
     if (notify_progress)
-      notify_progress((((gfloat) this_list) / ((gfloat) CURVE_LIST_ARRAY_LENGTH(curve_array) * (gfloat) 3.0) + (gfloat) 0.333), progress_data);
+      notify_progress((((gfloat) this_list) / ((gfloat) O_LIST_LENGTH(pixel_outline_list)) * (gfloat) 0.667 + (gfloat) 0.333), progress_data);
     if (test_cancel && test_cancel(testcancel_data))
       goto cleanup;
 
-    LOG("\nFitting curve list #%u:\n", this_list);
+    if (outline_cache && O_LENGTH(*pixel_o) > 0)
+      cached = (cached_outline_type *) g_hash_table_lookup(outline_cache, pixel_o);
 
-    curve_list_splines = fit_curve_list(curves, fitting_opts, dist, exception);
-    if (at_exception_got_fatal(exception)) {
-      if (char_splines.background_color)
-        at_color_free(char_splines.background_color);
-      goto cleanup;
+    if (cached) {
+      LOG("\nReusing splines for curve list #%u.\n", this_list);
+      curve_list_splines = translate_spline_list(cached->splines, cached->origin, O_COORDINATE(*pixel_o, 0));
+    } else {
+      curve_list_type curves;
+
+      LOG("\nFinding corners of curve list #%u:", this_list);
+      curves = split_at_corners(*pixel_o, fitting_opts, exception);
+
+      LOG("\nFitting curve list #%u:\n", this_list);
+      curve_list_splines = fit_curve_list(curves, fitting_opts, dist, exception);
+      free_curve_list(&curves);
+      if (at_exception_got_fatal(exception)) {
+        if (char_splines.background_color)
+          at_color_free(char_splines.background_color);
+        goto cleanup;
+      }
+      curve_list_splines.clockwise = curves.clockwise;
+
+      if (outline_cache && O_LENGTH(*pixel_o) > 0) {
+        XMALLOC(cached, sizeof(cached_outline_type));
+        cached->origin = O_COORDINATE(*pixel_o, 0);
+        cached->splines = translate_spline_list(curve_list_splines, cached->origin, cached->origin);
+        g_hash_table_insert(outline_cache, pixel_o, cached);
+      }
     }
-    curve_list_splines.clockwise = curves.clockwise;
 
-    memcpy(&(curve_list_splines.color), &(O_LIST_OUTLINE(pixel_outline_list, this_list).color), sizeof(at_color));
+    memcpy(&(curve_list_splines.color), &(pixel_o->color), sizeof(at_color));
     append_spline_list(&char_splines, curve_list_splines);
   }
 cleanup:
-  free_curve_list_array(&curve_array, notify_progress, progress_data);
+  if (outline_cache)
+    g_hash_table_destroy(outline_cache);
 
   return char_splines;
 }
@@ -288,6 +404,9 @@ static spline_list_type fit_curve_list(curve_list_type curve_list, fitting_opts_
     }
   }
 
+  if (fitting_opts->merge_threshold > 0.0)
+    merge_splines(&curve_list_splines, fitting_opts, exception);
+
   if (logging) {
     LOG("\nFitted splines are:\n");
     for (this_spline = 0; this_spline < SPLINE_LIST_LENGTH(curve_list_splines); this_spline++) {
@@ -313,6 +432,13 @@ static spline_list_type *fit_curve(curve_type curve, fitting_opts_type * fitting
     return NULL;
   }
 
+  /* Is it a piece of a circle, or a whole circle or ellipse?  */
+  if (fitting_opts->fit_arcs && CURVE_LENGTH(curve) >= ARC_MIN_POINTS) {
+    fittedsplines = fit_with_arc(curve, fitting_opts);
+    if (fittedsplines != NULL)
+      return fittedsplines;
+  }
+
   /* Do we have enough points to fit with a spline?  */
   fittedsplines = CURVE_LENGTH(curve) < 4 ? fit_with_line(curve)
       : fit_with_least_squares(curve, fitting_opts, exception);
@@ -340,112 +466,98 @@ static spline_list_type *fit_curve(curve_type curve, fitting_opts_type * fitting
    from there to the end of the line, probably as a straight line, which
    is certainly not what we want.
 
-   PIXEL_LIST has one element for each closed outline on the character.
-   To preserve this information, we return an array of curve_lists, one
-   element (which in turn consists of several curves, one between each
-   pair of corners) for each element in PIXEL_LIST.  */
+   We are called for one outline of the character at a time, and return
+   its curve_list, which consists of several curves, one between each
+   pair of corners.  */
 
-static curve_list_array_type split_at_corners(pixel_outline_list_type pixel_list, fitting_opts_type * fitting_opts, at_exception_type * exception)
+static curve_list_type split_at_corners(pixel_outline_type pixel_o, fitting_opts_type * fitting_opts, at_exception_type * exception)
 {
-  unsigned this_pixel_o;
-  curve_list_array_type curve_array = new_curve_list_array();
-
-  LOG("\nFinding corners:\n");
-
-  for (this_pixel_o = 0; this_pixel_o < O_LIST_LENGTH(pixel_list); this_pixel_o++) {
-    curve_type curve, first_curve;
-    index_list_type corner_list;
-    unsigned p, this_corner;
-    curve_list_type curve_list = new_curve_list();
-    pixel_outline_type pixel_o = O_LIST_OUTLINE(pixel_list, this_pixel_o);
-
-    CURVE_LIST_CLOCKWISE(curve_list) = O_CLOCKWISE(pixel_o);
-    curve_list.open = pixel_o.open;
-
-    LOG("#%u:", this_pixel_o);
-
-    /* If the outline does not have enough points, we can't do
-       anything.  The endpoints of the outlines are automatically
-       corners.  We need at least `corner_surround' more pixels on
-       either side of a point before it is conceivable that we might
-       want another corner.  */
-    if (O_LENGTH(pixel_o) > fitting_opts->corner_surround * 2 + 2)
+  curve_type curve, first_curve;
+  index_list_type corner_list;
+  unsigned p, this_corner;
+  curve_list_type curve_list = new_curve_list();
+
+  CURVE_LIST_CLOCKWISE(curve_list) = O_CLOCKWISE(pixel_o);
+  curve_list.open = pixel_o.open;
+
+  /* If the outline does not have enough points, we can't do
+     anything.  The endpoints of the outlines are automatically
+     corners.  We need at least `corner_surround' more pixels on
+     either side of a point before it is conceivable that we might
+     want another corner.  */
+  if (O_LENGTH(pixel_o) > fitting_opts->corner_surround * 2 + 2)
+    corner_list = find_corners(pixel_o, fitting_opts, exception);
+
+  else {
+    int surround;
+    if ((surround = (int)(O_LENGTH(pixel_o) - 3) / 2) >= 2) {
+      unsigned save_corner_surround = fitting_opts->corner_surround;
+      fitting_opts->corner_surround = surround;
       corner_list = find_corners(pixel_o, fitting_opts, exception);
-
-    else {
-      int surround;
-      if ((surround = (int)(O_LENGTH(pixel_o) - 3) / 2) >= 2) {
-        unsigned save_corner_surround = fitting_opts->corner_surround;
-        fitting_opts->corner_surround = surround;
-        corner_list = find_corners(pixel_o, fitting_opts, exception);
-        fitting_opts->corner_surround = save_corner_surround;
-      } else {
-        corner_list.length = 0;
-        corner_list.data = NULL;
-      }
+      fitting_opts->corner_surround = save_corner_surround;
+    } else {
+      corner_list.length = 0;
+      corner_list.data = NULL;
     }
+  }
 
-    /* Remember the first curve so we can make it be the `next' of the
-       last one.  (And vice versa.)  */
-    first_curve = new_curve();
-
-    curve = first_curve;
+  /* Remember the first curve so we can make it be the `next' of the
+     last one.  (And vice versa.)  */
+  first_curve = new_curve();
 
-    if (corner_list.length == 0) {  /* No corners.  Use all of the pixel outline as the curve.  */
-      for (p = 0; p < O_LENGTH(pixel_o); p++)
-        append_pixel(curve, O_COORDINATE(pixel_o, p));
+  curve = first_curve;
 
-      if (curve_list.open == TRUE)
-        CURVE_CYCLIC(curve) = FALSE;
-      else
-        CURVE_CYCLIC(curve) = TRUE;
-    } else {                    /* Each curve consists of the points between (inclusive) each pair
-                                   of corners.  */
-      for (this_corner = 0; this_corner < corner_list.length - 1; this_corner++) {
-        curve_type previous_curve = curve;
-        unsigned corner = GET_INDEX(corner_list, this_corner);
-        unsigned next_corner = GET_INDEX(corner_list, this_corner + 1);
-
-        for (p = corner; p <= next_corner; p++)
-          append_pixel(curve, O_COORDINATE(pixel_o, p));
-
-        append_curve(&curve_list, curve);
-        curve = new_curve();
-        NEXT_CURVE(previous_curve) = curve;
-        PREVIOUS_CURVE(curve) = previous_curve;
-      }
+  if (corner_list.length == 0) {  /* No corners.  Use all of the pixel outline as the curve.  */
+    for (p = 0; p < O_LENGTH(pixel_o); p++)
+      append_pixel(curve, O_COORDINATE(pixel_o, p));
 
-      /* The last curve is different.  It consists of the points
-         (inclusive) between the last corner and the end of the list,
-         and the beginning of the list and the first corner.  */
-      for (p = GET_LAST_INDEX(corner_list); p < O_LENGTH(pixel_o); p++)
+    if (curve_list.open == TRUE)
+      CURVE_CYCLIC(curve) = FALSE;
+    else
+      CURVE_CYCLIC(curve) = TRUE;
+  } else {                    /* Each curve consists of the points between (inclusive) each pair
+                                 of corners.  */
+    for (this_corner = 0; this_corner < corner_list.length - 1; this_corner++) {
+      curve_type previous_curve = curve;
+      unsigned corner = GET_INDEX(corner_list, this_corner);
+      unsigned next_corner = GET_INDEX(corner_list, this_corner + 1);
+
+      for (p = corner; p <= next_corner; p++)
         append_pixel(curve, O_COORDINATE(pixel_o, p));
 
-      if (!pixel_o.open) {
-        for (p = 0; p <= GET_INDEX(corner_list, 0); p++)
-          append_pixel(curve, O_COORDINATE(pixel_o, p));
-      } else {
-        curve_type last_curve = PREVIOUS_CURVE(curve);
-        PREVIOUS_CURVE(first_curve) = NULL;
-        if (last_curve)
-          NEXT_CURVE(last_curve) = NULL;
-      }
+      append_curve(&curve_list, curve);
+      curve = new_curve();
+      NEXT_CURVE(previous_curve) = curve;
+      PREVIOUS_CURVE(curve) = previous_curve;
     }
 
-    LOG(" [%u].\n", corner_list.length);
-    free_index_list(&corner_list);
+    /* The last curve is different.  It consists of the points
+       (inclusive) between the last corner and the end of the list,
+       and the beginning of the list and the first corner.  */
+    for (p = GET_LAST_INDEX(corner_list); p < O_LENGTH(pixel_o); p++)
+      append_pixel(curve, O_COORDINATE(pixel_o, p));
+
+    if (!pixel_o.open) {
+      for (p = 0; p <= GET_INDEX(corner_list, 0); p++)
+        append_pixel(curve, O_COORDINATE(pixel_o, p));
+    } else {
+      curve_type last_curve = PREVIOUS_CURVE(curve);
+      PREVIOUS_CURVE(first_curve) = NULL;
+      if (last_curve)
+        NEXT_CURVE(last_curve) = NULL;
+    }
+  }
 
-    /* Add `curve' to the end of the list, updating the pointers in
-       the chain.  */
-    append_curve(&curve_list, curve);
-    NEXT_CURVE(curve) = first_curve;
-    PREVIOUS_CURVE(first_curve) = curve;
+  LOG(" [%u].\n", corner_list.length);
+  free_index_list(&corner_list);
 
-    /* And now add the just-completed curve list to the array.  */
-    append_curve_list(&curve_array, curve_list);
-  }                             /* End of considering each pixel outline.  */
+  /* Add `curve' to the end of the list, updating the pointers in
+     the chain.  */
+  append_curve(&curve_list, curve);
+  NEXT_CURVE(curve) = first_curve;
+  PREVIOUS_CURVE(first_curve) = curve;
 
-  return curve_array;
+  return curve_list;
 }
 
 /* We consider a point to be a corner if (1) the angle defined by the
@@ -875,6 +987,388 @@ static spline_list_type *fit_with_line(curve_type curve)
   return new_spline_list_with_spline(line);
 }
 
+/* Drawings are full of circles and pieces of circles, and text and
+   drawings of dots, rings and ellipses.  The writers for formats that
+   know arcs can write each of these as a single primitive, instead of
+   the four to eight cubics it usually takes.  So, if asked to, we try
+   to fit a curve between two corners with an arc of the circle through
+   its end points, and a curve without any corners, that is, a whole
+   outline, with a circle or an ellipse.  The fit must be within
+   `error_threshold' everywhere, and turn the same way all along.  */
+
+static spline_list_type *fit_with_arc(curve_type curve, fitting_opts_type * fitting_opts)
+{
+  unsigned this_point, length = CURVE_LENGTH(curve);
+  at_real_coord start = CURVE_POINT(curve, 0), end = LAST_CURVE_POINT(curve);
+  gboolean closed = CURVE_CYCLIC(curve);
+  double cx, cy, r, sweep;
+  double u[2], w[2];
+  spline_list_type *arc;
+
+  LOG("\nFitting with arc:\n");
+
+  /* The cyclic curve ends with its first point again.  */
+  if (closed)
+    length--;
+
+  /* We don't know how to change the line width along an arc.  */
+  for (this_point = 0; this_point < length; this_point++)
+    if (CURVE_POINT(curve, this_point).z != 0.0)
+      return NULL;
+
+  if (closed) {
+    if (!fit_circle(curve, length, &cx, &cy, &r))
+      r = 0.0;
+  } else {
+    /* The center of a circle through the end points is on the
+       perpendicular bisector of the chord between them, at the
+       distance S times the chord length from the chord.  Find S
+       minimizing the sum of the squared differences of the squared
+       distances of the points from the center and from START.  */
+    double dx = end.x - start.x, dy = end.y - start.y;
+    double chord = sqrt(SQUARE(dx) + SQUARE(dy));
+    double num = 0.0, den = 0.0, sagitta = 0.0;
+
+    if (chord == 0.0)
+      return NULL;
+
+    for (this_point = 1; this_point + 1 < length; this_point++) {
+      double px = CURVE_POINT(curve, this_point).x - start.x;
+      double py = CURVE_POINT(curve, this_point).y - start.y;
+      double b = SQUARE(px) + SQUARE(py) - (px * dx + py * dy);
+      double g = 2.0 * (py * dx - px * dy);
+
+      num += b * g;
+      den += g * g;
+      sagitta = MAX(sagitta, fabs(g) / (2.0 * chord));
+    }
+
+    /* A straight line is better done with a line.  */
+    if (sagitta <= fitting_opts->line_threshold || den == 0.0) {
+      LOG("  Too straight for an arc.\n");
+      return NULL;
+    }
+
+    cx = start.x + dx / 2.0 - num / den * dy;
+    cy = start.y + dy / 2.0 + num / den * dx;
+    r = sqrt(SQUARE(cx - start.x) + SQUARE(cy - start.y));
+  }
+
+  if (r > 0.0) {
+    gboolean fits = arc_sweep(curve, cx, cy, fitting_opts->error_threshold / r, &sweep);
+
+    for (this_point = 0; fits && this_point < length; this_point++) {
+      at_real_coord p = CURVE_POINT(curve, this_point);
+      if (fabs(sqrt(SQUARE(p.x - cx) + SQUARE(p.y - cy)) - r) > fitting_opts->error_threshold)
+        fits = FALSE;
+    }
+    if (closed ? fabs(fabs(sweep) - 2.0 * M_PI) > M_PI / 2.0 : fabs(sweep) >= 2.0 * M_PI)
+      fits = FALSE;
+
+    if (fits) {
+      LOG("  Fitted to circle (%.3f,%.3f) of radius %.3f, turning by %.3f degrees.\n", cx, cy, r, sweep * 180.0 / M_PI);
+      u[0] = w[1] = r;
+      u[1] = w[0] = 0.0;
+      if (closed)
+        sweep = sweep > 0.0 ? 2.0 * M_PI : -2.0 * M_PI;
+      arc = arc_splines(cx, cy, u, w, atan2(start.y - cy, start.x - cx), sweep, CIRCLETYPE);
+
+      /* Make sure we end exactly where we should.  */
+      if (closed)
+        END_POINT(LAST_SPLINE_LIST_ELT(*arc)) = START_POINT(SPLINE_LIST_ELT(*arc, 0));
+      else {
+        START_POINT(SPLINE_LIST_ELT(*arc, 0)) = start;
+        END_POINT(LAST_SPLINE_LIST_ELT(*arc)) = end;
+      }
+      return arc;
+    }
+  }
+
+  if (closed && fit_ellipse(curve, length, fitting_opts->error_threshold, &cx, &cy, u, w)
+      && arc_sweep(curve, cx, cy, fitting_opts->error_threshold / sqrt(SQUARE(w[0]) + SQUARE(w[1])), &sweep)
+      && fabs(fabs(sweep) - 2.0 * M_PI) <= M_PI / 2.0) {
+    LOG("  Fitted to ellipse (%.3f,%.3f) with semi-axes (%.3f,%.3f) and (%.3f,%.3f).\n", cx, cy, u[0], u[1], w[0], w[1]);
+
+    /* Start at the end of the longer semi-axis, so that each piece of
+       the ellipse goes from the end of one semi-axis to the next.  */
+    arc = arc_splines(cx, cy, u, w, 0.0, sweep > 0.0 ? 2.0 * M_PI : -2.0 * M_PI, ELLIPSETYPE);
+    END_POINT(LAST_SPLINE_LIST_ELT(*arc)) = START_POINT(SPLINE_LIST_ELT(*arc, 0));
+    return arc;
+  }
+
+  LOG("  No circle or ellipse is close enough.\n");
+  return NULL;
+}
+
+/* Fit a circle to the first LENGTH points of CURVE, minimizing the
+   squared differences of the squared distances of the points from the
+   center and of the squared radius.  (This is the ``algebraic'' fit of
+   Kasa, which is not the best one, but a linear problem.)  */
+
+static gboolean fit_circle(curve_type curve, unsigned length, double *cx, double *cy, double *r)
+{
+  unsigned this_point;
+  double mx = 0.0, my = 0.0, r2;
+  double m[3 * 3], v[3];
+
+  for (this_point = 0; this_point < length; this_point++) {
+    mx += CURVE_POINT(curve, this_point).x;
+    my += CURVE_POINT(curve, this_point).y;
+  }
+  mx /= length;
+  my /= length;
+
+  /* Find D, E and F of the circle x^2 + y^2 + D x + E y + F = 0, with
+     the origin moved to the centroid of the points.  */
+  memset(m, 0, sizeof(m));
+  memset(v, 0, sizeof(v));
+  for (this_point = 0; this_point < length; this_point++) {
+    double x = CURVE_POINT(curve, this_point).x - mx;
+    double y = CURVE_POINT(curve, this_point).y - my;
+    double z = SQUARE(x) + SQUARE(y);
+
+    m[0] += x * x;
+    m[1] += x * y;
+    m[4] += y * y;
+    v[0] -= x * z;
+    v[1] -= y * z;
+    v[2] -= z;
+  }
+  m[3] = m[1];
+  m[8] = length;
+
+  if (!solve_linear_system(m, v, 3))
+    return FALSE;
+
+  r2 = (SQUARE(v[0]) + SQUARE(v[1])) / 4.0 - v[2];
+  if (r2 <= 0.0)
+    return FALSE;
+
+  *cx = mx - v[0] / 2.0;
+  *cy = my - v[1] / 2.0;
+  *r = sqrt(r2);
+  return TRUE;
+}
+
+/* Fit an ellipse to the first LENGTH points of CURVE, again with an
+   algebraic fit.  Unlike with circles, we check the distances of the
+   points from it here, estimating them as the value of the quadratic
+   over the length of its gradient.  Return the center in *CX and *CY,
+   and the longer and the shorter semi-axis, counterclockwise from it,
+   in U and W.  */
+
+static gboolean fit_ellipse(curve_type curve, unsigned length, gfloat error_threshold, double *cx, double *cy, double u[2], double w[2])
+{
+  unsigned this_point, i, j;
+  double mx = 0.0, my = 0.0, scale = 0.0;
+  double m[5 * 5], v[5];
+  double a = 1.0, b, c, d, e, f, det, x0, y0, f0, theta, ct, st, a2, c2, ru, rw;
+
+  for (this_point = 0; this_point < length; this_point++) {
+    mx += CURVE_POINT(curve, this_point).x;
+    my += CURVE_POINT(curve, this_point).y;
+  }
+  mx /= length;
+  my /= length;
+  for (this_point = 0; this_point < length; this_point++)
+    scale += SQUARE(CURVE_POINT(curve, this_point).x - mx) + SQUARE(CURVE_POINT(curve, this_point).y - my);
+  scale = sqrt(scale / length);
+  if (scale == 0.0)
+    return FALSE;
+
+  /* Find B, C, D, E and F of the conic x^2 + B x y + C y^2 + D x + E y
+     + F = 0, with the points moved to the centroid and scaled to a
+     mean distance of one, to keep the equations well conditioned.  */
+  memset(m, 0, sizeof(m));
+  memset(v, 0, sizeof(v));
+  for (this_point = 0; this_point < length; this_point++) {
+    double x = (CURVE_POINT(curve, this_point).x - mx) / scale;
+    double y = (CURVE_POINT(curve, this_point).y - my) / scale;
+    double row[5];
+
+    row[0] = x * y;
+    row[1] = y * y;
+    row[2] = x;
+    row[3] = y;
+    row[4] = 1.0;
+    for (i = 0; i < 5; i++) {
+      for (j = 0; j < 5; j++)
+        m[i * 5 + j] += row[i] * row[j];
+      v[i] -= row[i] * x * x;
+    }
+  }
+
+  if (!solve_linear_system(m, v, 5))
+    return FALSE;
+  b = v[0];
+  c = v[1];
+  d = v[2];
+  e = v[3];
+  f = v[4];
+
+  det = 4.0 * a * c - SQUARE(b);
+  if (det <= 0.0)
+    return FALSE;
+  x0 = (b * e - 2.0 * c * d) / det;
+  y0 = (b * d - 2.0 * a * e) / det;
+  f0 = f + (d * x0 + e * y0) / 2.0;
+
+  theta = atan2(b, a - c) / 2.0;
+  ct = cos(theta);
+  st = sin(theta);
+  a2 = a * SQUARE(ct) + b * ct * st + c * SQUARE(st);
+  c2 = a * SQUARE(st) - b * ct * st + c * SQUARE(ct);
+  if (f0 >= 0.0 || a2 <= 0.0 || c2 <= 0.0)
+    return FALSE;
+
+  for (this_point = 0; this_point < length; this_point++) {
+    double x = (CURVE_POINT(curve, this_point).x - mx) / scale;
+    double y = (CURVE_POINT(curve, this_point).y - my) / scale;
+    double q = a * x * x + b * x * y + c * y * y + d * x + e * y + f;
+    double gx = 2.0 * a * x + b * y + d, gy = b * x + 2.0 * c * y + e;
+    double gradient = sqrt(SQUARE(gx) + SQUARE(gy));
+
+    if (gradient == 0.0 || fabs(q) / gradient * scale > error_threshold)
+      return FALSE;
+  }
+
+  ru = sqrt(-f0 / a2) * scale;
+  rw = sqrt(-f0 / c2) * scale;
+  if (rw > ru) {
+    double t = ru;
+    ru = rw;
+    rw = t;
+    theta += M_PI / 2.0;
+    ct = cos(theta);
+    st = sin(theta);
+  }
+
+  *cx = mx + x0 * scale;
+  *cy = my + y0 * scale;
+  u[0] = ru * ct;
+  u[1] = ru * st;
+  w[0] = -rw * st;
+  w[1] = rw * ct;
+  return TRUE;
+}
+
+/* Find in *SWEEP how far CURVE turns around (CX, CY), in radians,
+   counterclockwise.  Return whether it keeps turning the same way,
+   that is, it never turns back by more than TOLERANCE in all.  */
+
+static gboolean arc_sweep(curve_type curve, double cx, double cy, double tolerance, double *sweep)
+{
+  unsigned this_point;
+  double forward = 0.0, backward = 0.0;
+  double previous = atan2(CURVE_POINT(curve, 0).y - cy, CURVE_POINT(curve, 0).x - cx);
+
+  for (this_point = 1; this_point < CURVE_LENGTH(curve); this_point++) {
+    double theta = atan2(CURVE_POINT(curve, this_point).y - cy, CURVE_POINT(curve, this_point).x - cx);
+    double turn = theta - previous;
+
+    if (turn > M_PI)
+      turn -= 2.0 * M_PI;
+    else if (turn <= -M_PI)
+      turn += 2.0 * M_PI;
+    if (turn > 0.0)
+      forward += turn;
+    else
+      backward -= turn;
+    previous = theta;
+  }
+
+  *sweep = forward - backward;
+  return MIN(forward, backward) <= tolerance;
+}
+
+/* Return the pieces, turning by a quarter at most, of the ellipse
+   (CX, CY) + U cos t + W sin t from t = START to START + SWEEP, as
+   splines of the given DEGREE.  */
+
+static spline_list_type *arc_splines(double cx, double cy, const double u[2], const double w[2], double start, double sweep, polynomial_degree degree)
+{
+  unsigned this_piece, pieces = (unsigned)ceil(fabs(sweep) / (M_PI / 2.0) - 1e-6);
+  double step, k;
+  spline_list_type *arc = new_spline_list();
+
+  if (pieces == 0)
+    pieces = 1;
+  step = sweep / pieces;
+  k = 4.0 / 3.0 * tan(step / 4.0);
+
+  for (this_piece = 0; this_piece < pieces; this_piece++) {
+    double t0 = start + this_piece * step, t1 = t0 + step;
+    double c0 = cos(t0), s0 = sin(t0), c1 = cos(t1), s1 = sin(t1);
+    spline_type piece;
+
+    START_POINT(piece).x = (gfloat) (cx + u[0] * c0 + w[0] * s0);
+    START_POINT(piece).y = (gfloat) (cy + u[1] * c0 + w[1] * s0);
+    CONTROL1(piece).x = (gfloat) (START_POINT(piece).x + k * (w[0] * c0 - u[0] * s0));
+    CONTROL1(piece).y = (gfloat) (START_POINT(piece).y + k * (w[1] * c0 - u[1] * s0));
+    END_POINT(piece).x = (gfloat) (cx + u[0] * c1 + w[0] * s1);
+    END_POINT(piece).y = (gfloat) (cy + u[1] * c1 + w[1] * s1);
+    CONTROL2(piece).x = (gfloat) (END_POINT(piece).x - k * (w[0] * c1 - u[0] * s1));
+    CONTROL2(piece).y = (gfloat) (END_POINT(piece).y - k * (w[1] * c1 - u[1] * s1));
+    START_POINT(piece).z = CONTROL1(piece).z = CONTROL2(piece).z = END_POINT(piece).z = 0.0;
+    SPLINE_DEGREE(piece) = degree;
+    SPLINE_LINEARITY(piece) = 0;
+
+    if (logging) {
+      LOG("  ");
+      print_spline(piece);
+    }
+    append_spline(arc, piece);
+  }
+
+  return arc;
+}
+
+/* Solve the N linear equations with the matrix A (by rows) and the
+   right-hand side B by Gaussian elimination with partial pivoting.
+   Return the solution in B, or FALSE if A is singular.  A is changed.  */
+
+static gboolean solve_linear_system(double *a, double *b, unsigned n)
+{
+  unsigned row, col, k;
+
+  for (col = 0; col < n; col++) {
+    unsigned pivot = col;
+
+    for (row = col + 1; row < n; row++)
+      if (fabs(a[row * n + col]) > fabs(a[pivot * n + col]))
+        pivot = row;
+    if (fabs(a[pivot * n + col]) < 1e-12)
+      return FALSE;
+
+    if (pivot != col) {
+      double t;
+      for (k = 0; k < n; k++) {
+        t = a[col * n + k];
+        a[col * n + k] = a[pivot * n + k];
+        a[pivot * n + k] = t;
+      }
+      t = b[col];
+      b[col] = b[pivot];
+      b[pivot] = t;
+    }
+
+    for (row = col + 1; row < n; row++) {
+      double factor = a[row * n + col] / a[col * n + col];
+      for (k = col; k < n; k++)
+        a[row * n + k] -= factor * a[col * n + k];
+      b[row] -= factor * b[col];
+    }
+  }
+
+  for (row = n; row-- > 0;) {
+    for (k = row + 1; k < n; k++)
+      b[row] -= a[row * n + k] * b[k];
+    b[row] /= a[row * n + row];
+  }
+
+  return TRUE;
+}
+
 /* The least squares method is well described in Schneider's thesis.
    Briefly, we try to fit the entire curve with one spline. If that
    fails, we subdivide the curve.  */
@@ -925,7 +1419,10 @@ static spline_list_type *fit_with_least_squares(curve_type curve, fitting_opts_t
     if (SPLINE_DEGREE(spline) == LINEARTYPE)
       break;
 
-    error = find_error(curve, spline, &worst_point, exception);
+    if (fitting_opts->fast_reject)
+      error = find_error_bounded(curve, spline, fitting_opts->error_threshold, &worst_point);
+    else
+      error = find_error(curve, spline, &worst_point, exception);
     if (error <= previous_error) {
       best_error = error;
       best_spline = spline;
@@ -1292,6 +1789,77 @@ static gfloat find_error(curve_type curve, spline_type spline, unsigned *worst_p
   return worst_error;
 }
 
+/* Like `find_error', but only as exact as the decision in
+   `fit_with_least_squares' needs it to be.  The spline lies inside the
+   bounding box of its control points, so no point can be closer to it
+   than to that box.  If some point is farther than THRESHOLD from the
+   box, the fit is rejected without evaluating the spline at all, and
+   that point becomes WORST_POINT.  Otherwise we evaluate the spline
+   comparing squared distances, and once a point exceeds THRESHOLD we
+   only follow the error uphill to its local maximum before giving up.
+   Fits that are accepted have been checked at every point.  */
+
+static gfloat find_error_bounded(curve_type curve, spline_type spline, gfloat threshold, unsigned *worst_point)
+{
+  unsigned this_point, i;
+  at_real_coord lo = START_POINT(spline), hi = START_POINT(spline);
+  gfloat threshold_sq = SQUARE(threshold);
+  gfloat worst_error = 0.0;
+
+  *worst_point = 0;
+
+  for (i = 1; i < 4; i++) {
+    lo.x = MIN(lo.x, spline.v[i].x);
+    lo.y = MIN(lo.y, spline.v[i].y);
+    lo.z = MIN(lo.z, spline.v[i].z);
+    hi.x = MAX(hi.x, spline.v[i].x);
+    hi.y = MAX(hi.y, spline.v[i].y);
+    hi.z = MAX(hi.z, spline.v[i].z);
+  }
+
+  for (this_point = 0; this_point < CURVE_LENGTH(curve); this_point++) {
+    at_real_coord p = CURVE_POINT(curve, this_point);
+    gfloat dx = p.x < lo.x ? lo.x - p.x : (p.x > hi.x ? p.x - hi.x : 0);
+    gfloat dy = p.y < lo.y ? lo.y - p.y : (p.y > hi.y ? p.y - hi.y : 0);
+    gfloat dz = p.z < lo.z ? lo.z - p.z : (p.z > hi.z ? p.z - hi.z : 0);
+    gfloat bound = SQUARE(dx) + SQUARE(dy) + SQUARE(dz);
+    if (bound >= worst_error) {
+      *worst_point = this_point;
+      worst_error = bound;
+    }
+  }
+
+  if (worst_error > threshold_sq) {
+    LOG("  Rejected by control hull, point #%u is %.3f away.\n", *worst_point, sqrt(worst_error));
+    return (gfloat) sqrt(worst_error);
+  }
+
+  worst_error = 0.0;
+  *worst_point = 0;
+  for (this_point = 0; this_point < CURVE_LENGTH(curve); this_point++) {
+    at_real_coord p = CURVE_POINT(curve, this_point);
+    gfloat t = CURVE_T(curve, this_point);
+    gfloat b0 = B0(t), b1 = B1(t), b2 = B2(t), b3 = B3(t);
+    gfloat dx = p.x - (b0 * spline.v[0].x + b1 * spline.v[1].x + b2 * spline.v[2].x + b3 * spline.v[3].x);
+    gfloat dy = p.y - (b0 * spline.v[0].y + b1 * spline.v[1].y + b2 * spline.v[2].y + b3 * spline.v[3].y);
+    gfloat dz = p.z - (b0 * spline.v[0].z + b1 * spline.v[1].z + b2 * spline.v[2].z + b3 * spline.v[3].z);
+    gfloat this_error = SQUARE(dx) + SQUARE(dy) + SQUARE(dz);
+
+    if (this_error >= worst_error) {
+      *worst_point = this_point;
+      worst_error = this_error;
+    } else if (worst_error > threshold_sq)
+      break;
+  }
+
+  if (worst_error > threshold_sq)
+    LOG("  Rejected at point #%u, error %.3f.\n", *worst_point, sqrt(worst_error));
+  else
+    LOG("  Worst error (point #%u) was %.3f.\n", *worst_point, sqrt(worst_error));
+
+  return (gfloat) sqrt(worst_error);
+}
+
 /* Supposing that we have accepted the error, another question arises:
    would we be better off just using a straight line?  */
 
@@ -1392,6 +1960,170 @@ static void change_bad_lines(spline_list_type * spline_list, fitting_opts_type *
     LOG("  No lines.\n");
 }
 
+/* The splines fitted to a curve list often come in runs that a single
+   spline would do as well: short collinear lines, and cubics split at
+   a subdivision point where one piece was just over `error_threshold'.
+   If asked to, we merge each such run into one spline, as long as it
+   stays within `merge_threshold' of every spline of the run.  Cubics
+   are only merged where they meet smoothly, so we never round off a
+   corner.  */
+
+/* How many points of each spline we look at when refitting.  */
+#define MERGE_SAMPLES 8
+
+static void merge_splines(spline_list_type * spline_list, fitting_opts_type * fitting_opts, at_exception_type * exception)
+{
+  unsigned this_spline, first = 0, merged = 0;
+  unsigned length = SPLINE_LIST_LENGTH(*spline_list);
+  spline_type *result;
+
+  if (length < 2)
+    return;
+
+  LOG("\nMerging splines (length %u):\n", length);
+
+  XMALLOC(result, length * sizeof(spline_type));
+  result[0] = SPLINE_LIST_ELT(*spline_list, 0);
+
+  /* RESULT[MERGED] stands for the splines FIRST through THIS_SPLINE - 1
+     of SPLINE_LIST; see if THIS_SPLINE can join them.  */
+  for (this_spline = 1; this_spline < length; this_spline++) {
+    spline_type prev = SPLINE_LIST_ELT(*spline_list, this_spline - 1);
+    spline_type s = SPLINE_LIST_ELT(*spline_list, this_spline);
+    gboolean joined = FALSE;
+
+    if (SPLINE_DEGREE(s) == LINEARTYPE && SPLINE_DEGREE(result[merged]) == LINEARTYPE)
+      joined = merge_lines(*spline_list, first, this_spline, fitting_opts->merge_threshold, &result[merged]);
+    else if (SPLINE_DEGREE(s) == CUBICTYPE && SPLINE_DEGREE(result[merged]) == CUBICTYPE) {
+      /* Measure the angle at the joint the way `find_corners' does,
+         with both vectors pointing away from it.  */
+      vector_type in = Vmult_scalar(spline_tangent(prev, FALSE), -1.0);
+      vector_type out = spline_tangent(s, TRUE);
+
+      if (magnitude(in) > 0.0 && magnitude(out) > 0.0) {
+        gfloat joint_angle = Vangle(in, out, exception);
+        if (at_exception_got_fatal(exception))
+          break;
+        if (fabs(joint_angle) > fitting_opts->corner_threshold)
+          joined = merge_cubics(*spline_list, first, this_spline, fitting_opts->merge_threshold, &result[merged], exception);
+      }
+    }
+
+    if (joined)
+      LOG("  #%u merged into #%u.\n", this_spline, first);
+    else {
+      result[++merged] = s;
+      first = this_spline;
+    }
+  }
+  if (at_exception_got_fatal(exception)) {
+    free(result);
+    return;
+  }
+  merged++;
+
+  LOG("  %u splines left.\n", merged);
+
+  free(SPLINE_LIST_DATA(*spline_list));
+  SPLINE_LIST_DATA(*spline_list) = result;
+  SPLINE_LIST_LENGTH(*spline_list) = merged;
+}
+
+/* Replace the lines FIRST through LAST of SPLINE_LIST by the single
+   line *MERGED, if none of their ends is more than THRESHOLD away from
+   it and all of them go its way.  */
+
+static gboolean merge_lines(spline_list_type spline_list, unsigned first, unsigned last, gfloat threshold, spline_type * merged)
+{
+  unsigned this_spline;
+  at_real_coord start = START_POINT(SPLINE_LIST_ELT(spline_list, first));
+  at_real_coord end = END_POINT(SPLINE_LIST_ELT(spline_list, last));
+  vector_type chord = Psubtract(end, start);
+  gfloat chord_length = magnitude(chord);
+
+  if (chord_length == 0.0)
+    return FALSE;
+  chord = Vmult_scalar(chord, (gfloat) 1.0 / chord_length);
+
+  for (this_spline = first; this_spline <= last; this_spline++) {
+    spline_type s = SPLINE_LIST_ELT(spline_list, this_spline);
+    vector_type v = Psubtract(END_POINT(s), start);
+
+    if (Vdot(Psubtract(END_POINT(s), START_POINT(s)), chord) <= 0.0)
+      return FALSE;
+    if (magnitude(Vadd(v, Vmult_scalar(chord, -Vdot(v, chord)))) > threshold)
+      return FALSE;
+  }
+
+  SPLINE_DEGREE(*merged) = LINEARTYPE;
+  START_POINT(*merged) = CONTROL1(*merged) = start;
+  END_POINT(*merged) = CONTROL2(*merged) = end;
+  SPLINE_LINEARITY(*merged) = 0;
+
+  return TRUE;
+}
+
+/* Fit a single cubic *MERGED to points sampled from the cubics FIRST
+   through LAST of SPLINE_LIST, keeping the tangents at both ends, and
+   return whether it stays within THRESHOLD of them.  */
+
+static gboolean merge_cubics(spline_list_type spline_list, unsigned first, unsigned last, gfloat threshold, spline_type * merged, at_exception_type * exception)
+{
+  unsigned this_spline, sample, worst_point;
+  gfloat error, linearity = 0.0;
+  spline_type fitted;
+  curve_type curve = new_curve();
+
+  for (this_spline = first; this_spline <= last; this_spline++) {
+    spline_type s = SPLINE_LIST_ELT(spline_list, this_spline);
+
+    for (sample = 0; sample < MERGE_SAMPLES; sample++)
+      append_point(curve, evaluate_spline(s, (gfloat) sample / MERGE_SAMPLES));
+    if (SPLINE_LINEARITY(s) > linearity)
+      linearity = SPLINE_LINEARITY(s);
+  }
+  append_point(curve, END_POINT(SPLINE_LIST_ELT(spline_list, last)));
+
+  XMALLOC(CURVE_START_TANGENT(curve), sizeof(vector_type));
+  XMALLOC(CURVE_END_TANGENT(curve), sizeof(vector_type));
+  *CURVE_START_TANGENT(curve) = spline_tangent(SPLINE_LIST_ELT(spline_list, first), TRUE);
+  *CURVE_END_TANGENT(curve) = spline_tangent(SPLINE_LIST_ELT(spline_list, last), FALSE);
+
+  set_initial_parameter_values(curve);
+  fitted = fit_one_spline(curve, exception);
+  error = find_error_bounded(curve, fitted, threshold, &worst_point);
+
+  free_curve(curve);
+  free(curve);
+
+  if (error > threshold)
+    return FALSE;
+
+  SPLINE_LINEARITY(fitted) = linearity;
+  *merged = fitted;
+  return TRUE;
+}
+
+/* The direction of the cubic S at its start point, if START, else at
+   its end point, both in the direction of travel.  */
+
+static vector_type spline_tangent(spline_type s, gboolean start)
+{
+  vector_type tangent;
+
+  if (start) {
+    tangent = Psubtract(CONTROL1(s), START_POINT(s));
+    if (magnitude(tangent) == 0.0)
+      tangent = Psubtract(CONTROL2(s), START_POINT(s));
+  } else {
+    tangent = Psubtract(END_POINT(s), CONTROL2(s));
+    if (magnitude(tangent) == 0.0)
+      tangent = Psubtract(END_POINT(s), CONTROL1(s));
+  }
+
+  return tangent;
+}
+
 /* Lists of array indices (well, that is what we use it for).  */
 
 static index_list_type new_index_list(void)
@@ -6,9 +6,14 @@
 
 #include <assert.h>
 #include <math.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 #include "xstd.h"
 #include "logreport.h"
 #include "image-proc.h"
+#include "parallel.h"
+#include "pixel.h"
 
 #define BLACK 0
 #define WHITE 0xff
@@ -31,58 +36,131 @@ static gboolean get_edge(bitmap_type, int y, int x, struct etyp *t);
 static void check(int v1, int v2, int v3, struct etyp *t);
 #endif
 
+/* Distance of a point that cannot reach any target point.  */
+#define FAR_DISTANCE 1.0e10F
+
+/* Allocate the rows of a W by H distance map, and of its weights if
+   WEIGHTED, in one block each.  */
+
+static void alloc_distance_map(at_distance_map * dist, unsigned w, unsigned h, gboolean weighted)
+{
+  unsigned y;
+
+  dist->height = h;
+  dist->width = w;
+  XMALLOC(dist->d, MAX(h, 1) * sizeof(float *));
+  XMALLOC(dist->d[0], MAX(w * h, 1) * sizeof(float));
+  for (y = 1; y < h; y++)
+    dist->d[y] = dist->d[0] + y * w;
+
+  if (!weighted) {
+    dist->weight = NULL;
+    return;
+  }
+  XMALLOC(dist->weight, MAX(h, 1) * sizeof(float *));
+  XMALLOC(dist->weight[0], MAX(w * h, 1) * sizeof(float));
+  for (y = 1; y < h; y++)
+    dist->weight[y] = dist->weight[0] + y * w;
+}
+
+/* Set up the distances and weights of the rows of a chamfer map;
+   rows are independent, so they are split between threads.  */
+
+typedef struct {
+  at_distance_map *dist;
+  unsigned char *bits;
+  unsigned planes;
+  unsigned char target_value;
+} chamfer_job;
+
+static void chamfer_rows(unsigned first, unsigned last, gpointer data)
+{
+  chamfer_job *job = (chamfer_job *) data;
+  unsigned w = job->dist->width;
+  unsigned x, y;
+  unsigned char *grays = NULL;
+
+  if (job->planes == 3)
+    XMALLOC(grays, MAX(w, 1));
+  for (y = first; y < last; y++) {
+    unsigned char *b = job->bits + y * w * job->planes;
+    float *d = job->dist->d[y], *weight = job->dist->weight[y];
+
+    if (grays) {
+      pixel_kernels()->rgb_to_gray(grays, b, w);
+      b = grays;
+    }
+    for (x = 0; x < w; x++) {
+      int gray = b[x];
+      float fgray;
+      d[x] = (gray == job->target_value ? 0.0F : FAR_DISTANCE);
+      fgray = gray * 0.0039215686F; /* = gray / 255.0F */
+      weight[x] = 1.0F - fgray;
+/*      weight[x] = 1.0F - (fgray * fgray);*/
+/*      weight[x] = (fgray < 0.5F ? 1.0F - fgray : -2.0F * fgray * (fgray - 1.0F));*/
+    }
+  }
+  free(grays);
+}
+
+#define CHAMFER_MIN(a, b) ((b) < (a) ? (b) : (a))
+
+/* Lower D, a row of W points with weights WEIGHT, to the distances
+   through the row NEXT to it (the row above in the forward scan, the
+   one below in the backward scan).  No point depends on another point
+   of D here, so four of them are done at once where SSE is there.  */
+static void chamfer_across(float *d, const float *next, const float *weight, unsigned w)
+{
+  unsigned x = 1;
+
+  if (w < 2)
+    return;
+  d[0] = CHAMFER_MIN(d[0], next[0] + weight[0]);
+  d[0] = CHAMFER_MIN(d[0], next[1] + (float)M_SQRT2 * weight[0]);
+#ifdef __SSE__
+  {
+    __m128 sqrt2 = _mm_set1_ps((float)M_SQRT2);
+
+    for (; x + 4 < w; x += 4) {
+      __m128 wt = _mm_loadu_ps(weight + x);
+      __m128 s = _mm_mul_ps(sqrt2, wt);
+      __m128 m = _mm_min_ps(_mm_add_ps(_mm_loadu_ps(next + x), wt), _mm_add_ps(_mm_loadu_ps(next + x - 1), s));
+      m = _mm_min_ps(_mm_add_ps(_mm_loadu_ps(next + x + 1), s), m);
+      _mm_storeu_ps(d + x, _mm_min_ps(m, _mm_loadu_ps(d + x)));
+    }
+  }
+#endif
+  for (; x < w - 1; x++) {
+    float s = (float)M_SQRT2 * weight[x];
+    float m = CHAMFER_MIN(next[x - 1] + s, next[x] + weight[x]);
+    m = CHAMFER_MIN(m, next[x + 1] + s);
+    d[x] = CHAMFER_MIN(d[x], m);
+  }
+  d[w - 1] = CHAMFER_MIN(d[w - 1], next[w - 2] + (float)M_SQRT2 * weight[w - 1]);
+  d[w - 1] = CHAMFER_MIN(d[w - 1], next[w - 1] + weight[w - 1]);
+}
+
 /* Allocate storage for a new distance map with the same dimensions
    as BITMAP and initialize it so that pixels in BITMAP with value
    TARGET_VALUE are at distance zero and all other pixels are at
    distance infinity.  Then compute the gray-weighted distance from
    every non-target point to the nearest target point. */
 
-at_distance_map new_distance_map(at_bitmap * bitmap, unsigned char target_value, gboolean padded, at_exception_type * exp)
+at_distance_map new_distance_map(at_bitmap * bitmap, unsigned char target_value, gboolean padded, unsigned threads, at_exception_type * exp)
 {
   signed x, y;
-  float d, min;
   at_distance_map dist;
-  unsigned char *b = AT_BITMAP_BITS(bitmap);
+  chamfer_job job;
   unsigned w = AT_BITMAP_WIDTH(bitmap);
   unsigned h = AT_BITMAP_HEIGHT(bitmap);
-  unsigned spp = AT_BITMAP_PLANES(bitmap);
-
-  dist.height = h;
-  dist.width = w;
-  XMALLOC(dist.d, h * sizeof(float *));
-  XMALLOC(dist.weight, h * sizeof(float *));
-  for (y = 0; y < (signed)h; y++) {
-    XCALLOC(dist.d[y], w * sizeof(float));
-    XMALLOC(dist.weight[y], w * sizeof(float));
-  }
 
-  if (spp == 3) {
-    for (y = 0; y < (signed)h; y++) {
-      for (x = 0; x < (signed)w; x++, b += spp) {
-        int gray;
-        float fgray;
-        gray = (int)LUMINANCE(b[0], b[1], b[2]);
-        dist.d[y][x] = (gray == target_value ? 0.0F : 1.0e10F);
-        fgray = gray * 0.0039215686F; /* = gray / 255.0F */
-        dist.weight[y][x] = 1.0F - fgray;
-/*        dist.weight[y][x] = 1.0F - (fgray * fgray);*/
-/*        dist.weight[y][x] = (fgray < 0.5F ? 1.0F - fgray : -2.0F * fgray * (fgray - 1.0F));*/
-      }
-    }
-  } else {
-    for (y = 0; y < (signed)h; y++) {
-      for (x = 0; x < (signed)w; x++, b += spp) {
-        int gray;
-        float fgray;
-        gray = b[0];
-        dist.d[y][x] = (gray == target_value ? 0.0F : 1.0e10F);
-        fgray = gray * 0.0039215686F; /* = gray / 255.0F */
-        dist.weight[y][x] = 1.0F - fgray;
-/*        dist.weight[y][x] = 1.0F - (fgray * fgray);*/
-/*        dist.weight[y][x] = (fgray < 0.5F ? 1.0F - fgray : -2.0F * fgray * (fgray - 1.0F)); */
-      }
-    }
-  }
+  alloc_distance_map(&dist, w, h, TRUE);
+
+  job.dist = &dist;
+  job.bits = AT_BITMAP_BITS(bitmap);
+  job.planes = AT_BITMAP_PLANES(bitmap);
+  job.target_value = target_value;
+  parallel_for(h, 16, threads, chamfer_rows, &job);
 
   /* If the image is padded then border points are all at most
      one unit away from the nearest target point. */
@@ -108,66 +186,164 @@ at_distance_map new_distance_map(at_bitmap * bitmap, unsigned char target_value,
      the distance from the central point to the neighbor (either
      sqrt(2) or one) multiplied by the central point's weight
      (derived from its gray level).  Replace the distance already
-     stored at the central point if the new distance is smaller. */
+     stored at the central point if the new distance is smaller.
+     The neighbors above are taken for a whole row at once, and only
+     the left neighbor is carried along the row.  The first column
+     is left as it is, as it always was.  */
   for (y = 1; y < (signed)h; y++) {
-    for (x = 1; x < (signed)w; x++) {
-      if (dist.d[y][x] == 0.0F)
-        continue;
+    float *d = dist.d[y], *weight = dist.weight[y];
+    float d0 = d[0];
 
-      min = dist.d[y][x];
+    chamfer_across(d, dist.d[y - 1], weight, w);
+    d[0] = d0;
+    for (x = 1; x < (signed)w; x++)
+      d[x] = CHAMFER_MIN(d[x], d[x - 1] + weight[x]);
+  }
 
-      /* upper-left neighbor */
-      d = dist.d[y - 1][x - 1] + (float)M_SQRT2 *dist.weight[y][x];
-      if (d < min)
-        min = dist.d[y][x] = d;
+  /* Same as above, but now scanning right to left, bottom to top,
+     and leaving the last column as it is.  */
+  for (y = h - 2; y >= 0; y--) {
+    float *d = dist.d[y], *weight = dist.weight[y];
+    float last = d[w - 1];
+
+    chamfer_across(d, dist.d[y + 1], weight, w);
+    d[w - 1] = last;
+    for (x = w - 2; x >= 0; x--)
+      d[x] = CHAMFER_MIN(d[x], d[x + 1] + weight[x]);
+  }
+  return dist;
+}
 
-      /* upper neighbor */
-      d = dist.d[y - 1][x] + dist.weight[y][x];
-      if (d < min)
-        min = dist.d[y][x] = d;
+/* The exact Euclidean distance transform is separable (Felzenszwalb
+   and Huttenlocher, "Distance Transforms of Sampled Functions").
+   First every row is scanned for the distance to the nearest target
+   point in the same row.  Then every column takes the lower envelope
+   of the parabolas (y - q)^2 + row_distance(q)^2.  Rows, and then
+   columns, are independent of each other, so each pass is split
+   between threads.  Until the column pass, D holds squared distances.  */
+
+typedef struct {
+  at_distance_map *dist;
+  unsigned char *bits;
+  unsigned planes;
+  unsigned char target_value;
+  gboolean padded;
+} euclidean_job;
+
+#define FAR_SQUARED (FAR_DISTANCE * FAR_DISTANCE)
+
+static void euclidean_rows(unsigned first, unsigned last, gpointer data)
+{
+  euclidean_job *job = (euclidean_job *) data;
+  unsigned w = job->dist->width;
+  unsigned y;
+  signed x, target;
+  unsigned char *grays = NULL;
+
+  if (job->planes == 3)
+    XMALLOC(grays, MAX(w, 1));
+  for (y = first; y < last; y++) {
+    unsigned char *b = job->bits + y * w * job->planes;
+    float *d = job->dist->d[y];
+
+    if (grays) {
+      pixel_kernels()->rgb_to_gray(grays, b, w);
+      b = grays;
+    }
 
-      /* left neighbor */
-      d = dist.d[y][x - 1] + dist.weight[y][x];
-      if (d < min)
-        min = dist.d[y][x] = d;
+    /* If the image is padded, there is a target point just outside
+       either end of the row.  */
+    target = job->padded ? -1 : -(signed)w - 1;
+    for (x = 0; x < (signed)w; x++) {
+      if (b[x] == job->target_value)
+        target = x;
+      d[x] = (float)(x - target);
+    }
 
-      /* upper-right neighbor (except at the last column) */
-      if (x + 1 < (signed)w) {
-        d = dist.d[y - 1][x + 1] + (float)M_SQRT2 *dist.weight[y][x];
-        if (d < min)
-          min = dist.d[y][x] = d;
-      }
+    target = job->padded ? (signed)w : 2 * (signed)w + 1;
+    for (x = (signed)w - 1; x >= 0; x--) {
+      if (d[x] == 0.0F)
+        target = x;
+      else if (target - x < d[x])
+        d[x] = (float)(target - x);
+      d[x] = (d[x] > (float)w ? FAR_SQUARED : d[x] * d[x]);
     }
   }
+  free(grays);
+}
 
-  /* Same as above, but now scanning right to left, bottom to top. */
-  for (y = h - 2; y >= 0; y--) {
-    for (x = w - 2; x >= 0; x--) {
-      min = dist.d[y][x];
-
-      /* lower-right neighbor */
-      d = dist.d[y + 1][x + 1] + (float)M_SQRT2 *dist.weight[y][x];
-      if (d < min)
-        min = dist.d[y][x] = d;
-
-      /* lower neighbor */
-      d = dist.d[y + 1][x] + dist.weight[y][x];
-      if (d < min)
-        min = dist.d[y][x] = d;
-
-      /* right neighbor */
-      d = dist.d[y][x + 1] + dist.weight[y][x];
-      if (d < min)
-        min = dist.d[y][x] = d;
-
-      /* lower-left neighbor (except at the first column) */
-      if (x - 1 >= 0) {
-        d = dist.d[y + 1][x - 1] + (float)M_SQRT2 *dist.weight[y][x];
-        if (d < min)
-          min = dist.d[y][x] = d;
+static void euclidean_columns(unsigned first, unsigned last, gpointer data)
+{
+  euclidean_job *job = (euclidean_job *) data;
+  float **d = job->dist->d;
+  signed h = job->dist->height;
+  signed *v;                    /* Positions of the parabolas in the envelope.  */
+  float *f;                     /* Their heights.  */
+  double *z;                    /* Where each of them starts to be the lowest.  */
+  unsigned x;
+
+  XMALLOC(v, (h + 2) * sizeof(signed));
+  XMALLOC(f, (h + 2) * sizeof(float));
+  XMALLOC(z, (h + 3) * sizeof(double));
+
+  for (x = first; x < last; x++) {
+    signed k = -1, q, p;
+
+    /* Padding puts a target point just above and below the column.  */
+    for (q = job->padded ? -1 : 0; q <= (job->padded ? h : h - 1); q++) {
+      float fq = (q < 0 || q >= h) ? 0.0F : d[q][x];
+      double s = 0.0;
+
+      if (fq >= FAR_SQUARED)
+        continue;
+      while (k >= 0) {
+        s = ((fq + (double)q * q) - (f[k] + (double)v[k] * v[k])) / (2.0 * (q - v[k]));
+        if (s > z[k])
+          break;
+        k--;
       }
+      k++;
+      v[k] = q;
+      f[k] = fq;
+      z[k] = (k == 0 ? -FAR_SQUARED : s);
+    }
+
+    if (k < 0) {
+      for (p = 0; p < h; p++)
+        d[p][x] = FAR_DISTANCE;
+      continue;
+    }
+
+    z[k + 1] = FAR_SQUARED;
+    for (p = 0, q = 0; p < h; p++) {
+      while (z[q + 1] < p)
+        q++;
+      d[p][x] = (float)sqrt((double)(p - v[q]) * (p - v[q]) + f[q]);
     }
   }
+
+  free(z);
+  free(f);
+  free(v);
+}
+
+at_distance_map new_euclidean_distance_map(at_bitmap * bitmap, unsigned char target_value, gboolean padded, unsigned threads, at_exception_type * exp)
+{
+  at_distance_map dist;
+  euclidean_job job;
+  unsigned w = AT_BITMAP_WIDTH(bitmap);
+  unsigned h = AT_BITMAP_HEIGHT(bitmap);
+
+  alloc_distance_map(&dist, w, h, FALSE);
+
+  job.dist = &dist;
+  job.bits = AT_BITMAP_BITS(bitmap);
+  job.planes = AT_BITMAP_PLANES(bitmap);
+  job.target_value = target_value;
+  job.padded = padded;
+
+  parallel_for(h, 16, threads, euclidean_rows, &job);
+  parallel_for(w, 16, threads, euclidean_columns, &job);
   return dist;
 }
 
@@ -175,22 +351,16 @@ at_distance_map new_distance_map(at_bitmap * bitmap, unsigned char target_value,
 
 void free_distance_map(at_distance_map * dist)
 {
-  unsigned y, h;
-
   if (!dist)
     return;
 
-  h = dist->height;
-
   if (dist->d != NULL) {
-    for (y = 0; y < h; y++)
-      free((gpointer *) dist->d[y]);
-    free((gpointer *) dist->d);
+    free(dist->d[0]);
+    free(dist->d);
   }
   if (dist->weight != NULL) {
-    for (y = 0; y < h; y++)
-      free((gpointer *) dist->weight[y]);
-    free((gpointer *) dist->weight);
+    free(dist->weight[0]);
+    free(dist->weight);
   }
 }
 
@@ -6,14 +6,22 @@
 #include "bitmap.h"
 #include "color.h"
 
+/* The rows of D (and of WEIGHT, if any) point into a single block of
+   HEIGHT * WIDTH floats, so D[0] can also be walked linearly.  */
 typedef struct {
   unsigned height, width;
   float **weight;
   float **d;
 } at_distance_map;
 
-/* Allocate and compute a new distance map. */
-extern at_distance_map new_distance_map(at_bitmap *, unsigned char target_value, gboolean padded, at_exception_type * exp);
+/* Allocate and compute a new distance map, using the gray-weighted
+   chamfer distance and up to THREADS threads to set it up. */
+extern at_distance_map new_distance_map(at_bitmap *, unsigned char target_value, gboolean padded, unsigned threads, at_exception_type * exp);
+
+/* Allocate and compute a new distance map holding the exact Euclidean
+   distance to the nearest target point, using up to THREADS threads
+   (0 means one per processor).  WEIGHT is not allocated. */
+extern at_distance_map new_euclidean_distance_map(at_bitmap *, unsigned char target_value, gboolean padded, unsigned threads, at_exception_type * exp);
 
 /* Free the dynamically-allocated storage associated with a distance map. */
 extern void free_distance_map(at_distance_map *);
@@ -29,6 +29,7 @@
 #include "bitmap.h"
 #include "logreport.h"
 #include "xstd.h"
+#include "pixel.h"
 #include "input-bmp.h"
 
 #define BitSet(byte, bit)  (((byte) & (bit)) == (bit))
@@ -61,27 +62,20 @@ struct Bitmap_Head_Struct {
 static long ToL(unsigned char *);
 static short ToS(unsigned char *);
 static int ReadColorMap(FILE *, unsigned char[256][3], int, int, int *, at_exception_type *);
-static unsigned char *ReadImage(FILE *, int, int, unsigned char[256][3], int, int, int, int);
+static void ReadImage(FILE *, int, int, unsigned char[256][3], int, int, int, int, unsigned char **);
+static int BlackWhite(unsigned char[256][3], int *);
+static void ReadPacked(FILE *, int, int, int, int, unsigned char **);
 
-at_bitmap input_bmp_reader(gchar * filename, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
+void input_bmp_reader(gchar * filename, FILE * fd, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
 {
-  FILE *fd;
   unsigned char buffer[64];
-  int ColormapSize, rowbytes, Maps, Grey;
+  int ColormapSize, rowbytes, Maps, Grey, Invert;
   unsigned char ColorMap[256][3];
-  at_bitmap image = at_bitmap_init(0, 0, 0, 1);
-  unsigned char *image_storage;
+  unsigned int planes;
+  unsigned char **places = NULL, *own = NULL;
   at_exception_type exp = at_exception_new(msg_func, msg_data);
 
-  fd = fopen(filename, "rb");
-
-  if (!fd) {
-    LOG("Can't open \"%s\"\n", filename);
-    at_exception_fatal(&exp, "bmp: cannot open input file");
-    return image;
-  }
-
-  /* It is a File. Now is it a Bitmap? Read the shortest possible header. */
+  /* Is it a Bitmap? Read the shortest possible header. */
 
   if (!ReadOK(fd, buffer, 18) || (strncmp((const char *)buffer, "BM", 2))) {
     LOG("Not a valid BMP file %s\n", filename);
@@ -171,7 +165,8 @@ at_bitmap input_bmp_reader(gchar * filename, at_input_opts_type * opts, at_msg_f
 
   /* Sanity checks */
 
-  if ((Bitmap_Head.biHeight == 0 || Bitmap_Head.biWidth == 0)
+  if ((Bitmap_Head.biHeight <= 0 || Bitmap_Head.biWidth <= 0)
+      || (Bitmap_Head.biHeight > G_MAXUSHORT || Bitmap_Head.biWidth > G_MAXUSHORT)
       || (Bitmap_Head.biPlanes != 1)
       || (ColormapSize > 256 || Bitmap_Head.biClrUsed > 256)) {
     LOG("Error reading BMP file header\n");
@@ -189,7 +184,8 @@ at_bitmap input_bmp_reader(gchar * filename, at_input_opts_type * opts, at_msg_f
   printf("\nSize: %u, Colors: %u, Bits: %u, Width: %u, Height: %u, Comp: %u, Zeile: %u\n", Bitmap_File_Head.bfSize, Bitmap_Head.biClrUsed, Bitmap_Head.biBitCnt, Bitmap_Head.biWidth, Bitmap_Head.biHeight, Bitmap_Head.biCompr, rowbytes);
 #endif
 
-  /* Get the Colormap */
+  /* Get the Colormap.  Indexes past its end are black. */
+  memset(ColorMap, 0, sizeof(ColorMap));
   ReadColorMap(fd, ColorMap, ColormapSize, Maps, &Grey, &exp);
   if (at_exception_got_fatal(&exp))
     goto cleanup;
@@ -198,12 +194,26 @@ at_bitmap input_bmp_reader(gchar * filename, at_input_opts_type * opts, at_msg_f
   printf("Colormap read\n");
 #endif
 
-  /* Get the Image and return the ID or -1 on error */
-  image_storage = ReadImage(fd, Bitmap_Head.biWidth, Bitmap_Head.biHeight, ColorMap, Bitmap_Head.biBitCnt, Bitmap_Head.biCompr, rowbytes, Grey);
-  image = at_bitmap_init(image_storage, (unsigned short)Bitmap_Head.biWidth, (unsigned short)Bitmap_Head.biHeight, Grey ? 1 : 3);
+  /* Get the Image.  Its rows are stored bottom-up, so they are
+     decoded where they belong and only handed over once they are all
+     read. */
+  planes = Grey && Bitmap_Head.biBitCnt <= 8 ? 1 : 3;
+  if (consumer->begin_packed && Bitmap_Head.biBitCnt == 1 && Bitmap_Head.biCompr == 0 && BlackWhite(ColorMap, &Invert)) {
+    /* Black and white rows are kept packed */
+    if (!consumer->begin_packed((unsigned short)Bitmap_Head.biWidth, (unsigned short)Bitmap_Head.biHeight, planes, consumer->data))
+      goto cleanup;
+    places = at_input_row_places(consumer, (unsigned short)((Bitmap_Head.biWidth + 7) / 8), (unsigned short)Bitmap_Head.biHeight, 1, &own);
+    ReadPacked(fd, Bitmap_Head.biWidth, Bitmap_Head.biHeight, rowbytes, Invert, places);
+  } else {
+    if (!consumer->begin((unsigned short)Bitmap_Head.biWidth, (unsigned short)Bitmap_Head.biHeight, planes, consumer->data))
+      goto cleanup;
+    places = at_input_row_places(consumer, (unsigned short)Bitmap_Head.biWidth, (unsigned short)Bitmap_Head.biHeight, planes, &own);
+    ReadImage(fd, Bitmap_Head.biWidth, Bitmap_Head.biHeight, ColorMap, Bitmap_Head.biBitCnt, Bitmap_Head.biCompr, rowbytes, Grey, places);
+  }
+  at_input_deliver_rows(places, (unsigned short)Bitmap_Head.biHeight, consumer);
 cleanup:
-  fclose(fd);
-  return (image);
+  free(places);
+  free(own);
 }
 
 static int ReadColorMap(FILE * fd, unsigned char buffer[256][3], int number, int size, int *grey, at_exception_type * exp)
@@ -230,30 +240,67 @@ cleanup:
   return 0;
 }
 
-static unsigned char *ReadImage(FILE * fd, int width, int height, unsigned char cmap[256][3], int bpp, int compression, int rowbytes, int grey)
+/* Whether the first two colors of CMAP are black and white, in either
+   order; *INVERT tells whether the first is black, so that the set bits
+   of the image are white.  */
+static int BlackWhite(unsigned char cmap[256][3], int *invert)
+{
+  static const unsigned char black[3] = { 0, 0, 0 }, white[3] = { 255, 255, 255 };
+
+  *invert = !memcmp(cmap[0], black, 3);
+  return !memcmp(cmap[*invert ? 1 : 0], white, 3) && !memcmp(cmap[*invert ? 0 : 1], black, 3);
+}
+
+/* Read the 1-bit image of WIDTH by HEIGHT pixels into the packed rows
+   PLACES, its rows from the top, flipping its bits if INVERT.  */
+static void ReadPacked(FILE * fd, int width, int height, int rowbytes, int invert, unsigned char **places)
+{
+  unsigned char *buffer;
+  int ypos, i, bytes = (width + 7) / 8;
+
+  XMALLOC(buffer, rowbytes);
+  for (ypos = height - 1; ypos >= 0 && ReadOK(fd, buffer, rowbytes); ypos--) {
+    for (i = 0; i < bytes; i++)
+      places[ypos][i] = invert ? ~buffer[i] : buffer[i];
+    AT_BITMAP_CLEAR_PAD(places[ypos], width);
+  }
+
+  /* The rows above where a short file ends are black.  */
+  for (; ypos >= 0; ypos--) {
+    memset(places[ypos], 0xff, bytes);
+    AT_BITMAP_CLEAR_PAD(places[ypos], width);
+  }
+  free(buffer);
+}
+
+/* Expand WIDTH color indexes to gray through GRAYS if it is not NULL,
+   or else to RGB through CMAP.  */
+static void ExpandRow(unsigned char *dest, const unsigned char *indexes, int width, unsigned char cmap[256][3], const unsigned char *grays)
+{
+  const pixel_kernels_type *kernels = pixel_kernels();
+
+  if (grays)
+    kernels->map_bytes(dest, indexes, width, grays);
+  else
+    kernels->expand_palette(dest, indexes, width, (const unsigned char (*)[3])cmap);
+}
+
+/* Decode the image into PLACES, its rows from the top.  */
+static void ReadImage(FILE * fd, int width, int height, unsigned char cmap[256][3], int bpp, int compression, int rowbytes, int grey, unsigned char **places)
 {
   unsigned char v, howmuch;
   int xpos = 0, ypos = 0;
-  unsigned char *image;
+  unsigned char *indexes = NULL;
   unsigned char *temp, *buffer;
-  long rowstride, channels;
-  unsigned short rgb;
+  unsigned char grays[256];
   int i, j, notused;
+  const pixel_kernels_type *kernels = pixel_kernels();
 
-  if (bpp >= 16) {              /* color image */
-    XMALLOC(image, width * height * 3 * sizeof(unsigned char));
-    channels = 3;
-  } else if (grey) {            /* grey image */
-    XMALLOC(image, width * height * 1 * sizeof(unsigned char));
-    channels = 1;
-  } else {                      /* indexed image */
-
-    XMALLOC(image, width * height * 1 * sizeof(unsigned char));
-    channels = 1;
-  }
+  if (grey)
+    for (i = 0; i < 256; i++)
+      grays[i] = cmap[i][0];
 
   XMALLOC(buffer, rowbytes);
-  rowstride = width * channels;
 
   ypos = height - 1;            /* Bitmaps begin in the lower left corner */
 
@@ -261,13 +308,8 @@ static unsigned char *ReadImage(FILE * fd, int width, int height, unsigned char
 
   case 32:
     {
-      while (ReadOK(fd, buffer, rowbytes)) {
-        temp = image + (ypos * rowstride);
-        for (xpos = 0; xpos < width; ++xpos) {
-          *(temp++) = buffer[xpos * 4 + 2];
-          *(temp++) = buffer[xpos * 4 + 1];
-          *(temp++) = buffer[xpos * 4];
-        }
+      while (ypos >= 0 && ReadOK(fd, buffer, rowbytes)) {
+        kernels->bgrx_to_rgb(places[ypos], buffer, width);
         --ypos;                 /* next line */
       }
     }
@@ -275,13 +317,8 @@ static unsigned char *ReadImage(FILE * fd, int width, int height, unsigned char
 
   case 24:
     {
-      while (ReadOK(fd, buffer, rowbytes)) {
-        temp = image + (ypos * rowstride);
-        for (xpos = 0; xpos < width; ++xpos) {
-          *(temp++) = buffer[xpos * 3 + 2];
-          *(temp++) = buffer[xpos * 3 + 1];
-          *(temp++) = buffer[xpos * 3];
-        }
+      while (ypos >= 0 && ReadOK(fd, buffer, rowbytes)) {
+        kernels->bgr_to_rgb(places[ypos], buffer, width);
         --ypos;                 /* next line */
       }
     }
@@ -289,14 +326,8 @@ static unsigned char *ReadImage(FILE * fd, int width, int height, unsigned char
 
   case 16:
     {
-      while (ReadOK(fd, buffer, rowbytes)) {
-        temp = image + (ypos * rowstride);
-        for (xpos = 0; xpos < width; ++xpos) {
-          rgb = ToS(&buffer[xpos * 2]);
-          *(temp++) = (unsigned char)(((rgb >> 10) & 0x1f) * 8);
-          *(temp++) = (unsigned char)(((rgb >> 5) & 0x1f) * 8);
-          *(temp++) = (unsigned char)(((rgb) & 0x1f) * 8);
-        }
+      while (ypos >= 0 && ReadOK(fd, buffer, rowbytes)) {
+        kernels->rgb555_to_rgb(places[ypos], buffer, width);
         --ypos;                 /* next line */
       }
     }
@@ -307,22 +338,28 @@ static unsigned char *ReadImage(FILE * fd, int width, int height, unsigned char
   case 1:
     {
       if (compression == 0) {
-        while (ReadOK(fd, &v, 1)) {
-          for (i = 1; (i <= (8 / bpp)) && (xpos < width); i++, xpos++) {
-            temp = (unsigned char *)(image + (ypos * rowstride) + (xpos * channels));
-            *temp = (unsigned char)((v & (((1 << bpp) - 1) << (8 - (i * bpp)))) >> (8 - (i * bpp)));
-          }
-          if (xpos == width) {
-            notused = ReadOK(fd, buffer, rowbytes - 1 - (width * bpp - 1) / 8);
-            ypos--;
-            xpos = 0;
-
+        XMALLOC(indexes, width);
+        while (ypos >= 0 && ReadOK(fd, buffer, rowbytes)) {
+          temp = indexes;
+          for (xpos = 0; xpos < width;) {
+            v = buffer[xpos * bpp / 8];
+            /* Bilevel scans are mostly bytes of one color */
+            if (bpp == 1 && (v == 0x00 || v == 0xff) && xpos + 8 <= width) {
+              memset(temp + xpos, v & 1, 8);
+              xpos += 8;
+              continue;
+            }
+            for (i = 1; (i <= (8 / bpp)) && (xpos < width); i++, xpos++)
+              temp[xpos] = (unsigned char)((v & (((1 << bpp) - 1) << (8 - (i * bpp)))) >> (8 - (i * bpp)));
           }
-          if (ypos < 0)
-            break;
+          ExpandRow(places[ypos], indexes, width, cmap, grey ? grays : NULL);
+          ypos--;
         }
         break;
       } else {
+        /* Records may skip over rows, so the indexes are all
+           expanded at the end.  */
+        XCALLOC(indexes, (size_t) width * height);
         while (ypos >= 0 && xpos <= width) {
           notused = ReadOK(fd, buffer, 2);
           if ((unsigned char)buffer[0] != 0)
@@ -333,7 +370,7 @@ static unsigned char *ReadImage(FILE * fd, int width, int height, unsigned char
               printf("%u %u | ", xpos, width);
 #endif
               for (i = 1; ((i <= (8 / bpp)) && (xpos < width) && ((unsigned char)j < (unsigned char)buffer[0])); i++, xpos++, j++) {
-                temp = image + (ypos * rowstride) + (xpos * channels);
+                temp = indexes + ((size_t) ypos * width) + xpos;
                 *temp = (unsigned char)((buffer[1] & (((1 << bpp) - 1) << (8 - (i * bpp)))) >> (8 - (i * bpp)));
               }
             }
@@ -346,7 +383,7 @@ static unsigned char *ReadImage(FILE * fd, int width, int height, unsigned char
               notused = ReadOK(fd, &v, 1);
               i = 1;
               while ((i <= (8 / bpp)) && (xpos < width)) {
-                temp = image + (ypos * rowstride) + (xpos * channels);
+                temp = indexes + ((size_t) ypos * width) + xpos;
                 *temp = (unsigned char)((v & (((1 << bpp) - 1) << (8 - (i * bpp)))) >> (8 - (i * bpp)));
                 i++;
                 xpos++;
@@ -379,6 +416,8 @@ static unsigned char *ReadImage(FILE * fd, int width, int height, unsigned char
             ypos -= (unsigned char)buffer[1];
           }
         }
+        for (ypos = 0; ypos < height; ypos++)
+          ExpandRow(places[ypos], indexes + (size_t) ypos * width, width, cmap, grey ? grays : NULL);
         break;
       }
     }
@@ -388,27 +427,13 @@ static unsigned char *ReadImage(FILE * fd, int width, int height, unsigned char
     ;
   }
 
-  if (bpp <= 8) {
-    unsigned char *temp2, *temp3;
-    unsigned char index;
-    temp2 = temp = image;
-    XMALLOC(image, width * height * 3 * sizeof(unsigned char));
-    temp3 = image;
-    for (ypos = 0; ypos < height; ypos++) {
-      for (xpos = 0; xpos < width; xpos++) {
-        index = *temp2++;
-        *temp3++ = cmap[index][0];
-        if (!grey) {
-          *temp3++ = cmap[index][1];
-          *temp3++ = cmap[index][2];
-        }
-      }
-    }
-    free(temp);
-  }
+  /* The rows above where a short file ends are black.  */
+  if (bpp >= 16 || compression == 0)
+    for (; ypos >= 0; ypos--)
+      memset(places[ypos], 0, (size_t) width * (bpp <= 8 && grey ? 1 : 3));
 
+  free(indexes);
   free(buffer);
-  return image;
 }
 
 static long ToL(unsigned char *puffer)
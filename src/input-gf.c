@@ -30,6 +30,7 @@
 #include "input-gf.h"
 #include "output-ugs.h"
 #include "bitmap.h"
+#include "xstd.h"
 
 #define WHITE		0
 
@@ -81,6 +82,7 @@ typedef struct _gf_char_t {
 typedef struct _gf_font_t {
   char *input_filename;
   FILE *input_file;
+  long start;                   /* Where the font starts in INPUT_FILE */
   double design_size;
   unsigned long checksum;
   double h_pixels_per_point, v_pixels_per_point;
@@ -154,6 +156,15 @@ static unsigned long get_four(gf_font_t * font)
   return b;
 }
 
+/* The same for a number in two's complement, which `long' may have
+   more than 32 bits for.  */
+static long get_signed_four(gf_font_t * font)
+{
+  unsigned long b = get_four(font);
+
+  return b & 0x80000000UL ? -(long)(0xffffffffUL - b) - 1 : (long)b;
+}
+
 static void move_relative(gf_font_t * font, long count)
 {
   if (fseek(font->input_file, count, SEEK_CUR) < 0) {
@@ -310,18 +321,11 @@ static void get_character_bitmap(gf_char_t * sym)
        * C coordinates.  That means the x's are the same,
        * but the y's are flipped. */
       if (painting_black) {
-        unsigned matrix_x, matrix_y;
-
-        matrix_y = sym->bbox_max_row - cur_y;
-        for (; length != 0; length--) {
-          matrix_x = cur_x - sym->bbox_min_col;
+        unsigned matrix_y = sym->bbox_max_row - cur_y;
 
-          PIXEL(sym, matrix_y, matrix_x) = 255;
-          cur_x++;
-        }
-      } else {
-        cur_x += length;
+        memset(&PIXEL(sym, matrix_y, cur_x - sym->bbox_min_col), 255, length);
       }
+      cur_x += length;
       painting_black = !painting_black;
 
     } else if (SKIP0 <= c && c <= SKIP3) {
@@ -458,31 +462,30 @@ static void deblank(gf_char_t * sym)
       sym->bbox_max_row -= white_on_top;
       sym->bbox_min_col += white_on_left;
       sym->bbox_max_col -= white_on_right;
+      sym->width = condensed.width;
+      sym->height = condensed.height;
     }
     free(sym->bitmap);
     sym->bitmap = condensed.bitmap;
   }
 }
 
-static int gf_open(gf_font_t * font, char *filename)
+static int gf_open(gf_font_t * font, FILE * file, char *filename)
 {
   unsigned char b, c;
   unsigned long post_ptr;
 
   font->input_filename = filename;
-  font->input_file = fopen(filename, "r");
-  if (!font->input_file) {
-    perror(filename);
-    return 0;
-  }
+  font->input_file = file;
+  font->start = ftell(file);
 
-  if (fseek(font->input_file, 0, SEEK_END) < 0) {
+  if (font->start < 0 || fseek(font->input_file, 0, SEEK_END) < 0) {
     perror(filename);
     return 0;
   }
   /* Check that file is not empty, because we are trying
    * to seek before the beginning. */
-  if (ftell(font->input_file) <= 0) {
+  if (ftell(font->input_file) <= font->start) {
     fprintf(stderr, "%s: empty file\n", font->input_filename);
     return 0;
   }
@@ -504,7 +507,7 @@ static int gf_open(gf_font_t * font, char *filename)
       break;
   }
 
-  fseek(font->input_file, post_ptr, SEEK_SET);
+  fseek(font->input_file, font->start + post_ptr, SEEK_SET);
   b = get_byte(font);
   if (b != POST) {
     fprintf(stderr, "%s: invalid font structure (expected %u, found %u)\n", font->input_filename, POST, b);
@@ -520,10 +523,10 @@ static int gf_open(gf_font_t * font, char *filename)
   font->h_pixels_per_point = get_four(font) / (double)(1L << 16);
   font->v_pixels_per_point = get_four(font) / (double)(1L << 16);
 
-  font->bbox_min_col = (signed long)get_four(font);
-  font->bbox_max_col = (signed long)get_four(font);
-  font->bbox_min_row = (signed long)get_four(font);
-  font->bbox_max_row = (signed long)get_four(font);
+  font->bbox_min_col = get_signed_four(font);
+  font->bbox_max_col = get_signed_four(font);
+  font->bbox_min_row = get_signed_four(font);
+  font->bbox_max_row = get_signed_four(font);
 
   /* We do not know in advance how many character locators exist,
    * but we do place a maximum on it (contrary to what the GF format
@@ -571,7 +574,7 @@ static int gf_get_char(gf_font_t * font, gf_char_t * sym, unsigned char charcode
   sym->h_escapement = loc->h_escapement;
   sym->tfm_width = loc->tfm_width;
 
-  if (fseek(font->input_file, loc->char_pointer, SEEK_SET) < 0) {
+  if (fseek(font->input_file, font->start + loc->char_pointer, SEEK_SET) < 0) {
     fprintf(stderr, "%s: seek error\n", font->input_filename);
     return 0;
   }
@@ -588,7 +591,7 @@ static int gf_get_char(gf_font_t * font, gf_char_t * sym, unsigned char charcode
      * this character is a ``residue'', and the font
      * is probably too big.
      */
-    lcode = (long)get_four(font);
+    lcode = get_signed_four(font);
     if (lcode < 0 || lcode > 255) {
       /* Someone is trying to use a font with character codes
        * that are out of our range. */
@@ -597,14 +600,14 @@ static int gf_get_char(gf_font_t * font, gf_char_t * sym, unsigned char charcode
     }
     sym->charcode = lcode;
 
-    back_pointer = (long)get_four(font);
+    back_pointer = get_signed_four(font);
     if (back_pointer != -1)
       fprintf(stderr, "%s: warning: character %u has a non-null back pointer (to %#lx)\n", font->input_filename, sym->charcode, back_pointer);
 
-    sym->bbox_min_col = (long)get_four(font);
-    sym->bbox_max_col = (long)get_four(font);
-    sym->bbox_min_row = (long)get_four(font);
-    sym->bbox_max_row = (long)get_four(font);
+    sym->bbox_min_col = get_signed_four(font);
+    sym->bbox_max_col = get_signed_four(font);
+    sym->bbox_min_row = get_signed_four(font);
+    sym->bbox_max_row = get_signed_four(font);
     break;
 
   case BOC1:
@@ -636,50 +639,159 @@ static int gf_get_char(gf_font_t * font, gf_char_t * sym, unsigned char charcode
   return 1;
 }
 
-at_bitmap input_gf_reader(gchar * filename, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
+static long gf_design_pixels(gf_font_t * font)
+{
+  return font->design_size * font->v_pixels_per_point + 0.5;
+}
+
+/* Fill in all of GLYPH but its bitmap from SYM.  */
+static void gf_glyph_metrics(gf_glyph_type * glyph, gf_char_t * sym)
+{
+  glyph->charcode = sym->charcode;
+  glyph->advance_width = sym->h_escapement;
+  glyph->tfm_width = sym->tfm_width;
+  glyph->left_bearing = sym->bbox_min_col;
+  glyph->descend = sym->bbox_min_row;
+  glyph->max_col = sym->bbox_max_col;
+  glyph->max_row = sym->bbox_max_row;
+}
+
+/* Order character codes by where the characters are in the file.  */
+static gint gf_compare_pointers(gconstpointer a, gconstpointer b, gpointer data)
+{
+  gf_font_t *font = (gf_font_t *) data;
+  long pa = font->char_loc[*(const unsigned char *)a].char_pointer;
+  long pb = font->char_loc[*(const unsigned char *)b].char_pointer;
+
+  return pa < pb ? -1 : pa > pb;
+}
+
+void input_gf_reader(gchar * filename, FILE * file, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
 {
   at_exception_type exp = at_exception_new(msg_func, msg_data);
-  at_bitmap bitmap = at_bitmap_init(NULL, 0, 0, 0);
   gf_font_t fontdata, *font = &fontdata;
   gf_char_t chardata, *sym = &chardata;
-  unsigned int i, j, ptr;
+  gf_glyph_type glyph;
+  unsigned int i, j, charcode = opts->charcode;
 
-  if (!gf_open(font, filename)) {
+  if (!gf_open(font, file, filename)) {
     at_exception_fatal(&exp, "Cannot open input GF file");
-    return bitmap;
+    return;
   }
-  if (opts->charcode == 0) {
+  if (charcode == 0) {
     /* Find a first character in font file. */
     for (i = 0; i < 256; ++i)
       if (font->char_loc[i].char_pointer != -1)
         break;
     if (i >= 256) {
       at_exception_fatal(&exp, "No characters in input GF file");
-      return bitmap;
+      return;
     }
-    opts->charcode = i;
+    charcode = i;
   }
-  if (!gf_get_char(font, sym, (unsigned char)opts->charcode)) {
-    fclose(font->input_file);
+  if (!gf_get_char(font, sym, (unsigned char)charcode)) {
     at_exception_fatal(&exp, "Error reading character from GF file");
-    return bitmap;
+    return;
   }
 
-  ugs_design_pixels = font->design_size * font->v_pixels_per_point + 0.5;
-  ugs_charcode = opts->charcode;
-  ugs_advance_width = sym->h_escapement;
-  ugs_left_bearing = sym->bbox_min_col;
-  ugs_descend = sym->bbox_min_row;
-  ugs_max_col = sym->bbox_max_col;
-  ugs_max_row = sym->bbox_max_row;
-
-  bitmap = at_bitmap_init(NULL, sym->width, sym->height, 1);
-  for (j = 0, ptr = 0; j < sym->height; j++) {
-    for (i = 0; i < sym->width; i++) {
-      AT_BITMAP_BITS(&bitmap)[ptr++] = PIXEL(sym, j, i);
+  gf_glyph_metrics(&glyph, sym);
+  glyph.charcode = charcode;
+  gf_set_ugs_glyph(gf_design_pixels(font), &glyph);
+
+  /* The rows of the character are in its bitmap already, and are
+     packed for a consumer that takes them so.  The paint is white on
+     black.  */
+  if (consumer->begin_packed) {
+    unsigned char *bits;
+
+    XMALLOC(bits, sym->width / 8 + 1);
+    if (consumer->begin_packed(sym->width, sym->height, 1, consumer->data))
+      for (j = 0; j < sym->height; j++) {
+        at_bitmap_pack_row(bits, (unsigned char *)&PIXEL(sym, j, 0), sym->width);
+        if (!consumer->row(j, bits, consumer->data))
+          break;
+      }
+    free(bits);
+  } else if (consumer->begin(sym->width, sym->height, 1, consumer->data))
+    for (j = 0; j < sym->height; j++)
+      if (!consumer->row(j, (unsigned char *)&PIXEL(sym, j, 0), consumer->data))
+        break;
+  free(sym->bitmap);
+}
+
+unsigned gf_read_font(gchar * filename, FILE * file, long *design_pixels, gf_glyph_type ** glyphs, at_exception_type * exp)
+{
+  gf_font_t fontdata, *font = &fontdata;
+  gf_char_t chardata, *sym = &chardata;
+  unsigned char codes[256];
+  int slot[256];
+  unsigned count = 0, i;
+  gf_glyph_type *glyph;
+
+  *glyphs = NULL;
+  if (!gf_open(font, file, filename)) {
+    at_exception_fatal(exp, "Cannot open input GF file");
+    return 0;
+  }
+  for (i = 0; i < 256; i++)
+    if (font->char_loc[i].char_pointer != -1) {
+      slot[i] = count;
+      codes[count++] = i;
     }
+  if (count == 0) {
+    at_exception_fatal(exp, "No characters in input GF file");
+    return 0;
   }
-  free(sym->bitmap);
-  fclose(font->input_file);
-  return bitmap;
+  *design_pixels = gf_design_pixels(font);
+
+  /* The glyphs are kept in the order of their codes, but read in the
+     order of the file, so that it is only gone through forwards.  */
+  g_qsort_with_data(codes, count, 1, gf_compare_pointers, font);
+  XCALLOC(*glyphs, count * sizeof(gf_glyph_type));
+  for (i = 0; i < count; i++) {
+    if (!gf_get_char(font, sym, codes[i])) {
+      gf_free_glyphs(*glyphs, count);
+      *glyphs = NULL;
+      at_exception_fatal(exp, "Error reading character from GF file");
+      return 0;
+    }
+    glyph = &(*glyphs)[slot[codes[i]]];
+    gf_glyph_metrics(glyph, sym);
+    glyph->charcode = codes[i];
+    glyph->bitmap = at_bitmap_init((unsigned char *)sym->bitmap, sym->width, sym->height, 1);
+  }
+  return count;
+}
+
+void gf_free_glyphs(gf_glyph_type * glyphs, unsigned count)
+{
+  unsigned i;
+
+  for (i = 0; i < count; i++)
+    free(AT_BITMAP_BITS(&glyphs[i].bitmap));
+  free(glyphs);
+}
+
+void gf_set_ugs_glyph(long design_pixels, gf_glyph_type * glyph)
+{
+  ugs_design_pixels = design_pixels;
+  ugs_charcode = glyph->charcode;
+  ugs_advance_width = glyph->advance_width;
+  ugs_tfm_width = glyph->tfm_width;
+  ugs_left_bearing = glyph->left_bearing;
+  ugs_descend = glyph->descend;
+  ugs_max_col = glyph->max_col;
+  ugs_max_row = glyph->max_row;
+}
+
+void gf_get_ugs_glyph(long *design_pixels, gf_glyph_type * glyph)
+{
+  *design_pixels = ugs_design_pixels;
+  glyph->charcode = ugs_charcode;
+  glyph->advance_width = ugs_advance_width;
+  glyph->tfm_width = ugs_tfm_width;
+  glyph->left_bearing = ugs_left_bearing;
+  glyph->descend = ugs_descend;
+  glyph->max_col = ugs_max_col;
+  glyph->max_row = ugs_max_row;
 }
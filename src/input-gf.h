@@ -22,6 +22,29 @@
 
 #include "input.h"
 
-at_bitmap input_gf_reader(gchar * filename, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data, gpointer user_data);
+void input_gf_reader(gchar * filename, FILE * file, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data, gpointer user_data);
+
+/* A character of a font, with the metrics the UGS output needs. */
+typedef struct {
+  unsigned charcode;
+  at_bitmap bitmap;             /* Without bits if the character is blank */
+  long advance_width;           /* In pixels */
+  long tfm_width;               /* In design size units, scaled by 2^20 */
+  long left_bearing, descend;
+  long max_col, max_row;
+} gf_glyph_type;
+
+/* Read every character of the GF font at the current position of
+   FILE, which must be able to seek, in one go.  The characters are
+   stored in *GLYPHS by their codes, and their number is returned;
+   *DESIGN_PIXELS is the design size of the font in pixels.  Returns 0
+   and notifies EXP on error. */
+unsigned gf_read_font(gchar * filename, FILE * file, long *design_pixels, gf_glyph_type ** glyphs, at_exception_type * exp);
+void gf_free_glyphs(gf_glyph_type * glyphs, unsigned count);
+
+/* Make GLYPH the character the UGS output writes next, or get the one
+   it would. */
+void gf_set_ugs_glyph(long design_pixels, gf_glyph_type * glyph);
+void gf_get_ugs_glyph(long *design_pixels, gf_glyph_type * glyph);
 
 #endif /* not INPUT_GF_H */
@@ -24,6 +24,7 @@
 #include "input.h"
 #include "input-magick.h"
 #include "bitmap.h"
+#include "xstd.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,27 +32,26 @@
 #include <sys/types.h>          /* Needed for correct interpretation of magick/api.h */
 #include <magick/api.h>
 
-static at_bitmap input_magick_reader(gchar * filename, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
+static void input_magick_reader(gchar * filename, FILE * file, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
 {
   Image *image = NULL;
   ImageInfo *image_info;
   ImageType image_type;
-  unsigned int i, j, point, np, runcount;
-  at_bitmap bitmap;
-  PixelPacket p;
-  PixelPacket *pixel = &p;
+  unsigned int j, np;
+  unsigned char *row, *own = NULL;
   ExceptionInfo exception;
-  InitializeMagick("");
   GetExceptionInfo(&exception);
   image_info = CloneImageInfo((ImageInfo *) NULL);
-  (void)strcpy(image_info->filename, filename);
+  /* Read FILE in the format this reader was added for */
+  image_info->file = file;
+  g_snprintf(image_info->filename, MaxTextExtent, "%s:%s", (char *)user_data, filename);
   image_info->antialias = 0;
 
   image = ReadImage(image_info, &exception);
   if (image == (Image *) NULL) {
     /* MagickError(exception.severity,exception.reason,exception.description); */
     if (msg_func)
-      msg_func(exception.reason, AT_MSG_FATAL, msg_data);
+      msg_func(exception.reason ? exception.reason : "Cannot read the image", AT_MSG_FATAL, msg_data);
     goto cleanup;
   }
   image_type = GetImageType(image, &exception);
@@ -60,26 +60,36 @@ static at_bitmap input_magick_reader(gchar * filename, at_input_opts_type * opts
   else
     np = 3;
 
-  bitmap = at_bitmap_init(NULL, image->columns, image->rows, np);
-
-  for (j = 0, runcount = 0, point = 0; j < image->rows; j++)
-    for (i = 0; i < image->columns; i++) {
-#if (MagickLibVersion < 0x0645) || (MagickLibVersion >= 0x0649)
-      p = GetOnePixel(image, i, j);
+  if (!consumer->begin(image->columns, image->rows, np, consumer->data))
+    goto destroy;
+
+  /* Have Magick scale a whole row to bytes at once, straight into the
+     place the consumer has for it, or else into a row of our own */
+  for (j = 0; j < image->rows; j++) {
+    row = consumer->buffer ? consumer->buffer(j, consumer->data) : NULL;
+    if (row == NULL) {
+      if (own == NULL)
+        XMALLOC(own, image->columns * np);
+      row = own;
+    }
+#if (MagickLibVersion >= 0x0600)
+    if (!ExportImagePixels(image, 0, j, image->columns, 1, np == 1 ? "R" : "RGB", CharPixel, row, &exception)) {
 #else
-      GetOnePixel(image, i, j, pixel);
+    if (!DispatchImage(image, 0, j, image->columns, 1, np == 1 ? "R" : "RGB", CharPixel, row, &exception)) {
 #endif
-      AT_BITMAP_BITS(&bitmap)[point++] = pixel->red;  /* if gray: red=green=blue */
-      if (np == 3) {
-        AT_BITMAP_BITS(&bitmap)[point++] = pixel->green;
-        AT_BITMAP_BITS(&bitmap)[point++] = pixel->blue;
-      }
+      if (msg_func)
+        msg_func(exception.reason ? exception.reason : "Cannot export the pixels of the image", AT_MSG_FATAL, msg_data);
+      break;
     }
+    if (!consumer->row(j, row, consumer->data))
+      break;
+  }
+  free(own);
 
+destroy:
   DestroyImage(image);
 cleanup:
   DestroyImageInfo(image_info);
-  return (bitmap);
 }
 
 int install_input_magick_readers(void)
@@ -97,7 +107,7 @@ int install_input_magick_readers(void)
 
   while (info) {
     if (info->name && info->description)
-      at_input_add_handler_full(info->name, info->description, input_magick_reader, 0, info->name, NULL);
+      at_input_add_stream_handler_full(info->name, info->description, input_magick_reader, 0, info->name, NULL);
     info = info->next;
   }
   return 0;
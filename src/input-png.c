@@ -32,7 +32,7 @@
 #include <png.h>
 #include "input-png.h"
 
-static png_bytep *read_png(png_structp png_ptr, png_infop info_ptr, at_input_opts_type * opts);
+static int read_png_info(png_structp png_ptr, png_infop info_ptr, at_input_opts_type * opts);
 
 /* for pre-1.0.6 versions of libpng */
 #ifndef png_jmpbuf
@@ -80,67 +80,104 @@ static int init_structs(png_structp * png, png_infop * info, png_infop * end_inf
   return 0;
 }
 
-#define CHECK_ERROR() 	do { if (at_exception_got_fatal(exp))	\
-	  {							\
-	    result = 0;						\
-	    goto cleanup;					\
-	  } } while (0)
+/* The place for ROW from CONSUMER, or NULL if it has none.  */
+static png_bytep row_buffer(at_input_consumer * consumer, unsigned short row)
+{
+  return consumer->buffer ? consumer->buffer(row, consumer->data) : NULL;
+}
 
-static int load_image(at_bitmap * image, FILE * stream, at_input_opts_type * opts, at_exception_type * exp)
+/* Rows are handed to CONSUMER as they are decoded, except those of
+   interlaced images, which are only complete after the last pass.
+   libpng decodes them in place when the consumer has a buffer for
+   them, so that the image is not copied once more.  */
+static void load_image(FILE * stream, at_input_opts_type * opts, at_input_consumer * consumer, at_exception_type * exp)
 {
   png_structp png;
   png_infop info, end_info;
-  png_bytep *rows;
+  png_bytep volatile pixels = NULL;
+  png_bytep *volatile rows = NULL;
+  png_bytep buffer;
   unsigned short width, height, row;
-  int pixel_size;
-  int result = 1;
+  int pixel_size, passes;
+  size_t rowbytes;
 
   if (!init_structs(&png, &info, &end_info, exp))
-    return 0;
-
-  png_init_io(png, stream);
-  CHECK_ERROR();
+    return;
 
-  rows = read_png(png, info, opts);
+  /* libpng jumps back here after handle_error */
+  if (setjmp(png_jmpbuf(png)))
+    goto cleanup;
 
+  png_init_io(png, stream);
+  passes = read_png_info(png, info, opts);
+
+  /* A bitmap is at most 65535 pixels wide and high, and the rows are
+     decoded into its own rows.  */
+  if (png_get_image_width(png, info) > G_MAXUSHORT || png_get_image_height(png, info) > G_MAXUSHORT) {
+    LOG("PNG image is %lu by %lu pixels\n", (unsigned long)png_get_image_width(png, info), (unsigned long)png_get_image_height(png, info));
+    at_exception_fatal(exp, "PNG image is too large");
+    goto cleanup;
+  }
   width = (unsigned short)png_get_image_width(png, info);
   height = (unsigned short)png_get_image_height(png, info);
-  if (png_get_color_type(png, info) == PNG_COLOR_TYPE_GRAY) {
-    pixel_size = 1;
+  pixel_size = png_get_channels(png, info);
+  rowbytes = png_get_rowbytes(png, info);
+  /* libpng writes ROWBYTES to each row it is given.  */
+  if (rowbytes != (size_t) width * pixel_size) {
+    at_exception_fatal(exp, "PNG rows are not 8-bit gray or RGB");
+    goto cleanup;
+  }
+  if (!consumer->begin(width, height, pixel_size, consumer->data))
+    goto cleanup;
+
+  if (passes > 1) {
+    XMALLOC(rows, height * sizeof(png_bytep));
+    for (row = 0; row < height; row++)
+      if ((rows[row] = row_buffer(consumer, row)) == NULL)
+        break;
+    if (row < height) {
+      XMALLOC(pixels, rowbytes * height);
+      for (row = 0; row < height; row++)
+        rows[row] = pixels + row * rowbytes;
+    }
+    png_read_image(png, rows);
+    for (row = 0; row < height; row++)
+      if (!consumer->row(row, rows[row], consumer->data))
+        goto cleanup;
   } else {
-    pixel_size = 3;
+    for (row = 0; row < height; row++) {
+      buffer = row_buffer(consumer, row);
+      if (buffer == NULL) {
+        if (pixels == NULL)
+          XMALLOC(pixels, rowbytes);
+        buffer = pixels;
+      }
+      png_read_row(png, buffer, NULL);
+      if (!consumer->row(row, buffer, consumer->data))
+        goto cleanup;
+    }
   }
+  png_read_end(png, end_info);
 
-  *image = at_bitmap_init(NULL, width, height, pixel_size);
-  for (row = 0; row < height; row++, rows++) {
-    memcpy(AT_BITMAP_PIXEL(image, row, 0), *rows, width * pixel_size * sizeof(unsigned char));
-  }
 cleanup:
+  free(rows);
+  free(pixels);
   finalize_structs(png, info, end_info);
-  return result;
 }
 
-at_bitmap input_png_reader(gchar * filename, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
+void input_png_reader(gchar * filename, FILE * stream, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
 {
-  FILE *stream;
-  at_bitmap image = at_bitmap_init(0, 0, 0, 1);
   at_exception_type exp = at_exception_new(msg_func, msg_data);
 
-  stream = fopen(filename, "rb");
-  if (!stream) {
-    LOG("Can't open \"%s\"\n", filename);
-    at_exception_fatal(&exp, "Cannot open input png file");
-    return image;
-  }
-
-  load_image(&image, stream, opts, &exp);
-  fclose(stream);
-
-  return image;
+  load_image(stream, opts, consumer, &exp);
 }
 
-static png_bytep *read_png(png_structp png_ptr, png_infop info_ptr, at_input_opts_type * opts)
+/* Set up the transformations giving 8-bit gray or RGB rows and
+   return the number of passes to read them in.  */
+static int read_png_info(png_structp png_ptr, png_infop info_ptr, at_input_opts_type * opts)
 {
+  int passes;
+
   png_color_16p original_bg;
   png_color_16 my_bg;
 
@@ -167,10 +204,7 @@ static png_bytep *read_png(png_structp png_ptr, png_infop info_ptr, at_input_opt
     png_set_background(png_ptr, &my_bg, PNG_BACKGROUND_GAMMA_FILE, 1, 1.0);
   } else
     png_set_strip_alpha(png_ptr);
-  png_set_interlace_handling(png_ptr);
+  passes = png_set_interlace_handling(png_ptr);
   png_read_update_info(png_ptr, info_ptr);
-
-  png_read_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
-  png_read_end(png_ptr, info_ptr);
-  return png_get_rows(png_ptr, info_ptr);
+  return passes;
 }
@@ -24,6 +24,6 @@
 
 #include "input.h"
 
-at_bitmap input_png_reader(gchar * filename, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data, gpointer user_data);
+void input_png_reader(gchar * filename, FILE * stream, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data, gpointer user_data);
 
 #endif /* not INPUT_PNG_H */
@@ -32,9 +32,15 @@
 #include "input-pnm.h"
 #include "logreport.h"
 #include "xstd.h"
+#include "pixel.h"
 
 #include <math.h>
 #include <ctype.h>
+#include <limits.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /* Declare local data types
  */
@@ -55,8 +61,9 @@ typedef struct _PNMInfo {
                                  * which we need to normalize to */
   int np;                       /* Number of image planes (0 for pbm) */
   int asciibody;                /* 1 if ascii body, 0 if raw body */
+  int packed;                   /* 1 if pbm rows are handed over packed */
   /* Routine to use to load the pnm body */
-  void (*loader) (PNMScanner *, struct _PNMInfo *, unsigned char *, at_exception_type * excep);
+  void (*loader) (PNMScanner *, struct _PNMInfo *, at_input_consumer *, at_exception_type * excep);
 } PNMInfo;
 
 #define BUFLEN 512              /* The input buffer size for data returned
@@ -65,19 +72,28 @@ typedef struct _PNMInfo {
                                  * by the spec anyways so this shouldn't
                                  * be an issue. */
 
+#define ASCII_BUFLEN 65536      /* The input buffer size for ascii bodies */
+
+#define RAW_BLOCK 65536         /* Samples to read and scale at a time
+                                 * when they need scaling */
+
 /* Declare some local functions.
  */
 
-static void pnm_load_ascii(PNMScanner * scan, PNMInfo * info, unsigned char *pixel_rgn, at_exception_type * excep);
-static void pnm_load_raw(PNMScanner * scan, PNMInfo * info, unsigned char *pixel_rgn, at_exception_type * excep);
-static void pnm_load_rawpbm(PNMScanner * scan, PNMInfo * info, unsigned char *pixel_rgn, at_exception_type * excep);
+static void pnm_load_ascii(PNMScanner * scan, PNMInfo * info, at_input_consumer * consumer, at_exception_type * excep);
+static void pnm_load_raw(PNMScanner * scan, PNMInfo * info, at_input_consumer * consumer, at_exception_type * excep);
+static void pnm_load_rawpbm(PNMScanner * scan, PNMInfo * info, at_input_consumer * consumer, at_exception_type * excep);
+
+static unsigned char *pnm_scale_table(int maxval);
 
 static void pnmscanner_destroy(PNMScanner * s);
 static void pnmscanner_createbuffer(PNMScanner * s, unsigned int bufsize);
+static int pnmscanner_fillbuffer(PNMScanner * s);
+static int pnmscanner_getnumber(PNMScanner * s);
+static unsigned int pnmscanner_getbits(PNMScanner * s, unsigned char *data, unsigned int count);
 static void pnmscanner_getchar(PNMScanner * s);
 static void pnmscanner_eatwhitespace(PNMScanner * s);
 static void pnmscanner_gettoken(PNMScanner * s, unsigned char *buf, unsigned int bufsize);
-static void pnmscanner_getsmalltoken(PNMScanner * s, unsigned char *buf);
 
 static PNMScanner *pnmscanner_create(FILE * fd);
 
@@ -89,7 +105,7 @@ static struct struct_pnm_types {
   int np;
   int asciibody;
   int maxval;
-  void (*loader) (PNMScanner *, struct _PNMInfo *, unsigned char *pixel_rgn, at_exception_type * excep);
+  void (*loader) (PNMScanner *, struct _PNMInfo *, at_input_consumer * consumer, at_exception_type * excep);
 } pnm_types[] = {
   {
   '1', 0, 1, 1, pnm_load_ascii},  /* ASCII PBM */
@@ -107,25 +123,14 @@ static struct struct_pnm_types {
   0, 0, 0, 0, NULL}
 };
 
-at_bitmap input_pnm_reader(gchar * filename, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
+void input_pnm_reader(gchar * filename, FILE * fd, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
 {
   char buf[BUFLEN];             /* buffer for random things like scanning */
   PNMInfo *pnminfo;
   PNMScanner *volatile scan;
   int ctr;
-  FILE *fd;
-  at_bitmap bitmap = at_bitmap_init(NULL, 0, 0, 0);
   at_exception_type excep = at_exception_new(msg_func, msg_data);
 
-  /* open the file */
-  fd = fopen(filename, "rb");
-
-  if (fd == NULL) {
-    LOG("pnm filter: can't open file\n");
-    at_exception_fatal(&excep, "pnm filter: can't open file");
-    return (bitmap);
-  }
-
   /* allocate the necessary structures */
   pnminfo = (PNMInfo *) malloc(sizeof(PNMInfo));
 
@@ -196,16 +201,18 @@ at_bitmap input_pnm_reader(gchar * filename, at_input_opts_type * opts, at_msg_f
     }
 
     pnminfo->maxval = isdigit(*buf) ? atoi(buf) : 0;
-    if ((pnminfo->maxval <= 0)
-        || (pnminfo->maxval > 255 && !pnminfo->asciibody)) {
+    if ((pnminfo->maxval <= 0) || (pnminfo->maxval > 65535)) {
       LOG("pnm filter: invalid maxval while loading\n");
       at_exception_fatal(&excep, "pnm filter: invalid maxval while loading");
       goto cleanup;
     }
   }
 
-  bitmap = at_bitmap_init(NULL, (unsigned short)pnminfo->xres, (unsigned short)pnminfo->yres, (pnminfo->np) ? (pnminfo->np) : 1);
-  pnminfo->loader(scan, pnminfo, AT_BITMAP_BITS(&bitmap), &excep);
+  /* pbm's are kept packed when the consumer takes them so */
+  pnminfo->packed = !pnminfo->np && consumer->begin_packed;
+  if (pnminfo->packed ? consumer->begin_packed((unsigned short)pnminfo->xres, (unsigned short)pnminfo->yres, 1, consumer->data)
+      : consumer->begin((unsigned short)pnminfo->xres, (unsigned short)pnminfo->yres, (pnminfo->np) ? (pnminfo->np) : 1, consumer->data))
+    pnminfo->loader(scan, pnminfo, consumer, &excep);
 
 cleanup:
   /* Destroy the scanner */
@@ -213,133 +220,244 @@ cleanup:
 
   /* free the structures */
   free(pnminfo);
-
-  /* close the file */
-  fclose(fd);
-
-  return (bitmap);
 }
 
-static void pnm_load_ascii(PNMScanner * scan, PNMInfo * info, unsigned char *data, at_exception_type * excep)
+static void pnm_load_ascii(PNMScanner * scan, PNMInfo * info, at_input_consumer * consumer, at_exception_type * excep)
 {
-  unsigned char *d;
-  unsigned int x;
-  int i, b;
-  int start, end, scanlines;
-  int np;
-  char buf[BUFLEN];
-
-  np = (info->np) ? (info->np) : 1;
+  size_t rowlen, i;
+  unsigned int row;
+  int value, eof = 0;
+  unsigned char *data, *scale, *bits = NULL;
 
   /* Buffer reads to increase performance */
-  pnmscanner_createbuffer(scan, 4096);
-
-  start = 0;
-  end = info->yres;
-  scanlines = end - start;
-  d = data;
-
-  for (i = 0; i < scanlines; i++)
-    for (x = 0; x < info->xres; x++) {
-      for (b = 0; b < np; b++) {
-        /* Truncated files will just have all 0's at the end of the images */
-        if (pnmscanner_eof(scan)) {
-          LOG("pnm filter: premature end of file\n");
-          at_exception_fatal(excep, "pnm filter: premature end of file");
-          return;
-        }
-        if (info->np)
-          pnmscanner_gettoken(scan, (unsigned char *)buf, BUFLEN);
-        else
-          pnmscanner_getsmalltoken(scan, (unsigned char *)buf);
+  pnmscanner_createbuffer(scan, ASCII_BUFLEN);
+
+  rowlen = (size_t) info->xres * (info->np ? info->np : 1);
+  XMALLOC(data, rowlen);
+  if (info->packed)
+    XMALLOC(bits, (rowlen + 7) / 8);
+  scale = info->maxval > 1 && info->maxval != 255 ? pnm_scale_table(info->maxval) : NULL;
+
+  for (row = 0; row < info->yres; row++) {
+    if (eof)
+      i = 0;
+    else if (!info->np)
+      i = pnmscanner_getbits(scan, data, rowlen);
+    else
+      for (i = 0; i < rowlen; i++) {
+        value = pnmscanner_getnumber(scan);
+        if (value < 0)
+          break;
         switch (info->maxval) {
         case 255:
-          d[b] = (unsigned char)(isdigit(*buf) ? atoi(buf) : 0);
+          data[i] = (unsigned char)value;
           break;
         case 1:
-          d[b] = (*buf == '0') ? 0xff : 0x00;
+          data[i] = (value == 0) ? 0xff : 0x00;
           break;
         default:
-          d[b] = (unsigned char)(255.0 * (((double)(isdigit(*buf) ? atoi(buf) : 0))
-                                          / (double)(info->maxval)));
+          data[i] = value <= info->maxval ? scale[value] : (unsigned char)(255.0 * ((double)value / (double)(info->maxval)));
         }
       }
 
-      d += np;
+    /* Truncated files will just have all 0's at the end of the images */
+    if (i < rowlen)
+      memset(data + i, 0, rowlen - i);
+    if (bits)
+      at_bitmap_pack_row(bits, data, rowlen);
+    if (i < rowlen && !eof) {
+      LOG("pnm filter: premature end of file\n");
+      at_exception_fatal(excep, "pnm filter: premature end of file");
+      eof = 1;
     }
+    if (!consumer->row(row, bits ? bits : data, consumer->data))
+      break;
+  }
+  free(bits);
+  free(data);
+  free(scale);
 }
 
-static void pnm_load_raw(PNMScanner * scan, PNMInfo * info, unsigned char *data, at_exception_type * excep)
+/* Samples with a maxval of 255 are read straight into the rows of
+   CONSUMER when it has a place for them, all of them at once when
+   those places follow one another as the rows of a bitmap do.
+   Samples with a maxval of 65535 are scaled by pixel_kernels.  Others,
+   one or two bytes each (most significant first) as the maxval asks,
+   are scaled through a table.  */
+static void pnm_load_raw(PNMScanner * scan, PNMInfo * info, at_input_consumer * consumer, at_exception_type * excep)
 {
-  unsigned char *d;
-  unsigned int x, i;
-  unsigned int start, end, scanlines;
+  size_t rowlen = (size_t) info->xres * info->np;
+  size_t bytes = info->maxval > 255 ? 2 : 1;
+  size_t n, i;
+  unsigned int row;
+  unsigned char *data = NULL, *dest, *buf = NULL, *scale = NULL;
+  int eof = 0;
   FILE *fd;
 
   fd = pnmscanner_fd(scan);
 
-  start = 0;
-  end = info->yres;
-  scanlines = end - start;
-  d = data;
-
-  for (i = 0; i < scanlines; i++) {
-    if (info->xres * info->np != fread(d, 1, info->xres * info->np, fd)) {
-      LOG("pnm filter: premature end of file\n");
-      at_exception_fatal(excep, "pnm filter: premature end of file\n");
+  if (info->maxval == 255 && consumer->buffer && info->yres > 0) {
+    unsigned char *first = consumer->buffer(0, consumer->data);
+
+    for (row = 1; first && row < info->yres; row++)
+      if (consumer->buffer(row, consumer->data) != first + row * rowlen)
+        break;
+    if (first && row == info->yres) {
+      /* The rows past the end of a truncated file are black.  */
+      n = fread(first, 1, rowlen * info->yres, fd);
+      if (n < rowlen * info->yres) {
+        memset(first + n, 0, rowlen * info->yres - n);
+        LOG("pnm filter: premature end of file\n");
+        at_exception_fatal(excep, "pnm filter: premature end of file\n");
+      }
+      for (row = 0; row < info->yres; row++)
+        if (!consumer->row(row, first + row * rowlen, consumer->data))
+          break;
       return;
     }
+  }
+
+  if (info->maxval != 255) {
+    if (info->maxval != 65535)
+      scale = pnm_scale_table(info->maxval);
+    XMALLOC(buf, rowlen * bytes);
+  }
+
+  for (row = 0; row < info->yres; row++) {
+    dest = consumer->buffer ? consumer->buffer(row, consumer->data) : NULL;
+    if (dest == NULL) {
+      if (data == NULL)
+        XMALLOC(data, rowlen);
+      dest = data;
+    }
+
+    if (eof)
+      n = 0;
+    else if (buf == NULL)
+      n = fread(dest, 1, rowlen, fd);
+    else {
+      n = fread(buf, bytes, rowlen, fd);
+      if (info->maxval == 65535)
+        pixel_kernels()->be16_to_8(dest, buf, n);
+      else if (bytes == 2) {
+        for (i = 0; i < n; i++) {
+          int value = buf[2 * i] << 8 | buf[2 * i + 1];
+
+          dest[i] = value <= info->maxval ? scale[value] : 255;
+        }
+      } else {
+        for (i = 0; i < n; i++)
+          dest[i] = buf[i] <= info->maxval ? scale[buf[i]] : 255;
+      }
+    }
 
-    if (info->maxval != 255) {  /* Normalize if needed */
-      for (x = 0; x < info->xres * info->np; x++)
-        d[x] = (unsigned char)(255.0 * (double)(d[x]) / (double)(info->maxval));
+    /* The rest of a truncated file is black.  */
+    if (n != rowlen) {
+      memset(dest + n, 0, rowlen - n);
+      if (!eof) {
+        LOG("pnm filter: premature end of file\n");
+        at_exception_fatal(excep, "pnm filter: premature end of file\n");
+        eof = 1;
+      }
     }
+    if (!consumer->row(row, dest, consumer->data))
+      break;
+  }
+  free(buf);
+  free(data);
+  free(scale);
+}
 
-    d += info->xres * info->np;
+/* The bits of ROW a truncated file stops short of, after N of its
+   ROWLEN bytes, are 0 (white), as are those of the rows after it.  */
+static void pnm_short_pbm_row(unsigned char *row, size_t n, unsigned int rowlen, int *eof, at_exception_type * excep)
+{
+  memset(row + n, 0, rowlen - n);
+  if (!*eof) {
+    LOG("pnm filter: error reading file\n");
+    at_exception_fatal(excep, "pnm filter: error reading file");
+    *eof = 1;
   }
 }
 
-static void pnm_load_rawpbm(PNMScanner * scan, PNMInfo * info, unsigned char *data, at_exception_type * excep)
+/* Packed rows are the rows of the file, so they are read straight
+   into the places of CONSUMER.  */
+static void pnm_load_rawpbm(PNMScanner * scan, PNMInfo * info, at_input_consumer * consumer, at_exception_type * excep)
 {
   unsigned char *buf;
   unsigned char curbyte;
   unsigned char *d;
   unsigned int x, i;
-  unsigned int start, end, scanlines;
   FILE *fd;
   unsigned int rowlen, bufpos;
+  size_t n;
+  int eof = 0;
 
   fd = pnmscanner_fd(scan);
   rowlen = (unsigned int)ceil((double)(info->xres) / 8.0);
   buf = (unsigned char *)malloc(rowlen * sizeof(unsigned char));
 
-  start = 0;
-  end = info->yres;
-  scanlines = end - start;
-  d = data;
-
-  for (i = 0; i < scanlines; i++) {
-    if (rowlen != fread(buf, 1, rowlen, fd)) {
-      LOG("pnm filter: error reading file\n");
-      at_exception_fatal(excep, "pnm filter: error reading file");
-      goto cleanup;
+  if (info->packed) {
+    for (i = 0; i < info->yres; i++) {
+      d = consumer->buffer ? consumer->buffer(i, consumer->data) : NULL;
+      if (d == NULL)
+        d = buf;
+      n = eof ? 0 : fread(d, 1, rowlen, fd);
+      if (n != rowlen)
+        pnm_short_pbm_row(d, n, rowlen, &eof, excep);
+      AT_BITMAP_CLEAR_PAD(d, info->xres);
+      if (!consumer->row(i, d, consumer->data))
+        break;
     }
+    free(buf);
+    return;
+  }
+
+  XMALLOC(d, info->xres);
+
+  for (i = 0; i < info->yres; i++) {
+    n = eof ? 0 : fread(buf, 1, rowlen, fd);
+    if (n != rowlen)
+      pnm_short_pbm_row(buf, n, rowlen, &eof, excep);
     bufpos = 0;
     curbyte = buf[0];
 
     for (x = 0; x < info->xres; x++) {
-      if ((x % 8) == 0)
+      if ((x % 8) == 0) {
         curbyte = buf[bufpos++];
+        /* Bilevel scans are mostly bytes of one color */
+        if ((curbyte == 0x00 || curbyte == 0xff) && x + 8 <= info->xres) {
+          memset(d + x, curbyte ^ 0xff, 8);
+          x += 7;
+          continue;
+        }
+      }
       d[x] = (curbyte & 0x80) ? 0x00 : 0xff;
       curbyte <<= 1;
     }
 
-    d += info->xres;
+    if (!consumer->row(i, d, consumer->data))
+      break;
   }
-cleanup:
+  free(d);
   free(buf);
 }
 
+/* pnm_scale_table ---
+ *    Returns a new table giving the 0..255 value of every sample
+ *    0..MAXVAL.
+ */
+static unsigned char *pnm_scale_table(int maxval)
+{
+  unsigned char *scale;
+  int value;
+
+  XMALLOC(scale, maxval + 1);
+  for (value = 0; value <= maxval; value++)
+    scale[value] = (unsigned char)(255.0 * ((double)value / (double)maxval));
+  return scale;
+}
+
 /**************** FILE SCANNER UTILITIES **************/
 
 /* pnmscanner_create ---
@@ -367,14 +485,120 @@ static void pnmscanner_destroy(PNMScanner * s)
 }
 
 /* pnmscanner_createbuffer ---
- *    Creates a buffer so we can do buffered reads.
+ *    Creates a buffer so we can do buffered reads.  The rest of the
+ *    input, from the current character on, can then only be read with
+ *    pnmscanner_getnumber and pnmscanner_getbits.
  */
 static void pnmscanner_createbuffer(PNMScanner * s, unsigned int bufsize)
 {
   s->inbuf = (char *)malloc(sizeof(char) * bufsize);
   s->inbufsize = bufsize;
   s->inbufpos = 0;
-  s->inbufvalidsize = fread(s->inbuf, 1, bufsize, s->fd);
+  s->inbufvalidsize = 0;
+  if (!s->eof)
+    s->inbuf[s->inbufvalidsize++] = s->cur;
+  s->inbufvalidsize += fread(s->inbuf + s->inbufvalidsize, 1, bufsize - s->inbufvalidsize, s->fd);
+}
+
+/* pnmscanner_fillbuffer ---
+ *    Refills the buffer once all of it has been used.  Returns 0 at
+ *    end of file.
+ */
+static int pnmscanner_fillbuffer(PNMScanner * s)
+{
+  if (s->inbufpos < s->inbufvalidsize)
+    return 1;
+  s->inbufpos = 0;
+  s->inbufvalidsize = fread(s->inbuf, 1, s->inbufsize, s->fd);
+  s->eof = (s->inbufvalidsize == 0);
+  return !s->eof;
+}
+
+/* pnmscanner_getnumber ---
+ *    Parses the next token from the buffer as a decimal number, eating
+ *    any leading whitespace and comments.  A token that does not start
+ *    with a digit counts as 0.  Returns -1 at end of file.
+ */
+static int pnmscanner_getnumber(PNMScanner * s)
+{
+  const unsigned char *p, *end;
+  int digits = 1, value = 0;
+
+  /* Skip whitespace and comments */
+  for (;;) {
+    if (!pnmscanner_fillbuffer(s))
+      return -1;
+    p = (const unsigned char *)s->inbuf + s->inbufpos;
+    end = (const unsigned char *)s->inbuf + s->inbufvalidsize;
+    while (p < end && isspace(*p))
+      p++;
+    s->inbufpos = p - (const unsigned char *)s->inbuf;
+    if (p == end)
+      continue;
+    if (*p != '#')
+      break;
+    while (pnmscanner_fillbuffer(s) && s->inbuf[s->inbufpos] != '\n')
+      s->inbufpos++;
+  }
+
+  /* Read the digits.  Most tokens end in the buffer with whitespace.  */
+  while (p < end && isdigit(*p) && value <= (INT_MAX - 9) / 10)
+    value = value * 10 + (*p++ - '0');
+  s->inbufpos = p - (const unsigned char *)s->inbuf;
+  if (p < end && isspace(*p))
+    return value;
+
+  /* Then whatever else the token has, one character at a time */
+  while (pnmscanner_fillbuffer(s)) {
+    unsigned char c = s->inbuf[s->inbufpos];
+
+    if (isspace(c) || c == '#')
+      break;
+    if (!isdigit(c))
+      digits = 0;
+    else if (digits && value <= (INT_MAX - 9) / 10)
+      value = value * 10 + (c - '0');
+    s->inbufpos++;
+  }
+  return value;
+}
+
+/* pnmscanner_getbits ---
+ *    Reads up to COUNT pbm pixels into DATA, each pixel being a single
+ *    character, white for '0' and black otherwise.  Whitespace and
+ *    comments in between are eaten.  Returns the number of pixels read,
+ *    which is less than COUNT at end of file.
+ */
+static unsigned int pnmscanner_getbits(PNMScanner * s, unsigned char *data, unsigned int count)
+{
+  unsigned int i = 0;
+  unsigned char c;
+
+  while (i < count && pnmscanner_fillbuffer(s)) {
+#ifdef __SSE2__
+    /* Rows of digits without spaces go sixteen at a time */
+    while (count - i >= 16 && s->inbufvalidsize - s->inbufpos >= 16) {
+      __m128i chars = _mm_loadu_si128((const __m128i *)(s->inbuf + s->inbufpos));
+      __m128i zeros = _mm_cmpeq_epi8(chars, _mm_set1_epi8('0'));
+      __m128i ones = _mm_cmpeq_epi8(chars, _mm_set1_epi8('1'));
+
+      if (_mm_movemask_epi8(_mm_or_si128(zeros, ones)) != 0xffff)
+        break;
+      _mm_storeu_si128((__m128i *) (data + i), zeros);
+      s->inbufpos += 16;
+      i += 16;
+    }
+    if (i == count || s->inbufpos >= s->inbufvalidsize)
+      continue;
+#endif
+    c = s->inbuf[s->inbufpos++];
+    if (c == '#') {
+      while (pnmscanner_fillbuffer(s) && s->inbuf[s->inbufpos] != '\n')
+        s->inbufpos++;
+    } else if (!isspace(c))
+      data[i++] = (c == '0') ? 0xff : 0x00;
+  }
+  return i;
 }
 
 /* pnmscanner_gettoken ---
@@ -392,34 +616,12 @@ static void pnmscanner_gettoken(PNMScanner * s, unsigned char *buf, unsigned int
   buf[ctr] = '\0';
 }
 
-/* pnmscanner_getsmalltoken ---
- *    Gets the next char, eating any leading whitespace.
- */
-static void pnmscanner_getsmalltoken(PNMScanner * s, unsigned char *buf)
-{
-  pnmscanner_eatwhitespace(s);
-  if (!(s->eof) && !isspace(s->cur) && (s->cur != '#')) {
-    *buf = s->cur;
-    pnmscanner_getchar(s);
-  }
-}
-
 /* pnmscanner_getchar ---
  *    Reads a character from the input stream
  */
 static void pnmscanner_getchar(PNMScanner * s)
 {
-  if (s->inbuf) {
-    s->cur = s->inbuf[s->inbufpos++];
-    if (s->inbufpos >= s->inbufvalidsize) {
-      if (s->inbufsize > s->inbufvalidsize)
-        s->eof = 1;
-      else
-        s->inbufvalidsize = fread(s->inbuf, 1, s->inbufsize, s->fd);
-      s->inbufpos = 0;
-    }
-  } else
-    s->eof = !fread(&(s->cur), 1, 1, s->fd);
+  s->eof = !fread(&(s->cur), 1, 1, s->fd);
 }
 
 /* pnmscanner_eatwhitespace ---
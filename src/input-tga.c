@@ -31,6 +31,7 @@
 #include "bitmap.h"
 #include "logreport.h"
 #include "xstd.h"
+#include "pixel.h"
 #include "input-bmp.h"
 
 /* TODO:
@@ -101,64 +102,64 @@ static struct {
   char null;
 } tga_footer;
 
-static at_bitmap ReadImage(FILE * fp, struct tga_header *hdr, at_exception_type * exp);
-at_bitmap input_tga_reader(gchar * filename, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
+static void ReadImage(FILE * fp, struct tga_header *hdr, const at_color * background, at_input_consumer * consumer, at_exception_type * exp);
+void input_tga_reader(gchar * filename, FILE * fp, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data, gpointer user_data)
 {
-  FILE *fp;
   struct tga_header hdr;
+  long start = ftell(fp);
 
-  at_bitmap image = at_bitmap_init(0, 0, 0, 1);
+  at_color white = { 0xff, 0xff, 0xff };
   at_exception_type exp = at_exception_new(msg_func, msg_data);
 
-  fp = fopen(filename, "rb");
-  if (!fp) {
-    LOG("TGA: can't open \"%s\"\n", filename);
-    at_exception_fatal(&exp, "Cannot open input tga file");
-  }
-
   /* Check the footer. */
   if (fseek(fp, 0L - (sizeof(tga_footer)), SEEK_END)
       || fread(&tga_footer, sizeof(tga_footer), 1, fp) != 1) {
     LOG("TGA: Cannot read footer from \"%s\"\n", filename);
     at_exception_fatal(&exp, "TGA: Cannot read footer");
-    goto cleanup;
+    return;
   }
 
   /* Check the signature. */
 
-  if (fseek(fp, 0, SEEK_SET) || fread(&hdr, sizeof(hdr), 1, fp) != 1) {
+  if (start < 0 || fseek(fp, start, SEEK_SET) || fread(&hdr, sizeof(hdr), 1, fp) != 1) {
     LOG("TGA: Cannot read header from \"%s\"\n", filename);
     at_exception_fatal(&exp, "TGA: Cannot read header");
-    goto cleanup;
+    return;
   }
 
   /* Skip the image ID field. */
   if (hdr.idLength && fseek(fp, hdr.idLength, SEEK_CUR)) {
     LOG("TGA: Cannot skip ID field in \"%s\"\n", filename);
     at_exception_fatal(&exp, "TGA: Cannot skip ID field");
-    goto cleanup;
+    return;
   }
 
-  image = ReadImage(fp, &hdr, &exp);
-cleanup:
-  fclose(fp);
-  return image;
+  /* Pixels with alpha are laid over the background color, or white. */
+  ReadImage(fp, &hdr, opts && opts->background_color ? opts->background_color : &white, consumer, &exp);
 }
 
-static int std_fread(unsigned char *buf, int datasize, int nelems, FILE * fp)
+#define RLE_PACKETSIZE 0x80
+
+/* The part of an RLE packet that ran past the end of the last row
+   read.  Each image has its own, sized for its pixels. */
+struct rle_state {
+  unsigned char *statebuf;      /* One packet: RLE_PACKETSIZE pixels */
+  int statelen;                 /* Bytes decoded into STATEBUF */
+  int laststate;                /* Bytes of them already handed out */
+};
+
+static int std_fread(unsigned char *buf, int datasize, int nelems, FILE * fp, struct rle_state *state)
 {
 
   return fread(buf, datasize, nelems, fp);
 }
 
-#define RLE_PACKETSIZE 0x80
-
 /* Decode a bufferful of file. */
-static int rle_fread(unsigned char *buf, int datasize, int nelems, FILE * fp)
+static int rle_fread(unsigned char *buf, int datasize, int nelems, FILE * fp, struct rle_state *state)
 {
-  static unsigned char *statebuf = 0;
-  static int statelen = 0;
-  static int laststate = 0;
+  unsigned char *statebuf = state->statebuf;
+  int statelen = state->statelen;
+  int laststate = state->laststate;
 
   int j, k;
   int buflen, count, bytes;
@@ -189,9 +190,8 @@ static int rle_fread(unsigned char *buf, int datasize, int nelems, FILE * fp)
 
     /* Decode the next packet. */
     count = fgetc(fp);
-    if (count == EOF) {
-      return j / datasize;
-    }
+    if (count == EOF)
+      break;
 
     /* Scale the byte length to the size of the data. */
     bytes = ((count & ~RLE_PACKETSIZE) + 1) * datasize;
@@ -200,17 +200,13 @@ static int rle_fread(unsigned char *buf, int datasize, int nelems, FILE * fp)
       /* We can copy directly into the image buffer. */
       p = buf + j;
     } else {
-      /* Allocate the state buffer if we haven't already. */
-      if (!statebuf)
-        statebuf = (unsigned char *)malloc(RLE_PACKETSIZE * datasize);
       p = statebuf;
     }
 
     if (count & RLE_PACKETSIZE) {
       /* Fill the buffer with the next value. */
-      if (fread(p, datasize, 1, fp) != 1) {
-        return j / datasize;
-      }
+      if (fread(p, datasize, 1, fp) != 1)
+        break;
 
       /* Optimized case for single-byte encoded data. */
       if (datasize == 1)
@@ -220,9 +216,8 @@ static int rle_fread(unsigned char *buf, int datasize, int nelems, FILE * fp)
           memcpy(p + k, p, datasize);
     } else {
       /* Read in the buffer. */
-      if (fread(p, bytes, 1, fp) != 1) {
-        return j / datasize;
-      }
+      if (fread(p, bytes, 1, fp) != 1)
+        break;
     }
 
     /* We may need to copy bytes from the state buffer. */
@@ -232,29 +227,34 @@ static int rle_fread(unsigned char *buf, int datasize, int nelems, FILE * fp)
       j += bytes;
   }
 
-  return nelems;
+  state->statelen = statelen;
+  state->laststate = laststate;
+  return j < buflen ? j / datasize : nelems;
 }
 
-static at_bitmap ReadImage(FILE * fp, struct tga_header *hdr, at_exception_type * exp)
+/* Rows stored top-down are handed to CONSUMER as they are read.
+   Those stored bottom-up are decoded where they belong and handed over
+   once they are all read.  */
+static void ReadImage(FILE * fp, struct tga_header *hdr, const at_color * background, at_input_consumer * consumer, at_exception_type * exp)
 {
-  at_bitmap image = at_bitmap_init(0, 0, 0, 1);
   unsigned char *buffer = NULL;
-  unsigned char *alphas = NULL;
+  unsigned char *grays = NULL;
+  unsigned char **places = NULL, *own = NULL;
+  unsigned char palette[256][3];
 
-  unsigned short width, height, bpp, abpp, pbpp, nalphas;
+  unsigned short width, height, bpp, abpp, pbpp;
   int j, k;
-  int pelbytes, wbytes, bsize, npels, pels;
-  int rle, badread;
+  int pelbytes, pels;
+  int rle, eof = 0;
   int itype, dtype;
-  unsigned char *cmap = NULL;
-  int (*myfread) (unsigned char *, int, int, FILE *);
+  int (*myfread) (unsigned char *, int, int, FILE *, struct rle_state *);
+  struct rle_state state = { NULL, 0, 0 };
+  const pixel_kernels_type *kernels = pixel_kernels();
 
   /* Find out whether the image is horizontally or vertically reversed. */
   char horzrev = (char)(hdr->descriptor & TGA_DESC_HORIZONTAL);
   char vertrev = (char)(!(hdr->descriptor & TGA_DESC_VERTICAL));
 
-  image.bitmap = NULL;
-
   /* Reassemble the multi-byte values correctly, regardless of
      host endianness. */
   width = (hdr->widthHi << 8) | hdr->widthLo;
@@ -305,7 +305,7 @@ static at_bitmap ReadImage(FILE * fp, struct tga_header *hdr, at_exception_type
     if (bpp != 8) {             /* We can only cope with 8-bit indices. */
       LOG("TGA: index sizes other than 8 bits are unimplemented\n");
       at_exception_fatal(exp, "TGA: index sizes other than 8 bits are unimplemented");
-      return image;
+      return;
     }
 
     if (abpp)
@@ -340,7 +340,7 @@ static at_bitmap ReadImage(FILE * fp, struct tga_header *hdr, at_exception_type
     {
       LOG("TGA: unrecognized image type %d\n", hdr->imageType);
       at_exception_fatal(exp, "TGA: unrecognized image type");
-      return image;
+      return;
     }
   }
 
@@ -348,7 +348,7 @@ static at_bitmap ReadImage(FILE * fp, struct tga_header *hdr, at_exception_type
     /* FIXME: We haven't implemented bit-packed fields yet. */
     LOG("TGA: channel sizes other than 8 bits are unimplemented\n");
     at_exception_fatal(exp, "TGA: channel sizes other than 8 bits are unimplemented");
-    return image;
+    return;
   }
 
   /* Check that we have a color map only when we need it. */
@@ -356,19 +356,19 @@ static at_bitmap ReadImage(FILE * fp, struct tga_header *hdr, at_exception_type
     if (hdr->colorMapType != 1) {
       LOG("TGA: indexed image has invalid color map type %d\n", hdr->colorMapType);
       at_exception_fatal(exp, "TGA: indexed image has invalid color map type");
-      return image;
+      return;
     }
   } else if (hdr->colorMapType != 0) {
     LOG("TGA: non-indexed image has invalid color map type %d\n", hdr->colorMapType);
     at_exception_fatal(exp, "TGA: non-indexed image has invalid color map type");
-    return image;
+    return;
   }
 
-  nalphas = 0;
   if (hdr->colorMapType == 1) {
     /* We need to read in the colormap. */
-    int index, colors;
+    int index, count;
     unsigned int length;
+    unsigned char *cmap;
 
     index = (hdr->colorMapIndexHi << 8) | hdr->colorMapIndexLo;
     length = (hdr->colorMapLengthHi << 8) | hdr->colorMapLengthLo;
@@ -376,168 +376,123 @@ static at_bitmap ReadImage(FILE * fp, struct tga_header *hdr, at_exception_type
     if (length == 0) {
       LOG("TGA: invalid color map length %d\n", length);
       at_exception_fatal(exp, "TGA: invalid color map length");
-      return image;
+      return;
     }
 
     pelbytes = ROUNDUP_DIVIDE(hdr->colorMapSize, 8);
-    colors = length + index;
-    cmap = (unsigned char *)malloc(colors * pelbytes);
-
-    /* Zero the entries up to the beginning of the map. */
-    memset(cmap, 0, index * pelbytes);
-
-    /* Read in the rest of the colormap. */
-    if (fread(cmap + (index * pelbytes), pelbytes, length, fp) != length) {
+    XMALLOC(cmap, length * pelbytes);
+    if (fread(cmap, pelbytes, length, fp) != length) {
       LOG("TGA: error reading colormap (ftell == %ld)\n", ftell(fp));
       at_exception_fatal(exp, "TGA: error reading colormap");
-      return image;
+      free(cmap);
+      return;
     }
 
-    /* If we have an alpha channel, then create a mapping to the alpha
-       values. */
-    if (pelbytes > 3)
-      alphas = (unsigned char *)malloc(colors);
-
-    k = 0;
-    for (j = 0; j < colors * pelbytes; j += pelbytes) {
-      /* Swap from BGR to RGB. */
-      unsigned char tmp = cmap[j];
-      cmap[k++] = cmap[j + 2];
-      cmap[k++] = cmap[j + 1];
-      cmap[k++] = tmp;
-
-      /* Take the alpha values out of the colormap. */
-      if (alphas)
-        alphas[nalphas++] = cmap[j + 3];
+    /* The entries up to the beginning of the map are black, and those
+       an 8-bit index cannot reach are left out.  Entries with alpha
+       are laid over the background once and for all.  */
+    memset(palette, 0, sizeof(palette));
+    count = MIN((int)length, 256 - index);
+    if (count > 0) {
+      if (pelbytes > 3)
+        kernels->bgra_over(palette[index], cmap, count, background);
+      else
+        kernels->bgr_to_rgb(palette[index], cmap, count);
     }
-
-    /* If the last color was transparent, then omit it from the
-       mapping. */
-    if (nalphas && alphas[nalphas - 1] == 0)
-      colors--;
+    free(cmap);
 
     /* Now pretend as if we only have 8 bpp. */
     abpp = 0;
     pbpp = 8;
-    pelbytes = 1;
-  } else
-    pelbytes = 3;
-
-  image = at_bitmap_init(NULL, width, height, 3);
+  }
 
   /* Calculate TGA bytes per pixel. */
   bpp = ROUNDUP_DIVIDE(pbpp + abpp, 8);
 
-  /* Maybe we need to reverse the data. */
-  if (horzrev || vertrev)
-    buffer = (unsigned char *)malloc(width * height * pelbytes * sizeof(unsigned char));
   if (rle)
     myfread = rle_fread;
   else
     myfread = std_fread;
 
-  wbytes = width * pelbytes;
-  badread = 0;
-
-  npels = width * height;
-  bsize = wbytes * height;
+  if (!consumer->begin(width, height, 3, consumer->data))
+    return;
 
-  /* Suck in the data one height at a time. */
-  if (badread)
-    pels = 0;
-  else
-    pels = (*myfread) (image.bitmap, bpp, npels, fp);
-
-  if (pels != npels) {
-    if (!badread) {
-      /* Probably premature end of file. */
-      LOG("TGA: error reading (ftell == %ld)\n", ftell(fp));
-      at_exception_warning(exp, "TGA: eroor reading file");
-      badread = 1;
-    }
-
-    /* Fill the rest of this tile with zeros. */
-    memset(image.bitmap + (pels * bpp), 0, ((npels - pels) * bpp));
-  }
-  /* If we have indexed alphas, then set them. */
-  if (nalphas) {
-    /* Start at the end of the buffer, and work backwards. */
-    k = (npels - 1) * bpp;
-    for (j = bsize - pelbytes; j >= 0; j -= pelbytes) {
-      /* Find the alpha for this index. */
-      image.bitmap[j + 1] = alphas[image.bitmap[k]];
-      image.bitmap[j] = image.bitmap[k--];
-    }
-  }
-
-  if (itype == GRAY)
-    for (j = bsize / 3 - 1; j >= 0; j -= 1) {
-      /* Find the alpha for this index. */
-      image.bitmap[3 * j] = image.bitmap[j];
-      image.bitmap[3 * j + 1] = image.bitmap[j];
-      image.bitmap[3 * j + 2] = image.bitmap[j];
+  XMALLOC(buffer, width * bpp);
+  if (rle)
+    XMALLOC(state.statebuf, RLE_PACKETSIZE * bpp);
+  if (itype == GRAY && abpp)
+    XMALLOC(grays, width);
+  if (vertrev)
+    places = at_input_row_places(consumer, width, height, 3, &own);
+
+  /* Convert the pixels to RGB a row at a time, putting each row where
+     it belongs. */
+  for (j = 0; j < height; j++) {
+    unsigned char *src = buffer;
+    unsigned char *dst;
+
+    if (vertrev)
+      dst = places[height - 1 - j];
+    else {
+      dst = consumer->buffer ? consumer->buffer(j, consumer->data) : NULL;
+      if (dst == NULL) {
+        if (own == NULL)
+          XMALLOC(own, width * 3);
+        dst = own;
+      }
     }
 
-  if (pelbytes >= 3) {
-    /* Rearrange the colors from BGR to RGB. */
-    for (j = 0; j < bsize; j += pelbytes) {
-      unsigned char tmp = image.bitmap[j];
-      image.bitmap[j] = image.bitmap[j + 2];
-      image.bitmap[j + 2] = tmp;
+    pels = eof ? 0 : (*myfread) (buffer, bpp, width, fp, &state);
+    if (pels != width) {
+      if (!eof) {
+        /* Probably premature end of file. */
+        LOG("TGA: error reading (ftell == %ld)\n", ftell(fp));
+        at_exception_warning(exp, "TGA: eroor reading file");
+        eof = 1;
+      }
+      /* Fill the rest of the image with zeros. */
+      memset(buffer + (pels * bpp), 0, ((width - pels) * bpp));
     }
-  }
 
-  if (horzrev || vertrev) {
-    unsigned char *tmp;
-    if (vertrev) {
-      /* We need to mirror only vertically. */
-      for (j = 0; j < bsize; j += wbytes)
-        memcpy(buffer + j, image.bitmap + bsize - (j + wbytes), wbytes);
-    } else if (horzrev) {
-      /* We need to mirror only horizontally. */
-      for (j = 0; j < bsize; j += wbytes)
-        for (k = 0; k < wbytes; k += pelbytes)
-          memcpy(buffer + k + j, image.bitmap + (j + wbytes) - (k + pelbytes), pelbytes);
-    } else {
-      /* Completely reverse the pixels in the buffer. */
-      for (j = 0; j < bsize; j += pelbytes)
-        memcpy(buffer + j, image.bitmap + bsize - (j + pelbytes), pelbytes);
-    }
+    if (itype == INDEXED)
+      kernels->expand_palette(dst, src, width, (const unsigned char (*)[3])palette);
+    else if (itype == GRAY && abpp) {
+      kernels->graya_over(grays, src, width, at_color_luminance(background));
+      kernels->gray_to_rgb(dst, grays, width);
+    } else if (itype == GRAY)
+      kernels->gray_to_rgb(dst, src, width);
+    else if (abpp && (hdr->descriptor & TGA_DESC_ABITS))
+      kernels->bgra_over(dst, src, width, background);
+    else if (abpp)
+      /* A fourth byte the descriptor says nothing about is no alpha */
+      kernels->bgrx_to_rgb(dst, src, width);
+    else
+      kernels->bgr_to_rgb(dst, src, width);
+
+    if (horzrev)
+      for (k = 0; k < width / 2; k++) {
+        unsigned char *left = dst + 3 * k, *right = dst + 3 * (width - 1 - k);
+        unsigned char tmp[3];
+        memcpy(tmp, left, 3);
+        memcpy(left, right, 3);
+        memcpy(right, tmp, 3);
+      }
 
-    /* Swap the buffers because we modified them. */
-    tmp = buffer;
-    buffer = image.bitmap;
-    image.bitmap = tmp;
+    if (!vertrev && !consumer->row(j, dst, consumer->data))
+      goto cleanup;
   }
 
   if (fgetc(fp) != EOF) {
     LOG("TGA: too much input data, ignoring extra...\n");
     at_exception_warning(exp, "TGA: too much input data, ignoring extra datum");
   }
+  if (vertrev)
+    at_input_deliver_rows(places, height, consumer);
 
+cleanup:
+  free(places);
+  free(own);
+  free(grays);
+  free(state.statebuf);
   free(buffer);
-
-  if (hdr->colorMapType == 1) {
-    unsigned char *temp, *temp2, *temp3;
-    unsigned char index;
-    int xpos, ypos;
-
-    temp2 = temp = image.bitmap;
-    image.bitmap = temp3 = (unsigned char *)malloc(width * height * 3 * sizeof(unsigned char));
-
-    for (ypos = 0; ypos < height; ypos++) {
-      for (xpos = 0; xpos < width; xpos++) {
-        index = *temp2++;
-        *temp3++ = cmap[3 * index + 0];
-        *temp3++ = cmap[3 * index + 1];
-        *temp3++ = cmap[3 * index + 2];
-      }
-    }
-    free(temp);
-    free(cmap);
-  }
-
-  free(alphas);
-
-  return image;
 }                               /* read_image */
@@ -22,6 +22,6 @@
 
 #include "input.h"
 
-at_bitmap input_tga_reader(gchar * filename, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data, gpointer user_data);
+void input_tga_reader(gchar * filename, FILE * fp, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data, gpointer user_data);
 
 #endif /* not INPUT_TGA_H */
@@ -25,6 +25,7 @@
 #include "autotrace.h"
 #include "private.h"
 #include "input.h"
+#include "bitmap.h"
 #include "xstd.h"
 #include "filename.h"
 #include <string.h>
@@ -38,7 +39,32 @@ struct _at_input_format_entry {
 };
 
 static GHashTable *at_input_formats = NULL;
-static at_input_format_entry *at_input_format_new(const char *descr, at_input_func reader, gpointer user_data, GDestroyNotify user_data_destroy_func);
+
+/* The first bytes of the formats, and the suffix of their reader.
+   Those of ImageMagick are only found if it is built in.  */
+static const struct {
+  const char *magic;
+  size_t size;
+  const char *suffix;
+} at_input_magics[] = {
+  {"\x89PNG\r\n\x1a\n", 8, "PNG"},
+  {"BM", 2, "BMP"},
+  {"P1", 2, "PBM"},
+  {"P2", 2, "PGM"},
+  {"P3", 2, "PPM"},
+  {"P4", 2, "PBM"},
+  {"P5", 2, "PGM"},
+  {"P6", 2, "PPM"},
+  {"\xf7\x83", 2, "GF"},
+  {"GIF8", 4, "GIF"},
+  {"\xff\xd8\xff", 3, "JPEG"},
+  {"II*\0", 4, "TIFF"},
+  {"MM\0*", 4, "TIFF"},
+  {NULL, 0, NULL}
+};
+
+static at_input_format_entry *at_input_format_new(const char *descr, at_input_func reader, at_input_stream_func stream, gpointer user_data, GDestroyNotify user_data_destroy_func);
+static int input_add_handler(const gchar * suffix, const gchar * description, at_input_func reader, at_input_stream_func stream, gboolean override, gpointer user_data, GDestroyNotify user_data_destroy_func);
 static void at_input_format_free(at_input_format_entry * entry);
 
 /*
@@ -65,12 +91,13 @@ int at_input_init(void)
   return 1;
 }
 
-static at_input_format_entry *at_input_format_new(const gchar * descr, at_input_func reader, gpointer user_data, GDestroyNotify user_data_destroy_func)
+static at_input_format_entry *at_input_format_new(const gchar * descr, at_input_func reader, at_input_stream_func stream, gpointer user_data, GDestroyNotify user_data_destroy_func)
 {
   at_input_format_entry *entry;
   entry = g_malloc(sizeof(at_input_format_entry));
   if (entry) {
     entry->reader.func = reader;
+    entry->reader.stream = stream;
     entry->reader.data = user_data;
     entry->descr = g_strdup(descr);
     entry->user_data_destroy_func = user_data_destroy_func;
@@ -93,6 +120,23 @@ int at_input_add_handler(const gchar * suffix, const gchar * description, at_inp
 }
 
 int at_input_add_handler_full(const gchar * suffix, const gchar * description, at_input_func reader, gboolean override, gpointer user_data, GDestroyNotify user_data_destroy_func)
+{
+  g_return_val_if_fail(reader, 0);
+  return input_add_handler(suffix, description, reader, NULL, override, user_data, user_data_destroy_func);
+}
+
+int at_input_add_stream_handler(const gchar * suffix, const gchar * description, at_input_stream_func reader)
+{
+  return at_input_add_stream_handler_full(suffix, description, reader, 0, NULL, NULL);
+}
+
+int at_input_add_stream_handler_full(const gchar * suffix, const gchar * description, at_input_stream_func reader, gboolean override, gpointer user_data, GDestroyNotify user_data_destroy_func)
+{
+  g_return_val_if_fail(reader, 0);
+  return input_add_handler(suffix, description, NULL, reader, override, user_data, user_data_destroy_func);
+}
+
+static int input_add_handler(const gchar * suffix, const gchar * description, at_input_func reader, at_input_stream_func stream, gboolean override, gpointer user_data, GDestroyNotify user_data_destroy_func)
 {
   gchar *gsuffix;
   const gchar *gdescription;
@@ -101,7 +145,6 @@ int at_input_add_handler_full(const gchar * suffix, const gchar * description, a
 
   g_return_val_if_fail(suffix, 0);
   g_return_val_if_fail(description, 0);
-  g_return_val_if_fail(reader, 0);
 
   gsuffix = g_strdup((gchar *) suffix);
   g_return_val_if_fail(gsuffix, 0);
@@ -115,7 +158,7 @@ int at_input_add_handler_full(const gchar * suffix, const gchar * description, a
     return 1;
   }
 
-  new_entry = at_input_format_new(gdescription, reader, user_data, user_data_destroy_func);
+  new_entry = at_input_format_new(gdescription, reader, stream, user_data, user_data_destroy_func);
   g_return_val_if_fail(new_entry, 0);
 
   g_hash_table_replace(at_input_formats, gsuffix, new_entry);
@@ -124,11 +167,21 @@ int at_input_add_handler_full(const gchar * suffix, const gchar * description, a
 
 at_bitmap_reader *at_input_get_handler(gchar * filename)
 {
+  at_bitmap_reader *reader;
+  unsigned char magic[AT_INPUT_MAGIC_SIZE];
+  size_t size;
+  FILE *file;
   char *ext = find_suffix(filename);
   if (ext == NULL)
     ext = "";
 
-  return at_input_get_handler_by_suffix(ext);
+  reader = at_input_get_handler_by_suffix(ext);
+  if (reader == NULL && (file = fopen(filename, "rb")) != NULL) {
+    size = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    reader = at_input_get_handler_by_magic(magic, size);
+  }
+  return reader;
 }
 
 at_bitmap_reader *at_input_get_handler_by_suffix(gchar * suffix)
@@ -151,6 +204,71 @@ at_bitmap_reader *at_input_get_handler_by_suffix(gchar * suffix)
     return NULL;
 }
 
+at_bitmap_reader *at_input_get_handler_by_magic(const unsigned char *data, size_t size)
+{
+  int i;
+
+  for (i = 0; at_input_magics[i].magic; i++)
+    if (size >= at_input_magics[i].size && memcmp(data, at_input_magics[i].magic, at_input_magics[i].size) == 0)
+      return at_input_get_handler_by_suffix((gchar *) at_input_magics[i].suffix);
+  return NULL;
+}
+
+gboolean at_input_deliver_bitmap(at_bitmap * bitmap, at_input_consumer * consumer)
+{
+  unsigned short row;
+  unsigned char *pixels = NULL;
+  gboolean more = TRUE;
+
+  /* A packed bitmap is unpacked a row at a time for a consumer that
+     does not take packed rows.  */
+  if (AT_BITMAP_PACKED(bitmap) && consumer->begin_packed)
+    more = consumer->begin_packed(AT_BITMAP_WIDTH(bitmap), AT_BITMAP_HEIGHT(bitmap), AT_BITMAP_PLANES(bitmap), consumer->data);
+  else {
+    if (AT_BITMAP_PACKED(bitmap))
+      XMALLOC(pixels, MAX((size_t) AT_BITMAP_WIDTH(bitmap) * AT_BITMAP_PLANES(bitmap), 1));
+    more = consumer->begin(AT_BITMAP_WIDTH(bitmap), AT_BITMAP_HEIGHT(bitmap), AT_BITMAP_PLANES(bitmap), consumer->data);
+  }
+  for (row = 0; more && row < AT_BITMAP_HEIGHT(bitmap); row++) {
+    if (pixels) {
+      at_bitmap_unpack_row(pixels, AT_BITMAP_ROW(bitmap, row), AT_BITMAP_WIDTH(bitmap), AT_BITMAP_PLANES(bitmap));
+      more = consumer->row(row, pixels, consumer->data);
+    } else
+      more = consumer->row(row, AT_BITMAP_ROW(bitmap, row), consumer->data);
+  }
+  free(pixels);
+  return more;
+}
+
+unsigned char **at_input_row_places(at_input_consumer * consumer, unsigned short width, unsigned short height, unsigned int planes, unsigned char **own)
+{
+  unsigned char **places;
+  size_t rowlen = (size_t) width * planes;
+  unsigned short row;
+
+  XMALLOC(places, MAX(height, 1) * sizeof(unsigned char *));
+  *own = NULL;
+  for (row = 0; row < height; row++) {
+    places[row] = consumer->buffer ? consumer->buffer(row, consumer->data) : NULL;
+    if (places[row] == NULL) {
+      if (*own == NULL)
+        XCALLOC(*own, MAX(rowlen * height, 1));
+      places[row] = *own + row * rowlen;
+    }
+  }
+  return places;
+}
+
+gboolean at_input_deliver_rows(unsigned char **places, unsigned short height, at_input_consumer * consumer)
+{
+  unsigned short row;
+
+  for (row = 0; row < height; row++)
+    if (!consumer->row(row, places[row], consumer->data))
+      return FALSE;
+  return TRUE;
+}
+
 const char **at_input_list_new(void)
 {
   char **list, **tmp;
@@ -35,6 +35,14 @@ extern "C" {
   typedef
    at_bitmap(*at_input_func) (gchar * name, at_input_opts_type * opts, at_msg_func msg_func, gpointer msg_data, gpointer user_data);
 
+/* A streaming reader decodes the image read from FILE a row at a
+   time into CONSUMER rather than returning the whole bitmap.  The
+   image starts at the current position of FILE, which the reader
+   does not close; NAME is only for messages.  It must stop as soon
+   as the consumer asks to. */
+  typedef
+  void (*at_input_stream_func) (gchar * name, FILE * file, at_input_opts_type * opts, at_input_consumer * consumer, at_msg_func msg_func, gpointer msg_data, gpointer user_data);
+
 /* at_input_add_handler
    Register an input handler to autotrace.
    If a handler for the suffix is already existed, do nothing. */
@@ -44,6 +52,30 @@ extern "C" {
    remove the old handler first then add new handler.
    If OVERRIDE is false, do nothing. */
   extern int at_input_add_handler_full(const gchar * suffix, const gchar * description, at_input_func reader, gboolean override, gpointer user_data, GDestroyNotify user_data_destroy_func);
+/* at_input_add_stream_handler, at_input_add_stream_handler_full
+   Same as above for a streaming reader. */
+  extern int at_input_add_stream_handler(const gchar * suffix, const gchar * description, at_input_stream_func reader);
+  extern int at_input_add_stream_handler_full(const gchar * suffix, const gchar * description, at_input_stream_func reader, gboolean override, gpointer user_data, GDestroyNotify user_data_destroy_func);
+
+/* at_input_deliver_bitmap
+   Hand the rows of BITMAP to CONSUMER, for readers that have to
+   decode the whole image first.  A packed BITMAP is handed over
+   packed to a consumer with a BEGIN_PACKED, and unpacked to others.
+   Returns FALSE if the consumer stopped the reading. */
+  extern gboolean at_input_deliver_bitmap(at_bitmap * bitmap, at_input_consumer * consumer);
+
+/* at_input_row_places
+   Return the places to decode the HEIGHT rows of WIDTH * PLANES bytes
+   of an image into, for readers that store the rows out of order and
+   have called the BEGIN of CONSUMER; after its BEGIN_PACKED, WIDTH is
+   that of a packed row in bytes and PLANES is 1.  These are the rows of its BUFFER
+   where it has them and otherwise rows of *OWN, which is then
+   allocated, zeroed, and must be freed with the returned array.
+   at_input_deliver_rows
+   Hand the rows at PLACES to CONSUMER, the top one first.
+   Returns FALSE if the consumer stopped the reading. */
+  extern unsigned char **at_input_row_places(at_input_consumer * consumer, unsigned short width, unsigned short height, unsigned int planes, unsigned char **own);
+  extern gboolean at_input_deliver_rows(unsigned char **places, unsigned short height, at_input_consumer * consumer);
 
 /* at_bitmap_init
    Return initialized at_bitmap value.
@@ -0,0 +1,609 @@
+/* kmeans.c: k-means - reducing a high color bitmap to certain number of colors */
+
+/*
+ * The colors are counted into a histogram of 5 bits per sample, which
+ * also keeps the sum of the pixels of each cell, so that a cell stands
+ * for the mean of its pixels rather than for its center.  The used
+ * cells are the points of a weighted k-means, seeded as k-means++ does:
+ * the most common cell first, then each seed drawn at random among the
+ * cells, with a chance of its pixel count times its squared distance to
+ * the nearest seed so far.  The draws come from a fixed linear
+ * congruential sequence, so the seeds are the same on every run.  The
+ * seeds are then improved by a few rounds of Lloyd's algorithm.
+ * Distances are scaled like those of median cut.
+ * The pixels are then mapped through an inverse colormap of 6 bits per
+ * sample, each cell of which takes the center nearest to its middle.
+ *
+ * The color cube is split into 8x8x8 blocks, and the points are kept
+ * in the order of the blocks.  As in median cut, a block is only
+ * searched for the centers that may be nearest to some color in it, so
+ * the points and the cells of a block are compared with a few centers
+ * rather than with all of them.  Blocks are independent, and the
+ * centers are only summed by one thread in the order of the points, so
+ * the colormap is the same for any number of threads.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* Def: HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+#include "xstd.h"
+#include "quantize.h"
+#include "parallel.h"
+
+#define MAXNUMCOLORS 256
+
+/* The histogram the colors are counted in.  */
+#define KMEANS_BITS	5
+#define KMEANS_SHIFT	(8 - KMEANS_BITS)
+#define KMEANS_ELEMS	(1 << KMEANS_BITS)
+#define KMEANS_CELLS	(KMEANS_ELEMS * KMEANS_ELEMS * KMEANS_ELEMS)
+
+#define KMEANS_INDEX(r, g, b) ((((r) >> KMEANS_SHIFT) << (2 * KMEANS_BITS)) \
+                               | (((g) >> KMEANS_SHIFT) << KMEANS_BITS) | ((b) >> KMEANS_SHIFT))
+
+/* The inverse colormap the pixels are mapped through.  */
+#define MAP_BITS	6
+#define MAP_SHIFT	(8 - MAP_BITS)
+#define MAP_ELEMS	(1 << MAP_BITS)
+#define MAP_CELLS	(MAP_ELEMS * MAP_ELEMS * MAP_ELEMS)
+
+#define MAP_INDEX(r, g, b) ((((r) >> MAP_SHIFT) << (2 * MAP_BITS)) \
+                            | (((g) >> MAP_SHIFT) << MAP_BITS) | ((b) >> MAP_SHIFT))
+
+#define BLOCK_LOG	3
+#define BLOCK_SIDE	(1 << BLOCK_LOG)  /* # of blocks per side of the cube */
+#define BLOCK_COUNT	(BLOCK_SIDE * BLOCK_SIDE * BLOCK_SIDE)
+#define BLOCK_VALUES	(256 / BLOCK_SIDE)  /* # of sample values per side of a block */
+#define BLOCK_CELLS(bits) (1 << (3 * ((bits) - BLOCK_LOG)))
+
+/* scale RGB distances by *2,*3,*1, as median cut does */
+#define R_SCALE  2.0f
+#define G_SCALE  3.0f
+#define B_SCALE  1.0f
+
+/* Rounds of Lloyd's algorithm, unless the cells stop moving sooner.  */
+#define KMEANS_ROUNDS 10
+
+/* Each histogram takes 1 MB.  */
+#define MAX_HISTOGRAMS 4
+
+typedef struct {
+  unsigned long count;
+  unsigned long r, g, b;
+} kmeans_cell;
+
+typedef struct {
+  QuantizeObj *quantobj;
+  at_bitmap *image;
+  const at_color *color;        /* The color ignored while counting, or
+                                   the background while mapping.  */
+  at_color bg_color;            /* Its colormap entry while mapping.  */
+  unsigned slices;
+  kmeans_cell **histograms;     /* One per slice.  */
+
+  /* The used cells in the order of the blocks, with their means
+     scaled for the distance.  The points of block B are
+     block_first[B]..block_first[B + 1]-1.  */
+  unsigned points;
+  unsigned block_first[BLOCK_COUNT + 1];
+  float *pr, *pg, *pb;
+  ColorFreq *weight;
+  unsigned char *nearest;
+
+  /* While seeding, the distance of each point to the nearest seed,
+     and the sum of the distances of each block weighted by the pixel
+     counts, and the largest distance of each block.  */
+  float *distance;
+  double block_score[BLOCK_COUNT];
+  float block_far[BLOCK_COUNT];
+
+  /* The centers, scaled the same way.  */
+  int centers;
+  float cr[MAXNUMCOLORS], cg[MAXNUMCOLORS], cb[MAXNUMCOLORS];
+  int seed;                     /* The newest seed.  */
+  gboolean fill;                /* Also fill the empty cells.  */
+} kmeans_job;
+
+#define SLICE_FIRST_ROW(job, i) ((int) ((long) AT_BITMAP_HEIGHT ((job)->image) * (i) / (job)->slices))
+
+static unsigned count_slices(at_bitmap * image, unsigned threads)
+{
+  unsigned slices = parallel_threads(threads);
+  unsigned rows = (AT_BITMAP_HEIGHT(image) + 63) / 64;
+
+  if (slices > rows)
+    slices = rows;
+  if (slices > MAX_HISTOGRAMS)
+    slices = MAX_HISTOGRAMS;
+  return slices > 0 ? slices : 1;
+}
+
+static void count_cells(unsigned first, unsigned last, gpointer data)
+{
+  kmeans_job *job = (kmeans_job *) data;
+  const at_color *ignoreColor = job->color;
+  int spp = AT_BITMAP_PLANES(job->image);
+  int width = AT_BITMAP_WIDTH(job->image);
+  unsigned i;
+
+  for (i = first; i < last; i++) {
+    kmeans_cell *histogram = job->histograms[i];
+    unsigned char *src = job->image->bitmap + spp * SLICE_FIRST_ROW(job, i) * width;
+    unsigned char *end = job->image->bitmap + spp * SLICE_FIRST_ROW(job, i + 1) * width;
+    kmeans_cell *cell;
+
+    for (; src < end; src += spp)
+      if (spp == 3) {
+        /* If we have an ignorecolor, skip it. */
+        if (ignoreColor && src[0] == ignoreColor->r && src[1] == ignoreColor->g && src[2] == ignoreColor->b)
+          continue;
+        cell = &histogram[KMEANS_INDEX(src[0], src[1], src[2])];
+        cell->count++;
+        cell->r += src[0];
+        cell->g += src[1];
+        cell->b += src[2];
+      } else {
+        if (ignoreColor && src[0] == ignoreColor->r)
+          continue;
+        cell = &histogram[KMEANS_INDEX(src[0], src[0], src[0])];
+        cell->count++;
+        cell->r += src[0];
+        cell->g += src[0];
+        cell->b += src[0];
+      }
+  }
+}
+
+static void sum_histograms(unsigned first, unsigned last, gpointer data)
+{
+  kmeans_job *job = (kmeans_job *) data;
+  unsigned i, cell;
+
+  for (i = 1; i < job->slices; i++)
+    for (cell = first; cell < last; cell++) {
+      job->histograms[0][cell].count += job->histograms[i][cell].count;
+      job->histograms[0][cell].r += job->histograms[i][cell].r;
+      job->histograms[0][cell].g += job->histograms[i][cell].g;
+      job->histograms[0][cell].b += job->histograms[i][cell].b;
+    }
+}
+
+/* The cell of the I-th cell of BLOCK in a cube of BITS bits per
+   side.  */
+static unsigned block_cell(unsigned block, unsigned i, unsigned bits)
+{
+  unsigned side = 1 << (bits - BLOCK_LOG);
+  unsigned R = (block / (BLOCK_SIDE * BLOCK_SIDE)) * side + i / (side * side);
+  unsigned G = (block / BLOCK_SIDE % BLOCK_SIDE) * side + i / side % side;
+  unsigned B = (block % BLOCK_SIDE) * side + i % side;
+
+  return (R << (2 * bits)) | (G << bits) | B;
+}
+
+/* The squared distance from V to LO..HI along one axis: NEAR for the
+   nearest point, FAR for the farthest.  */
+static void axis_distance(float v, float lo, float hi, float *near, float *far)
+{
+  float d_lo = v - lo, d_hi = hi - v;
+
+  *near = v < lo ? -d_lo : v > hi ? -d_hi : 0.0f;
+  *near *= *near;
+  *far = d_lo > d_hi ? d_lo : d_hi;
+  *far *= *far;
+}
+
+/* The bounds of the colors of BLOCK, scaled.  */
+static void block_bounds(unsigned block, float *lo, float *hi)
+{
+  lo[0] = (float)(block / (BLOCK_SIDE * BLOCK_SIDE) * BLOCK_VALUES);
+  lo[1] = (float)(block / BLOCK_SIDE % BLOCK_SIDE * BLOCK_VALUES);
+  lo[2] = (float)(block % BLOCK_SIDE * BLOCK_VALUES);
+  hi[0] = (lo[0] + BLOCK_VALUES - 1) * R_SCALE;
+  hi[1] = (lo[1] + BLOCK_VALUES - 1) * G_SCALE;
+  hi[2] = (lo[2] + BLOCK_VALUES - 1) * B_SCALE;
+  lo[0] *= R_SCALE;
+  lo[1] *= G_SCALE;
+  lo[2] *= B_SCALE;
+}
+
+/* Put the centers that may be the nearest one for some color of BLOCK
+   into CANDIDATES, in their order, and return their number: those no
+   farther from the block than the farthest corner of the block is
+   from the center that is nearest to that corner at worst.  */
+static int find_candidates(const kmeans_job * job, unsigned block, unsigned char *candidates)
+{
+  float lo[3], hi[3], near[MAXNUMCOLORS];
+  float best_far = G_MAXFLOAT;
+  int c, count = 0;
+
+  block_bounds(block, lo, hi);
+  for (c = 0; c < job->centers; c++) {
+    float near_r, near_g, near_b, far_r, far_g, far_b, far;
+
+    axis_distance(job->cr[c], lo[0], hi[0], &near_r, &far_r);
+    axis_distance(job->cg[c], lo[1], hi[1], &near_g, &far_g);
+    axis_distance(job->cb[c], lo[2], hi[2], &near_b, &far_b);
+    near[c] = near_r + near_g + near_b;
+    far = far_r + far_g + far_b;
+    if (far < best_far)
+      best_far = far;
+  }
+  for (c = 0; c < job->centers; c++)
+    if (near[c] <= best_far)
+      candidates[count++] = c;
+  return count;
+}
+
+/* The index of the center among CANDIDATES nearest to R, G, B, which
+   are scaled.  */
+static int nearest_center(const kmeans_job * job, const unsigned char *candidates, int count, float r, float g, float b)
+{
+  float best_distance = G_MAXFLOAT;
+  int i, best = candidates[0];
+
+  for (i = 0; i < count; i++) {
+    int c = candidates[i];
+    float dr = job->cr[c] - r;
+    float dg = job->cg[c] - g;
+    float db = job->cb[c] - b;
+    float distance = dr * dr + dg * dg + db * db;
+
+    if (distance < best_distance) {
+      best_distance = distance;
+      best = c;
+    }
+  }
+  return best;
+}
+
+/* Find the nearest center of the points of some blocks, and with FILL
+   map the empty cells of the blocks to the center nearest to the
+   middle of the cell.  */
+static void find_nearest(unsigned first, unsigned last, gpointer data)
+{
+  kmeans_job *job = (kmeans_job *) data;
+  Histogram histogram = job->quantobj->histogram;
+  unsigned char candidates[MAXNUMCOLORS];
+  unsigned block, i;
+
+  for (block = first; block < last; block++) {
+    int count = find_candidates(job, block, candidates);
+
+    for (i = job->block_first[block]; i < job->block_first[block + 1]; i++)
+      job->nearest[i] = nearest_center(job, candidates, count, job->pr[i], job->pg[i], job->pb[i]);
+
+    if (job->fill)
+      for (i = 0; i < BLOCK_CELLS(MAP_BITS); i++) {
+        unsigned cell = block_cell(block, i, MAP_BITS);
+
+        if (histogram[cell] == 0) {
+          int r = ((cell >> (2 * MAP_BITS)) << MAP_SHIFT) + (1 << MAP_SHIFT >> 1);
+          int g = (((cell >> MAP_BITS) & (MAP_ELEMS - 1)) << MAP_SHIFT) + (1 << MAP_SHIFT >> 1);
+          int b = ((cell & (MAP_ELEMS - 1)) << MAP_SHIFT) + (1 << MAP_SHIFT >> 1);
+
+          histogram[cell] = nearest_center(job, candidates, count, r * R_SCALE, g * G_SCALE, b * B_SCALE) + 1;
+        }
+      }
+  }
+}
+
+/* Update the distance of the points of some blocks to the nearest
+   seed, and find the best next seed of each block.  */
+static void update_distances(unsigned first, unsigned last, gpointer data)
+{
+  kmeans_job *job = (kmeans_job *) data;
+  float r = job->cr[job->seed], g = job->cg[job->seed], b = job->cb[job->seed];
+  float lo[3], hi[3], near_r, near_g, near_b, far;
+  unsigned block, i;
+
+  for (block = first; block < last; block++) {
+    unsigned end = job->block_first[block + 1];
+
+    /* The seed is not nearer to any point of the block than its
+       previous seeds.  */
+    block_bounds(block, lo, hi);
+    axis_distance(r, lo[0], hi[0], &near_r, &far);
+    axis_distance(g, lo[1], hi[1], &near_g, &far);
+    axis_distance(b, lo[2], hi[2], &near_b, &far);
+    if (near_r + near_g + near_b >= job->block_far[block])
+      continue;
+
+    job->block_far[block] = 0.0f;
+    for (i = job->block_first[block]; i < end; i++) {
+      float dr = job->pr[i] - r;
+      float dg = job->pg[i] - g;
+      float db = job->pb[i] - b;
+      float distance = dr * dr + dg * dg + db * db;
+
+      job->distance[i] = distance < job->distance[i] ? distance : job->distance[i];
+      job->block_far[block] = job->distance[i] > job->block_far[block] ? job->distance[i] : job->block_far[block];
+    }
+
+    job->block_score[block] = 0.0;
+    for (i = job->block_first[block]; i < end; i++)
+      job->block_score[block] += (double)job->weight[i] * job->distance[i];
+  }
+}
+
+static void set_centers(kmeans_job * job, const at_color * cmap, int count)
+{
+  int i;
+
+  job->centers = count;
+  for (i = 0; i < count; i++) {
+    job->cr[i] = cmap[i].r * R_SCALE;
+    job->cg[i] = cmap[i].g * G_SCALE;
+    job->cb[i] = cmap[i].b * B_SCALE;
+  }
+}
+
+/* Pick the seeds as k-means++ does: the most common cell first, then
+   each time a cell drawn with a chance of its pixel count times the
+   squared distance to the nearest seed.  The draws come from a fixed
+   sequence, so that the seeds are the same every time.  */
+static void seed_centers(kmeans_job * job, int desired, unsigned threads)
+{
+  guint32 random = 1;
+  unsigned i, best = 0, block, last;
+
+  for (i = 1; i < job->points; i++)
+    if (job->weight[i] > job->weight[best])
+      best = i;
+  for (i = 0; i < job->points; i++)
+    job->distance[i] = G_MAXFLOAT;
+  for (block = 0; block < BLOCK_COUNT; block++) {
+    job->block_score[block] = 0.0;
+    job->block_far[block] = G_MAXFLOAT;
+  }
+
+  job->centers = 0;
+  while (job->centers < desired) {
+    double total = 0.0, target;
+
+    job->seed = job->centers++;
+    job->cr[job->seed] = job->pr[best];
+    job->cg[job->seed] = job->pg[best];
+    job->cb[job->seed] = job->pb[best];
+    parallel_for(BLOCK_COUNT, 1, threads, update_distances, job);
+
+    for (block = 0; block < BLOCK_COUNT; block++)
+      total += job->block_score[block];
+    /* Every cell is a seed already.  */
+    if (total == 0.0)
+      break;
+
+    random = random * 1103515245 + 12345;
+    target = total * (random >> 8) / (1 << 24);
+    /* Rounding can carry TARGET past the last score; the draw then
+       falls to the last block that has one, as an empty block has no
+       cell to pick.  */
+    for (block = 0, last = 0; block < BLOCK_COUNT; block++) {
+      if (job->block_score[block] > 0.0) {
+        last = block;
+        if (target < job->block_score[block])
+          break;
+      }
+      target -= job->block_score[block];
+    }
+    block = last;
+    for (best = job->block_first[block]; best < job->block_first[block + 1] - 1; best++) {
+      if (target < (double)job->weight[best] * job->distance[best])
+        break;
+      target -= (double)job->weight[best] * job->distance[best];
+    }
+  }
+}
+
+/* Move each center to the mean of its points; returns whether any
+   point changed its center.  */
+static gboolean move_centers(kmeans_job * job, unsigned char *previous, double (*sums)[4])
+{
+  gboolean moved = FALSE;
+  unsigned i;
+  int c;
+
+  memset(sums, 0, job->centers * sizeof(*sums));
+  for (i = 0; i < job->points; i++) {
+    double *sum = sums[job->nearest[i]];
+
+    sum[0] += job->weight[i];
+    sum[1] += (double)job->weight[i] * job->pr[i];
+    sum[2] += (double)job->weight[i] * job->pg[i];
+    sum[3] += (double)job->weight[i] * job->pb[i];
+    if (previous[i] != job->nearest[i])
+      moved = TRUE;
+    previous[i] = job->nearest[i];
+  }
+  for (c = 0; c < job->centers; c++)
+    if (sums[c][0] > 0.0) {
+      job->cr[c] = sums[c][1] / sums[c][0];
+      job->cg[c] = sums[c][2] / sums[c][0];
+      job->cb[c] = sums[c][3] / sums[c][0];
+    }
+  return moved;
+}
+
+static void kmeans_select_colors(QuantizeObj * quantobj, at_bitmap ** images, unsigned count, const at_color * ignoreColor, unsigned threads)
+{
+  kmeans_job job;
+  kmeans_cell *histogram;
+  unsigned char *previous;
+  double (*sums)[4];
+  unsigned histograms = 1, i, block, cell;
+  int desired = MIN(quantobj->desired_number_of_colors, MAXNUMCOLORS);
+  int c, colors, round;
+
+  for (i = 0; i < count; i++)
+    histograms = MAX(histograms, count_slices(images[i], threads));
+
+  job.quantobj = quantobj;
+  job.color = ignoreColor;
+  XMALLOC(job.histograms, histograms * sizeof(kmeans_cell *));
+  for (i = 0; i < histograms; i++)
+    XCALLOC(job.histograms[i], KMEANS_CELLS * sizeof(kmeans_cell));
+
+  for (i = 0; i < count; i++) {
+    job.image = images[i];
+    job.slices = count_slices(images[i], threads);
+    parallel_for(job.slices, 1, threads, count_cells, &job);
+  }
+  job.slices = histograms;
+  if (histograms > 1)
+    parallel_for(KMEANS_CELLS, KMEANS_ELEMS * KMEANS_ELEMS, threads, sum_histograms, &job);
+  histogram = job.histograms[0];
+  for (i = 1; i < histograms; i++)
+    free(job.histograms[i]);
+  free(job.histograms);
+
+  /* Gather the used cells, block by block.  */
+  job.points = 0;
+  for (cell = 0; cell < KMEANS_CELLS; cell++)
+    if (histogram[cell].count)
+      job.points++;
+  XMALLOC(job.pr, MAX(job.points, 1) * sizeof(float));
+  XMALLOC(job.pg, MAX(job.points, 1) * sizeof(float));
+  XMALLOC(job.pb, MAX(job.points, 1) * sizeof(float));
+  XMALLOC(job.weight, MAX(job.points, 1) * sizeof(ColorFreq));
+  XMALLOC(job.distance, MAX(job.points, 1) * sizeof(float));
+  XMALLOC(job.nearest, MAX(job.points, 1));
+  XMALLOC(previous, MAX(job.points, 1));
+  XMALLOC(sums, MAXNUMCOLORS * sizeof(*sums));
+  for (block = 0, i = 0; block < BLOCK_COUNT; block++) {
+    job.block_first[block] = i;
+    for (c = 0; c < BLOCK_CELLS(KMEANS_BITS); c++) {
+      cell = block_cell(block, c, KMEANS_BITS);
+      if (histogram[cell].count) {
+        double n = histogram[cell].count;
+
+        job.pr[i] = histogram[cell].r / n * R_SCALE;
+        job.pg[i] = histogram[cell].g / n * G_SCALE;
+        job.pb[i] = histogram[cell].b / n * B_SCALE;
+        job.weight[i++] = histogram[cell].count;
+      }
+    }
+  }
+  job.block_first[BLOCK_COUNT] = i;
+  free(histogram);
+
+  job.fill = FALSE;
+  if (job.points == 0 || desired <= 0) {
+    /* Nothing to choose from; keep one black entry for the mapping.  */
+    quantobj->cmap[0].r = quantobj->cmap[0].g = quantobj->cmap[0].b = 0;
+    quantobj->freq[0] = 0;
+    colors = 1;
+  } else {
+    seed_centers(&job, desired, threads);
+    memset(previous, MAXNUMCOLORS - 1, job.points);
+    for (round = 0; round < KMEANS_ROUNDS; round++) {
+      parallel_for(BLOCK_COUNT, 1, threads, find_nearest, &job);
+      if (!move_centers(&job, previous, sums))
+        break;
+    }
+    if (round == KMEANS_ROUNDS)
+      parallel_for(BLOCK_COUNT, 1, threads, find_nearest, &job);
+
+    /* Count the points of the final centers, and drop the empty ones.  */
+    memset(sums, 0, job.centers * sizeof(*sums));
+    for (i = 0; i < job.points; i++)
+      sums[job.nearest[i]][0] += job.weight[i];
+    for (c = 0, colors = 0; c < job.centers; c++)
+      if (sums[c][0] > 0.0) {
+        quantobj->cmap[colors].r = (unsigned char)(job.cr[c] / R_SCALE + 0.5f);
+        quantobj->cmap[colors].g = (unsigned char)(job.cg[c] / G_SCALE + 0.5f);
+        quantobj->cmap[colors].b = (unsigned char)(job.cb[c] / B_SCALE + 0.5f);
+        quantobj->freq[colors++] = (ColorFreq) sums[c][0];
+      }
+  }
+  quantobj->actual_number_of_colors = colors;
+
+  /* The inverse colormap is filled when the first image is mapped.  */
+  memset(quantobj->histogram, 0, MAP_CELLS * sizeof(ColorFreq));
+  quantobj->inverse_cmap_filled = FALSE;
+
+  free(job.pr);
+  free(job.pg);
+  free(job.pb);
+  free(job.weight);
+  free(job.distance);
+  free(job.nearest);
+  free(previous);
+  free(sums);
+}
+
+/* Fill the cells no pixel was counted in, so that the histogram can
+   be shared by images and threads without being written to.  */
+static void kmeans_fill_inverse_cmap(QuantizeObj * quantobj, unsigned threads)
+{
+  kmeans_job job;
+  unsigned block;
+
+  if (quantobj->inverse_cmap_filled)
+    return;
+
+  job.quantobj = quantobj;
+  for (block = 0; block <= BLOCK_COUNT; block++)
+    job.block_first[block] = 0;
+  job.fill = TRUE;
+  set_centers(&job, quantobj->cmap, quantobj->actual_number_of_colors);
+  parallel_for(BLOCK_COUNT, 1, threads, find_nearest, &job);
+  quantobj->inverse_cmap_filled = TRUE;
+}
+
+/* Map some rows of pixels to the output colormapped representation. */
+static void map_rows(unsigned first, unsigned last, gpointer data)
+{
+  kmeans_job *job = (kmeans_job *) data;
+  QuantizeObj *quantobj = job->quantobj;
+  Histogram histogram = quantobj->histogram;
+  const at_color *bgColor = job->color;
+  at_color bg_color = job->bg_color;
+  int spp = AT_BITMAP_PLANES(job->image);
+  int width = AT_BITMAP_WIDTH(job->image);
+  unsigned char *p = job->image->bitmap + spp * first * width;
+  unsigned char *end = job->image->bitmap + spp * last * width;
+  const at_color *color;
+
+  if (spp == 3)
+    for (; p < end; p += 3) {
+      color = &quantobj->cmap[histogram[MAP_INDEX(p[0], p[1], p[2])] - 1];
+      /* If the colormap entry for this pixel is the same as the
+         background's colormap entry, set the pixel to the
+         background color. */
+      if (bgColor && color->r == bg_color.r && color->g == bg_color.g && color->b == bg_color.b)
+        color = bgColor;
+      p[0] = color->r;
+      p[1] = color->g;
+      p[2] = color->b;
+  } else
+    for (; p < end; p++) {
+      color = &quantobj->cmap[histogram[MAP_INDEX(p[0], p[0], p[0])] - 1];
+      p[0] = bgColor && color->r == bg_color.r ? bgColor->r : color->r;
+    }
+}
+
+static void kmeans_map_image(QuantizeObj * quantobj, at_bitmap * image, const at_color * bgColor, unsigned threads)
+{
+  kmeans_job job;
+
+  kmeans_fill_inverse_cmap(quantobj, threads);
+
+  job.quantobj = quantobj;
+  job.image = image;
+  job.color = bgColor;
+  job.bg_color.r = job.bg_color.g = job.bg_color.b = 0xff;
+  if (bgColor)
+    job.bg_color = quantobj->cmap[quantobj->histogram[MAP_INDEX(bgColor->r, bgColor->g, bgColor->b)] - 1];
+
+  parallel_for(AT_BITMAP_HEIGHT(image), 16, threads, map_rows, &job);
+}
+
+const quantizer_engine kmeans_engine = {
+  "k-means",
+  MAP_CELLS,
+  kmeans_select_colors,
+  kmeans_fill_inverse_cmap,
+  kmeans_map_image
+};
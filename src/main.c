@@ -12,6 +12,9 @@
 #include "xstd.h"
 #include "atou.h"
 #include "input.h"
+#include "bitmap.h"
+#include "input-gf.h"
+#include "parallel.h"
 
 #include <string.h>
 #include <assert.h>
@@ -33,19 +36,36 @@ static at_bitmap_reader *input_reader = NULL;
    returns "bar.baz".  */
 static char *get_basename(char *name);
 
+/* The images given on the command line; several are traced in a
+   batch, each into a file of its own.  */
+static char **input_names = NULL;
+static unsigned input_count = 0;
+
 /* The name of the file we're going to write.  (-output-file) */
 
 static char *output_name = (char *)"";
 
+/* The images the palette is computed from.  (-palette-image) */
+static char **palette_names = NULL;
+static unsigned palette_count = 0;
+
 /* The output function. (-output-format) */
 static at_spline_writer *output_writer = NULL;
 
+#define DEFAULT_FORMAT "eps"
+
+/* The suffix of the files a batch is written to.  (-output-format) */
+static char *output_suffix = (char *)DEFAULT_FORMAT;
+
 /* Whether to print version information */
 static gboolean printed_version;
 
 /* Whether to dump a bitmap file */
 static gboolean dumping_bitmap = FALSE;
 
+/* Trace every character of a GF font.  (-whole-font) */
+static gboolean whole_font = FALSE;
+
 /* Report tracing status in real time (--report-progress) */
 static gboolean report_progress = FALSE;
 #define dot_printer_max_column 50
@@ -55,25 +75,26 @@ static void dot_printer(gfloat percentage, gpointer client_data);
 static char *read_command_line(int, char *[], at_fitting_opts_type *, at_input_opts_type *, at_output_opts_type *);
 
 static void dump(at_bitmap * bitmap, FILE * fp);
+static void dump_bitmap(char *rootname, at_bitmap * bitmap);
+
+static void trace_font(char *input_name, at_fitting_opts_type * fitting_opts, at_output_opts_type * output_opts, FILE * output_file);
+static void trace_batch(at_fitting_opts_type * fitting_opts, at_input_opts_type * input_opts, at_output_opts_type * output_opts);
 
 static void input_list_formats(FILE * file);
 static void output_list_formats(FILE * file);
 
 static void exception_handler(const gchar * msg, at_msg_type type, gpointer data);
 
-#define DEFAULT_FORMAT "eps"
-
 int main(int argc, char *argv[])
 {
   at_fitting_opts_type *fitting_opts;
   at_input_opts_type *input_opts;
   at_output_opts_type *output_opts;
   char *input_name, *input_rootname;
-  char *dumpfile_name = NULL;
   at_splines_type *splines;
   at_bitmap *bitmap;
+  at_palette *palette = NULL;
   FILE *output_file;
-  FILE *dump_file;
 
   at_progress_func progress_reporter = NULL;
   int progress_stat = 0;
@@ -88,6 +109,7 @@ int main(int argc, char *argv[])
 
   fitting_opts = at_fitting_opts_new();
   input_opts = at_input_opts_new();
+  input_opts->packed = TRUE;
   output_opts = at_output_opts_new();
 
   input_name = read_command_line(argc, argv, fitting_opts, input_opts, output_opts);
@@ -105,8 +127,34 @@ int main(int argc, char *argv[])
     free (input_rootname);
 */
 
-  /* Set input_reader if it is not set in command line args */
-  if (!input_reader)
+  if (input_count > 1 && *output_name)
+    FATAL(_("output-file cannot be used with several input files"));
+  if (input_count > 1 && whole_font)
+    FATAL(_("whole-font traces a single font"));
+  if (input_count > 1) {
+    GHashTable *outputs = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+    unsigned i;
+
+    /* The output of a batch is named after its input, and written to
+       the current directory, so inputs of the same name from two
+       directories would write over each other.  */
+    for (i = 0; i < input_count; i++) {
+      char *name;
+      const char *other;
+
+      if (strcmp(input_names[i], "-") == 0)
+        FATAL(_("Standard input cannot be read with several input files"));
+      name = make_suffix(get_basename(input_names[i]), output_suffix);
+      if ((other = g_hash_table_lookup(outputs, name)) != NULL)
+        FATAL(_("%s and %s would both be written to %s"), other, input_names[i], name);
+      g_hash_table_insert(outputs, name, input_names[i]);
+    }
+    g_hash_table_destroy(outputs);
+  }
+
+  /* Set input_reader if it is not set in command line args.  The
+     images of a batch may each be in a format of their own.  */
+  if (!input_reader && input_count == 1)
     input_reader = at_input_get_handler(input_name);
 
   /* Set output_writer if it is not set in command line args
@@ -131,8 +179,50 @@ int main(int argc, char *argv[])
     }
   }
 
-  /* Open the main input file.  */
-  if (input_reader != NULL) {
+  /* Compute the palette from its images.  */
+  if (palette_count > 0) {
+    at_bitmap **palette_bitmaps;
+    unsigned i;
+
+    XMALLOC(palette_bitmaps, palette_count * sizeof(at_bitmap *));
+    for (i = 0; i < palette_count; i++) {
+      at_bitmap_reader *palette_reader = input_reader ? input_reader : at_input_get_handler(palette_names[i]);
+
+      if (palette_reader == NULL)
+        FATAL(_("Unsupported input format of %s"), palette_names[i]);
+      palette_bitmaps[i] = at_bitmap_read(palette_reader, palette_names[i], input_opts, exception_handler, NULL);
+    }
+    palette = at_palette_new(palette_bitmaps, palette_count, fitting_opts, exception_handler, NULL);
+    fitting_opts->palette = palette;
+    for (i = 0; i < palette_count; i++)
+      at_bitmap_free(palette_bitmaps[i]);
+    free(palette_bitmaps);
+    free(palette_names);
+  }
+
+  if (whole_font || input_count > 1) {
+    if (whole_font)
+      trace_font(input_name, fitting_opts, output_opts, output_file);
+    else
+      trace_batch(fitting_opts, input_opts, output_opts);
+
+    at_input_opts_free(input_opts);
+    at_output_opts_free(output_opts);
+    if (output_file != stdout)
+      fclose(output_file);
+    at_fitting_opts_free(fitting_opts);
+    if (palette)
+      at_palette_free(palette);
+    return 0;
+  }
+
+  /* Open the main input file.  Standard input is read in the format
+     given, or the one its first bytes tell.  */
+  if (strcmp(input_name, "-") == 0) {
+    bitmap = at_bitmap_read_file(input_reader, stdin, input_opts, exception_handler, NULL);
+
+    at_input_opts_free(input_opts);
+  } else if (input_reader != NULL) {
     bitmap = at_bitmap_read(input_reader, input_name, input_opts, exception_handler, NULL);
 
     at_input_opts_free(input_opts);
@@ -147,26 +237,8 @@ int main(int argc, char *argv[])
   splines = at_splines_new_full(bitmap, fitting_opts, exception_handler, NULL, progress_reporter, &progress_stat, NULL, NULL);
 
   /* Dump loaded bitmap if needed */
-  if (dumping_bitmap) {
-    if (at_bitmap_get_planes(bitmap) == 1)
-      dumpfile_name = extend_filename(input_rootname, "dump.pgm");
-    else
-      dumpfile_name = extend_filename(input_rootname, "dump.ppm");
-    dump_file = fopen(dumpfile_name, "wb");
-    if (dump_file == NULL) {
-      perror(dumpfile_name);
-      exit(errno);
-    }
-    if (at_bitmap_get_planes(bitmap) == 1)
-      fprintf(dump_file, "%s\n", "P5");
-    else
-      fprintf(dump_file, "%s\n", "P6");
-    fprintf(dump_file, "%s\n", "# Created by AutoTrace");
-    fprintf(dump_file, "%d %d\n", at_bitmap_get_width(bitmap), at_bitmap_get_height(bitmap));
-    fprintf(dump_file, "%d\n", 255);
-    dump(bitmap, dump_file);
-    fclose(dump_file);
-  }
+  if (dumping_bitmap)
+    dump_bitmap(input_rootname, bitmap);
 
   at_splines_write(output_writer, output_file, output_name, output_opts, splines, exception_handler, NULL);
   at_output_opts_free(output_opts);
@@ -177,6 +249,8 @@ int main(int argc, char *argv[])
   at_splines_free(splines);
   at_bitmap_free(bitmap);
   at_fitting_opts_free(fitting_opts);
+  if (palette)
+    at_palette_free(palette);
 
   if (report_progress)
     fputs("\n", stderr);
@@ -187,7 +261,9 @@ int main(int argc, char *argv[])
 /* Reading the options.  */
 
 #define USAGE1 "Options:\
-<input_name> should be a supported image.\n"\
+<input_name> should be a supported image, or - for standard input.\n\
+  Several images are traced one after the other into files named after\n\
+  them, with the suffix of the output format.\n"\
   GETOPT_USAGE								\
 "background-color <hexadezimal>: the color of the background that\n\
   should be ignored, for example FFFFFF;\n\
@@ -206,14 +282,21 @@ corner-surround <unsigned>: number of pixels on either side of a\n\
 corner-threshold <angle-in-degrees>: if a pixel, its predecessor(s),\n\
   and its successor(s) meet at an angle smaller than this, it's a\n\
   corner; default is 100.\n\
+despeckle-graph: despeckle all levels on a graph of the image's\n\
+  regions, labeled once; much faster at high levels, but a different\n\
+  algorithm: shaded images can come out much different.\n\
 despeckle-level <unsigned>: 0..20; default is no despeckling.\n\
 despeckle-tightness <real>: 0.0..8.0; default is 2.0.\n\
 dpi <unsigned>: The dots per inch value in the input image, affects scaling\n\
   of mif output image\n"
 #define USAGE2 "error-threshold <real>: subdivide fitted curves that are off by\n\
   more pixels than this; default is 2.0.\n\
+fast-reject: reject poor fits from cheap error bounds; subdivision\n\
+  points may differ slightly from the exact search.\n\
 filter-iterations <unsigned>: smooth the curve this many times\n\
   before fitting; default is 4.\n\
+fit-arcs: fit curves with pieces of circles and outlines with whole\n\
+  circles or ellipses where these are close enough.\n\
 input-format:  %s. \n\
 help: print this message.\n\
 line-reversion-threshold <real>: if a spline is closer to a straight\n\
@@ -225,18 +308,34 @@ line-threshold <real>: if the spline is not more than this far away\n\
 list-output-formats: print a list of support output formats to stderr.\n\
 list-input-formats:  print a list of support input formats to stderr.\n\
 log: write detailed progress reports to <input_name>.log.\n\
+merge-threshold <real>: merge adjacent splines if one spline stays\n\
+  within this many pixels of both; default is 0, no merging.\n\
 noise-removal <real>:: 0.0..1.0; default is 0.99.\n\
+outline-cache: fit each repeated outline shape only once and reuse its\n\
+  splines for the other copies.\n\
 output-file <filename>: write to <filename>\n\
 output-format <format>: use format <format> for the output file\n\
   %s can be used.\n\
+palette-image <filename>: reduce the colors to a palette computed from\n\
+  <filename> rather than from the input; give it again for more images,\n\
+  for example frames of an animation.  The number of colors is still\n\
+  set with color-count.\n\
 preserve-width: whether to preserve line width prior to thinning.\n\
+quantizer <name>: how color-count chooses the colors, either median-cut\n\
+  or k-means, which is faster for a few colors; default is median-cut.\n\
 remove-adjacent-corners: remove corners that are adjacent.\n\
 tangent-surround <unsigned>: number of points on either side of a\n\
   point to consider when computing the tangent at that point; default is 3.\n\
 report-progress: report tracing status in real time.\n\
+threads <unsigned>: number of threads used by the parallel stages;\n\
+  default is 0, that means one per processor.\n\
 debug-arch: print the type of cpu.\n\
 debug-bitmap: dump loaded bitmap to <input_name>.bitmap.ppm or pgm.\n\
 version: print the version number of this program.\n\
+weighted-distance: with preserve-width, measure the line width with the\n\
+  gray-weighted chamfer distance instead of the exact Euclidean distance.\n\
+whole-font: trace every character of a GF font, several at a time, into\n\
+  one UGS font.\n\
 width-weight-factor <real>: weight factor for fitting the linewidth.\n\
 "
 
@@ -257,11 +356,14 @@ static char *read_command_line(int argc, char *argv[], at_fitting_opts_type * fi
   {"corner-always-threshold", 1, 0, 0},
   {"corner-surround", 1, 0, 0},
   {"corner-threshold", 1, 0, 0},
+  {"despeckle-graph", 0, 0, 0},
   {"despeckle-level", 1, 0, 0},
   {"despeckle-tightness", 1, 0, 0},
   {"dpi", 1, 0, 0},
   {"error-threshold", 1, 0, 0},
+  {"fast-reject", 0, 0, 0},
   {"filter-iterations", 1, 0, 0},
+  {"fit-arcs", 0, 0, 0},
   {"help", 0, 0, 0},
   {"input-format", 1, 0, 0},
   {"line-reversion-threshold", 1, 0, 0},
@@ -269,15 +371,22 @@ static char *read_command_line(int argc, char *argv[], at_fitting_opts_type * fi
   {"list-output-formats", 0, 0, 0},
   {"list-input-formats", 0, 0, 0},
   {"log", 0, (int *)&logging, 1},
+  {"merge-threshold", 1, 0, 0},
   {"noise-removal", 1, 0, 0},
+  {"outline-cache", 0, 0, 0},
   {"output-file", 1, 0, 0},
   {"output-format", 1, 0, 0},
+  {"palette-image", 1, 0, 0},
   {"preserve-width", 0, 0, 0},
+  {"quantizer", 1, 0, 0},
   {"range", 1, 0, 0},
   {"remove-adjacent-corners", 0, 0, 0},
   {"tangent-surround", 1, 0, 0},
+  {"threads", 1, 0, 0},
   {"report-progress", 0, (int *)&report_progress, 1},
   {"version", 0, (int *)&printed_version, 1},
+  {"weighted-distance", 0, 0, 0},
+  {"whole-font", 0, (int *)&whole_font, 1},
   {"width-weight-factor", 1, 0, 0},
   {0, 0, 0, 0}
   };
@@ -329,6 +438,9 @@ static char *read_command_line(int argc, char *argv[], at_fitting_opts_type * fi
       exit(0);
     }
 
+    else if (ARGUMENT_IS("despeckle-graph"))
+      fitting_opts->despeckle_graph = TRUE;
+
     else if (ARGUMENT_IS("despeckle-level"))
       fitting_opts->despeckle_level = atou(optarg);
 
@@ -344,12 +456,18 @@ static char *read_command_line(int argc, char *argv[], at_fitting_opts_type * fi
     else if (ARGUMENT_IS("error-threshold"))
       fitting_opts->error_threshold = (gfloat) atof(optarg);
 
+    else if (ARGUMENT_IS("fast-reject"))
+      fitting_opts->fast_reject = TRUE;
+
     else if (ARGUMENT_IS("filter-iterations"))
       fitting_opts->filter_iterations = atou(optarg);
 
+    else if (ARGUMENT_IS("fit-arcs"))
+      fitting_opts->fit_arcs = TRUE;
+
     else if (ARGUMENT_IS("help")) {
       char *ishortlist, *oshortlist;
-      fprintf(stderr, _("Usage: %s [options] <input_file_name>.\n"), argv[0]);
+      fprintf(stderr, _("Usage: %s [options] <input_file_name>...\n"), argv[0]);
       fprintf(stderr, USAGE1);
       fprintf(stderr, USAGE2, ishortlist = at_input_shortlist(), oshortlist = at_output_shortlist());
       free(ishortlist);
@@ -380,6 +498,12 @@ static char *read_command_line(int argc, char *argv[], at_fitting_opts_type * fi
       exit(0);
     }
 
+    else if (ARGUMENT_IS("merge-threshold"))
+      fitting_opts->merge_threshold = (gfloat) atof(optarg);
+
+    else if (ARGUMENT_IS("outline-cache"))
+      fitting_opts->outline_cache = TRUE;
+
     else if (ARGUMENT_IS("output-file"))
       output_name = optarg;
 
@@ -387,26 +511,225 @@ static char *read_command_line(int argc, char *argv[], at_fitting_opts_type * fi
       output_writer = at_output_get_handler_by_suffix(optarg);
       if (output_writer == NULL)
         FATAL(_("Output format %s is not supported"), optarg);
-    } else if (ARGUMENT_IS("preserve_width"))
+      output_suffix = optarg;
+    } else if (ARGUMENT_IS("palette-image")) {
+      XREALLOC(palette_names, (palette_count + 1) * sizeof(char *));
+      palette_names[palette_count++] = optarg;
+    } else if (ARGUMENT_IS("preserve-width"))
       fitting_opts->preserve_width = TRUE;
 
+    else if (ARGUMENT_IS("quantizer")) {
+      if (!strcmp(optarg, "median-cut"))
+        fitting_opts->quantizer = AT_QUANTIZER_MEDIAN_CUT;
+      else if (!strcmp(optarg, "k-means"))
+        fitting_opts->quantizer = AT_QUANTIZER_KMEANS;
+      else
+        FATAL(_("quantizer must be median-cut or k-means, not %s"), optarg);
+    }
+
     else if (ARGUMENT_IS("remove-adjacent-corners"))
       fitting_opts->remove_adjacent_corners = TRUE;
 
     else if (ARGUMENT_IS("tangent-surround"))
       fitting_opts->tangent_surround = atou(optarg);
 
+    else if (ARGUMENT_IS("threads"))
+      fitting_opts->threads = atou(optarg);
+
     else if (ARGUMENT_IS("version"))
       printf(_("AutoTrace version %s.\n"), at_version(FALSE));
 
+    else if (ARGUMENT_IS("weighted-distance"))
+      fitting_opts->weighted_distance = TRUE;
+
     else if (ARGUMENT_IS("width-weight-factor"))
       fitting_opts->width_weight_factor = (gfloat) atof(optarg);
 
     /* Else it was just a flag; getopt has already done the assignment.  */
   }
+  input_names = argv + optind;
+  input_count = argc - optind;
   FINISH_COMMAND_LINE();
 }
 
+/* The characters of a font and the splines traced from them.  */
+typedef struct {
+  gf_glyph_type *glyphs;
+  at_splines_type **splines;
+  at_fitting_opts_type *opts;
+} font_job;
+
+static void trace_glyphs(unsigned first, unsigned last, gpointer data)
+{
+  font_job *job = (font_job *) data;
+  /* The fitting changes some options for a while */
+  at_fitting_opts_type *opts = at_fitting_opts_copy(job->opts);
+  unsigned i;
+
+  for (i = first; i < last; i++)
+    job->splines[i] = at_splines_new(&job->glyphs[i].bitmap, opts, exception_handler, NULL);
+  at_fitting_opts_free(opts);
+}
+
+/* Read all the characters of the GF font INPUT_NAME at once, trace
+   as many of them at a time as there are threads, and write them one
+   after the other as a UGS font.  */
+
+static void trace_font(char *input_name, at_fitting_opts_type * fitting_opts, at_output_opts_type * output_opts, FILE * output_file)
+{
+  at_exception_type exp = at_exception_new(exception_handler, NULL);
+  font_job job;
+  FILE *input_file;
+  long design_pixels;
+  unsigned count, i;
+
+  if (output_writer != at_output_get_handler_by_suffix("ugs"))
+    FATAL(_("whole-font needs the ugs output format"));
+
+  if (strcmp(input_name, "-") == 0)
+    input_file = stdin;
+  else if ((input_file = fopen(input_name, "rb")) == NULL) {
+    perror(input_name);
+    exit(errno);
+  }
+  count = gf_read_font(input_name, input_file, &design_pixels, &job.glyphs, &exp);
+  if (input_file != stdin)
+    fclose(input_file);
+
+  /* The threads go to the characters rather than to the stages of
+     tracing each of them.  */
+  job.opts = at_fitting_opts_copy(fitting_opts);
+  job.opts->threads = 1;
+  XMALLOC(job.splines, count * sizeof(at_splines_type *));
+  parallel_for(count, 1, fitting_opts->threads, trace_glyphs, &job);
+
+  for (i = 0; i < count; i++) {
+    gf_set_ugs_glyph(design_pixels, &job.glyphs[i]);
+    at_splines_write(output_writer, output_file, output_name, output_opts, job.splines[i], exception_handler, NULL);
+    at_splines_free(job.splines[i]);
+  }
+  free(job.splines);
+  gf_free_glyphs(job.glyphs, count);
+  at_fitting_opts_free(job.opts);
+}
+
+/* An image of a batch on its way from its file to its output.  */
+typedef struct {
+  char *name;
+  at_bitmap *bitmap;
+  at_splines_type *splines;
+  long design_pixels;           /* The GF character written as UGS */
+  gf_glyph_type glyph;
+} batch_item;
+
+typedef struct {
+  batch_item *items;
+  at_fitting_opts_type *fitting_opts;
+  at_input_opts_type *input_opts;
+  at_output_opts_type *output_opts;
+  gboolean ugs;
+  GMutex ugs_lock;              /* Held over the UGS character in use */
+} batch_job;
+
+/* How many images may wait between two stages of a batch.  */
+#define BATCH_DEPTH 2
+
+static void read_item(unsigned i, gpointer data)
+{
+  batch_job *job = (batch_job *) data;
+  batch_item *item = &job->items[i];
+  at_bitmap_reader *reader = input_reader ? input_reader : at_input_get_handler(item->name);
+
+  if (reader == NULL)
+    FATAL(_("Unsupported input format of %s"), item->name);
+
+  /* The GF reader leaves the character for the UGS writer, which by
+     then may be at work on the one before; the lock keeps the two
+     apart.  */
+  if (job->ugs)
+    g_mutex_lock(&job->ugs_lock);
+  item->bitmap = at_bitmap_read(reader, item->name, job->input_opts, exception_handler, NULL);
+  if (job->ugs) {
+    gf_get_ugs_glyph(&item->design_pixels, &item->glyph);
+    g_mutex_unlock(&job->ugs_lock);
+  }
+}
+
+static void trace_item(unsigned i, gpointer data)
+{
+  batch_job *job = (batch_job *) data;
+  batch_item *item = &job->items[i];
+  at_progress_func progress_reporter = NULL;
+  int progress_stat = 0;
+
+  if (report_progress) {
+    progress_reporter = dot_printer;
+    fprintf(stderr, "%-15s", item->name);
+  }
+  item->splines = at_splines_new_full(item->bitmap, job->fitting_opts, exception_handler, NULL, progress_reporter, &progress_stat, NULL, NULL);
+  if (dumping_bitmap) {
+    char *basename = get_basename(item->name);
+    char *rootname = remove_suffix(basename);
+    dump_bitmap(rootname ? rootname : basename, item->bitmap);
+    if (rootname && rootname != basename)
+      free(rootname);
+  }
+  at_bitmap_free(item->bitmap);
+  if (report_progress)
+    fputs("\n", stderr);
+}
+
+static void write_item(unsigned i, gpointer data)
+{
+  batch_job *job = (batch_job *) data;
+  batch_item *item = &job->items[i];
+  char *name = make_suffix(get_basename(item->name), output_suffix);
+  FILE *file;
+
+  if (strcmp(name, item->name) == 0)
+    FATAL(_("Input and output file may not be the same\n"));
+  file = fopen(name, "wb");
+  if (file == NULL) {
+    perror(name);
+    exit(errno);
+  }
+  if (job->ugs) {
+    g_mutex_lock(&job->ugs_lock);
+    gf_set_ugs_glyph(item->design_pixels, &item->glyph);
+  }
+  at_splines_write(output_writer, file, name, job->output_opts, item->splines, exception_handler, NULL);
+  if (job->ugs)
+    g_mutex_unlock(&job->ugs_lock);
+  fclose(file);
+  at_splines_free(item->splines);
+  free(name);
+}
+
+/* Trace the images of the command line into files named after them,
+   with the suffix of the output format.  Reading an image, tracing
+   the one before and writing the one before that are done at the
+   same time.  */
+
+static void trace_batch(at_fitting_opts_type * fitting_opts, at_input_opts_type * input_opts, at_output_opts_type * output_opts)
+{
+  parallel_stage_func stages[] = { read_item, trace_item, write_item };
+  batch_job job;
+  unsigned i;
+
+  XCALLOC(job.items, input_count * sizeof(batch_item));
+  for (i = 0; i < input_count; i++)
+    job.items[i].name = input_names[i];
+  job.fitting_opts = fitting_opts;
+  job.input_opts = input_opts;
+  job.output_opts = output_opts;
+  job.ugs = output_writer == at_output_get_handler_by_suffix("ugs");
+  g_mutex_init(&job.ugs_lock);
+
+  parallel_pipeline(input_count, stages, 3, BATCH_DEPTH, &job);
+  g_mutex_clear(&job.ugs_lock);
+  free(job.items);
+}
+
 /* Return NAME with any leading path stripped off.  This returns a
    pointer into NAME.  For example, `basename ("/foo/bar.baz")'
    returns "bar.baz".  */
@@ -468,6 +791,33 @@ static void dot_printer(gfloat percentage, gpointer client_data)
   }
 }
 
+/* Write BITMAP to ROOTNAME.dump.pgm or .ppm.  (-debug-bitmap) */
+
+static void dump_bitmap(char *rootname, at_bitmap * bitmap)
+{
+  char *dumpfile_name;
+  FILE *dump_file;
+
+  if (at_bitmap_get_planes(bitmap) == 1)
+    dumpfile_name = extend_filename(rootname, "dump.pgm");
+  else
+    dumpfile_name = extend_filename(rootname, "dump.ppm");
+  dump_file = fopen(dumpfile_name, "wb");
+  if (dump_file == NULL) {
+    perror(dumpfile_name);
+    exit(errno);
+  }
+  if (at_bitmap_get_planes(bitmap) == 1)
+    fprintf(dump_file, "%s\n", "P5");
+  else
+    fprintf(dump_file, "%s\n", "P6");
+  fprintf(dump_file, "%s\n", "# Created by AutoTrace");
+  fprintf(dump_file, "%d %d\n", at_bitmap_get_width(bitmap), at_bitmap_get_height(bitmap));
+  fprintf(dump_file, "%d\n", 255);
+  dump(bitmap, dump_file);
+  fclose(dump_file);
+}
+
 static void dump(at_bitmap * bitmap, FILE * fp)
 {
   unsigned short width, height;
@@ -477,6 +827,7 @@ static void dump(at_bitmap * bitmap, FILE * fp)
   height = at_bitmap_get_height(bitmap);
   np = at_bitmap_get_planes(bitmap);
 
+  at_bitmap_unpack(bitmap);
   fwrite(AT_BITMAP_BITS(bitmap), sizeof(unsigned char), width * height * np, fp);
 }
 
@@ -27,6 +27,7 @@
 #include "logreport.h"
 #include "xstd.h"
 #include "quantize.h"
+#include "parallel.h"
 
 #define MAXNUMCOLORS 256
 
@@ -68,17 +69,18 @@ static void zero_histogram_rgb(Histogram histogram)
         histogram[r * MR + g * MG + b] = 0;
 }
 
-static void generate_histogram_rgb(Histogram histogram, at_bitmap * image, const at_color * ignoreColor)
+static void generate_histogram_rgb(Histogram histogram, at_bitmap * image, const at_color * ignoreColor, int first_row, int last_row)
 {
-  unsigned char *src = image->bitmap;
+  int width = AT_BITMAP_WIDTH(image);
   int num_elems;
+  unsigned char *src;
   ColorFreq *col;
 
-  num_elems = AT_BITMAP_WIDTH(image) * AT_BITMAP_HEIGHT(image);
-  zero_histogram_rgb(histogram);
+  num_elems = width * (last_row - first_row);
 
   switch (AT_BITMAP_PLANES(image)) {
   case 3:
+    src = image->bitmap + 3 * first_row * width;
     while (num_elems--) {
       /* If we have an ignorecolor, skip it. */
       if (ignoreColor) {
@@ -96,6 +98,7 @@ static void generate_histogram_rgb(Histogram histogram, at_bitmap * image, const
     break;
 
   case 1:
+    src = image->bitmap + first_row * width;
     while (--num_elems >= 0) {
       if (ignoreColor && src[num_elems] == ignoreColor->r)
         continue;
@@ -713,94 +716,156 @@ static void fill_inverse_cmap_rgb(QuantizeObj * quantobj, Histogram histogram, i
   }
 }
 
-/*  This is pass 1  */
-static void median_cut_pass1_rgb(QuantizeObj * quantobj, at_bitmap * image, const at_color * ignoreColor)
+/* Both passes are split between threads over slices of rows.  Pass 1
+ * counts each slice into a histogram of its own, and these are summed
+ * into the first.  Pass 2 first finds the update boxes the pixels fall
+ * in and fills their inverse colormap entries, one box per thread at a
+ * time, so that the rows are then mapped with the cache only read.
+ * Neither depends on the order of the work, so the result is the same
+ * for any number of threads.
+ */
+
+/* Each histogram takes 16 MB.  */
+#define MAX_HISTOGRAMS 8
+
+#define BOX_COUNT ((HIST_R_ELEMS / BOX_R_ELEMS) * (HIST_G_ELEMS / BOX_G_ELEMS) * (HIST_B_ELEMS / BOX_B_ELEMS))
+#define BOX_INDEX(R, G, B) ((((R) >> BOX_R_LOG) * (HIST_G_ELEMS / BOX_G_ELEMS) + ((G) >> BOX_G_LOG)) \
+                            * (HIST_B_ELEMS / BOX_B_ELEMS) + ((B) >> BOX_B_LOG))
+
+typedef struct {
+  QuantizeObj *quantobj;
+  at_bitmap *image;
+  const at_color *color;        /* The color ignored by pass 1, or the
+                                   background of pass 2.  */
+  at_color bg_color;            /* Its colormap entry in pass 2.  */
+  unsigned slices;
+  Histogram *histograms;        /* One per slice in pass 1.  */
+  unsigned char *boxes;         /* Per slice, the boxes hit in pass 2.  */
+  int *box_list;                /* The boxes to fill.  */
+} median_job;
+
+#define SLICE_FIRST_ROW(job, i) ((int) ((long) AT_BITMAP_HEIGHT ((job)->image) * (i) / (job)->slices))
+
+static unsigned count_slices(at_bitmap * image, unsigned threads, unsigned max_slices)
 {
-  generate_histogram_rgb(quantobj->histogram, image, ignoreColor);
-  select_colors_rgb(quantobj, quantobj->histogram);
+  unsigned slices = parallel_threads(threads);
+  unsigned rows = (AT_BITMAP_HEIGHT(image) + 63) / 64;
+
+  if (slices > rows)
+    slices = rows;
+  if (slices > max_slices)
+    slices = max_slices;
+  return slices > 0 ? slices : 1;
+}
+
+static void histogram_slices(unsigned first, unsigned last, gpointer data)
+{
+  median_job *job = (median_job *) data;
+  unsigned i;
+
+  for (i = first; i < last; i++)
+    generate_histogram_rgb(job->histograms[i], job->image, job->color, SLICE_FIRST_ROW(job, i), SLICE_FIRST_ROW(job, i + 1));
+}
+
+static void sum_histograms(unsigned first, unsigned last, gpointer data)
+{
+  median_job *job = (median_job *) data;
+  unsigned i, cell;
+
+  for (i = 1; i < job->slices; i++)
+    for (cell = first; cell < last; cell++)
+      job->histograms[0][cell] += job->histograms[i][cell];
+}
+
+static void find_boxes(unsigned first, unsigned last, gpointer data)
+{
+  median_job *job = (median_job *) data;
+  int spp = AT_BITMAP_PLANES(job->image);
+  int width = AT_BITMAP_WIDTH(job->image);
+  unsigned i;
+
+  for (i = first; i < last; i++) {
+    unsigned char *boxes = &job->boxes[i * BOX_COUNT];
+    unsigned char *src = job->image->bitmap + spp * SLICE_FIRST_ROW(job, i) * width;
+    unsigned char *end = job->image->bitmap + spp * SLICE_FIRST_ROW(job, i + 1) * width;
+
+    memset(boxes, 0, BOX_COUNT);
+    for (; src < end; src += spp)
+      if (spp == 3)
+        boxes[BOX_INDEX(src[0] >> R_SHIFT, src[1] >> G_SHIFT, src[2] >> B_SHIFT)] = 1;
+      else
+        boxes[BOX_INDEX(src[0] >> R_SHIFT, src[0] >> G_SHIFT, src[0] >> B_SHIFT)] = 1;
+  }
+}
+
+static void fill_boxes(unsigned first, unsigned last, gpointer data)
+{
+  median_job *job = (median_job *) data;
+  unsigned i;
+
+  for (i = first; i < last; i++) {
+    int box = job->box_list[i];
+    int B = box % (HIST_B_ELEMS / BOX_B_ELEMS);
+    int G = box / (HIST_B_ELEMS / BOX_B_ELEMS) % (HIST_G_ELEMS / BOX_G_ELEMS);
+    int R = box / (HIST_B_ELEMS / BOX_B_ELEMS) / (HIST_G_ELEMS / BOX_G_ELEMS);
+
+    fill_inverse_cmap_rgb(job->quantobj, job->quantobj->histogram, R << BOX_R_LOG, G << BOX_G_LOG, B << BOX_B_LOG);
+  }
 }
 
 /* Map some rows of pixels to the output colormapped representation. */
-static void median_cut_pass2_rgb(QuantizeObj * quantobj, at_bitmap * image, const at_color * bgColor)
+static void map_rows(unsigned first, unsigned last, gpointer data)
  /* This version performs no dithering */
 {
+  median_job *job = (median_job *) data;
+  QuantizeObj *quantobj = job->quantobj;
   Histogram histogram = quantobj->histogram;
+  const at_color *bgColor = job->color;
+  at_color bg_color = job->bg_color;
   ColorFreq *cachep;
   int R, G, B;
   int origR, origG, origB;
-  int row, col;
-  int spp = AT_BITMAP_PLANES(image);
-  int width = AT_BITMAP_WIDTH(image);
-  int height = AT_BITMAP_HEIGHT(image);
+  int spp = AT_BITMAP_PLANES(job->image);
+  int width = AT_BITMAP_WIDTH(job->image);
   unsigned char *src, *dest;
-  at_color bg_color = { 0xff, 0xff, 0xff };
 
-  zero_histogram_rgb(histogram);
+  src = dest = job->image->bitmap + spp * first * width;
+  if (spp == 3) {
+    long idx = (long)width * (last - first);
+    while (idx-- > 0) {
+      /* get pixel value and index into the cache */
+      origR = (*src++);
+      origG = (*src++);
+      origB = (*src++);
 
-  if (bgColor) {
-    /* Find the nearest colormap entry for the background color. */
-    R = bgColor->r >> R_SHIFT;
-    G = bgColor->g >> G_SHIFT;
-    B = bgColor->b >> B_SHIFT;
-    cachep = &histogram[R * MR + G * MG + B];
-    if (*cachep == 0)
-      fill_inverse_cmap_rgb(quantobj, histogram, R, G, B);
-    bg_color = quantobj->cmap[*cachep - 1];
-  }
+      R = origR >> R_SHIFT;
+      G = origG >> G_SHIFT;
+      B = origB >> B_SHIFT;
+      cachep = &histogram[R * MR + G * MG + B];
 
-  src = dest = image->bitmap;
-  if (spp == 3) {
-    for (row = 0; row < height; row++) {
-      for (col = 0; col < width; col++) {
-        /* get pixel value and index into the cache */
-        origR = (*src++);
-        origG = (*src++);
-        origB = (*src++);
-
-        /*
-           if (origR > 253 && origG > 253 && origB > 253)
-           {
-           (*dest++) = 255; (*dest++) = 255; (*dest++) = 255;
-           continue;
-           }
-         */
-
-        /* get pixel value and index into the cache */
-        R = origR >> R_SHIFT;
-        G = origG >> G_SHIFT;
-        B = origB >> B_SHIFT;
-        cachep = &histogram[R * MR + G * MG + B];
-        /* If we have not seen this color before, find nearest
-           colormap entry and update the cache */
-        if (*cachep == 0) {
-          fill_inverse_cmap_rgb(quantobj, histogram, R, G, B);
-        }
-        /* Now emit the colormap index for this cell */
-        dest[0] = quantobj->cmap[*cachep - 1].r;
-        dest[1] = quantobj->cmap[*cachep - 1].g;
-        dest[2] = quantobj->cmap[*cachep - 1].b;
-
-        /* If the colormap entry for this pixel is the same as the
-           background's colormap entry, set the pixel to the
-           background color. */
-        if (bgColor && (dest[0] == bg_color.r && dest[1] == bg_color.g && dest[2] == bg_color.b)) {
-          dest[0] = bgColor->r;
-          dest[1] = bgColor->g;
-          dest[2] = bgColor->b;
-        }
-        dest += 3;
+      /* Now emit the colormap index for this cell */
+      dest[0] = quantobj->cmap[*cachep - 1].r;
+      dest[1] = quantobj->cmap[*cachep - 1].g;
+      dest[2] = quantobj->cmap[*cachep - 1].b;
+
+      /* If the colormap entry for this pixel is the same as the
+         background's colormap entry, set the pixel to the
+         background color. */
+      if (bgColor && (dest[0] == bg_color.r && dest[1] == bg_color.g && dest[2] == bg_color.b)) {
+        dest[0] = bgColor->r;
+        dest[1] = bgColor->g;
+        dest[2] = bgColor->b;
       }
+      dest += 3;
     }
   } else if (spp == 1) {
-    long idx = width * height;
+    long idx = (long)width * (last - first);
     while (--idx >= 0) {
       origR = src[idx];
       R = origR >> R_SHIFT;
       G = origR >> G_SHIFT;
       B = origR >> B_SHIFT;
       cachep = &histogram[R * MR + G * MG + B];
-      if (*cachep == 0)
-        fill_inverse_cmap_rgb(quantobj, histogram, R, G, B);
 
       dest[idx] = quantobj->cmap[*cachep - 1].r;
 
@@ -813,51 +878,111 @@ static void median_cut_pass2_rgb(QuantizeObj * quantobj, at_bitmap * image, cons
   }
 }
 
-static QuantizeObj *initialize_median_cut(int num_colors)
+/*  This is pass 1, over one image or more  */
+static void median_cut_pass1_rgb(QuantizeObj * quantobj, at_bitmap ** images, unsigned count, const at_color * ignoreColor, unsigned threads)
 {
-  QuantizeObj *quantobj;
+  median_job job;
+  unsigned histograms = 1, i;
+
+  for (i = 0; i < count; i++)
+    histograms = MAX(histograms, count_slices(images[i], threads, MAX_HISTOGRAMS));
+
+  job.quantobj = quantobj;
+  job.color = ignoreColor;
+  XMALLOC(job.histograms, histograms * sizeof(Histogram));
+  job.histograms[0] = quantobj->histogram;
+  for (i = 1; i < histograms; i++)
+    XMALLOC(job.histograms[i], sizeof(ColorFreq) * HIST_R_ELEMS * HIST_G_ELEMS * HIST_B_ELEMS);
+  for (i = 0; i < histograms; i++)
+    zero_histogram_rgb(job.histograms[i]);
+
+  for (i = 0; i < count; i++) {
+    job.image = images[i];
+    job.slices = count_slices(images[i], threads, MAX_HISTOGRAMS);
+    parallel_for(job.slices, 1, threads, histogram_slices, &job);
+  }
+  job.slices = histograms;
+  if (histograms > 1)
+    parallel_for(HIST_R_ELEMS * HIST_G_ELEMS * HIST_B_ELEMS, MR, threads, sum_histograms, &job);
 
-  /* Initialize the data structures */
-  XMALLOC(quantobj, sizeof(QuantizeObj));
+  for (i = 1; i < histograms; i++)
+    free(job.histograms[i]);
+  free(job.histograms);
 
-  XMALLOC(quantobj->histogram, sizeof(ColorFreq) * HIST_R_ELEMS * HIST_G_ELEMS * HIST_B_ELEMS);
-  quantobj->desired_number_of_colors = num_colors;
+  select_colors_rgb(quantobj, quantobj->histogram);
+  quantobj->inverse_cmap_filled = FALSE;
+}
 
-  return quantobj;
+/* Fill the inverse colormap for every box, so that the histogram can
+   be shared by images and threads without being written to.  */
+static void fill_inverse_cmap_all(QuantizeObj * quantobj, unsigned threads)
+{
+  median_job job;
+  int box;
+
+  zero_histogram_rgb(quantobj->histogram);
+
+  job.quantobj = quantobj;
+  XMALLOC(job.box_list, BOX_COUNT * sizeof(int));
+  for (box = 0; box < BOX_COUNT; box++)
+    job.box_list[box] = box;
+  parallel_for(BOX_COUNT, 1, threads, fill_boxes, &job);
+  free(job.box_list);
+
+  quantobj->inverse_cmap_filled = TRUE;
 }
 
-void quantize(at_bitmap * image, long ncolors, const at_color * bgColor, QuantizeObj ** iQuant, at_exception_type * exp)
+/*  This is pass 2  */
+static void median_cut_pass2_rgb(QuantizeObj * quantobj, at_bitmap * image, const at_color * bgColor, unsigned threads)
 {
-  QuantizeObj *quantobj;
-  unsigned int spp = AT_BITMAP_PLANES(image);
+  Histogram histogram = quantobj->histogram;
+  median_job job;
+  int R, G, B, box, count;
+  unsigned i;
+
+  job.quantobj = quantobj;
+  job.image = image;
+  job.color = bgColor;
+  job.bg_color.r = job.bg_color.g = job.bg_color.b = 0xff;
+
+  /* Fill the inverse colormap for every box a pixel falls in, and the
+     box of the background color.  */
+  if (!quantobj->inverse_cmap_filled) {
+    zero_histogram_rgb(histogram);
+
+    job.slices = count_slices(image, threads, G_MAXUINT);
+    XMALLOC(job.boxes, job.slices * BOX_COUNT);
+    XMALLOC(job.box_list, BOX_COUNT * sizeof(int));
+    parallel_for(job.slices, 1, threads, find_boxes, &job);
+    if (bgColor)
+      job.boxes[BOX_INDEX(bgColor->r >> R_SHIFT, bgColor->g >> G_SHIFT, bgColor->b >> B_SHIFT)] = 1;
+    for (box = 0, count = 0; box < BOX_COUNT; box++)
+      for (i = 0; i < job.slices; i++)
+        if (job.boxes[i * BOX_COUNT + box]) {
+          job.box_list[count++] = box;
+          break;
+        }
 
-  if (spp != 3 && spp != 1) {
-    LOG("quantize: %u-plane images are not supported", spp);
-    at_exception_fatal(exp, "quantize: wrong plane images are passed");
-    return;
+    parallel_for(count, 1, threads, fill_boxes, &job);
+    free(job.box_list);
+    free(job.boxes);
   }
 
-  /* If a pointer was sent in, let's use it. */
-  if (iQuant) {
-    if (*iQuant == NULL) {
-      quantobj = initialize_median_cut(ncolors);
-      median_cut_pass1_rgb(quantobj, image, bgColor);
-      *iQuant = quantobj;
-    } else
-      quantobj = *iQuant;
-  } else {
-    quantobj = initialize_median_cut(ncolors);
-    median_cut_pass1_rgb(quantobj, image, NULL);
+  if (bgColor) {
+    /* Find the nearest colormap entry for the background color. */
+    R = bgColor->r >> R_SHIFT;
+    G = bgColor->g >> G_SHIFT;
+    B = bgColor->b >> B_SHIFT;
+    job.bg_color = quantobj->cmap[histogram[R * MR + G * MG + B] - 1];
   }
 
-  median_cut_pass2_rgb(quantobj, image, bgColor);
-
-  if (iQuant == NULL)
-    quantize_object_free(quantobj);
+  parallel_for(AT_BITMAP_HEIGHT(image), 16, threads, map_rows, &job);
 }
 
-void quantize_object_free(QuantizeObj * quantobj)
-{
-  free(quantobj->histogram);
-  free(quantobj);
-}
+const quantizer_engine median_cut_engine = {
+  "median-cut",
+  HIST_R_ELEMS * HIST_G_ELEMS * HIST_B_ELEMS,
+  median_cut_pass1_rgb,
+  fill_inverse_cmap_all,
+  median_cut_pass2_rgb
+};
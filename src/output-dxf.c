@@ -29,6 +29,7 @@
 #include "output-dxf.h"
 #include "xstd.h"
 #include "autotrace.h"
+#define _USE_MATH_DEFINES
 #include <math.h>
 #include <time.h>
 #include <string.h>
@@ -570,6 +571,37 @@ int bspline_to_lines(xypnt_head_rec * vtx_list /*  */ ,
   return (0);
 }
 
+/* The last vertex of the polyline being output, which is only written
+   once the segment from it is known: an arc must put its bulge on the
+   vertex it starts at.  */
+typedef struct {
+  int pending;
+  double x, y;
+  char layer[10];
+} dxf_vertex;
+
+/* Write the pending vertex V, if any, with BULGE.  */
+static void flush_vertex(FILE * dxf_file, dxf_vertex * v, double bulge)
+{
+  if (!v->pending)
+    return;
+  if (bulge != 0.0)
+    fprintf(dxf_file, "  0\nVERTEX\n  8\n%s\n  10\n%f\n  20\n%f\n  42\n%f\n", v->layer, v->x, v->y, bulge);
+  else
+    fprintf(dxf_file, "  0\nVERTEX\n  8\n%s\n  10\n%f\n  20\n%f\n", v->layer, v->x, v->y);
+  v->pending = 0;
+}
+
+/* Write the pending vertex V, and make X, Y of layer LAYER the next.  */
+static void add_vertex(FILE * dxf_file, dxf_vertex * v, const char *layer, double x, double y)
+{
+  flush_vertex(dxf_file, v, 0.0);
+  v->pending = 1;
+  v->x = x;
+  v->y = y;
+  strcpy(v->layer, layer);
+}
+
 /******************************************************************************
 * This function outputs the DXF code which produces the polylines
 */
@@ -581,6 +613,7 @@ static void out_splines(FILE * dxf_file, spline_list_array_type shape)
   xypnt pnt, pnt_old = { 0, 0 };
   char fin, new_layer = 0, layerstr[10];
   int i, first_seg = 1, idx;
+  dxf_vertex vertex = { 0 };
 
   strcpy(layerstr, "C1");
   for (this_list = 0; this_list < SPLINE_LIST_ARRAY_LENGTH(shape); this_list++) {
@@ -605,15 +638,16 @@ static void out_splines(FILE * dxf_file, spline_list_array_type shape)
       if (lround(startx * RESOLUTION) != pnt_old.xp || lround(starty * RESOLUTION) != pnt_old.yp || new_layer) {
         /* must begin new polyline */
         new_layer = 0;
+        flush_vertex(dxf_file, &vertex, 0.0);
         fprintf(dxf_file, "  0\nSEQEND\n  8\n%s\n", layerstr);
         fprintf(dxf_file, "  0\nPOLYLINE\n  8\n%s\n  66\n1\n  10\n%f\n  20\n%f\n", layerstr, startx, starty);
-        fprintf(dxf_file, "  0\nVERTEX\n  8\n%s\n  10\n%f\n  20\n%f\n", layerstr, startx, starty);
+        add_vertex(dxf_file, &vertex, layerstr, startx, starty);
         pnt_old.xp = lround(startx * RESOLUTION);
         pnt_old.yp = lround(starty * RESOLUTION);
       }
     } else {
       fprintf(dxf_file, "  0\nPOLYLINE\n  8\n%s\n  66\n1\n  10\n%f\n  20\n%f\n", layerstr, startx, starty);
-      fprintf(dxf_file, "  0\nVERTEX\n  8\n%s\n  10\n%f\n  20\n%f\n", layerstr, startx, starty);
+      add_vertex(dxf_file, &vertex, layerstr, startx, starty);
       pnt_old.xp = lround(startx * RESOLUTION);
       pnt_old.yp = lround(starty * RESOLUTION);
     }
@@ -625,11 +659,40 @@ static void out_splines(FILE * dxf_file, spline_list_array_type shape)
         if (lround(startx * RESOLUTION) != pnt_old.xp || lround(starty * RESOLUTION) != pnt_old.yp || new_layer) {
           /* must begin new polyline */
           new_layer = 0;
+          flush_vertex(dxf_file, &vertex, 0.0);
+          fprintf(dxf_file, "  0\nSEQEND\n  8\n%s\n", layerstr);
+          fprintf(dxf_file, "  0\nPOLYLINE\n  8\n%s\n  66\n1\n  10\n%f\n  20\n%f\n", layerstr, startx, starty);
+          add_vertex(dxf_file, &vertex, layerstr, startx, starty);
+        }
+        add_vertex(dxf_file, &vertex, layerstr, END_POINT(s).x, END_POINT(s).y);
+
+        startx = END_POINT(s).x;
+        starty = END_POINT(s).y;
+        pnt_old.xp = lround(startx * RESOLUTION);
+        pnt_old.yp = lround(starty * RESOLUTION);
+      } else if (SPLINE_DEGREE(s) == CIRCLETYPE) {
+        /* Polylines have circular arcs: the bulge of a vertex, the
+           tangent of a quarter of the angle the arc to the next vertex
+           turns by, makes the segment to that vertex an arc.  */
+        arc_type arc;
+        double bulge;
+
+        this_spline += spline_list_arc(list, this_spline, 270.0, &arc) - 1;
+        s = SPLINE_LIST_ELT(list, this_spline);
+        bulge = tan(arc.sweep * M_PI / 720.0);
+
+        if (lround(startx * RESOLUTION) != pnt_old.xp || lround(starty * RESOLUTION) != pnt_old.yp || new_layer) {
+          /* must begin new polyline */
+          new_layer = 0;
+          flush_vertex(dxf_file, &vertex, 0.0);
           fprintf(dxf_file, "  0\nSEQEND\n  8\n%s\n", layerstr);
           fprintf(dxf_file, "  0\nPOLYLINE\n  8\n%s\n  66\n1\n  10\n%f\n  20\n%f\n", layerstr, startx, starty);
-          fprintf(dxf_file, "  0\nVERTEX\n  8\n%s\n  10\n%f\n  20\n%f\n", layerstr, startx, starty);
+          add_vertex(dxf_file, &vertex, layerstr, startx, starty);
         }
-        fprintf(dxf_file, "  0\nVERTEX\n  8\n%s\n  10\n%f\n  20\n%f\n", layerstr, END_POINT(s).x, END_POINT(s).y);
+        /* The bulge goes with the start vertex, the last of the
+           polyline so far.  */
+        flush_vertex(dxf_file, &vertex, bulge);
+        add_vertex(dxf_file, &vertex, layerstr, END_POINT(s).x, END_POINT(s).y);
 
         startx = END_POINT(s).x;
         starty = END_POINT(s).y;
@@ -661,14 +724,15 @@ static void out_splines(FILE * dxf_file, spline_list_array_type shape)
         if (pnt.xp != pnt_old.xp || pnt.yp != pnt_old.yp || new_layer) {
           /* must begin new polyline */
           new_layer = 0;
+          flush_vertex(dxf_file, &vertex, 0.0);
           fprintf(dxf_file, "  0\nSEQEND\n  8\n%s\n", layerstr);
           fprintf(dxf_file, "  0\nPOLYLINE\n  8\n%s\n  66\n1\n  10\n%f\n  20\n%f\n", layerstr, (double)pnt.xp / RESOLUTION, (double)pnt.yp / RESOLUTION);
-          fprintf(dxf_file, "  0\nVERTEX\n  8\n%s\n  10\n%f\n  20\n%f\n", layerstr, (double)pnt.xp / RESOLUTION, (double)pnt.yp / RESOLUTION);
+          add_vertex(dxf_file, &vertex, layerstr, (double)pnt.xp / RESOLUTION, (double)pnt.yp / RESOLUTION);
         }
         i = 0;
         while (!fin) {
           if (i) {
-            fprintf(dxf_file, "  0\nVERTEX\n  8\n%s\n  10\n%f\n  20\n%f\n", layerstr, (double)pnt.xp / RESOLUTION, (double)pnt.yp / RESOLUTION);
+            add_vertex(dxf_file, &vertex, layerstr, (double)pnt.xp / RESOLUTION, (double)pnt.yp / RESOLUTION);
           }
           xypnt_next_pnt(res, &pnt, &fin);
           i++;
@@ -690,6 +754,7 @@ static void out_splines(FILE * dxf_file, spline_list_array_type shape)
     last_color = curr_color;
   }
 
+  flush_vertex(dxf_file, &vertex, 0.0);
   fprintf(dxf_file, "  0\nSEQEND\n  8\n0\n");
 
 }
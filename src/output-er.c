@@ -91,7 +91,7 @@ static void out_splines(FILE * er_file, spline_list_array_type shape, unsigned w
       if (SPLINE_DEGREE(prev) == -1) {
         x0 = START_POINT(s).x;
         y0 = START_POINT(s).y;
-      } else if (SPLINE_DEGREE(prev) == CUBICTYPE) {
+      } else if (SPLINE_DEGREE(prev) != LINEARTYPE) {
         x0 = CONTROL2(prev).x;
         y0 = CONTROL2(prev).y;
       } else {                  /* if (SPLINE_DEGREE(prev) == LINEARTYPE) */
@@ -102,7 +102,7 @@ static void out_splines(FILE * er_file, spline_list_array_type shape, unsigned w
       x1 = START_POINT(s).x;
       y1 = START_POINT(s).y;
 
-      if (SPLINE_DEGREE(s) == CUBICTYPE) {
+      if (SPLINE_DEGREE(s) != LINEARTYPE) {
         x2 = CONTROL1(s).x;
         y2 = CONTROL1(s).y;
       } else {
@@ -141,14 +141,14 @@ static void out_splines(FILE * er_file, spline_list_array_type shape, unsigned w
 
         if (SPLINE_DEGREE(prev) == -1)
           x0 = START_POINT(s).z;
-        else if (SPLINE_DEGREE(prev) == CUBICTYPE)
+        else if (SPLINE_DEGREE(prev) != LINEARTYPE)
           x0 = CONTROL2(prev).z;
         else                    /* if (SPLINE_DEGREE(prev) == LINEARTYPE) */
           x0 = START_POINT(s).z;
 
         x1 = START_POINT(s).z;
 
-        if (SPLINE_DEGREE(s) == CUBICTYPE)
+        if (SPLINE_DEGREE(s) != LINEARTYPE)
           x2 = CONTROL1(s).z;
         else
           x2 = START_POINT(s).z;
@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 #include "spline.h"
 #include "xstd.h"
 
@@ -33,6 +34,7 @@
 #define WritePenDown(fp,x,y) (fprintf(fp,"PD%d %d;", X_FLOAT_TO_UI32(x), Y_FLOAT_TO_UI32(y)))
 #define WritePenUp(fp,x,y) (fprintf(fp,"PU%d %d;", X_FLOAT_TO_UI32(x), Y_FLOAT_TO_UI32(y)))
 #define WriteSelectPen(fp,iColor) (fprintf(fp,"SP%d;",iColor))
+#define WriteArc(fp,x,y,sweep) (fprintf(fp,"PD;AA%ld %ld %.2f;", lround((x) * SCALE), lround((y) * SCALE), sweep))
 
 #define WDEVPIXEL 1280
 #define HDEVPIXEL 1024
@@ -45,6 +47,12 @@
 #define X_FLOAT_TO_UI32(num) ((uint32_t)(num * SCALE))
 #define Y_FLOAT_TO_UI32(num) ((uint32_t)(num * SCALE))
 
+/* AA takes its center in whole units, so an arc is only drawn as such
+   when its center is on them, give or take this much; other arcs would
+   miss their end points and are drawn as their cubics.  */
+#define ARC_CENTER_ERROR 0.01
+#define ON_UNITS(num) (fabs((num) * SCALE - floor((num) * SCALE + 0.5)) <= ARC_CENTER_ERROR)
+
 /*
   Searches color by closest rgb values (distance**2 of 2 3D points)
   returns: color value
@@ -202,6 +210,21 @@ static void OutputPlt(FILE * fdes, int llx, int lly, int urx, int ury, spline_li
         LastPoint = END_POINT(curr_spline);
         WritePenDown(fdes, LastPoint.x, LastPoint.y);
         break;
+      case CIRCLETYPE:
+        {
+          //output Arc around its center, if that is on whole units
+          arc_type arc;
+          unsigned count = spline_list_arc(curr_list, this_spline, 360.0, &arc);
+          if (!ON_UNITS(arc.center.x) || !ON_UNITS(arc.center.y)) {
+            WriteBezier(fdes, curr_spline, &LastPoint);
+            break;
+          }
+          this_spline += count - 1;
+          curr_spline = SPLINE_LIST_ELT(curr_list, this_spline);
+          WriteArc(fdes, arc.center.x, arc.center.y, arc.sweep);
+          LastPoint = END_POINT(curr_spline);
+        }
+        break;
       default:
         //output Bezier curve
         WriteBezier(fdes, curr_spline, &LastPoint);
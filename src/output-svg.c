@@ -24,6 +24,7 @@
 #include "spline.h"
 #include "color.h"
 #include "output-svg.h"
+#include <math.h>
 
 static void out_splines(FILE * file, spline_list_array_type shape, int height)
 {
@@ -52,6 +53,13 @@ static void out_splines(FILE * file, spline_list_array_type shape, int height)
 
       if (SPLINE_DEGREE(s) == LINEARTYPE) {
         fprintf(file, "L%g %g", END_POINT(s).x, height - END_POINT(s).y);
+      } else if (SPLINE_IS_ARC(s)) {
+        /* Going up the page is going down in SVG, which turns the
+           angles around.  */
+        arc_type arc;
+        this_spline += spline_list_arc(list, this_spline, 270.0, &arc) - 1;
+        s = SPLINE_LIST_ELT(list, this_spline);
+        fprintf(file, "A%g %g %g %d %d %g %g", arc.rx, arc.ry, arc.rotation == 0.0 ? 0.0 : 180.0 - arc.rotation, fabs(arc.sweep) > 180.0, arc.sweep < 0.0, END_POINT(s).x, height - END_POINT(s).y);
       } else {
         fprintf(file, "C%g %g %g %g %g %g", CONTROL1(s).x, height - CONTROL1(s).y, CONTROL2(s).x, height - CONTROL2(s).y, END_POINT(s).x, height - END_POINT(s).y);
       }
@@ -31,6 +31,7 @@ long ugs_design_pixels;         /*  A design size of font in pixels. */
 
 long ugs_charcode;
 long ugs_advance_width;
+long ugs_tfm_width;            /*  In design size units, scaled by 2^20. */
 long ugs_left_bearing, ugs_descend;
 long ugs_max_col, ugs_max_row;
 
@@ -285,6 +286,7 @@ int output_ugs_writer(FILE * file, gchar * name, int llx, int lly, int urx, int
   /* Write the header.  */
   fprintf(file, "symbol %#lx design-size %ld\n", ugs_charcode, ugs_design_pixels);
   fprintf(file, "\tadvance-width %ld\n", ugs_advance_width);
+  fprintf(file, "\ttfm-width %ld\n", ugs_tfm_width);
 
   upperx = ugs_advance_width - ugs_max_col - 1;
   uppery = ugs_max_row;
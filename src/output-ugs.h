@@ -27,6 +27,7 @@ int output_ugs_writer(FILE * file, gchar * name, int llx, int lly, int urx, int
 extern long ugs_charcode;
 extern long ugs_design_pixels;
 extern long ugs_advance_width;
+extern long ugs_tfm_width;
 extern long ugs_left_bearing, ugs_descend;
 extern long ugs_max_col, ugs_max_row;
 
@@ -0,0 +1,144 @@
+/* parallel.c: run independent slices of a loop on several threads. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* Def: HAVE_CONFIG_H */
+
+#include "parallel.h"
+#include "xstd.h"
+#include <glib.h>
+
+typedef struct {
+  parallel_func func;
+  gpointer data;
+  unsigned first, last;
+} slice_type;
+
+static gpointer run_slice(gpointer data)
+{
+  slice_type *slice = (slice_type *) data;
+  slice->func(slice->first, slice->last, slice->data);
+  return NULL;
+}
+
+unsigned parallel_threads(unsigned threads)
+{
+  if (threads == 0)
+    threads = g_get_num_processors();
+  return threads > 0 ? threads : 1;
+}
+
+void parallel_for(unsigned count, unsigned grain, unsigned threads, parallel_func func, gpointer data)
+{
+  unsigned n, i;
+  slice_type *slices;
+  GThread **workers;
+
+  if (count == 0)
+    return;
+  if (grain == 0)
+    grain = 1;
+
+  n = parallel_threads(threads);
+  if (n > (count + grain - 1) / grain)
+    n = (count + grain - 1) / grain;
+
+  if (n <= 1) {
+    func(0, count, data);
+    return;
+  }
+
+  XMALLOC(slices, n * sizeof(slice_type));
+  XMALLOC(workers, n * sizeof(GThread *));
+  for (i = 0; i < n; i++) {
+    slices[i].func = func;
+    slices[i].data = data;
+    slices[i].first = (unsigned)((guint64) count * i / n);
+    slices[i].last = (unsigned)((guint64) count * (i + 1) / n);
+  }
+
+  /* The caller does the first slice itself.  */
+  for (i = 1; i < n; i++)
+    workers[i] = g_thread_new("autotrace", run_slice, &slices[i]);
+  run_slice(&slices[0]);
+  for (i = 1; i < n; i++)
+    g_thread_join(workers[i]);
+
+  free(workers);
+  free(slices);
+}
+
+typedef struct {
+  parallel_stage_func *stages;
+  unsigned count_stages, count, depth;
+  gpointer data;
+  unsigned *done;               /* How many items each stage is through */
+  GMutex lock;
+  GCond progress;
+} pipeline_type;
+
+typedef struct {
+  pipeline_type *pipeline;
+  unsigned stage;
+} stage_type;
+
+static gpointer run_stage(gpointer data)
+{
+  stage_type *stage = (stage_type *) data;
+  pipeline_type *p = stage->pipeline;
+  unsigned s = stage->stage, item;
+
+  for (item = 0; item < p->count; item++) {
+    g_mutex_lock(&p->lock);
+    /* Wait for the item from the stage before, and for room after */
+    while ((s > 0 && p->done[s - 1] <= item) || (s + 1 < p->count_stages && item > p->done[s + 1] + p->depth))
+      g_cond_wait(&p->progress, &p->lock);
+    g_mutex_unlock(&p->lock);
+
+    p->stages[s] (item, p->data);
+
+    g_mutex_lock(&p->lock);
+    p->done[s] = item + 1;
+    g_cond_broadcast(&p->progress);
+    g_mutex_unlock(&p->lock);
+  }
+  return NULL;
+}
+
+void parallel_pipeline(unsigned count, parallel_stage_func * stages, unsigned count_stages, unsigned depth, gpointer data)
+{
+  pipeline_type pipeline;
+  stage_type *workers;
+  GThread **threads;
+  unsigned s;
+
+  if (count == 0 || count_stages == 0)
+    return;
+
+  pipeline.stages = stages;
+  pipeline.count_stages = count_stages;
+  pipeline.count = count;
+  pipeline.depth = depth;
+  pipeline.data = data;
+  XCALLOC(pipeline.done, count_stages * sizeof(unsigned));
+  g_mutex_init(&pipeline.lock);
+  g_cond_init(&pipeline.progress);
+
+  XMALLOC(workers, count_stages * sizeof(stage_type));
+  XMALLOC(threads, count_stages * sizeof(GThread *));
+  for (s = 0; s < count_stages; s++) {
+    workers[s].pipeline = &pipeline;
+    workers[s].stage = s;
+  }
+  for (s = 0; s + 1 < count_stages; s++)
+    threads[s] = g_thread_new("autotrace", run_stage, &workers[s]);
+  run_stage(&workers[count_stages - 1]);
+  for (s = 0; s + 1 < count_stages; s++)
+    g_thread_join(threads[s]);
+
+  g_cond_clear(&pipeline.progress);
+  g_mutex_clear(&pipeline.lock);
+  free(threads);
+  free(workers);
+  free(pipeline.done);
+}
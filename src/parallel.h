@@ -0,0 +1,32 @@
+/* parallel.h: run independent slices of a loop on several threads. */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "types.h"
+
+/* Work on the items FIRST..LAST-1; DATA is shared by all slices.  */
+typedef void (*parallel_func) (unsigned first, unsigned last, gpointer data);
+
+/* Split 0..COUNT-1 into consecutive slices and call FUNC on each of
+   them from up to THREADS threads, one of which is the caller's.
+   THREADS == 0 means one thread per processor.  No slice is made
+   smaller than GRAIN items.  Returns when every slice is done, so FUNC
+   may only write to the items of its own slice.  */
+extern void parallel_for(unsigned count, unsigned grain, unsigned threads, parallel_func func, gpointer data);
+
+/* The number of threads parallel_for would use for THREADS.  */
+extern unsigned parallel_threads(unsigned threads);
+
+/* Do stage S of item ITEM; DATA is shared by all stages.  */
+typedef void (*parallel_stage_func) (unsigned item, gpointer data);
+
+/* Put the items 0..COUNT-1 through each of the COUNT_STAGES STAGES in
+   turn, every stage on a thread of its own, the last one the
+   caller's.  A stage does the items in order, and item N of a stage
+   overlaps item N-1 of the next one.  At most DEPTH items are kept
+   waiting between two stages; a stage ahead of that waits for the
+   next one.  */
+extern void parallel_pipeline(unsigned count, parallel_stage_func * stages, unsigned count_stages, unsigned depth, gpointer data);
+
+#endif /* not PARALLEL_H */
@@ -0,0 +1,340 @@
+/* pixel.c: convert runs of pixels from the layouts images are stored
+   in to the 8-bit gray or RGB of a bitmap. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* Def: HAVE_CONFIG_H */
+
+#include "pixel.h"
+#include <string.h>
+#include <glib.h>
+
+/* SSE2 is there wherever the compiler was told so.  The byte shuffles
+   of SSSE3 are compiled in anyway where the compiler knows how, and
+   only used once the processor turns out to have them.  */
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)) \
+  && (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define PIXEL_SSSE3 1
+#include <immintrin.h>
+#define SSSE3_FUNC __attribute__ ((target ("ssse3")))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* X / 255 rounded to the nearest integer, for X up to 255 * 255.  */
+#define DIV255(x) (((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+static void expand_palette_c(unsigned char *dst, const unsigned char *src, unsigned n, const unsigned char palette[256][3])
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++, dst += 3) {
+    const unsigned char *color = palette[src[i]];
+    dst[0] = color[0];
+    dst[1] = color[1];
+    dst[2] = color[2];
+  }
+}
+
+static void map_bytes_c(unsigned char *dst, const unsigned char *src, unsigned n, const unsigned char table[256])
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++)
+    dst[i] = table[src[i]];
+}
+
+static void bgr_to_rgb_c(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++, dst += 3, src += 3) {
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = src[0];
+  }
+}
+
+static void bgrx_to_rgb_c(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++, dst += 3, src += 4) {
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = src[0];
+  }
+}
+
+static void bgra_over_c(unsigned char *dst, const unsigned char *src, unsigned n, const at_color * background)
+{
+  unsigned i, alpha;
+
+  for (i = 0; i < n; i++, dst += 3, src += 4) {
+    alpha = src[3];
+    dst[0] = DIV255(src[2] * alpha + background->r * (255 - alpha));
+    dst[1] = DIV255(src[1] * alpha + background->g * (255 - alpha));
+    dst[2] = DIV255(src[0] * alpha + background->b * (255 - alpha));
+  }
+}
+
+static void graya_over_c(unsigned char *dst, const unsigned char *src, unsigned n, unsigned char background)
+{
+  unsigned i, alpha;
+
+  for (i = 0; i < n; i++, src += 2) {
+    alpha = src[1];
+    dst[i] = DIV255(src[0] * alpha + background * (255 - alpha));
+  }
+}
+
+static void rgb555_to_rgb_c(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  unsigned i, value;
+
+  for (i = 0; i < n; i++, dst += 3, src += 2) {
+    value = src[0] | src[1] << 8;
+    dst[0] = (value >> 7) & 0xf8;
+    dst[1] = (value >> 2) & 0xf8;
+    dst[2] = (value << 3) & 0xf8;
+  }
+}
+
+static void gray_to_rgb_c(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++, dst += 3)
+    dst[0] = dst[1] = dst[2] = src[i];
+}
+
+static void rgb_to_gray_c(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++, src += 3)
+    dst[i] = (unsigned char)(src[0] * 0.30 + src[1] * 0.59 + src[2] * 0.11 + 0.5);
+}
+
+/* 255.0 * (value / 65535.0) cut to an integer is value / 257.  */
+static void be16_to_8_c(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++, src += 2)
+    dst[i] = (unsigned char)((src[0] << 8 | src[1]) / 257);
+}
+
+const pixel_kernels_type pixel_scalar_kernels = {
+  expand_palette_c, map_bytes_c, bgr_to_rgb_c, bgrx_to_rgb_c, bgra_over_c, graya_over_c,
+  rgb555_to_rgb_c, gray_to_rgb_c, rgb_to_gray_c, be16_to_8_c
+};
+
+#ifdef __SSE2__
+/* DIV255 of the eight 16-bit lanes of X.  */
+static __m128i div255_sse2(__m128i x)
+{
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static void graya_over_sse2(unsigned char *dst, const unsigned char *src, unsigned n, unsigned char background)
+{
+  __m128i low = _mm_set1_epi16(0xff), max = _mm_set1_epi16(255), bg = _mm_set1_epi16(background);
+  unsigned i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+    __m128i alpha_a = _mm_srli_epi16(a, 8), alpha_b = _mm_srli_epi16(b, 8);
+
+    a = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(a, low), alpha_a), _mm_mullo_epi16(bg, _mm_sub_epi16(max, alpha_a)));
+    b = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(b, low), alpha_b), _mm_mullo_epi16(bg, _mm_sub_epi16(max, alpha_b)));
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(div255_sse2(a), div255_sse2(b)));
+  }
+  graya_over_c(dst + i, src + 2 * i, n - i, background);
+}
+
+/* value / 257 is the high byte of value * 0xff01 shifted down by 8 */
+static void be16_to_8_sse2(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  __m128i k = _mm_set1_epi16((short)0xff01);
+  unsigned i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+
+    a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+    b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+    a = _mm_srli_epi16(_mm_mulhi_epu16(a, k), 8);
+    b = _mm_srli_epi16(_mm_mulhi_epu16(b, k), 8);
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(a, b));
+  }
+  be16_to_8_c(dst + i, src + 2 * i, n - i);
+}
+
+static const pixel_kernels_type sse2_kernels = {
+  expand_palette_c, map_bytes_c, bgr_to_rgb_c, bgrx_to_rgb_c, bgra_over_c, graya_over_sse2,
+  rgb555_to_rgb_c, gray_to_rgb_c, rgb_to_gray_c, be16_to_8_sse2
+};
+#endif /* __SSE2__ */
+
+#ifdef PIXEL_SSSE3
+#define Z -128                  /* A shuffle index giving 0 */
+
+/* Loads and stores run over by a pixel or two, which the next round
+   or the plain C kernel for the rest then writes again; the loops stop
+   early enough to stay inside SRC and DST.  */
+
+SSSE3_FUNC static void bgr_to_rgb_ssse3(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  __m128i swap = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+  unsigned i = 0;
+
+  for (; i + 6 <= n; i += 5)
+    _mm_storeu_si128((__m128i *) (dst + 3 * i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 3 * i)), swap));
+  bgr_to_rgb_c(dst + 3 * i, src + 3 * i, n - i);
+}
+
+SSSE3_FUNC static void bgrx_to_rgb_ssse3(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  __m128i swap = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, Z, Z, Z, Z);
+  unsigned i = 0;
+
+  for (; i + 6 <= n; i += 4)
+    _mm_storeu_si128((__m128i *) (dst + 3 * i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 4 * i)), swap));
+  bgrx_to_rgb_c(dst + 3 * i, src + 4 * i, n - i);
+}
+
+SSSE3_FUNC static void bgra_over_ssse3(unsigned char *dst, const unsigned char *src, unsigned n, const at_color * background)
+{
+  __m128i swap = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, Z, Z, Z, Z);
+  __m128i bg = _mm_setr_epi16(background->b, background->g, background->r, 0, background->b, background->g, background->r, 0);
+  __m128i max = _mm_set1_epi16(255), zero = _mm_setzero_si128();
+  unsigned i = 0;
+
+  for (; i + 6 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+    __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+    __m128i alpha_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff);
+    __m128i alpha_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff);
+
+    lo = _mm_add_epi16(_mm_mullo_epi16(lo, alpha_lo), _mm_mullo_epi16(bg, _mm_sub_epi16(max, alpha_lo)));
+    hi = _mm_add_epi16(_mm_mullo_epi16(hi, alpha_hi), _mm_mullo_epi16(bg, _mm_sub_epi16(max, alpha_hi)));
+    v = _mm_packus_epi16(div255_sse2(lo), div255_sse2(hi));
+    _mm_storeu_si128((__m128i *) (dst + 3 * i), _mm_shuffle_epi8(v, swap));
+  }
+  bgra_over_c(dst + 3 * i, src + 4 * i, n - i, background);
+}
+
+SSSE3_FUNC static void rgb555_to_rgb_ssse3(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  __m128i mask = _mm_set1_epi16(0xf8);
+  __m128i rg0 = _mm_setr_epi8(0, 1, Z, 2, 3, Z, 4, 5, Z, 6, 7, Z, 8, 9, Z, 10);
+  __m128i b0 = _mm_setr_epi8(Z, Z, 0, Z, Z, 1, Z, Z, 2, Z, Z, 3, Z, Z, 4, Z);
+  __m128i rg1 = _mm_setr_epi8(11, Z, 12, 13, Z, 14, 15, Z, Z, Z, Z, Z, Z, Z, Z, Z);
+  __m128i b1 = _mm_setr_epi8(Z, 5, Z, Z, 6, Z, Z, 7, Z, Z, Z, Z, Z, Z, Z, Z);
+  unsigned i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+    __m128i r = _mm_and_si128(_mm_srli_epi16(v, 7), mask);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(v, 2), mask);
+    __m128i b = _mm_and_si128(_mm_slli_epi16(v, 3), mask);
+    __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+
+    b = _mm_packus_epi16(b, b);
+    _mm_storeu_si128((__m128i *) (dst + 3 * i), _mm_or_si128(_mm_shuffle_epi8(rg, rg0), _mm_shuffle_epi8(b, b0)));
+    _mm_storel_epi64((__m128i *) (dst + 3 * i + 16), _mm_or_si128(_mm_shuffle_epi8(rg, rg1), _mm_shuffle_epi8(b, b1)));
+  }
+  rgb555_to_rgb_c(dst + 3 * i, src + 2 * i, n - i);
+}
+
+SSSE3_FUNC static void gray_to_rgb_ssse3(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  __m128i spread0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+  __m128i spread1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+  __m128i spread2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+  unsigned i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *) (dst + 3 * i), _mm_shuffle_epi8(v, spread0));
+    _mm_storeu_si128((__m128i *) (dst + 3 * i + 16), _mm_shuffle_epi8(v, spread1));
+    _mm_storeu_si128((__m128i *) (dst + 3 * i + 32), _mm_shuffle_epi8(v, spread2));
+  }
+  gray_to_rgb_c(dst + 3 * i, src + i, n - i);
+}
+
+#ifdef __SSE2_MATH__
+/* The same double arithmetic, in the same order, as rgb_to_gray_c
+   and at_color_luminance, two pixels to a register.  Where doubles
+   are done on the x87 the results might differ, so there this is
+   left out.  */
+static __m128d luminance_sse2(__m128i r, __m128i g, __m128i b)
+{
+  __m128d y = _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(r), _mm_set1_pd(0.30)), _mm_mul_pd(_mm_cvtepi32_pd(g), _mm_set1_pd(0.59)));
+
+  y = _mm_add_pd(y, _mm_mul_pd(_mm_cvtepi32_pd(b), _mm_set1_pd(0.11)));
+  return _mm_add_pd(y, _mm_set1_pd(0.5));
+}
+
+SSSE3_FUNC static void rgb_to_gray_ssse3(unsigned char *dst, const unsigned char *src, unsigned n)
+{
+  __m128i red = _mm_setr_epi8(0, Z, Z, Z, 3, Z, Z, Z, 6, Z, Z, Z, 9, Z, Z, Z);
+  __m128i green = _mm_setr_epi8(1, Z, Z, Z, 4, Z, Z, Z, 7, Z, Z, Z, 10, Z, Z, Z);
+  __m128i blue = _mm_setr_epi8(2, Z, Z, Z, 5, Z, Z, Z, 8, Z, Z, Z, 11, Z, Z, Z);
+  unsigned i = 0;
+
+  for (; i + 6 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + 3 * i));
+    __m128i r = _mm_shuffle_epi8(v, red), g = _mm_shuffle_epi8(v, green), b = _mm_shuffle_epi8(v, blue);
+    __m128i lo = _mm_cvttpd_epi32(luminance_sse2(r, g, b));
+    __m128i hi = _mm_cvttpd_epi32(luminance_sse2(_mm_shuffle_epi32(r, 0xee), _mm_shuffle_epi32(g, 0xee), _mm_shuffle_epi32(b, 0xee)));
+    int gray = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(_mm_unpacklo_epi64(lo, hi), lo), lo));
+
+    memcpy(dst + i, &gray, 4);
+  }
+  rgb_to_gray_c(dst + i, src + 3 * i, n - i);
+}
+#else
+#define rgb_to_gray_ssse3 rgb_to_gray_c
+#endif /* __SSE2_MATH__ */
+
+static const pixel_kernels_type ssse3_kernels = {
+  expand_palette_c, map_bytes_c, bgr_to_rgb_ssse3, bgrx_to_rgb_ssse3, bgra_over_ssse3, graya_over_sse2,
+  rgb555_to_rgb_ssse3, gray_to_rgb_ssse3, rgb_to_gray_ssse3, be16_to_8_sse2
+};
+#endif /* PIXEL_SSSE3 */
+
+const pixel_kernels_type *pixel_kernels_nth(unsigned n)
+{
+  const pixel_kernels_type *usable[3];
+  unsigned count = 0;
+
+  usable[count++] = &pixel_scalar_kernels;
+#ifdef __SSE2__
+  usable[count++] = &sse2_kernels;
+#endif
+#ifdef PIXEL_SSSE3
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3"))
+    usable[count++] = &ssse3_kernels;
+#endif
+  return n < count ? usable[n] : NULL;
+}
+
+const pixel_kernels_type *pixel_kernels(void)
+{
+  static gsize chosen = 0;
+
+  if (g_once_init_enter(&chosen)) {
+    unsigned n = 0;
+
+    while (pixel_kernels_nth(n + 1))
+      n++;
+    g_once_init_leave(&chosen, (gsize) pixel_kernels_nth(n));
+  }
+  return (const pixel_kernels_type *)chosen;
+}
@@ -0,0 +1,48 @@
+/* pixel.h: convert runs of pixels from the layouts images are stored
+   in to the 8-bit gray or RGB of a bitmap. */
+
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include "types.h"
+#include "color.h"
+
+/* Every kernel converts the N pixels at SRC and puts them at DST,
+   which must not overlap SRC.  */
+typedef struct {
+  /* 8-bit indexes to the RGB entries of PALETTE.  */
+  void (*expand_palette) (unsigned char *dst, const unsigned char *src, unsigned n, const unsigned char palette[256][3]);
+  /* 8-bit indexes to the bytes of TABLE.  */
+  void (*map_bytes) (unsigned char *dst, const unsigned char *src, unsigned n, const unsigned char table[256]);
+  /* BGR to RGB.  */
+  void (*bgr_to_rgb) (unsigned char *dst, const unsigned char *src, unsigned n);
+  /* BGR and an unused fourth byte to RGB.  */
+  void (*bgrx_to_rgb) (unsigned char *dst, const unsigned char *src, unsigned n);
+  /* BGR and alpha to RGB, laid over BACKGROUND.  */
+  void (*bgra_over) (unsigned char *dst, const unsigned char *src, unsigned n, const at_color * background);
+  /* Gray and alpha to gray, laid over the gray BACKGROUND.  */
+  void (*graya_over) (unsigned char *dst, const unsigned char *src, unsigned n, unsigned char background);
+  /* 16 bits, least significant byte first, of which 5 each are red,
+     green and blue from the top, to RGB.  */
+  void (*rgb555_to_rgb) (unsigned char *dst, const unsigned char *src, unsigned n);
+  /* Gray to RGB.  */
+  void (*gray_to_rgb) (unsigned char *dst, const unsigned char *src, unsigned n);
+  /* RGB to gray, exactly as at_color_luminance.  */
+  void (*rgb_to_gray) (unsigned char *dst, const unsigned char *src, unsigned n);
+  /* 16-bit samples, most significant byte first, to 8 bits, as
+     255.0 * (value / 65535.0) cut to an integer.  */
+  void (*be16_to_8) (unsigned char *dst, const unsigned char *src, unsigned n);
+} pixel_kernels_type;
+
+/* The kernels in plain C; all others give the same bytes.  */
+extern const pixel_kernels_type pixel_scalar_kernels;
+
+/* The fastest kernels this processor can run, chosen on the first
+   call.  */
+extern const pixel_kernels_type *pixel_kernels(void);
+
+/* The Nth of the kernels this processor can run, from the slowest,
+   pixel_scalar_kernels, to the fastest; NULL past the last.  */
+extern const pixel_kernels_type *pixel_kernels_nth(unsigned n);
+
+#endif /* not PIXEL_H */
@@ -28,6 +28,7 @@
 
 struct _at_bitmap_reader {
   at_input_func func;
+  at_input_stream_func stream;  /* Used instead of FUNC when set */
   gpointer data;
 };
 
@@ -13,6 +13,7 @@
 #include "xstd.h"
 #include "pxl-outline.h"
 #include <assert.h>
+#include <string.h>
 
 /* We consider each pixel to consist of four edges, and we travel along
    edges, instead of through pixel centers.  This is necessary for those
@@ -60,6 +61,8 @@ static pixel_outline_type new_pixel_outline(void);
 static void free_pixel_outline(pixel_outline_type *);
 static void concat_pixel_outline(pixel_outline_type *, const pixel_outline_type *);
 static void append_outline_pixel(pixel_outline_type *, at_coord);
+static unsigned same_as_above(at_bitmap *, unsigned short, unsigned short);
+static unsigned same_bits_as_above(at_bitmap *, unsigned short, unsigned short);
 static gboolean is_marked_edge(edge_type, unsigned short, unsigned short, at_bitmap *);
 static gboolean is_outline_edge(edge_type, at_bitmap *, unsigned short, unsigned short, at_color, at_exception_type *);
 static gboolean is_unmarked_outline_edge(unsigned short, unsigned short, edge_type, at_bitmap *, at_bitmap *, at_color, at_exception_type *);
@@ -79,6 +82,65 @@ static unsigned num_neighbors(unsigned short, unsigned short, at_bitmap *);
 
 #define CHECK_FATAL() if (at_exception_got_fatal(exp)) goto cleanup;
 
+/* The number of pixels from COL on in ROW of BITMAP that are the same
+   as the pixels above them.  Eight bytes are compared at a time, so a
+   run of a one-plane (bilevel) image goes by eight pixels at once.  */
+
+static unsigned same_as_above(at_bitmap * bitmap, unsigned short row, unsigned short col)
+{
+  unsigned planes = AT_BITMAP_PLANES(bitmap);
+  unsigned n = (AT_BITMAP_WIDTH(bitmap) - col) * planes, i = 0;
+  const unsigned char *p, *above;
+  guint64 a, b;
+
+  if (AT_BITMAP_PACKED(bitmap))
+    return same_bits_as_above(bitmap, row, col);
+  p = AT_BITMAP_PIXEL(bitmap, row, col);
+  above = p - AT_BITMAP_WIDTH(bitmap) * planes;
+  for (; i + sizeof(guint64) <= n; i += sizeof(guint64)) {
+    memcpy(&a, p + i, sizeof(guint64));
+    memcpy(&b, above + i, sizeof(guint64));
+    if (a != b)
+      break;
+  }
+  while (i < n && p[i] == above[i])
+    i++;
+  return i / planes;
+}
+
+/* The same for a packed BITMAP, whose rows go by 64 pixels at a
+   time.  */
+
+static unsigned same_bits_as_above(at_bitmap * bitmap, unsigned short row, unsigned short col)
+{
+  unsigned width = AT_BITMAP_WIDTH(bitmap), bytes = (width + 7) / 8;
+  const unsigned char *p = AT_BITMAP_ROW(bitmap, row);
+  const unsigned char *above = AT_BITMAP_ROW(bitmap, row - 1);
+  unsigned i = col / 8, n = 0;
+  unsigned char diff;
+  guint64 a, b;
+
+  /* The pixels of the first byte before COL do not count */
+  diff = (p[i] ^ above[i]) & (0xff >> col % 8);
+  if (diff == 0) {
+    for (i++; i + sizeof(guint64) <= bytes; i += sizeof(guint64)) {
+      memcpy(&a, p + i, sizeof(guint64));
+      memcpy(&b, above + i, sizeof(guint64));
+      if (a != b)
+        break;
+    }
+    while (i < bytes && p[i] == above[i])
+      i++;
+    /* The bits past the width are clear in both rows */
+    if (i == bytes)
+      return width - col;
+    diff = p[i] ^ above[i];
+  }
+  while (!(diff & 0x80 >> n))
+    n++;
+  return i * 8 + n - col;
+}
+
 /* We go through a bitmap TOP to BOTTOM, LEFT to RIGHT, looking for each pixel with an unmarked edge
    that we consider a starting point of an outline. */
 
@@ -93,13 +155,21 @@ pixel_outline_list_type find_outline_pixels(at_bitmap * bitmap, at_color * bg_co
   outline_list.data = NULL;
 
   for (row = 0; row < AT_BITMAP_HEIGHT(bitmap); row++) {
+    if (notify_progress)
+      notify_progress((gfloat) (row * AT_BITMAP_WIDTH(bitmap)) / ((gfloat) max_progress * (gfloat) 3.0), progress_data);
+
     for (col = 0; col < AT_BITMAP_WIDTH(bitmap); col++) {
       edge_type edge;
       at_color color;
       gboolean is_background;
+      unsigned same;
 
-      if (notify_progress)
-        notify_progress((gfloat) (row * AT_BITMAP_WIDTH(bitmap) + col) / ((gfloat) max_progress * (gfloat) 3.0), progress_data);
+      /* Neither the top edge of a pixel nor the bottom edge of the
+         one above is on an outline when the two are the same.  */
+      if (row != 0 && (same = same_as_above(bitmap, row, col)) != 0) {
+        col += same - 1;
+        continue;
+      }
 
       /* A valid edge can be TOP for an outside outline.
          Outside outlines are traced counterclockwise */
@@ -150,10 +220,10 @@ pixel_outline_list_type find_outline_pixels(at_bitmap * bitmap, at_color * bg_co
         } else
           CHECK_FATAL();        /* FREE(DONE) outline_list */
       }
-      if (test_cancel && test_cancel(testcancel_data)) {
-        free_pixel_outline_list(&outline_list);
-        goto cleanup;
-      }
+    }
+    if (test_cancel && test_cancel(testcancel_data)) {
+      free_pixel_outline_list(&outline_list);
+      goto cleanup;
     }
   }
 cleanup:
@@ -205,8 +275,9 @@ gboolean is_valid_dir(unsigned short row, unsigned short col, direction_type dir
 
   at_color c;
 
-  if ((COMPUTE_DELTA(ROW, dir) + row < 0) || (COMPUTE_DELTA(COL, dir) + col < 0))
-	return FALSE;	// Must not call at_bitmap_get_color() with negative row or col.
+  if ((COMPUTE_DELTA(ROW, dir) + row < 0) || (COMPUTE_DELTA(COL, dir) + col < 0)
+      || !AT_BITMAP_VALID_PIXEL(bitmap, COMPUTE_DELTA(ROW, dir) + row, COMPUTE_DELTA(COL, dir) + col))
+	return FALSE;	// Must not call at_bitmap_get_color() outside the bitmap.
 
   at_bitmap_get_color(bitmap, COMPUTE_DELTA(ROW, dir) + row, COMPUTE_DELTA(COL, dir) + col, &c);
   return ((gboolean) (!is_marked_dir(row, col, dir, marked)
@@ -0,0 +1,107 @@
+/* quantize.c: reduce a high color bitmap with one of the quantizer engines */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* Def: HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include "logreport.h"
+#include "xstd.h"
+#include "quantize.h"
+
+/* Indexed by at_quantizer_type.  */
+static const quantizer_engine *const engines[] = {
+  &median_cut_engine,
+  &kmeans_engine
+};
+
+static gboolean check_planes(at_bitmap ** images, unsigned count, at_exception_type * exp)
+{
+  unsigned i;
+
+  for (i = 0; i < count; i++) {
+    unsigned int spp = AT_BITMAP_PLANES(images[i]);
+
+    if (spp != 3 && spp != 1) {
+      LOG("quantize: %u-plane images are not supported", spp);
+      at_exception_fatal(exp, "quantize: wrong plane images are passed");
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+static QuantizeObj *initialize_quantizer(at_quantizer_type quantizer, int num_colors, at_exception_type * exp)
+{
+  QuantizeObj *quantobj;
+
+  if ((unsigned)quantizer >= sizeof(engines) / sizeof(engines[0])) {
+    LOG("quantize: unknown quantizer %d", (int)quantizer);
+    at_exception_fatal(exp, "quantize: unknown quantizer");
+    return NULL;
+  }
+
+  /* Initialize the data structures */
+  XMALLOC(quantobj, sizeof(QuantizeObj));
+
+  quantobj->engine = engines[quantizer];
+  XMALLOC(quantobj->histogram, sizeof(ColorFreq) * quantobj->engine->histogram_size);
+  quantobj->desired_number_of_colors = num_colors;
+  quantobj->inverse_cmap_filled = FALSE;
+
+  return quantobj;
+}
+
+void quantize(at_bitmap * image, long ncolors, const at_color * bgColor, QuantizeObj ** iQuant, at_quantizer_type quantizer, unsigned threads, at_exception_type * exp)
+{
+  QuantizeObj *quantobj;
+
+  /* A blank character of a font has no pixels to choose colors from */
+  if (AT_BITMAP_WIDTH(image) == 0 || AT_BITMAP_HEIGHT(image) == 0)
+    return;
+  if (!check_planes(&image, 1, exp))
+    return;
+
+  /* If a pointer was sent in, let's use it. */
+  if (iQuant) {
+    if (*iQuant == NULL) {
+      quantobj = initialize_quantizer(quantizer, ncolors, exp);
+      if (quantobj == NULL)
+        return;
+      quantobj->engine->select_colors(quantobj, &image, 1, bgColor, threads);
+      *iQuant = quantobj;
+    } else
+      quantobj = *iQuant;
+  } else {
+    quantobj = initialize_quantizer(quantizer, ncolors, exp);
+    if (quantobj == NULL)
+      return;
+    quantobj->engine->select_colors(quantobj, &image, 1, NULL, threads);
+  }
+
+  quantobj->engine->map_image(quantobj, image, bgColor, threads);
+
+  if (iQuant == NULL)
+    quantize_object_free(quantobj);
+}
+
+QuantizeObj *quantize_object_new(at_bitmap ** images, unsigned count, long ncolors, const at_color * bgColor, at_quantizer_type quantizer, unsigned threads, at_exception_type * exp)
+{
+  QuantizeObj *quantobj;
+
+  if (!check_planes(images, count, exp))
+    return NULL;
+
+  quantobj = initialize_quantizer(quantizer, ncolors, exp);
+  if (quantobj == NULL)
+    return NULL;
+  quantobj->engine->select_colors(quantobj, images, count, bgColor, threads);
+  quantobj->engine->fill_inverse_cmap(quantobj, threads);
+  return quantobj;
+}
+
+void quantize_object_free(QuantizeObj * quantobj)
+{
+  free(quantobj->histogram);
+  free(quantobj);
+}
@@ -38,15 +38,45 @@
 typedef unsigned long ColorFreq;
 typedef ColorFreq *Histogram;
 
+typedef struct _quantizer_engine quantizer_engine;
+
 typedef struct {
   int desired_number_of_colors; /* Number of colors we will allow */
   int actual_number_of_colors;  /* Number of colors actually needed */
   at_color cmap[256];           /* colormap created by quantization */
   ColorFreq freq[256];
   Histogram histogram;          /* holds the histogram */
+  gboolean inverse_cmap_filled; /* histogram holds the whole inverse colormap */
+  const quantizer_engine *engine; /* selected the colors */
 } QuantizeObj;
 
-void quantize(at_bitmap *, long ncolors, const at_color * bgColor, QuantizeObj **, at_exception_type * exp);
+/* A way to choose the colormap.  Each engine keeps its own histogram
+   of HISTOGRAM_SIZE cells in the QuantizeObj, which after the colors
+   are selected maps a pixel to its colormap index plus one.  */
+struct _quantizer_engine {
+  const char *name;
+  unsigned long histogram_size;
+
+  /* Choose the colormap for the pixels of IMAGES other than
+     IGNORECOLOR.  */
+  void (*select_colors) (QuantizeObj * quantobj, at_bitmap ** images, unsigned count, const at_color * ignoreColor, unsigned threads);
+
+  /* Fill the whole inverse colormap, and set inverse_cmap_filled.  */
+  void (*fill_inverse_cmap) (QuantizeObj * quantobj, unsigned threads);
+
+  /* Reduce IMAGE to the colormap.  Pixels that take the color of
+     BGCOLOR take BGCOLOR itself.  */
+  void (*map_image) (QuantizeObj * quantobj, at_bitmap * image, const at_color * bgColor, unsigned threads);
+};
+
+extern const quantizer_engine median_cut_engine;
+extern const quantizer_engine kmeans_engine;
+
+void quantize(at_bitmap *, long ncolors, const at_color * bgColor, QuantizeObj **, at_quantizer_type quantizer, unsigned threads, at_exception_type * exp);
 
+/* A palette of NCOLORS colors for all of IMAGES, to be passed to
+   quantize through its fourth argument.  The histogram is then the
+   whole inverse colormap, so quantize only reads it.  */
+QuantizeObj *quantize_object_new(at_bitmap ** images, unsigned count, long ncolors, const at_color * bgColor, at_quantizer_type quantizer, unsigned threads, at_exception_type * exp);
 void quantize_object_free(QuantizeObj * obj);
 #endif /* NOT QUANTIZE_H */
@@ -10,18 +10,32 @@
 #include "vector.h"
 #include "xstd.h"
 #include <assert.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+/* How close two arcs must be to count as pieces of the same circle or
+   ellipse, in pixels and degrees.  */
+#define ARC_EPSILON 0.01
+#define ARC_ROTATION_EPSILON 0.1
 
 /* Print a spline in human-readable form.  */
 
 void print_spline(spline_type s)
 {
-  assert(SPLINE_DEGREE(s) == LINEARTYPE || SPLINE_DEGREE(s) == CUBICTYPE);
+  assert(SPLINE_DEGREE(s) == LINEARTYPE || SPLINE_DEGREE(s) == CUBICTYPE || SPLINE_IS_ARC(s));
 
   if (SPLINE_DEGREE(s) == LINEARTYPE)
     fprintf(stdout, "(%.3f,%.3f)--(%.3f,%.3f).\n", START_POINT(s).x, START_POINT(s).y, END_POINT(s).x, END_POINT(s).y);
 
   else if (SPLINE_DEGREE(s) == CUBICTYPE)
     fprintf(stdout, "(%.3f,%.3f)..ctrls(%.3f,%.3f)&(%.3f,%.3f)..(%.3f,%.3f).\n", START_POINT(s).x, START_POINT(s).y, CONTROL1(s).x, CONTROL1(s).y, CONTROL2(s).x, CONTROL2(s).y, END_POINT(s).x, END_POINT(s).y);
+
+  else {
+    arc_type arc;
+
+    spline_arc(s, &arc);
+    fprintf(stdout, "(%.3f,%.3f)..arc(%.3f,%.3f)r(%.3f,%.3f)@%.3f%+.3f..(%.3f,%.3f).\n", START_POINT(s).x, START_POINT(s).y, arc.center.x, arc.center.y, arc.rx, arc.ry, arc.rotation, arc.sweep, END_POINT(s).x, END_POINT(s).y);
+  }
 }
 
 /* Evaluate the spline S at a given T value.  This is an implementation
@@ -33,7 +47,7 @@ at_real_coord evaluate_spline(spline_type s, gfloat t)
   spline_type V[4];             /* We need degree+1 splines, but assert degree <= 3.  */
   signed i, j;
   gfloat one_minus_t = (gfloat) 1.0 - t;
-  polynomial_degree degree = SPLINE_DEGREE(s);
+  polynomial_degree degree = SPLINE_IS_ARC(s) ? CUBICTYPE : SPLINE_DEGREE(s);
 
   for (i = 0; i <= degree; i++) {
     V[0].v[i].x = s.v[i].x;
@@ -54,6 +68,54 @@ at_real_coord evaluate_spline(spline_type s, gfloat t)
   return V[degree].v[0];
 }
 
+/* Find the circle or ellipse the arc S is a piece of.  A piece of a
+   circle is enough to find its center, on the normal at the start
+   point and as far from the end point.  The pieces of an ellipse go
+   from the end of one semi-axis to the end of the next, which the
+   control points give us.  */
+
+void spline_arc(spline_type s, arc_type * arc)
+{
+  vector_type start_tangent = Psubtract(CONTROL1(s), START_POINT(s));
+
+  assert(SPLINE_IS_ARC(s));
+
+  if (SPLINE_DEGREE(s) == CIRCLETYPE) {
+    vector_type chord = Psubtract(END_POINT(s), START_POINT(s));
+    vector_type normal = { -start_tangent.dy, start_tangent.dx, 0.0 };
+    gfloat distance = Vdot(normal, chord);
+    vector_type from, to;
+
+    arc->center = START_POINT(s);
+    if (distance != 0.0)
+      arc->center = Vadd_point(arc->center, Vmult_scalar(normal, Vdot(chord, chord) / (2 * distance)));
+    from = Psubtract(START_POINT(s), arc->center);
+    to = Psubtract(END_POINT(s), arc->center);
+
+    arc->rx = arc->ry = magnitude(from);
+    arc->rotation = 0.0;
+    arc->sweep = (gfloat) (atan2(from.dx * to.dy - from.dy * to.dx, Vdot(from, to)) * 180.0 / M_PI);
+  } else {
+    vector_type a = Vmult_scalar(Psubtract(CONTROL2(s), END_POINT(s)), (gfloat) (1.0 / ARC_KAPPA));
+    vector_type b = Vmult_scalar(start_tangent, (gfloat) (1.0 / ARC_KAPPA));
+
+    arc->center = Vsubtract_point(START_POINT(s), a);
+    arc->sweep = a.dx * b.dy - a.dy * b.dx > 0.0 ? 90.0 : -90.0;
+    if (magnitude(b) > magnitude(a)) {
+      vector_type t = a;
+      a = b;
+      b = t;
+    }
+    arc->rx = magnitude(a);
+    arc->ry = magnitude(b);
+    arc->rotation = (gfloat) (atan2(a.dy, a.dx) * 180.0 / M_PI);
+    if (arc->rotation < 0.0)
+      arc->rotation += 180.0;
+    if (arc->rotation >= 180.0)
+      arc->rotation -= 180.0;
+  }
+}
+
 /* Return a new, empty, spline list.  */
 
 spline_list_type *new_spline_list(void)
@@ -126,6 +188,36 @@ void concat_spline_lists(spline_list_type * s1, spline_list_type s2)
         = SPLINE_LIST_ELT(s2, this_spline);
 }
 
+/* Count the arcs starting at FIRST in L that we can output as one.  */
+
+unsigned spline_list_arc(spline_list_type l, unsigned first, gfloat max_sweep, arc_type * arc)
+{
+  unsigned this_spline;
+  polynomial_degree degree = SPLINE_DEGREE(SPLINE_LIST_ELT(l, first));
+
+  spline_arc(SPLINE_LIST_ELT(l, first), arc);
+
+  for (this_spline = first + 1; this_spline < SPLINE_LIST_LENGTH(l); this_spline++) {
+    spline_type s = SPLINE_LIST_ELT(l, this_spline);
+    arc_type next;
+    gfloat rotation;
+
+    if (SPLINE_DEGREE(s) != degree)
+      break;
+    spline_arc(s, &next);
+
+    rotation = (gfloat) fabs(next.rotation - arc->rotation);
+    if (fabs(next.center.x - arc->center.x) > ARC_EPSILON || fabs(next.center.y - arc->center.y) > ARC_EPSILON || fabs(next.rx - arc->rx) > ARC_EPSILON || fabs(next.ry - arc->ry) > ARC_EPSILON || (rotation > ARC_ROTATION_EPSILON && 180.0 - rotation > ARC_ROTATION_EPSILON))
+      break;
+    if (next.sweep * arc->sweep < 0.0 || fabs(arc->sweep + next.sweep) > max_sweep + ARC_ROTATION_EPSILON)
+      break;
+
+    arc->sweep += next.sweep;
+  }
+
+  return this_spline - first;
+}
+
 /* Return a new, empty, spline list array.  */
 
 spline_list_array_type new_spline_list_array(void)
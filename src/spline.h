@@ -25,12 +25,35 @@ typedef at_spline_type spline_type;
 #define SPLINE_DEGREE	    AT_SPLINE_DEGREE_VALUE
 #define SPLINE_LINEARITY(spl)	((spl).linearity)
 
+/* Splines of degree CIRCLETYPE, ELLIPSETYPE or PARALLELELLIPSETYPE
+   are arcs: pieces of a circle or an ellipse that turn by at most a
+   quarter of a full turn.  Their control points are still those of
+   the cubic approximating the piece, so a writer that does not know
+   about arcs can output them like any other cubic.  */
+#define SPLINE_IS_ARC(spl)  (SPLINE_DEGREE(spl) >= PARALLELELLIPSETYPE)
+
+/* The distance of the control points from the end points, relative to
+   the radius, in the cubic approximating a quarter circle.  */
+#define ARC_KAPPA 0.55228475
+
+/* The circle or ellipse an arc is a piece of.  Angles are in degrees,
+   counterclockwise.  */
+typedef struct {
+  at_real_coord center;
+  gfloat rx, ry;                /* The semi-axes, RX the longer one.  */
+  gfloat rotation;              /* Of the RX axis, in [0, 180).  */
+  gfloat sweep;                 /* Negative if going clockwise.  */
+} arc_type;
+
 #ifndef _IMPORTING
 /* Print a spline on the given file.  */
 extern void print_spline(spline_type);
 
 /* Evaluate SPLINE at the given T value.  */
 extern at_real_coord evaluate_spline(spline_type spline, gfloat t);
+
+/* Find the circle or ellipse the arc SPLINE is a piece of.  */
+extern void spline_arc(spline_type spline, arc_type * arc);
 #endif
 
 /* Each outline in a character is typically represented by many
@@ -70,6 +93,11 @@ extern void append_spline(spline_list_type * s_list, spline_type s);
 
 /* Append the elements in list S2 to S1, changing S1.  */
 extern void concat_spline_lists(spline_list_type * s1, spline_list_type s2);
+
+/* Starting at the arc FIRST in S_LIST, count the arcs that are pieces
+   of the same circle or ellipse and turn the same way, by at most
+   MAX_SWEEP degrees in all.  Put the arc they make up in *ARC.  */
+extern unsigned spline_list_arc(spline_list_type s_list, unsigned first, gfloat max_sweep, arc_type * arc);
 #endif
 
 typedef at_spline_list_array_type spline_list_array_type;
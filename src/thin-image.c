@@ -28,6 +28,7 @@
 #include "types.h"
 #include "bitmap.h"
 #include "xstd.h"
+#include "parallel.h"
 #include <string.h>
 
 #define PIXEL_SET(p, new)  ((void)memcpy((p), (new), sizeof(Pixel)))
@@ -36,9 +37,6 @@
 
 typedef unsigned char Pixel[3]; /* RGB pixel data type */
 
-void thin3(at_bitmap * image, Pixel colour);
-void thin1(at_bitmap * image, unsigned char colour);
-
 /* -------------------------------- ThinImage - Thin binary image. --------------------------- *
  *
  *    Description:
@@ -50,304 +48,397 @@ void thin1(at_bitmap * image, unsigned char colour);
  *
  * -------------------------------------------------------------------------------------------- */
 
-/* Direction masks:                  */
-/*   N     S     W        E            */
-static unsigned int masks[] = { 0200, 0002, 0040, 0010 };
-
-/*    True if pixel neighbor map indicates the pixel is 8-simple and  */
-/*    not an end point and thus can be deleted.  The neighborhood     */
-/*    map is defined as an integer of bits abcdefghi with a non-zero  */
-/*    bit representing a non-zero pixel.  The bit assignment for the  */
-/*    neighborhood is:                                                */
-/*                                                                    */
-/*                            a b c                                   */
-/*                            d e f                                   */
-/*                            g h i                                   */
-
-static unsigned char todelete[512] = {
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  0, 0, 0, 1, 0, 0, 1, 1, 0, 1, 1, 1, 0, 0, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  0, 0, 1, 1, 1, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  1, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  1, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  1, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  1, 0, 1, 1, 1, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  1, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  1, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  1, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  1, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
-};
-
-static at_color background = { 0xff, 0xff, 0xff };
-
-void thin_image(at_bitmap * image, const at_color * bg, at_exception_type * exp)
+/* A pixel may be deleted when it is 8-simple and not an end point.
+   With its neighbors named
+                              NW N NE
+                              W  .  E
+                              SW S SE
+   that is when exactly one of
+                              N == 0 && (NE || E),
+                              E == 0 && (SE || S),
+                              S == 0 && (SW || W),
+                              W == 0 && (NW || N)
+   holds and at least two neighbors are set.  Each pass deletes only
+   pixels whose neighbor in its direction (N, S, W, then E) is not
+   set, so the pixel always has a 4-neighbor that is not set, for
+   which this is the same as the table of Cychosz's neighborhood maps.
+   The rows of a plane are words of 64 pixels, the pixel at X being bit
+   X % 64 of word X / 64, so that 64 pixels are tested at once.  */
+
+typedef guint64 thin_word;
+#define THIN_WORD_BITS 64
+
+static unsigned int count_bits(thin_word w)
 {
-  /* This is nasty as we need to call thin once for each
-   * colour in the image the way I do this is to keep a second
-   * copy of the bitmap and to use this to keep
-   * track of which colours have not yet been processed,
-   * trades time for pathological case memory.....*/
-  long m, n, num_pixels;
+  w = w - ((w >> 1) & G_GUINT64_CONSTANT(0x5555555555555555));
+  w = (w & G_GUINT64_CONSTANT(0x3333333333333333)) + ((w >> 2) & G_GUINT64_CONSTANT(0x3333333333333333));
+  w = (w + (w >> 4)) & G_GUINT64_CONSTANT(0x0f0f0f0f0f0f0f0f);
+  return (unsigned int)((w * G_GUINT64_CONSTANT(0x0101010101010101)) >> 56);
+}
+
+/* A colour of the image and the rectangle it is thinned in: the
+   bounds of its pixels widened by a pixel on each side, as far as the
+   image goes.  Outside the rectangle there is no pixel of the colour,
+   so thinning it there is the same as thinning the whole image.  */
+typedef struct {
+  Pixel colour;                 /* Only colour[0] for one plane.  */
+  unsigned int x0, y0, x1, y1;  /* Inclusive.  */
+} thin_region;
+
+typedef struct {
+  at_bitmap *image;
+  at_bitmap *original;          /* Not written while thinning.  */
+  thin_region *regions;
+  unsigned char bg_color[3];    /* Only bg_color[0] for one plane.  */
+} thin_job;
+
+static void thin_plane(thin_word * plane, unsigned int xsize, unsigned int ysize, gboolean rgb);
+static void thin_regions(unsigned first, unsigned last, gpointer data);
+static void thin_packed(at_bitmap * image, gboolean black_bg);
+
+/* Find the region of colour P, adding it to REGIONS.  */
+static unsigned int find_region(GHashTable * table, thin_region ** regions, unsigned int *count, const unsigned char *p, unsigned int spp)
+{
+  guint key = spp == 3 ? ((guint) p[0] << 16 | (guint) p[1] << 8 | p[2]) : p[0];
+  unsigned int index = GPOINTER_TO_UINT(g_hash_table_lookup(table, GUINT_TO_POINTER(key + 1)));
+
+  if (index == 0) {
+    thin_region *region;
+
+    XREALLOC(*regions, (*count + 1) * sizeof(thin_region));
+    region = &(*regions)[*count];
+    memcpy(region->colour, p, spp);
+    region->x0 = region->y0 = G_MAXUINT;
+    region->x1 = region->y1 = 0;
+    index = ++*count;
+    g_hash_table_insert(table, GUINT_TO_POINTER(key + 1), GUINT_TO_POINTER(index));
+    if (spp == 3)
+      LOG("Thinning colour (%x, %x, %x)\n", p[0], p[1], p[2]);
+    else
+      LOG("Thinning colour %x\n", p[0]);
+  }
+  return index - 1;
+}
+
+void thin_image(at_bitmap * image, const at_color * bg, unsigned threads, at_exception_type * exp)
+{
+  /* Each colour is thinned on its own, in the rectangle around its
+   * pixels, so one pass over the image finds the colours and their
+   * rectangles.  The colours are read from a copy of the bitmap, and
+   * each writes only to its own pixels, so they are thinned in
+   * parallel.  */
+  long n, num_pixels;
   at_bitmap bm;
   unsigned int spp = AT_BITMAP_PLANES(image), width = AT_BITMAP_WIDTH(image), height = AT_BITMAP_HEIGHT(image);
+  at_color background = { 0xff, 0xff, 0xff };
+  unsigned char *bg_color;
+  unsigned int count = 0, index = 0, x, y;
+  GHashTable *table;
+  thin_job job;
 
   if (bg)
     background = *bg;
 
+  if (spp != 3 && spp != 1) {
+    LOG("thin_image: %u-plane images are not supported", spp);
+    at_exception_fatal(exp, "thin_image: wrong plane images are passed");
+    return;
+  }
+
+  bg_color = job.bg_color;
+  bg_color[0] = background.r;
+  bg_color[1] = background.g;
+  bg_color[2] = background.b;
+  if (spp == 1 && !(background.r == background.g && background.g == background.b))
+    bg_color[0] = at_color_luminance(&background);
+
+  /* A packed image has a single colour to thin when the background is
+     black or white, and keeps its bits; otherwise the pixels thinned
+     away could not be set to the background.  */
+  if (AT_BITMAP_PACKED(image)) {
+    if (spp == 3 ? bg_color[0] == bg_color[1] && bg_color[1] == bg_color[2] && (bg_color[0] == 0x00 || bg_color[0] == 0xff)
+        : bg_color[0] == 0x00 || bg_color[0] == 0xff) {
+      thin_packed(image, bg_color[0] == 0x00);
+      return;
+    }
+    at_bitmap_unpack(image);
+  }
+
   bm.height = image->height;
   bm.width = image->width;
   bm.np = image->np;
+  bm.depth = image->depth;
   XMALLOC(bm.bitmap, height * width * spp);
   memcpy(bm.bitmap, image->bitmap, height * width * spp);
   /* that clones the image */
 
-  num_pixels = height * width;
-  switch (spp) {
-  case 3:
-    {
-      Pixel *ptr = (Pixel *) AT_BITMAP_BITS(&bm);
-      Pixel bg_color;
-      bg_color[0] = background.r;
-      bg_color[1] = background.g;
-      bg_color[2] = background.b;
-
-      for (n = num_pixels - 1; n >= 0L; --n) {
-        Pixel p;
-
-        PIXEL_SET(p, ptr[n]);
-        if (!PIXEL_EQUAL(p, bg_color)) {
-          /* we have a new colour in the image */
-          LOG("Thinning colour (%x, %x, %x)\n", p[0], p[1], p[2]);
-          for (m = n - 1; m >= 0L; --m) {
-            if (PIXEL_EQUAL(ptr[m], p))
-              PIXEL_SET(ptr[m], bg_color);
-          }
-          thin3(image, p);
-        }
-      }
-      break;
-    }
+  /* The colours are listed in the order the pixels are found from the
+     end of the image.  */
+  job.regions = NULL;
+  table = g_hash_table_new(g_direct_hash, g_direct_equal);
+  num_pixels = (long)height * width;
+  for (n = num_pixels - 1; n >= 0L; --n) {
+    unsigned char *p = AT_BITMAP_BITS(&bm) + n * spp;
+    thin_region *region;
+
+    if (spp == 3 ? PIXEL_EQUAL(p, bg_color) : p[0] == bg_color[0])
+      continue;
+    if (count == 0 || memcmp(p, job.regions[index].colour, spp) != 0)
+      index = find_region(table, &job.regions, &count, p, spp);
+    region = &job.regions[index];
+    x = n % width;
+    y = n / width;
+    region->x0 = MIN(region->x0, x);
+    region->x1 = MAX(region->x1, x);
+    region->y0 = MIN(region->y0, y);
+    region->y1 = MAX(region->y1, y);
+  }
+  g_hash_table_destroy(table);
 
-  case 1:
-    {
-      unsigned char *ptr = AT_BITMAP_BITS(&bm);
-      unsigned char bg_color;
-
-      if (background.r == background.g && background.g == background.b)
-        bg_color = background.r;
-      else
-        bg_color = at_color_luminance(&background);
-
-      for (n = num_pixels - 1; n >= 0L; --n) {
-        unsigned char c = ptr[n];
-        if (c != bg_color) {
-          LOG("Thinning colour %x\n", c);
-          for (m = n - 1; m >= 0L; --m)
-            if (ptr[m] == c)
-              ptr[m] = bg_color;
-          thin1(image, c);
-        }
-      }
-      break;
+  for (index = 0; index < count; index++) {
+    thin_region *region = &job.regions[index];
+
+    region->x0 = region->x0 > 0 ? region->x0 - 1 : 0;
+    region->y0 = region->y0 > 0 ? region->y0 - 1 : 0;
+    region->x1 = MIN(region->x1 + 1, width - 1);
+    region->y1 = MIN(region->y1 + 1, height - 1);
+  }
+
+  job.image = image;
+  job.original = &bm;
+  parallel_for(count, 1, threads, thin_regions, &job);
+
+  free(job.regions);
+  free(bm.bitmap);
+}
+
+/* Thin the colours FIRST..LAST-1, each in a plane of its own.  */
+static void thin_regions(unsigned first, unsigned last, gpointer data)
+{
+  thin_job *job = (thin_job *) data;
+  unsigned int spp = AT_BITMAP_PLANES(job->image), width = AT_BITMAP_WIDTH(job->image);
+  const unsigned char *bg_color = job->bg_color;
+  unsigned int i, x, y;
+
+  for (i = first; i < last; i++) {
+    thin_region *region = &job->regions[i];
+    unsigned int xsize = region->x1 - region->x0 + 1, ysize = region->y1 - region->y0 + 1;
+    unsigned int words;
+    thin_word *plane;
+
+    words = (xsize + THIN_WORD_BITS - 1) / THIN_WORD_BITS;
+    XCALLOC(plane, (size_t) words * ysize * sizeof(thin_word));
+    for (y = region->y0; y <= region->y1; y++) {
+      unsigned char *p = AT_BITMAP_BITS(job->original) + ((size_t) y * width + region->x0) * spp;
+      thin_word *row = plane + (size_t) (y - region->y0) * words;
+
+      for (x = 0; x < xsize; x++, p += spp)
+        if (spp == 3 ? PIXEL_EQUAL(p, region->colour) : p[0] == region->colour[0])
+          row[x / THIN_WORD_BITS] |= (thin_word) 1 << (x % THIN_WORD_BITS);
     }
 
-  default:
-    {
-      LOG("thin_image: %u-plane images are not supported", spp);
-      at_exception_fatal(exp, "thin_image: wrong plane images are passed");
-      goto cleanup;
+    thin_plane(plane, xsize, ysize, spp == 3);
+
+    /* Delete the pixels thinned away.  */
+    for (y = region->y0; y <= region->y1; y++) {
+      unsigned char *p = AT_BITMAP_BITS(job->original) + ((size_t) y * width + region->x0) * spp;
+      unsigned char *r = AT_BITMAP_BITS(job->image) + ((size_t) y * width + region->x0) * spp;
+      thin_word *row = plane + (size_t) (y - region->y0) * words;
+
+      for (x = 0; x < xsize; x++, p += spp, r += spp)
+        if (!(row[x / THIN_WORD_BITS] >> (x % THIN_WORD_BITS) & 1) && (spp == 3 ? PIXEL_EQUAL(p, region->colour) : p[0] == region->colour[0]))
+          memcpy(r, bg_color, spp);
     }
+    free(plane);
   }
-cleanup:
-  free(bm.bitmap);
 }
 
-void thin3(at_bitmap * image, Pixel colour)
+static unsigned char reverse_bits(unsigned char b)
 {
-  Pixel *ptr, *y_ptr, *y1_ptr;
-  Pixel bg_color;
-  unsigned int xsize, ysize;    /* Image resolution             */
-  unsigned int x, y;            /* Pixel location               */
-  unsigned int i;               /* Pass index           */
-  unsigned int pc = 0;          /* Pass count           */
-  unsigned int count = 1;       /* Deleted pixel count          */
-  unsigned int p, q;            /* Neighborhood maps of adjacent */
-  /* cells                        */
-  unsigned char *qb;            /* Neighborhood maps of previous */
-  /* scanline                     */
-  unsigned int m;               /* Deletion direction mask      */
+  b = (unsigned char)((b & 0xf0) >> 4 | (b & 0x0f) << 4);
+  b = (unsigned char)((b & 0xcc) >> 2 | (b & 0x33) << 2);
+  return (unsigned char)((b & 0xaa) >> 1 | (b & 0x55) << 1);
+}
 
-  bg_color[0] = background.r;
-  bg_color[1] = background.g;
-  bg_color[2] = background.b;
+/* Thin the black pixels of the packed IMAGE, or its white ones if
+   BLACK_BG, on a plane of the whole image.  Its rows only need their
+   bits put in the order of the words of the plane.  */
+static void thin_packed(at_bitmap * image, gboolean black_bg)
+{
+  unsigned int width = AT_BITMAP_WIDTH(image), height = AT_BITMAP_HEIGHT(image);
+  unsigned int words = (width + THIN_WORD_BITS - 1) / THIN_WORD_BITS, bytes = (width + 7) / 8;
+  unsigned char flip = black_bg ? 0xff : 0x00;
+  thin_word *plane;
+  unsigned int x, y;
+
+  LOG("Thinning colour %x\n", flip ^ 0xff);
+  XCALLOC(plane, (size_t) words * height * sizeof(thin_word));
+  for (y = 0; y < height; y++) {
+    const unsigned char *bits = AT_BITMAP_ROW(image, y);
+    thin_word *row = plane + (size_t) y * words;
+
+    for (x = 0; x < bytes; x++)
+      row[x / 8] |= (thin_word) reverse_bits(bits[x] ^ flip) << (x % 8 * 8);
+    if (width % THIN_WORD_BITS)
+      row[words - 1] &= ((thin_word) 1 << (width % THIN_WORD_BITS)) - 1;
+  }
 
-  LOG(" Thinning image.....\n ");
-  xsize = AT_BITMAP_WIDTH(image);
-  ysize = AT_BITMAP_HEIGHT(image);
-  XMALLOC(qb, xsize * sizeof(unsigned char));
-  qb[xsize - 1] = 0;            /* Used for lower-right pixel   */
-  ptr = (Pixel *) AT_BITMAP_BITS(image);
+  thin_plane(plane, width, height, AT_BITMAP_PLANES(image) == 3);
 
-  while (count) {               /* Scan image while deletions   */
-    pc++;
-    count = 0;
+  for (y = 0; y < height; y++) {
+    unsigned char *bits = AT_BITMAP_ROW(image, y);
+    const thin_word *row = plane + (size_t) y * words;
 
-    for (i = 0; i < 4; i++) {
-
-      m = masks[i];
-
-      /* Build initial previous scan buffer.                  */
-      p = PIXEL_EQUAL(ptr[0], colour);
-      for (x = 0; x < xsize - 1; x++)
-        qb[x] = (unsigned char)(p = ((p << 1) & 0006) | (unsigned int)PIXEL_EQUAL(ptr[x + 1], colour));
-
-      /* Scan image for pixel deletion candidates.            */
-      y_ptr = ptr;
-      y1_ptr = ptr + xsize;
-      for (y = 0; y < ysize - 1; y++, y_ptr += xsize, y1_ptr += xsize) {
-        q = qb[0];
-        p = ((q << 2) & 0330) | (unsigned int)PIXEL_EQUAL(y1_ptr[0], colour);
-
-        for (x = 0; x < xsize - 1; x++) {
-          q = qb[x];
-          p = ((p << 1) & 0666) | ((q << 3) & 0110) | (unsigned int)PIXEL_EQUAL(y1_ptr[x + 1], colour);
-          qb[x] = (unsigned char)p;
-          if ((i != 2 || x != 0) && ((p & m) == 0) && todelete[p]) {
-            count++;            /* delete the pixel */
-            PIXEL_SET(y_ptr[x], bg_color);
-          }
-        }
+    for (x = 0; x < bytes; x++)
+      bits[x] = reverse_bits((unsigned char)(row[x / 8] >> (x % 8 * 8))) ^ flip;
+    AT_BITMAP_CLEAR_PAD(bits, width);
+  }
+  free(plane);
+}
 
-        /* Process right edge pixel.                        */
-        p = (p << 1) & 0666;
-        if (i != 3 && (p & m) == 0 && todelete[p]) {
-          count++;
-          PIXEL_SET(y_ptr[xsize - 1], bg_color);
-        }
-      }
+/* Note that sub-pass PASS changed word W of row Y, which may change
+   the words around it in later sub-passes.  */
+static void mark_changed(int *word_pass, int *row_pass, unsigned int words, unsigned int ysize, unsigned int y, unsigned int w, int pass)
+{
+  unsigned int r, v;
 
-      if (i != 1) {
-        /* Process bottom scan line.                            */
-        q = qb[0];
-        p = ((q << 2) & 0330);
-
-        y_ptr = ptr + xsize * (ysize - 1);
-        for (x = 0; x < xsize; x++) {
-          q = qb[x];
-          p = ((p << 1) & 0666) | ((q << 3) & 0110);
-          if ((i != 2 || x != 0) && (p & m) == 0 && todelete[p]) {
-            count++;
-            PIXEL_SET(y_ptr[x], bg_color);
-          }
-        }
-      }
-    }
-    LOG("ThinImage: pass %d, %d pixels deleted\n", pc, count);
+  for (r = y > 0 ? y - 1 : 0; r <= y + 1 && r < ysize; r++) {
+    row_pass[r] = pass;
+    for (v = w > 0 ? w - 1 : 0; v <= w + 1 && v < words; v++)
+      word_pass[(size_t) r * words + v] = pass;
   }
-  free(qb);
 }
 
-void thin1(at_bitmap * image, unsigned char colour)
+/* Thin the pixels of PLANE that are set, clearing them.  Like the
+   thinning of RGB images always did, RGB keeps the pixels of the left
+   column in the west pass, those of the right column but the bottom
+   one in the east pass and those of the bottom row in the south pass.
+
+   A pass decides on all pixels from the plane as it was before the
+   pass, so each row is tested against copies of the rows around it as
+   they were.  A word keeps its pixels in a pass if it kept them four
+   sub-passes before, in the same direction, and no word around it has
+   changed since; so after the first pass only the words and rows near
+   the last deletions are tested.  */
+static void thin_plane(thin_word * plane, unsigned int xsize, unsigned int ysize, gboolean rgb)
 {
-  unsigned char *ptr, *y_ptr, *y1_ptr;
-  unsigned char bg_color;
-  unsigned int xsize, ysize;    /* Image resolution             */
-  unsigned int x, y;            /* Pixel location               */
+  unsigned int words = (xsize + THIN_WORD_BITS - 1) / THIN_WORD_BITS;
+  thin_word right_bit = (thin_word) 1 << ((xsize - 1) % THIN_WORD_BITS);
+  thin_word *copies[2], *zero;
+  const thin_word *above;
+  int *word_pass, *row_pass;    /* Last sub-pass that changed a word
+                                   or a row nearby.  */
+  int pass = 0;                 /* Sub-pass count               */
+  unsigned int y, w, k;
   unsigned int i;               /* Pass index           */
   unsigned int pc = 0;          /* Pass count           */
   unsigned int count = 1;       /* Deleted pixel count          */
-  unsigned int p, q;            /* Neighborhood maps of adjacent */
-  /* cells                        */
-  unsigned char *qb;            /* Neighborhood maps of previous */
-  /* scanline                     */
-  unsigned int m;               /* Deletion direction mask      */
-
-  if (background.r == background.g && background.g == background.b)
-    bg_color = background.r;
-  else
-    bg_color = at_color_luminance(&background);
 
   LOG(" Thinning image.....\n ");
-  xsize = AT_BITMAP_WIDTH(image);
-  ysize = AT_BITMAP_HEIGHT(image);
-  XMALLOC(qb, xsize * sizeof(unsigned char));
-  qb[xsize - 1] = 0;            /* Used for lower-right pixel   */
-  ptr = AT_BITMAP_BITS(image);
+  XMALLOC(copies[0], words * sizeof(thin_word));
+  XMALLOC(copies[1], words * sizeof(thin_word));
+  XCALLOC(zero, words * sizeof(thin_word));
+  XMALLOC(word_pass, (size_t) words * ysize * sizeof(int));
+  XMALLOC(row_pass, ysize * sizeof(int));
+  for (y = 0; y < ysize; y++) {
+    row_pass[y] = -1;
+    for (w = 0; w < words; w++)
+      word_pass[(size_t) y * words + w] = -1;
+  }
 
   while (count) {               /* Scan image while deletions   */
     pc++;
     count = 0;
 
-    for (i = 0; i < 4; i++) {
-
-      m = masks[i];
-
-      /* Build initial previous scan buffer.                  */
-      p = (ptr[0] == colour);
-      for (x = 0; x < xsize - 1; x++)
-        qb[x] = (unsigned char)(p = ((p << 1) & 0006) | (unsigned int)(ptr[x + 1] == colour));
-
-      /* Scan image for pixel deletion candidates.            */
-      y_ptr = ptr;
-      y1_ptr = ptr + xsize;
-      for (y = 0; y < ysize - 1; y++, y_ptr += xsize, y1_ptr += xsize) {
-        q = qb[0];
-        p = ((q << 2) & 0330) | (y1_ptr[0] == colour);
-
-        for (x = 0; x < xsize - 1; x++) {
-          q = qb[x];
-          p = ((p << 1) & 0666) | ((q << 3) & 0110) | (unsigned int)(y1_ptr[x + 1] == colour);
-          qb[x] = (unsigned char)p;
-          if (((p & m) == 0) && todelete[p]) {
-            count++;
-            y_ptr[x] = bg_color;  /* delete the pixel */
-          }
-        }
+    for (i = 0; i < 4; i++, pass++) {
+      above = zero;
+      k = 0;
 
-        /* Process right edge pixel.                        */
-        p = (p << 1) & 0666;
-        if ((p & m) == 0 && todelete[p]) {
-          count++;
-          y_ptr[xsize - 1] = bg_color;
+      for (y = 0; y < ysize; y++) {
+        thin_word *row = plane + (size_t) y * words;
+        const thin_word *below = y + 1 < ysize ? row + words : zero;
+        const int *changed = word_pass + (size_t) y * words;
+        thin_word *here;
+
+        if (row_pass[y] < pass - 4) {
+          above = row;
+          continue;
         }
-      }
+        here = copies[k];
+        k ^= 1;
+
+        memcpy(here, row, words * sizeof(thin_word));
+        for (w = 0; w < words; w++) {
+          thin_word c = here[w], n, s, e, west, ne, nw, se, sw;
+          thin_word t_n, t_e, t_s, t_w, ones, twos, dir, del;
+
+          if (c == 0 || changed[w] < pass - 4)
+            continue;
+
+          /* The neighbors of the pixels of the word.  */
+          n = above[w];
+          s = below[w];
+          e = here[w] >> 1;
+          west = here[w] << 1;
+          ne = above[w] >> 1;
+          nw = above[w] << 1;
+          se = below[w] >> 1;
+          sw = below[w] << 1;
+          if (w + 1 < words) {
+            e |= (here[w + 1] & 1) << (THIN_WORD_BITS - 1);
+            ne |= (above[w + 1] & 1) << (THIN_WORD_BITS - 1);
+            se |= (below[w + 1] & 1) << (THIN_WORD_BITS - 1);
+          }
+          if (w > 0) {
+            west |= here[w - 1] >> (THIN_WORD_BITS - 1);
+            nw |= above[w - 1] >> (THIN_WORD_BITS - 1);
+            sw |= below[w - 1] >> (THIN_WORD_BITS - 1);
+          }
 
-      /* Process bottom scan line.                            */
-      q = qb[0];
-      p = ((q << 2) & 0330);
-
-      y_ptr = ptr + xsize * (ysize - 1);
-      for (x = 0; x < xsize; x++) {
-        q = qb[x];
-        p = ((p << 1) & 0666) | ((q << 3) & 0110);
-        if ((p & m) == 0 && todelete[p]) {
-          count++;
-          y_ptr[x] = bg_color;
+          t_n = ~n & (ne | e);
+          t_e = ~e & (se | s);
+          t_s = ~s & (sw | west);
+          t_w = ~west & (nw | n);
+
+          ones = twos = 0;
+#define THIN_COUNT(x) (twos |= ones & (x), ones |= (x))
+          THIN_COUNT(n);
+          THIN_COUNT(ne);
+          THIN_COUNT(e);
+          THIN_COUNT(se);
+          THIN_COUNT(s);
+          THIN_COUNT(sw);
+          THIN_COUNT(west);
+          THIN_COUNT(nw);
+#undef THIN_COUNT
+
+          dir = i == 0 ? n : i == 1 ? s : i == 2 ? west : e;
+          del = c & ~dir & twos & (t_n | t_e | t_s | t_w)
+              & ~((t_n & t_e) | (t_s & t_w) | ((t_n | t_e) & (t_s | t_w)));
+
+          if (rgb) {
+            if (i == 2 && w == 0)
+              del &= ~(thin_word) 1;
+            if (i == 3 && w == words - 1 && y + 1 < ysize)
+              del &= ~right_bit;
+            if (i == 1 && y + 1 == ysize)
+              del = 0;
+          }
+
+          if (del) {
+            count += count_bits(del);
+            row[w] = c & ~del;
+            mark_changed(word_pass, row_pass, words, ysize, y, w, pass);
+          }
         }
+        above = here;
       }
     }
-    LOG("thin1: pass %d, %d pixels deleted\n", pc, count);
+    LOG("ThinImage: pass %d, %d pixels deleted\n", pc, count);
   }
-  free(qb);
+  free(copies[0]);
+  free(copies[1]);
+  free(zero);
+  free(word_pass);
+  free(row_pass);
 }
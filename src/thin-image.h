@@ -31,6 +31,8 @@
 #include "color.h"
 #include "exception.h"
 
-void thin_image(at_bitmap * image, const at_color * bg_color, at_exception_type * exp);
+/* Thin each colour of IMAGE other than BG_COLOR, up to THREADS colours
+   at a time.  */
+void thin_image(at_bitmap * image, const at_color * bg_color, unsigned threads, at_exception_type * exp);
 
 #endif /* not THIN_IMAGE_H */
@@ -0,0 +1,108 @@
+/* bench-quantize.c: time the quantizer engines on images and report
+   how far their colors are from the originals.
+
+   Usage: bench-quantize [-threads N] IMAGE...
+
+   For each image, engine and number of colors, the best time of a few
+   runs is printed with two errors over the samples of the image: the
+   plain mean squared error and the one weighted by 2, 3 and 1 for red,
+   green and blue, which both engines minimize. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* Def: HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "autotrace.h"
+#include "quantize.h"
+
+#define RUNS 3
+
+static const long color_counts[] = { 8, 16, 64, 256 };
+
+static const char *engine_names[] = { "median-cut", "k-means" };
+
+static void quantize_errors(const at_bitmap * original, const at_bitmap * quantized, double *mse, double *weighted)
+{
+  unsigned planes = AT_BITMAP_PLANES(original);
+  size_t i, samples = (size_t) AT_BITMAP_WIDTH(original) * AT_BITMAP_HEIGHT(original) * planes;
+  double sum = 0.0, weighted_sum = 0.0;
+
+  for (i = 0; i < samples; i++) {
+    double d = (double)original->bitmap[i] - quantized->bitmap[i];
+
+    sum += d * d;
+    if (planes == 3)
+      weighted_sum += (i % 3 == 0 ? 4.0 : i % 3 == 1 ? 9.0 : 1.0) * d * d;
+    else
+      weighted_sum += (4.0 + 9.0 + 1.0) / 3 * d * d;
+  }
+  *mse = samples ? sum / samples : 0.0;
+  *weighted = samples ? weighted_sum / samples : 0.0;
+}
+
+static void bench_image(gchar * name, unsigned threads)
+{
+  at_bitmap_reader *reader = at_input_get_handler(name);
+  at_bitmap *original;
+  unsigned engine, c, run;
+
+  if (reader == NULL) {
+    fprintf(stderr, "%s: unsupported input format\n", name);
+    exit(1);
+  }
+  original = at_bitmap_read(reader, name, NULL, NULL, NULL);
+  if (original == NULL) {
+    fprintf(stderr, "%s: cannot be read\n", name);
+    exit(1);
+  }
+
+  printf("%s %ux%u\n", name, AT_BITMAP_WIDTH(original), AT_BITMAP_HEIGHT(original));
+  for (c = 0; c < sizeof(color_counts) / sizeof(color_counts[0]); c++) {
+    printf("  %3ld colors", color_counts[c]);
+    for (engine = 0; engine < sizeof(engine_names) / sizeof(engine_names[0]); engine++) {
+      gint64 best = G_MAXINT64;
+      double mse, weighted;
+      at_bitmap *image = NULL;
+
+      for (run = 0; run < RUNS; run++) {
+        at_exception_type exp = at_exception_new(NULL, NULL);
+        gint64 start;
+
+        if (image)
+          at_bitmap_free(image);
+        image = at_bitmap_copy(original);
+        start = g_get_monotonic_time();
+        quantize(image, color_counts[c], NULL, NULL, (at_quantizer_type) engine, threads, &exp);
+        best = MIN(best, g_get_monotonic_time() - start);
+      }
+      quantize_errors(original, image, &mse, &weighted);
+      at_bitmap_free(image);
+      printf("   %s %5ldms %7.1f / %7.1f", engine_names[engine], (long)(best / 1000), mse, weighted);
+    }
+    printf("\n");
+  }
+  at_bitmap_free(original);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned threads = 1;
+  int i = 1;
+
+  if (argc > 2 && strcmp(argv[1], "-threads") == 0) {
+    threads = atoi(argv[2]);
+    i = 3;
+  }
+  if (i >= argc) {
+    fprintf(stderr, "Usage: %s [-threads N] IMAGE...\n", argv[0]);
+    return 1;
+  }
+
+  autotrace_init();
+  for (; i < argc; i++)
+    bench_image(argv[i], threads);
+  return 0;
+}
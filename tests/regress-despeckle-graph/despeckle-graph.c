@@ -0,0 +1,205 @@
+/* despeckle-graph.c: check what region-graph despeckling must do on
+   images of noise, shading and flat colors, whatever it picks among
+   equally similar neighbors:
+   - it gives the same image with any number of threads;
+   - it recolors the regions of the image, the 4-connected blobs of one
+     color, whole, and each with the color of some region of the blob
+     it ends up in;
+   - it leaves regions of at least half the last level's size alone;
+   - it changes nothing when no color may take another;
+   - on two-color images, where a blob has a single color to take, it
+     gives what the despeckling without -despeckle-graph gives. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* Def: HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "despeckle.h"
+
+#define WIDTH 150
+/* Taller than two labeling tiles.  */
+#define HEIGHT 140
+#define PIXELS (WIDTH * HEIGHT)
+
+static unsigned failures;
+
+static void failed(const char *image, unsigned planes, int level, const char *what)
+{
+  if (failures++ < 10)
+    fprintf(stderr, "%s, %u planes, level %d: %s\n", image, planes, level, what);
+}
+
+/* Label the 4-connected blobs of one color of BITS in LABELS, giving
+   their sizes in SIZES; return their number.  */
+static int label_regions(const unsigned char *bits, unsigned planes, int *labels, int *sizes)
+{
+  static int queue[PIXELS];
+  int p, count = 0;
+
+  for (p = 0; p < PIXELS; p++)
+    labels[p] = -1;
+  for (p = 0; p < PIXELS; p++) {
+    int head = 0, tail = 0;
+
+    if (labels[p] >= 0)
+      continue;
+    labels[p] = count;
+    sizes[count] = 0;
+    queue[tail++] = p;
+    while (head < tail) {
+      int q = queue[head++], n[4], i;
+
+      sizes[count]++;
+      n[0] = q % WIDTH > 0 ? q - 1 : -1;
+      n[1] = q % WIDTH < WIDTH - 1 ? q + 1 : -1;
+      n[2] = q >= WIDTH ? q - WIDTH : -1;
+      n[3] = q < PIXELS - WIDTH ? q + WIDTH : -1;
+      for (i = 0; i < 4; i++)
+        if (n[i] >= 0 && labels[n[i]] < 0 && memcmp(&bits[planes * q], &bits[planes * n[i]], planes) == 0) {
+          labels[n[i]] = count;
+          queue[tail++] = n[i];
+        }
+    }
+    count++;
+  }
+  return count;
+}
+
+static at_bitmap *despeckled(const at_bitmap * image, int level, gfloat noise_removal, gboolean graph, unsigned threads)
+{
+  at_bitmap *copy = at_bitmap_copy(image);
+  at_exception_type exp = at_exception_new(NULL, NULL);
+
+  despeckle(copy, level, 0.5, noise_removal, graph, threads, &exp);
+  return copy;
+}
+
+static void check(const char *name, const at_bitmap * image, int level)
+{
+  static int labels[PIXELS], sizes[PIXELS], out_labels[PIXELS], out_sizes[PIXELS], owner[PIXELS];
+  unsigned planes = AT_BITMAP_PLANES(image);
+  const unsigned char *in = AT_BITMAP_BITS(image);
+  at_bitmap *result = despeckled(image, level, 1.0, TRUE, 1), *other;
+  const unsigned char *out = AT_BITMAP_BITS(result);
+  unsigned threads;
+  int p, r, count, out_count;
+
+  for (threads = 2; threads <= 4; threads++) {
+    other = despeckled(image, level, 1.0, TRUE, threads);
+    if (memcmp(out, AT_BITMAP_BITS(other), PIXELS * planes) != 0)
+      failed(name, planes, level, "threads change the result");
+    at_bitmap_free(other);
+  }
+
+  count = label_regions(in, planes, labels, sizes);
+  out_count = label_regions(out, planes, out_labels, out_sizes);
+
+  /* Each region ends up in one blob, of one color.  */
+  for (r = 0; r < count; r++)
+    owner[r] = -1;
+  for (p = 0; p < PIXELS; p++) {
+    if (owner[labels[p]] < 0)
+      owner[labels[p]] = out_labels[p];
+    else if (owner[labels[p]] != out_labels[p]) {
+      failed(name, planes, level, "a region is split");
+      break;
+    }
+  }
+
+  /* That color is one of its regions', and the big regions keep theirs.  */
+  for (r = 0; r < out_count; r++)
+    out_sizes[r] = 0;
+  for (p = 0; p < PIXELS; p++) {
+    if (memcmp(&in[planes * p], &out[planes * p], planes) == 0)
+      out_sizes[out_labels[p]] = 1;
+    else if (level > 0 && sizes[labels[p]] >= 1 << (level - 1)) {
+      failed(name, planes, level, "a big region is recolored");
+      break;
+    }
+  }
+  for (r = 0; r < out_count; r++)
+    if (!out_sizes[r]) {
+      failed(name, planes, level, "a blob takes a color none of its regions had");
+      break;
+    }
+
+  at_bitmap_free(result);
+
+  /* Without noise removal no color is close enough to another.  */
+  result = despeckled(image, level, 0.0, TRUE, 1);
+  if (memcmp(in, AT_BITMAP_BITS(result), PIXELS * planes) != 0)
+    failed(name, planes, level, "a region is recolored without noise removal");
+  at_bitmap_free(result);
+}
+
+static void check_levels(const char *name, const at_bitmap * image, gboolean two_colors)
+{
+  int level;
+
+  for (level = 0; level <= 10; level++) {
+    check(name, image, level);
+    if (two_colors) {
+      at_bitmap *graph = despeckled(image, level, 1.0, TRUE, 1);
+      at_bitmap *walk = despeckled(image, level, 1.0, FALSE, 1);
+
+      if (memcmp(AT_BITMAP_BITS(graph), AT_BITMAP_BITS(walk), PIXELS * AT_BITMAP_PLANES(image)) != 0)
+        failed(name, AT_BITMAP_PLANES(image), level, "differs from the walk on two colors");
+      at_bitmap_free(graph);
+      at_bitmap_free(walk);
+    }
+  }
+}
+
+/* Fill IMAGE, pixel by pixel, with the values of KIND.  */
+static void fill(at_bitmap * image, int kind)
+{
+  unsigned planes = AT_BITMAP_PLANES(image), i;
+  unsigned char *bits = AT_BITMAP_BITS(image);
+  int x, y;
+
+  for (y = 0; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++)
+      for (i = 0; i < planes; i++) {
+        unsigned char *v = &bits[planes * (y * WIDTH + x) + i];
+
+        switch (kind) {
+        case 0:                /* Two colors, with specks of every size.  */
+          *v = (rand() % 8 == 0) != ((x / 9 + y / 7) % 2) ? 255 : 0;
+          if (planes == 3 && i > 0)
+            *v = bits[planes * (y * WIDTH + x)] ? 200 : 20;
+          break;
+        case 1:                /* Shading, with ties everywhere.  */
+          *v = (x + 2 * y + 40 * i) / 3 + rand() % 3;
+          break;
+        case 2:                /* A few flat colors with specks.  */
+          *v = rand() % 10 == 0 ? rand() % 256 : ((x / 20 + y / 15 + i) % 4) * 60;
+          break;
+        default:               /* Noise.  */
+          *v = rand() % 6 * 40;
+          break;
+        }
+      }
+}
+
+int main(void)
+{
+  static const char *kind_names[] = { "two colors", "shading", "flat colors", "noise" };
+  unsigned planes;
+  int kind;
+
+  srand(1);
+  for (planes = 1; planes <= 3; planes += 2)
+    for (kind = 0; kind < 4; kind++) {
+      at_bitmap *image = at_bitmap_new(WIDTH, HEIGHT, planes);
+
+      fill(image, kind);
+      check_levels(kind_names[kind], image, kind == 0);
+      at_bitmap_free(image);
+    }
+
+  printf("region-graph despeckling checked, %u failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1 @@
+IN;IP 0 0 406 406;SC 0 48 0 48;SP4;PU0 48;PD0 0;PD48 0;PD48 48;PD0 48;SP1;PU16 43;PD13 42;PD10 41;PD8 40;PD7 38;PD5 36;PD4 33;PD4 31;PD5 28;PD6 25;PD7 23;PD9 22;PD11 20;PD14 19;PD16 19;PD19 20;PD22 21;PD24 22;PD25 24;PD27 26;PD28 29;PD28 31;PD27 34;PD26 37;PD25 39;PD23 40;PD21 42;PD18 43;PD16 43;SP4;PU13 36;PD12 36;PD11 34;PD10 33;PD10 32;PD10 30;PD10 29;PD11 28;PD11 27;PD13 26;PD14 25;PD15 25;PD17 25;PD18 25;PD19 26;PD20 26;PD21 28;PD22 29;PD22 30;PD22 32;PD22 33;PD21 34;PD21 35;PD19 36;PD18 37;PD17 37;PD15 37;PD14 37;PD13 36;SP1;PU22 16;PD22 13;PD23 10;PD24 8;PD26 6;PD29 5;PD31 4;PD34 3;PD37 4;PD39 5;PD42 6;PD44 8;PD45 10;PD46 13;PD47 16;PD22 16;PU22 16;
\ No newline at end of file
@@ -0,0 +1 @@
+IN;IP 0 0 338 338;SC 0 40 0 40;SP4;PU0 40;PD0 0;PD40 0;PD40 40;PD0 40;SP1;PU15 35;PD;AA20 20 360.00;SP4;PU17 28;PD;AA20 20 360.00;PU17 28;
\ No newline at end of file
@@ -0,0 +1,127 @@
+/* pixel-kernels.c: check that every table of pixel kernels this
+   processor can run gives the bytes of the plain C one. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* Def: HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pixel.h"
+#include "color.h"
+
+/* Rows of up to MAX_PIXELS pixels of up to 4 bytes, so that every
+   length from none to a few vectors and their tails is tried.  */
+#define MAX_PIXELS 40
+#define ROUNDS 200
+/* Bytes after the row that must stay untouched.  */
+#define GUARD 16
+
+static unsigned char src[4 * MAX_PIXELS];
+static unsigned char want[3 * MAX_PIXELS + GUARD], got[3 * MAX_PIXELS + GUARD];
+static unsigned char palette[256][3], table[256];
+static at_color background;
+static unsigned char gray_background;
+
+static void fill_random(unsigned char *p, size_t size, unsigned round)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    p[i] = rand();
+  /* Alpha and 16-bit samples at their ends too.  */
+  if (round % 3 == 0)
+    for (i = 1; i < size; i += 2)
+      p[i] = rand() % 2 ? 0 : 255;
+}
+
+/* Run kernel KIND of K into BUFFER for N pixels.  */
+static void run(const pixel_kernels_type * k, int kind, unsigned char *buffer, unsigned n)
+{
+  memset(buffer, 0xa5, 3 * MAX_PIXELS + GUARD);
+  switch (kind) {
+  case 0:
+    k->expand_palette(buffer, src, n, (const unsigned char (*)[3])palette);
+    break;
+  case 1:
+    k->map_bytes(buffer, src, n, table);
+    break;
+  case 2:
+    k->bgr_to_rgb(buffer, src, n);
+    break;
+  case 3:
+    k->bgrx_to_rgb(buffer, src, n);
+    break;
+  case 4:
+    k->bgra_over(buffer, src, n, &background);
+    break;
+  case 5:
+    k->graya_over(buffer, src, n, gray_background);
+    break;
+  case 6:
+    k->rgb555_to_rgb(buffer, src, n);
+    break;
+  case 7:
+    k->gray_to_rgb(buffer, src, n);
+    break;
+  case 8:
+    k->rgb_to_gray(buffer, src, n);
+    break;
+  case 9:
+    k->be16_to_8(buffer, src, n);
+    break;
+  }
+}
+
+static const char *kind_names[] = {
+  "expand_palette", "map_bytes", "bgr_to_rgb", "bgrx_to_rgb", "bgra_over",
+  "graya_over", "rgb555_to_rgb", "gray_to_rgb", "rgb_to_gray", "be16_to_8"
+};
+
+int main(void)
+{
+  const pixel_kernels_type *k;
+  unsigned nth, round, n, i, failures = 0;
+  int kind;
+
+  srand(1);
+  for (nth = 1; (k = pixel_kernels_nth(nth)) != NULL; nth++)
+    for (round = 0; round < ROUNDS; round++)
+      for (n = 0; n <= MAX_PIXELS; n++) {
+        fill_random(src, sizeof(src), round);
+        fill_random(&palette[0][0], sizeof(palette), 1);
+        fill_random(table, sizeof(table), 1);
+        background.r = rand();
+        background.g = rand();
+        background.b = rand();
+        gray_background = rand();
+
+        for (kind = 0; kind < 10; kind++) {
+          run(&pixel_scalar_kernels, kind, want, n);
+          run(k, kind, got, n);
+          if (memcmp(want, got, sizeof(want)) != 0) {
+            if (failures++ < 10)
+              fprintf(stderr, "kernels %u: %s differs for %u pixels\n", nth, kind_names[kind], n);
+          }
+        }
+      }
+
+  /* The plain C luminance is that of at_color_luminance.  */
+  for (round = 0; round < ROUNDS; round++) {
+    fill_random(src, sizeof(src), round);
+    run(&pixel_scalar_kernels, 8, want, MAX_PIXELS);
+    for (i = 0; i < MAX_PIXELS; i++) {
+      at_color c;
+
+      c.r = src[3 * i];
+      c.g = src[3 * i + 1];
+      c.b = src[3 * i + 2];
+      if (want[i] != at_color_luminance(&c) && failures++ < 10)
+        fprintf(stderr, "rgb_to_gray differs from at_color_luminance\n");
+    }
+  }
+
+  printf("%u tables checked against plain C, %u failures\n", nth - 1, failures);
+  return failures != 0;
+}